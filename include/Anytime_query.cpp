@@ -0,0 +1,151 @@
+/**
+* @author: WTY
+* @date: 2024/8/29
+* @description: 有时间或行数预算的随时查询：按选定顺序访问分区，预算用完即返回当前的top-k与覆盖率
+*/
+
+#include "Anytime_query.h"
+#include "Block_index.h"
+#include "Simd_kernels.h"
+
+/**
+ * 一个待访问的分区：ciphertext[begin, end)，随机顺序时 score 与 bound 不使用
+ */
+struct AnytimePartition {
+    long begin;
+    long end;
+    double score;   // center·q，块中心的距离估计，决定访问顺序
+    double bound;   // center·q - radius * ||q||，块内距离的下界，用于跳过不可能进入top-k的块
+};
+
+/**
+ * @Method: anytimeTopK
+ * @Description: 按预算扫描密文，未访问的分区中的行不会被读取；至少扫描一个分区，保证结果非空
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param const AnytimeBudget& budget 查询预算
+ * @param AnytimeStats* stats 返回覆盖率等统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, ciphertext中的行号)，距离从大到小
+ */
+vector<pair<double, long>> anytimeTopK(const VectorXd& q, int k, const AnytimeBudget& budget, AnytimeStats* stats) {
+    typedef chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+    const long n = (long) ciphertext.size();
+
+    // 剪枝索引与当前密文对应时按块中心的距离估计排序（下界偏松，按下界排序接近按半径排序），否则将数据集切成定长分区后随机排列
+    vector<AnytimePartition> partitions;
+    bool bestFirst = budget.order == ANYTIME_BEST_FIRST && !blockIndex.blocks.empty() &&
+                     blockIndex.version == datasetVersion;
+    if (bestFirst) {
+        const double qNorm = q.norm();
+        partitions.resize(blockIndex.blocks.size());
+        for (size_t b = 0; b < partitions.size(); b++) {
+            const CiphertextBlock& block = blockIndex.blocks[b];
+            partitions[b].begin = block.begin;
+            partitions[b].end = block.end;
+            partitions[b].score = block.center.dot(q);
+            partitions[b].bound = partitions[b].score - block.radius * qNorm;
+        }
+        sort(partitions.begin(), partitions.end(), [](const AnytimePartition& a, const AnytimePartition& b) {
+            return a.score < b.score;
+        });
+    } else {
+        const long size = max(1L, budget.partitionRows);
+        for (long begin = 0; begin < n; begin += size) {
+            AnytimePartition partition = {begin, min(n, begin + size), 0, 0};
+            partitions.push_back(partition);
+        }
+        static thread_local mt19937 generator(random_device{}());
+        shuffle(partitions.begin(), partitions.end(), generator);
+    }
+
+    TopKHeap heap(k);
+    const SimdKernels& kernels = simdKernels();
+    vector<const double*> rows;
+    vector<double> distances;
+    long rowsScanned = 0, partitionsScanned = 0;
+    bool exact = true;
+    for (size_t p = 0; p < partitions.size(); p++) {
+        const AnytimePartition& partition = partitions[p];
+        // 下界不小于当前第k小距离的块不可能进入top-k，不读取也不影响精确性
+        if (bestFirst && heap.full() && partition.bound >= heap.threshold()) {
+            continue;
+        }
+        long count = partition.end - partition.begin;
+        if (partitionsScanned > 0) {
+            bool outOfTime = budget.millis > 0 &&
+                             chrono::duration<double, milli>(Clock::now() - start).count() >= budget.millis;
+            if (outOfTime || (budget.rows > 0 && rowsScanned >= budget.rows)) {
+                exact = false;
+                break;
+            }
+        }
+        // 行数预算不足一个分区时只扫描分区的前一部分
+        if (budget.rows > 0 && rowsScanned + count > budget.rows) {
+            count = max(1L, budget.rows - rowsScanned);
+            exact = false;
+        }
+
+        rows.resize(count);
+        distances.resize(count);
+        for (long r = 0; r < count; r++) {
+            rows[r] = ciphertext[partition.begin + r].data();
+        }
+        kernels.scanRows(rows.data(), count, q.data(), q.size(), distances.data());
+        for (long r = 0; r < count; r++) {
+            heap.push(distances[r], partition.begin + r);
+        }
+        rowsScanned += count;
+        partitionsScanned++;
+        if (count < partition.end - partition.begin) {
+            break;
+        }
+    }
+
+    if (stats != NULL) {
+        stats->rowsScanned = rowsScanned;
+        stats->rowsTotal = n;
+        stats->coverage = n > 0 ? (double) rowsScanned / n : 1;
+        stats->partitionsScanned = partitionsScanned;
+        stats->partitionsTotal = (long) partitions.size();
+        stats->exact = exact;
+        stats->bestFirst = bestFirst;
+        stats->elapsedMillis = chrono::duration<double, milli>(Clock::now() - start).count();
+    }
+    return heap.extractDescending();
+}
+
+/**
+ * @Method: SSQAnytime
+ * @Description: 在预算内发起查询请求，结果为近似top-k，并输出覆盖率
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const AnytimeBudget& budget 查询预算
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQAnytime(char* fileString, char* resultFilePath, const AnytimeBudget& budget, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || ciphertext.empty() || !denseKeyReady(point.size())) {
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    AnytimeStats stats;
+    vector<pair<double, long>> winners = anytimeTopK(q, k, budget, &stats);
+    printf("随时查询：%s顺序，访问 %ld/%ld 分区，覆盖 %ld/%ld 行（%.2f%%），%s，%f 毫秒\n",
+           stats.bestFirst ? "最优优先" : "随机", stats.partitionsScanned, stats.partitionsTotal, stats.rowsScanned,
+           stats.rowsTotal, stats.coverage * 100, stats.exact ? "结果精确" : "结果近似", stats.elapsedMillis);
+    fflush(stdout);
+
+    // 密文被剪枝索引重排过时换回原数据集的行号
+    MatrixXd rows(winners.size(), encryptMatrix.rows());
+    for (size_t i = 0; i < winners.size(); i++) {
+        rows.row(i) = ciphertext[winners[i].second].transpose();
+        winners[i].second = originalRowId(winners[i].second);
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
@@ -0,0 +1,71 @@
+/**
+* @author: WTY
+* @date: 2024/8/29
+* @description: 有时间或行数预算的随时查询：按选定顺序访问分区，预算用完即返回当前的top-k与覆盖率
+*/
+
+#ifndef ANYTIME_QUERY_H
+#define ANYTIME_QUERY_H
+
+#include "SSQ.h"
+
+/**
+ * 分区访问顺序
+ */
+enum AnytimeOrder {
+    ANYTIME_RANDOM = 0,     // 分区随机排列，覆盖的行是数据集的均匀样本
+    ANYTIME_BEST_FIRST = 1  // 按剪枝索引的块中心距离从小到大访问并跳过下界过大的块，没有有效索引时退化为随机顺序
+};
+
+/**
+ * 查询预算，两种预算都设置时先用完的一个生效
+ */
+struct AnytimeBudget {
+    double millis;          // 时间预算（毫秒），0 表示不限
+    long rows;              // 最多计算的密文行数，0 表示不限
+    int order;              // AnytimeOrder
+    long partitionRows;     // 随机顺序下每个分区的行数，也是检查时间预算的粒度
+
+    AnytimeBudget() : millis(0), rows(0), order(ANYTIME_RANDOM), partitionRows(256) {
+    }
+};
+
+/**
+ * 随时查询统计
+ */
+struct AnytimeStats {
+    long rowsScanned;
+    long rowsTotal;
+    double coverage;            // rowsScanned / rowsTotal
+    long partitionsScanned;
+    long partitionsTotal;
+    bool exact;                 // 全部扫描完，或剩余分区的下界已不可能进入top-k，结果与全量扫描一致
+    bool bestFirst;             // 是否实际使用了剪枝索引的顺序
+    double elapsedMillis;
+};
+
+/**
+ * @Method: anytimeTopK
+ * @Description: 按预算扫描密文，未访问的分区中的行不会被读取；至少扫描一个分区，保证结果非空
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param const AnytimeBudget& budget 查询预算
+ * @param AnytimeStats* stats 返回覆盖率等统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, ciphertext中的行号)，距离从大到小
+ */
+vector<pair<double, long>> anytimeTopK(const VectorXd& q, int k, const AnytimeBudget& budget,
+                                       AnytimeStats* stats = NULL);
+
+/**
+ * @Method: SSQAnytime
+ * @Description: 在预算内发起查询请求，结果为近似top-k，并输出覆盖率
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const AnytimeBudget& budget 查询预算
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQAnytime(char* fileString, char* resultFilePath, const AnytimeBudget& budget, int resultFormat = RESULT_TEXT);
+
+
+#endif //ANYTIME_QUERY_H
@@ -0,0 +1,348 @@
+/**
+* @author: WTY
+* @date: 2024/8/22
+* @description: 按属性过滤的相似查询：每个属性值一个压缩位图，查询时求交集后只扫描选中的行
+*/
+
+#include "Attribute_index.h"
+#include "Block_index.h"
+#include <sstream>
+
+// 属性索引，由 buildAttributeIndex 建立
+AttributeIndex attributeIndex;
+
+// 每次交给SIMD内核的行数
+static const size_t FILTER_BLOCK_ROWS = 256;
+
+// SHA-256 的轮常量
+static const uint32_t SHA256_K[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static inline uint32_t rotr(uint32_t x, int n) {
+    return (x >> n) | (x << (32 - n));
+}
+
+/**
+ * @Method: sha256
+ * @Description: 计算消息的 SHA-256 摘要(FIPS 180-4)
+ */
+static string sha256(const string& message) {
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    // 填充：追加 0x80、若干 0 与64位大端的比特长度，使总长度为64字节的整数倍
+    string data = message;
+    uint64_t bitLength = (uint64_t) message.size() * 8;
+    data.push_back((char) 0x80);
+    while (data.size() % 64 != 56) {
+        data.push_back(0);
+    }
+    for (int i = 7; i >= 0; i--) {
+        data.push_back((char) (bitLength >> (i * 8)));
+    }
+
+    uint32_t w[64];
+    for (size_t block = 0; block < data.size(); block += 64) {
+        for (int i = 0; i < 16; i++) {
+            const unsigned char* p = (const unsigned char*) data.data() + block + i * 4;
+            w[i] = ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            hh = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+        h[5] += f;
+        h[6] += g;
+        h[7] += hh;
+    }
+
+    string digest(32, 0);
+    for (int i = 0; i < 32; i++) {
+        digest[i] = (char) (h[i / 4] >> (24 - (i % 4) * 8));
+    }
+    return digest;
+}
+
+/**
+ * @Method: hmacSha256
+ * @Description: HMAC-SHA256(RFC 2104)，返回32字节的原始摘要
+ */
+static string hmacSha256(const string& key, const string& message) {
+    string k = key.size() > 64 ? sha256(key) : key;
+    k.resize(64, 0);
+    string inner(64, 0), outer(64, 0);
+    for (int i = 0; i < 64; i++) {
+        inner[i] = (char) (k[i] ^ 0x36);
+        outer[i] = (char) (k[i] ^ 0x5c);
+    }
+    return sha256(outer + sha256(inner + message));
+}
+
+/**
+ * @Method: attributeToken
+ * @Description: 生成属性的令牌，key 为空时返回原字符串
+ * @param const string& keyValue 形如 key=value 的属性
+ * @param const string& key 数据拥有者与客户端共享的令牌密钥
+ * @return string 属性令牌
+ */
+string attributeToken(const string& keyValue, const string& key) {
+    if (key.empty()) {
+        return keyValue;
+    }
+    // 令牌为 HMAC-SHA256(key, key=value) 的十六进制表示，没有密钥无法由属性值算出令牌
+    string mac = hmacSha256(key, keyValue);
+    static const char HEX[] = "0123456789abcdef";
+    string token(64, '0');
+    for (size_t i = 0; i < mac.size(); i++) {
+        token[i * 2] = HEX[(unsigned char) mac[i] >> 4];
+        token[i * 2 + 1] = HEX[(unsigned char) mac[i] & 15];
+    }
+    return token;
+}
+
+/**
+ * @Method: buildAttributeIndex
+ * @Description: 读取属性文件并为每个属性值建立压缩位图，行数需与当前密文数据集一致。
+ *               密文按剪枝索引重排过时，属性文件第 r 行对应的是原数据集第 r 行，位图中记录其在 ciphertext 中的位置
+ * @param char* fileString 属性文件的地址
+ * @param const char* key 令牌化使用的密钥，NULL 表示以明文保存；密钥只用于生成令牌，不会保存在索引中
+ * @return 状态码，1：成功；0：失败
+ */
+int buildAttributeIndex(char* fileString, const char* key) {
+    auto start_time = chrono::high_resolution_clock::now();
+    ifstream infile(fileString);
+    if (!infile.is_open()) {
+        cerr << "Unable to open file " << fileString << endl;
+        return 0;
+    }
+
+    // 原数据集行号 -> ciphertext 中的位置
+    long n;
+    uint64_t version;
+    vector<uint32_t> positionOf;
+    {
+        CiphertextReadGuard guard;
+        n = (long) ciphertext.size();
+        version = datasetVersion;
+        positionOf.resize(n);
+        for (long position = 0; position < n; position++) {
+            long original = originalRowId(position);
+            if (original < 0 || original >= n) {
+                cerr << "Row id map does not cover dataset rows " << n << endl;
+                return 0;
+            }
+            positionOf[original] = (uint32_t) position;
+        }
+    }
+
+    string tokenKey = key != NULL ? key : "";
+    unordered_map<string, vector<uint32_t>> positions;
+    string line;
+    long row = 0;
+    while (getline(infile, line)) {
+        stringstream ss(line);
+        string keyValue;
+        while (ss >> keyValue) {
+            if (row < n) {
+                positions[attributeToken(keyValue, tokenKey)].push_back(positionOf[row]);
+            }
+        }
+        row++;
+    }
+    if (row != n) {
+        cerr << "Attribute rows " << row << " do not match dataset rows " << n << endl;
+        return 0;
+    }
+
+    // 位图要求行号递增加入，重排后的位置需要先排序
+    AttributeIndex index;
+    for (auto it = positions.begin(); it != positions.end(); ++it) {
+        vector<uint32_t>& rows = it->second;
+        sort(rows.begin(), rows.end());
+        rows.erase(unique(rows.begin(), rows.end()), rows.end());
+        RowBitmap& bitmap = index.bitmaps[it->first];
+        for (size_t i = 0; i < rows.size(); i++) {
+            bitmap.add(rows[i]);
+        }
+    }
+    attributeIndex.bitmaps.swap(index.bitmaps);
+    attributeIndex.keyed = !tokenKey.empty();
+    attributeIndex.rows = row;
+    attributeIndex.version = version;
+
+    size_t bytes = 0;
+    for (auto it = attributeIndex.bitmaps.begin(); it != attributeIndex.bitmaps.end(); ++it) {
+        bytes += it->second.memoryBytes();
+    }
+    chrono::duration<double, milli> total_duration = chrono::high_resolution_clock::now() - start_time;
+    printf("属性索引：%zu 个属性值，位图共 %zu 字节，建立时间 %f 毫秒\n", attributeIndex.bitmaps.size(), bytes,
+           total_duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: filterRows
+ * @Description: 对所有过滤条件的位图求交集，从最小的位图开始
+ * @param const vector<string>& filters 属性令牌
+ * @return RowBitmap 满足所有条件的行
+ */
+RowBitmap filterRows(const vector<string>& filters) {
+    vector<const RowBitmap*> bitmaps;
+    for (size_t i = 0; i < filters.size(); i++) {
+        auto it = attributeIndex.bitmaps.find(filters[i]);
+        if (it == attributeIndex.bitmaps.end()) {
+            return RowBitmap();     // 没有任何行具有该属性
+        }
+        bitmaps.push_back(&it->second);
+    }
+    if (bitmaps.empty()) {
+        // 没有条件时选中全部行
+        RowBitmap all;
+        for (long r = 0; r < (long) ciphertext.size(); r++) {
+            all.add((uint32_t) r);
+        }
+        return all;
+    }
+    sort(bitmaps.begin(), bitmaps.end(),
+         [](const RowBitmap* a, const RowBitmap* b) { return a->cardinality() < b->cardinality(); });
+    RowBitmap result = *bitmaps[0];
+    for (size_t i = 1; i < bitmaps.size() && result.cardinality() > 0; i++) {
+        result = RowBitmap::intersect(result, *bitmaps[i]);
+    }
+    return result;
+}
+
+/**
+ * @Method: filteredTopK
+ * @Description: 只扫描位图中选中的行，未选中行的密文不会被访问；属性索引已失效时返回空结果
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param const RowBitmap& selected 选中的行
+ * @param FilterStats* stats 返回扫描统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> filteredTopK(const VectorXd& q, int k, const RowBitmap& selected, FilterStats* stats) {
+    CiphertextReadGuard guard;
+    if (stats != NULL) {
+        stats->rowsTotal = (long) ciphertext.size();
+        stats->rowsSelected = 0;
+    }
+    // 位图记录的是建立索引时的行位置，数据集更新后不再对应
+    if (attributeIndex.version != datasetVersion) {
+        return vector<pair<double, long>>();
+    }
+    TopKHeap heap(k);
+    const SimdKernels& kernels = simdKernels();
+    vector<const double*> rows(FILTER_BLOCK_ROWS);
+    vector<long> ids(FILTER_BLOCK_ROWS);
+    vector<double> distances(FILTER_BLOCK_ROWS);
+    size_t count = 0;
+
+    auto flush = [&]() {
+        kernels.scanRows(rows.data(), count, q.data(), q.size(), distances.data());
+        for (size_t i = 0; i < count; i++) {
+            heap.push(distances[i], ids[i]);
+        }
+        count = 0;
+    };
+    // 位图按行号递增遍历，收集满一块选中行的指针后交给内核
+    selected.forEach([&](uint32_t row) {
+        if (row >= ciphertext.size()) {
+            return;
+        }
+        rows[count] = ciphertext[row].data();
+        ids[count] = (long) row;
+        if (++count == FILTER_BLOCK_ROWS) {
+            flush();
+        }
+    });
+    if (count > 0) {
+        flush();
+    }
+
+    if (stats != NULL) {
+        stats->rowsSelected = (long) selected.cardinality();
+    }
+    return heap.extractDescending();
+}
+
+/**
+ * @Method: SSQFiltered
+ * @Description: 发起带属性过滤的查询请求，只在满足所有条件的行中返回top-k；
+ *               数据集在建立属性索引之后更新过时失败，需重新 buildAttributeIndex
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const char* filterExpr 以逗号分隔的 key=value 条件，例如 "region=eu,tenant=7"
+ * @param int resultFormat 结果格式 ResultFormat
+ * @param const char* key 客户端持有的令牌密钥，需与建立索引时的密钥相同
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQFiltered(char* fileString, char* resultFilePath, const char* filterExpr, int resultFormat, const char* key) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point)) {
+        return 0;
+    }
+    if (attributeIndex.version != datasetVersion) {
+        cerr << "Attribute index is stale, rebuild it with buildAttributeIndex" << endl;
+        return 0;
+    }
+    string tokenKey = key != NULL ? key : "";
+    if (tokenKey.empty() == attributeIndex.keyed) {
+        cerr << (attributeIndex.keyed ? "Attribute index is keyed, a token key is required"
+                                      : "Attribute index stores plaintext attributes, no token key expected") << endl;
+        return 0;
+    }
+
+    // 客户端用同一密钥生成条件的令牌
+    vector<string> filters;
+    stringstream ss(filterExpr != NULL ? filterExpr : "");
+    string keyValue;
+    while (getline(ss, keyValue, ',')) {
+        if (!keyValue.empty()) {
+            filters.push_back(attributeToken(keyValue, tokenKey));
+        }
+    }
+
+    if (!denseKeyReady(point.size())) {
+        return 0;
+    }
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    auto start_time = chrono::high_resolution_clock::now();
+    RowBitmap selected = filterRows(filters);
+    FilterStats stats;
+    vector<pair<double, long>> winners = filteredTopK(q, k, selected, &stats);
+    chrono::duration<double, milli> total_duration = chrono::high_resolution_clock::now() - start_time;
+    printf("属性过滤：选中 %ld/%ld 行，过滤与扫描时间 %f 毫秒\n", stats.rowsSelected, stats.rowsTotal,
+           total_duration.count());
+    fflush(stdout);
+
+    return outputResults(resultFilePath, winners, encryptMatrixInverse, resultFormat);
+}
@@ -0,0 +1,95 @@
+/**
+* @author: WTY
+* @date: 2024/8/22
+* @description: 按属性过滤的相似查询：每个属性值一个压缩位图，查询时求交集后只扫描选中的行
+*/
+
+#ifndef ATTRIBUTE_INDEX_H
+#define ATTRIBUTE_INDEX_H
+
+#include "SSQ.h"
+#include "Row_bitmap.h"
+#include <unordered_map>
+
+/**
+ * 属性索引。属性文件每行对应数据集的一行，由空格分隔的 key=value 组成，例如
+ *     tenant=7 region=eu date=2024-08
+ * 指定了密钥时，服务器只保存数据拥有者用 HMAC-SHA256 生成的令牌而不是明文属性值，密钥只由数据拥有者
+ * 与客户端持有，查询时客户端用同一密钥生成令牌。令牌是确定性的，服务器仍能看到哪些行具有相同的属性值。
+ */
+struct AttributeIndex {
+    unordered_map<string, RowBitmap> bitmaps;   // 属性令牌 -> 具有该属性的行(ciphertext 中的位置)
+    bool keyed;                                 // 令牌是否由密钥生成，false 表示属性以明文保存
+    long rows;
+    uint64_t version;                           // 建立索引时的 datasetVersion，与当前版本不同说明位图已失效
+
+    AttributeIndex() : keyed(false), rows(0), version(0) {
+    }
+};
+
+/**
+ * 过滤扫描统计
+ */
+struct FilterStats {
+    long rowsTotal;
+    long rowsSelected;  // 过滤后实际扫描的行数
+};
+
+// 属性索引，由 buildAttributeIndex 建立
+extern AttributeIndex attributeIndex;
+
+/**
+ * @Method: attributeToken
+ * @Description: 生成属性的令牌 HMAC-SHA256(key, keyValue)，key 为空时返回原字符串
+ * @param const string& keyValue 形如 key=value 的属性
+ * @param const string& key 数据拥有者与客户端共享的令牌密钥
+ * @return string 属性令牌（64位十六进制）
+ */
+string attributeToken(const string& keyValue, const string& key);
+
+/**
+ * @Method: buildAttributeIndex
+ * @Description: 读取属性文件并为每个属性值建立压缩位图，行数需与当前密文数据集一致。
+ *               属性文件按原数据集的行顺序，密文按剪枝索引重排过时通过 originalRowId 映射到密文位置
+ * @param char* fileString 属性文件的地址
+ * @param const char* key 令牌化使用的密钥，NULL 表示以明文保存；密钥不会保存在索引中
+ * @return 状态码，1：成功；0：失败
+ */
+int buildAttributeIndex(char* fileString, const char* key = NULL);
+
+/**
+ * @Method: filterRows
+ * @Description: 对所有过滤条件的位图求交集，从最小的位图开始
+ * @param const vector<string>& filters 属性令牌
+ * @return RowBitmap 满足所有条件的行
+ */
+RowBitmap filterRows(const vector<string>& filters);
+
+/**
+ * @Method: filteredTopK
+ * @Description: 只扫描位图中选中的行，未选中行的密文不会被访问；属性索引已失效时返回空结果
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param const RowBitmap& selected 选中的行
+ * @param FilterStats* stats 返回扫描统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> filteredTopK(const VectorXd& q, int k, const RowBitmap& selected,
+                                        FilterStats* stats = NULL);
+
+/**
+ * @Method: SSQFiltered
+ * @Description: 发起带属性过滤的查询请求，只在满足所有条件的行中返回top-k；
+ *               数据集在建立属性索引之后更新过时失败，需重新 buildAttributeIndex
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const char* filterExpr 以逗号分隔的 key=value 条件，例如 "region=eu,tenant=7"
+ * @param int resultFormat 结果格式 ResultFormat
+ * @param const char* key 客户端持有的令牌密钥，需与建立索引时的密钥相同，明文索引时为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQFiltered(char* fileString, char* resultFilePath, const char* filterExpr, int resultFormat = RESULT_TEXT,
+                const char* key = NULL);
+
+
+#endif //ATTRIBUTE_INDEX_H
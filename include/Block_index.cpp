@@ -0,0 +1,302 @@
+/**
+* @author: WTY
+* @date: 2024/8/20
+* @description: 基于加密块中心与半径界的剪枝索引：按界从小到大访问块，跳过不可能进入top-k的块
+*/
+
+#include "Block_index.h"
+#include <cstring>
+
+// 剪枝索引，由 dealDataPruned 建立
+BlockIndex blockIndex;
+
+static double squaredDistance(const vector<double>& a, const vector<double>& b) {
+    double sum = 0;
+    for (size_t j = 0; j < a.size(); j++) {
+        double diff = a[j] - b[j];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/**
+ * @Method: bisect
+ * @Description: 对 ids[begin, end) 做一次2-means二分，返回分界位置
+ */
+static long bisect(const vector<vector<double>>& data_list, vector<long>& ids, long begin, long end, int iterations,
+                   mt19937& generator) {
+    const long n = end - begin;
+    const size_t d = data_list[0].size();
+
+    // 最远点启发式选取两个初始中心
+    long a = ids[begin + generator() % n];
+    long far1 = a, far2 = a;
+    double best = -1;
+    for (long i = begin; i < end; i++) {
+        double dist = squaredDistance(data_list[ids[i]], data_list[a]);
+        if (dist > best) {
+            best = dist;
+            far1 = ids[i];
+        }
+    }
+    best = -1;
+    for (long i = begin; i < end; i++) {
+        double dist = squaredDistance(data_list[ids[i]], data_list[far1]);
+        if (dist > best) {
+            best = dist;
+            far2 = ids[i];
+        }
+    }
+    vector<double> centers[2] = {data_list[far1], data_list[far2]};
+    vector<char> side(n);
+
+    for (int it = 0; it < iterations; it++) {
+        vector<double> sums[2] = {vector<double>(d, 0), vector<double>(d, 0)};
+        long counts[2] = {0, 0};
+        for (long i = 0; i < n; i++) {
+            const vector<double>& x = data_list[ids[begin + i]];
+            side[i] = squaredDistance(x, centers[1]) < squaredDistance(x, centers[0]) ? 1 : 0;
+            counts[(int) side[i]]++;
+            for (size_t j = 0; j < d; j++) {
+                sums[(int) side[i]][j] += x[j];
+            }
+        }
+        if (counts[0] == 0 || counts[1] == 0) {
+            break;
+        }
+        for (int c = 0; c < 2; c++) {
+            for (size_t j = 0; j < d; j++) {
+                centers[c][j] = sums[c][j] / counts[c];
+            }
+        }
+    }
+
+    // 按归属稳定地重排
+    vector<long> left, right;
+    for (long i = 0; i < n; i++) {
+        const vector<double>& x = data_list[ids[begin + i]];
+        if (squaredDistance(x, centers[1]) < squaredDistance(x, centers[0])) {
+            right.push_back(ids[begin + i]);
+        } else {
+            left.push_back(ids[begin + i]);
+        }
+    }
+    if (left.empty() || right.empty()) {
+        return begin + n / 2;   // 无法分开（例如全部重复）时对半分
+    }
+    copy(left.begin(), left.end(), ids.begin() + begin);
+    copy(right.begin(), right.end(), ids.begin() + begin + left.size());
+    return begin + (long) left.size();
+}
+
+/**
+ * @Method: dealDataPruned
+ * @Description: 读取数据集，在明文上递归二分聚类成块并按块重排，加密后为每块计算加密中心与半径界
+ * @param char* fileString 读取数据集的地址
+ * @param int blockSize 每块的最大行数
+ * @param int iterations 每次二分时的迭代次数
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataPruned(char* fileString, int blockSize, int iterations) {
+    auto start_time = chrono::high_resolution_clock::now();
+    vector<vector<double>> data_list = readDataFromFile(fileString);
+    if (data_list.empty()) {
+        return 0;
+    }
+    blockSize = max(1, blockSize);
+
+    // 递归二分，叶子按深度优先顺序排列，相邻的块在空间上也相近
+    vector<long>& ids = blockIndex.originalIds;
+    ids.resize(data_list.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        ids[i] = (long) i;
+    }
+    vector<pair<long, long>> ranges;
+    vector<pair<long, long>> stack(1, make_pair(0L, (long) ids.size()));
+    mt19937 generator(random_device{}());
+    while (!stack.empty()) {
+        pair<long, long> range = stack.back();
+        stack.pop_back();
+        if (range.second - range.first <= blockSize) {
+            ranges.push_back(range);
+            continue;
+        }
+        long mid = bisect(data_list, ids, range.first, range.second, iterations, generator);
+        stack.push_back(make_pair(mid, range.second));
+        stack.push_back(make_pair(range.first, mid));
+    }
+
+    auto cluster_time = chrono::high_resolution_clock::now();
+
+    // 按重排后的顺序加密
+    encryptMatrix = generateInvertibleMatrix(data_list[0].size() + 3);
+    keyMode = KEY_DENSE;
+    datasetVersion++;
+    encryptDataList(data_list, ids.data(), ciphertext);
+
+    // 随机数 r11 的方向 u = encryptMatrix^T (e_{d+1} - e_{d+2}) 与任何加密查询的内积都为 0，
+    // 计算半径时去掉该方向的分量，界依然成立且更紧
+    const size_t d = data_list[0].size();
+    VectorXd u = (encryptMatrix.row(d + 1) - encryptMatrix.row(d + 2)).transpose();
+    u.normalize();
+
+    blockIndex.blocks.resize(ranges.size());
+    for (size_t b = 0; b < ranges.size(); b++) {
+        CiphertextBlock& block = blockIndex.blocks[b];
+        block.begin = ranges[b].first;
+        block.end = ranges[b].second;
+        block.center = VectorXd::Zero(d + 3);
+        for (long i = block.begin; i < block.end; i++) {
+            block.center += ciphertext[i];
+        }
+        block.center /= (double) (block.end - block.begin);
+        block.center -= block.center.dot(u) * u;
+        block.radius = 0;
+        for (long i = block.begin; i < block.end; i++) {
+            VectorXd diff = ciphertext[i] - block.center;
+            diff -= diff.dot(u) * u;
+            block.radius = max(block.radius, diff.norm());
+        }
+    }
+    blockIndex.version = datasetVersion;
+    blockIndex.idsVersion = datasetVersion;
+
+    auto end_time = chrono::high_resolution_clock::now();
+    chrono::duration<double, milli> cluster_duration = cluster_time - start_time;
+    chrono::duration<double, milli> total_duration = end_time - start_time;
+    printf("剪枝索引：%zu 块，聚类时间 %f 毫秒，总时间 %f 毫秒\n", blockIndex.blocks.size(), cluster_duration.count(),
+           total_duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: originalRowId
+ * @Description: ciphertext 中第 position 行在原数据集中的行号，密文未按剪枝索引重排时即 position
+ */
+long originalRowId(long position) {
+    if (blockIndex.idsVersion != datasetVersion || position < 0 || position >= (long) blockIndex.originalIds.size()) {
+        return position;
+    }
+    return blockIndex.originalIds[position];
+}
+
+/**
+ * @Method: extendOriginalIds
+ * @Description: 在 ciphertext 末尾追加行之后调用，追加行的行号即其位置，映射有效时随之延长
+ * @param uint64_t previousVersion 追加之前的 datasetVersion
+ * @param long firstRow 第一条追加行的位置
+ * @param long count 追加的行数
+ */
+void extendOriginalIds(uint64_t previousVersion, long firstRow, long count) {
+    if (blockIndex.originalIds.empty() || blockIndex.idsVersion != previousVersion ||
+        (long) blockIndex.originalIds.size() != firstRow) {
+        return;
+    }
+    for (long i = 0; i < count; i++) {
+        blockIndex.originalIds.push_back(firstRow + i);
+    }
+    blockIndex.idsVersion = datasetVersion;
+}
+
+/**
+ * @Method: prunedTopK
+ * @Description: 按下界从小到大访问块，下界不小于当前第k小距离时停止，结果与全量扫描一致
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param PruningStats* stats 返回剪枝统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, ciphertext中的行号)，距离从大到小
+ */
+vector<pair<double, long>> prunedTopK(const VectorXd& q, int k, PruningStats* stats) {
+    // 重新导入或追加行之后，块的范围、中心与半径不再对应当前密文，退回全量扫描
+    if (blockIndex.version != datasetVersion) {
+        if (stats != NULL) {
+            memset(stats, 0, sizeof(*stats));
+            stats->rowsScanned = (long) ciphertext.size();
+        }
+        return scanTopK(q, k);
+    }
+    CiphertextReadGuard guard;
+    const vector<CiphertextBlock>& blocks = blockIndex.blocks;
+    const double qNorm = q.norm();
+
+    // 每块的下界：center·q - radius * ||q||
+    vector<pair<double, long>> bounds(blocks.size());
+    for (size_t b = 0; b < blocks.size(); b++) {
+        bounds[b] = make_pair(blocks[b].center.dot(q) - blocks[b].radius * qNorm, (long) b);
+    }
+    sort(bounds.begin(), bounds.end());
+
+    TopKHeap heap(k);
+    const SimdKernels& kernels = simdKernels();
+    vector<const double*> rows;
+    vector<double> distances;
+    long blocksScanned = 0, rowsScanned = 0;
+    for (size_t i = 0; i < bounds.size(); i++) {
+        // 之后的块下界更大，都不可能进入top-k
+        if (heap.full() && bounds[i].first >= heap.threshold()) {
+            break;
+        }
+        const CiphertextBlock& block = blocks[bounds[i].second];
+        if (block.begin < 0 || block.end > (long) ciphertext.size()) {
+            continue;
+        }
+        long count = block.end - block.begin;
+        rows.resize(count);
+        distances.resize(count);
+        for (long r = 0; r < count; r++) {
+            rows[r] = ciphertext[block.begin + r].data();
+        }
+        kernels.scanRows(rows.data(), count, q.data(), q.size(), distances.data());
+        for (long r = 0; r < count; r++) {
+            heap.push(distances[r], block.begin + r);
+        }
+        blocksScanned++;
+        rowsScanned += count;
+    }
+
+    if (stats != NULL) {
+        stats->blocksTotal = (long) blocks.size();
+        stats->blocksScanned = blocksScanned;
+        stats->blocksSkipped = (long) blocks.size() - blocksScanned;
+        stats->rowsScanned = rowsScanned;
+        stats->rowsSkipped = (long) ciphertext.size() - rowsScanned;
+    }
+    return heap.extractDescending();
+}
+
+/**
+ * @Method: SSQPruned
+ * @Description: 使用剪枝索引发起查询请求，结果中的行号为原数据集的行号
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQPruned(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || blockIndex.blocks.empty() || !denseKeyReady(point.size())) {
+        return 0;
+    }
+    if (blockIndex.version != datasetVersion) {
+        cerr << "Pruning index is stale, rebuild it with dealDataPruned" << endl;
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    PruningStats stats;
+    vector<pair<double, long>> winners = prunedTopK(q, k, &stats);
+    printf("剪枝扫描：访问 %ld/%ld 块，跳过 %ld 块（%ld 行）\n", stats.blocksScanned, stats.blocksTotal,
+           stats.blocksSkipped, stats.rowsSkipped);
+    fflush(stdout);
+
+    MatrixXd rows(winners.size(), encryptMatrix.rows());
+    for (size_t i = 0; i < winners.size(); i++) {
+        rows.row(i) = ciphertext[winners[i].second].transpose();
+        winners[i].second = originalRowId(winners[i].second);
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
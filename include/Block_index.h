@@ -0,0 +1,101 @@
+/**
+* @author: WTY
+* @date: 2024/8/20
+* @description: 基于加密块中心与半径界的剪枝索引：按界从小到大访问块，跳过不可能进入top-k的块
+*/
+
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include "SSQ.h"
+
+/**
+ * 一个密文块：ciphertext[begin, end) 中空间上相近的记录
+ * 对块内任意密文 c 与任意查询 q，有 c·q >= center·q - radius * ||q||（柯西-施瓦茨）
+ * 注意：界是在密文空间上计算的，受加密矩阵条件数以及扩展分量 ||x||^2 的影响，
+ * 数据量级较大时界会偏松，跳过的块数需以 PruningStats 的统计为准；结果始终精确。
+ */
+struct CiphertextBlock {
+    long begin;
+    long end;
+    VectorXd center;    // 块内密文的中心
+    double radius;      // 块内密文到中心的最大距离（已去掉与所有查询正交的随机数方向）
+};
+
+/**
+ * 剪枝索引。建立索引时密文按块重新排列，originalIds[i] 为 ciphertext[i] 在原数据集中的行号。
+ * 行号映射与块的有效期分开：追加行后块不再覆盖全部密文（version 过期），但已有行的位置不变，
+ * 映射随追加延长后依然有效（idsVersion 随之更新）；密文被替换后两者都失效
+ */
+struct BlockIndex {
+    vector<CiphertextBlock> blocks;
+    vector<long> originalIds;
+    uint64_t version;           // 建立索引时的 datasetVersion，与当前版本不同说明块已失效
+    uint64_t idsVersion;        // originalIds 对应的 datasetVersion
+
+    BlockIndex() : version(0), idsVersion(0) {
+    }
+};
+
+/**
+ * 剪枝扫描统计
+ */
+struct PruningStats {
+    long blocksTotal;
+    long blocksScanned;
+    long blocksSkipped;
+    long rowsScanned;
+    long rowsSkipped;
+};
+
+// 剪枝索引，由 dealDataPruned 建立
+extern BlockIndex blockIndex;
+
+/**
+ * @Method: dealDataPruned
+ * @Description: 读取数据集，在明文上递归二分聚类成块并按块重排，加密后为每块计算加密中心与半径界
+ * @param char* fileString 读取数据集的地址
+ * @param int blockSize 每块的最大行数
+ * @param int iterations 每次二分时的迭代次数
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataPruned(char* fileString, int blockSize = 256, int iterations = 5);
+
+/**
+ * @Method: originalRowId
+ * @Description: ciphertext 中第 position 行在原数据集中的行号，密文未按剪枝索引重排时即 position
+ */
+long originalRowId(long position);
+
+/**
+ * @Method: extendOriginalIds
+ * @Description: 在 ciphertext 末尾追加行之后调用，追加行的行号即其位置，映射有效时随之延长
+ * @param uint64_t previousVersion 追加之前的 datasetVersion
+ * @param long firstRow 第一条追加行的位置
+ * @param long count 追加的行数
+ */
+void extendOriginalIds(uint64_t previousVersion, long firstRow, long count);
+
+/**
+ * @Method: prunedTopK
+ * @Description: 按下界从小到大访问块，下界不小于当前第k小距离时停止，结果与全量扫描一致；
+ *               索引与 datasetVersion 不一致时退回全量扫描
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param PruningStats* stats 返回剪枝统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, ciphertext中的行号)，距离从大到小
+ */
+vector<pair<double, long>> prunedTopK(const VectorXd& q, int k, PruningStats* stats = NULL);
+
+/**
+ * @Method: SSQPruned
+ * @Description: 使用剪枝索引发起查询请求，结果中的行号为原数据集的行号
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQPruned(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //BLOCK_INDEX_H
@@ -0,0 +1,275 @@
+/**
+* @author: WTY
+* @date: 2024/8/24
+* @description: 分块对角结构的加密密钥：加密每行 O(d·b)，求逆 O(d·b^2)，适用于高维数据
+*/
+
+#include "Block_key.h"
+#include <numeric>
+
+// 分块密钥，由 dealDataBlockKey 生成
+BlockKey blockKey;
+
+// 加密时每批处理的行数
+static const long BLOCK_KEY_BATCH_ROWS = 256;
+
+size_t BlockKey::memoryBytes() const {
+    size_t bytes = permutation.size() * sizeof(int) + blockOffsets.size() * sizeof(int) +
+                   mixing.size() * sizeof(double);
+    for (size_t j = 0; j < blocks.size(); j++) {
+        bytes += (blocks[j].size() + inverseBlocks[j].size()) * sizeof(double);
+    }
+    return bytes;
+}
+
+/**
+ * @Method: generateBlockKey
+ * @Description: 生成维度为 D 的分块密钥并计算各块的逆，代价 O(D·b^2)
+ * @param int dim D = d+3
+ * @param int blockSize 对角块大小 b
+ * @return BlockKey 生成的密钥
+ */
+BlockKey generateBlockKey(int dim, int blockSize) {
+    BlockKey key;
+    key.dim = dim;
+    key.blockSize = max(1, min(blockSize, dim));
+    key.augIndex[0] = 0;
+    key.augIndex[1] = dim - 2;
+    key.augIndex[2] = dim - 1;
+
+    random_device rd;
+    mt19937 generator(rd());
+    key.permutation.resize(dim);
+    iota(key.permutation.begin(), key.permutation.end(), 0);
+    shuffle(key.permutation.begin(), key.permutation.end(), generator);
+
+    for (int offset = 0; offset < dim; offset += key.blockSize) {
+        int size = min(key.blockSize, dim - offset);
+        key.blockOffsets.push_back(offset);
+        MatrixXd block;
+        Eigen::FullPivLU<MatrixXd> lu;
+        do {
+            block = MatrixXd::Random(size, size);
+            lu.compute(block);
+        } while (!lu.isInvertible());   // 检查块是否可逆
+        key.blocks.push_back(block);
+        key.inverseBlocks.push_back(lu.inverse());
+    }
+    key.blockOffsets.push_back(dim);
+
+    // 扩展分量所在的行为 0，保证 R^T S = 0
+    key.mixing = MatrixXd::Random(dim, 3);
+    for (int a = 0; a < 3; a++) {
+        key.mixing.row(key.augIndex[a]).setZero();
+    }
+    return key;
+}
+
+/**
+ * @Method: blockKeyEncryptRows
+ * @Description: 批量加密 c_i = E^T t_i，每行代价 O(D·b)
+ * @param const BlockKey& key 分块密钥
+ * @param const RowMatrixXd& t 每行一条扩展向量
+ * @return RowMatrixXd 每行一条密文
+ */
+RowMatrixXd blockKeyEncryptRows(const BlockKey& key, const RowMatrixXd& t) {
+    const long n = t.rows();
+    RowMatrixXd mixed(n, key.dim);
+    for (long r = 0; r < n; r++) {
+        // (I + R S^T) 混合扩展分量后按 Π 置换
+        double aug0 = t(r, key.augIndex[0]), aug1 = t(r, key.augIndex[1]), aug2 = t(r, key.augIndex[2]);
+        const int* perm = key.permutation.data();
+        double* out = mixed.row(r).data();
+        for (int i = 0; i < key.dim; i++) {
+            int src = perm[i];
+            out[i] = t(r, src) + key.mixing(src, 0) * aug0 + key.mixing(src, 1) * aug1 +
+                     key.mixing(src, 2) * aug2;
+        }
+    }
+    // 行形式下 c^T = t2^T Bd，每个对角块一次小矩阵乘法
+    RowMatrixXd c(n, key.dim);
+    for (size_t j = 0; j < key.blocks.size(); j++) {
+        int offset = key.blockOffsets[j], size = key.blockOffsets[j + 1] - offset;
+        c.middleCols(offset, size).noalias() = mixed.middleCols(offset, size) * key.blocks[j];
+    }
+    return c;
+}
+
+/**
+ * @Method: blockKeyDecryptRows
+ * @Description: 批量解密 t_i = E^{-T} c_i，每行代价 O(D·b)
+ * @param const BlockKey& key 分块密钥
+ * @param const MatrixXd& rows 每行一条密文
+ * @return MatrixXd 每行一条扩展向量
+ */
+MatrixXd blockKeyDecryptRows(const BlockKey& key, const MatrixXd& rows) {
+    const long n = rows.rows();
+    // u^T = c^T Bd^{-1}
+    MatrixXd u(n, key.dim);
+    for (size_t j = 0; j < key.inverseBlocks.size(); j++) {
+        int offset = key.blockOffsets[j], size = key.blockOffsets[j + 1] - offset;
+        u.middleCols(offset, size).noalias() = rows.middleCols(offset, size) * key.inverseBlocks[j];
+    }
+    // 逆置换 Π^T，再去掉混入的扩展分量 (I - R S^T)
+    MatrixXd t(n, key.dim);
+    for (int i = 0; i < key.dim; i++) {
+        t.col(key.permutation[i]) = u.col(i);
+    }
+    MatrixXd aug(n, 3);
+    for (int a = 0; a < 3; a++) {
+        aug.col(a) = t.col(key.augIndex[a]);
+    }
+    t.noalias() -= aug * key.mixing.transpose();
+    return t;
+}
+
+/**
+ * @Method: blockKeyEncryptQuery
+ * @Description: 加密扩展后的查询向量 q = E^{-1} q'，代价 O(D·b)
+ * @param const BlockKey& key 分块密钥
+ * @param const VectorXd& augmented augmentQuery 得到的扩展查询向量
+ * @return VectorXd 加密后的查询向量
+ */
+VectorXd blockKeyEncryptQuery(const BlockKey& key, const VectorXd& augmented) {
+    // (I - S R^T) q'
+    VectorXd unmixed = augmented;
+    for (int a = 0; a < 3; a++) {
+        unmixed[key.augIndex[a]] -= key.mixing.col(a).dot(augmented);
+    }
+    VectorXd permuted(key.dim);
+    for (int i = 0; i < key.dim; i++) {
+        permuted[i] = unmixed[key.permutation[i]];
+    }
+    VectorXd q(key.dim);
+    for (size_t j = 0; j < key.inverseBlocks.size(); j++) {
+        int offset = key.blockOffsets[j], size = key.blockOffsets[j + 1] - offset;
+        q.segment(offset, size).noalias() = key.inverseBlocks[j] * permuted.segment(offset, size);
+    }
+    return q;
+}
+
+/**
+ * @Method: dealDataBlockKey
+ * @Description: 读取数据集并用分块密钥加密，稠密加密矩阵 encryptMatrix 被清空
+ * @param char* fileString 读取数据集的地址
+ * @param int blockSize 对角块大小 b
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataBlockKey(char* fileString, int blockSize) {
+    vector<vector<double>> data_list = readDataFromFile(fileString);
+    if (data_list.empty()) {
+        return 0;
+    }
+    const size_t d = data_list[0].size();
+
+    auto start_time = chrono::high_resolution_clock::now();
+    blockKey = generateBlockKey((int) d + 3, blockSize);
+    // 该模式不生成稠密密钥；清空旧的加密矩阵并标记密钥类型，使用稠密密钥的查询与插入会直接失败
+    encryptMatrix.resize(0, 0);
+    keyMode = KEY_BLOCK;
+    datasetVersion++;
+    auto key_time = chrono::high_resolution_clock::now();
+
+    random_device rd;
+    mt19937 generator(rd());
+    uniform_real_distribution<double> distribution(1, 100);
+    ciphertext.resize(data_list.size());
+    RowMatrixXd t(BLOCK_KEY_BATCH_ROWS, d + 3);
+    for (long b = 0; b < (long) data_list.size(); b += BLOCK_KEY_BATCH_ROWS) {
+        long count = min(BLOCK_KEY_BATCH_ROWS, (long) data_list.size() - b);
+        for (long i = 0; i < count; i++) {
+            augmentRecord(data_list[b + i].data(), d, distribution(generator), t.row(i).data());
+        }
+        RowMatrixXd c = blockKeyEncryptRows(blockKey, t.topRows(count));
+        for (long i = 0; i < count; i++) {
+            ciphertext[b + i] = c.row(i).transpose();
+        }
+    }
+
+    auto end_time = chrono::high_resolution_clock::now();
+    chrono::duration<double, milli> key_duration = key_time - start_time;
+    chrono::duration<double, milli> encrypt_duration = end_time - key_time;
+    printf("分块密钥（b=%d）：生成密钥 %f 毫秒，加密数据 %f 毫秒，密钥 %zu 字节\n", blockKey.blockSize,
+           key_duration.count(), encrypt_duration.count(), blockKey.memoryBytes());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: SSQBlockKey
+ * @Description: 在分块密钥加密的数据集上发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQBlockKey(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point)) {
+        return 0;
+    }
+    if (keyMode != KEY_BLOCK || blockKey.dim != (int) point.size() + 3) {
+        cerr << "Dataset is not encrypted with a block key of dimension " << point.size() + 3 << endl;
+        return 0;
+    }
+
+    VectorXd q = blockKeyEncryptQuery(blockKey, augmentQuery(point));
+    vector<pair<double, long>> winners = scanTopK(q, k);
+
+    MatrixXd rows(winners.size(), blockKey.dim);
+    for (size_t i = 0; i < winners.size(); i++) {
+        rows.row(i) = ciphertext[winners[i].second].transpose();
+    }
+    return writeResults(resultFilePath, winners, blockKeyDecryptRows(blockKey, rows), resultFormat);
+}
+
+/**
+ * @Method: benchmarkKeyModes
+ * @Description: 在随机数据上比较稠密密钥与分块密钥的生成、求逆、加密、解密时间与密钥大小
+ * @param int d 数据维度
+ * @param long rows 加密的行数
+ * @param int blockSize 分块密钥的块大小
+ */
+void benchmarkKeyModes(int d, long rows, int blockSize) {
+    typedef chrono::high_resolution_clock Clock;
+    const int dim = d + 3;
+    mt19937 generator(random_device{}());
+    uniform_real_distribution<double> distribution(1, 100);
+    RowMatrixXd x = RowMatrixXd::Random(rows, d) * 100;
+    RowMatrixXd t(rows, dim);
+    for (long i = 0; i < rows; i++) {
+        augmentRecord(x.row(i).data(), d, distribution(generator), t.row(i).data());
+    }
+
+    // 稠密密钥
+    Clock::time_point t0 = Clock::now();
+    MatrixXd dense = generateInvertibleMatrix(dim);
+    Clock::time_point t1 = Clock::now();
+    MatrixXd denseInverse = calculateInverseMatrix(dense);
+    Clock::time_point t2 = Clock::now();
+    const RowMatrixXd denseKey = dense;
+    RowMatrixXd c(rows, dim);
+    simdKernels().encryptRows(t.data(), rows, dim, denseKey.data(), c.data());
+    Clock::time_point t3 = Clock::now();
+    MatrixXd decrypted = decryptRows(c, denseInverse);
+    Clock::time_point t4 = Clock::now();
+    printf("稠密密钥 D=%d：生成 %f 毫秒，求逆 %f 毫秒，加密 %ld 行 %f 毫秒，解密 %f 毫秒，密钥 %zu 字节，最大误差 %g\n",
+           dim, chrono::duration<double, milli>(t1 - t0).count(), chrono::duration<double, milli>(t2 - t1).count(),
+           rows, chrono::duration<double, milli>(t3 - t2).count(), chrono::duration<double, milli>(t4 - t3).count(),
+           (size_t) (dense.size() + denseInverse.size()) * sizeof(double), (decrypted - t).cwiseAbs().maxCoeff());
+
+    // 分块密钥，生成时已包含各块的求逆
+    t0 = Clock::now();
+    BlockKey key = generateBlockKey(dim, blockSize);
+    t1 = Clock::now();
+    RowMatrixXd blockCipher = blockKeyEncryptRows(key, t);
+    t2 = Clock::now();
+    decrypted = blockKeyDecryptRows(key, blockCipher);
+    t3 = Clock::now();
+    printf("分块密钥 D=%d b=%d：生成并求逆 %f 毫秒，加密 %ld 行 %f 毫秒，解密 %f 毫秒，密钥 %zu 字节，最大误差 %g\n",
+           dim, key.blockSize, chrono::duration<double, milli>(t1 - t0).count(), rows,
+           chrono::duration<double, milli>(t2 - t1).count(), chrono::duration<double, milli>(t3 - t2).count(),
+           key.memoryBytes(), (decrypted - t).cwiseAbs().maxCoeff());
+    fflush(stdout);
+}
@@ -0,0 +1,119 @@
+/**
+* @author: WTY
+* @date: 2024/8/24
+* @description: 分块对角结构的加密密钥：加密每行 O(d·b)，求逆 O(d·b^2)，适用于高维数据
+*/
+
+#ifndef BLOCK_KEY_H
+#define BLOCK_KEY_H
+
+#include "SSQ.h"
+
+/**
+ * 分块密钥。记 D = d+3，扩展向量为 t，稠密模式的密文为 E^T t，这里取
+ *     E^T = Bd^T · Π · (I + R S^T)
+ * 其中
+ *     S   D×3，选出三个扩展分量（第 0、d+1、d+2 维：平方和、r11、-r11）
+ *     R   D×3 的随机稠密矩阵，扩展分量所在的行为 0，因此 R^T S = 0
+ *     Π   随机置换，(Π v)[i] = v[permutation[i]]
+ *     Bd  块对角矩阵，对角块为随机的 b×b 稠密矩阵（最后一块可能较小）
+ * (I + R S^T) 把平方和与随机数 r11 混入每一维后再置换分块，使每个密文块都含有随机掩码。
+ * 由 R^T S = 0 得 (I + R S^T)^{-1} = I - R S^T，于是
+ *     查询  q = E^{-1} q' = Bd^{-1} · Π · (I - S R^T) q'
+ *     解密  t = (I - R S^T) · Π^T · Bd^{-T} c
+ * 内积 c·q = t·q' 与稠密密钥相同，查询与扫描逻辑不变。
+ *
+ * 安全参数：
+ *     b（blockSize）  每个密文块只是 b 维明文片段与三个扩展分量的线性组合，已知明文攻击恢复一块
+ *                     至少需要 b+3 对明文/密文，而稠密密钥需要 D 对。b 越大越接近稠密密钥，
+ *                     代价也按 b 线性增长；b >= D 时退化为稠密密钥加上置换与混合。
+ *     Π               隐藏明文维度到密文块的对应关系，共 D! / (b!)^(D/b) 种划分方式。
+ *     R               隐藏扩展分量，使单个密文块不能直接去掉随机数 r11。
+ * 该结构的安全性弱于稠密密钥，只应在 d 很大、稠密密钥的加密与求逆代价不可接受时使用。
+ */
+struct BlockKey {
+    int dim;                            // D = d+3
+    int blockSize;                      // b
+    int augIndex[3];                    // 扩展分量所在的维
+    vector<int> permutation;            // Π
+    vector<int> blockOffsets;           // 第 j 块从置换后的第 blockOffsets[j] 维开始，末尾为 D
+    vector<MatrixXd> blocks;            // Bd 的对角块
+    vector<MatrixXd> inverseBlocks;     // Bd^{-1} 的对角块
+    MatrixXd mixing;                    // R，D×3
+
+    /**
+     * @Method: memoryBytes
+     * @Description: 密钥（含逆）占用的字节数
+     */
+    size_t memoryBytes() const;
+};
+
+// 分块密钥，由 dealDataBlockKey 生成
+extern BlockKey blockKey;
+
+/**
+ * @Method: generateBlockKey
+ * @Description: 生成维度为 D 的分块密钥并计算各块的逆，代价 O(D·b^2)
+ * @param int dim D = d+3
+ * @param int blockSize 对角块大小 b
+ * @return BlockKey 生成的密钥
+ */
+BlockKey generateBlockKey(int dim, int blockSize);
+
+/**
+ * @Method: blockKeyEncryptRows
+ * @Description: 批量加密 c_i = E^T t_i，每行代价 O(D·b)
+ * @param const BlockKey& key 分块密钥
+ * @param const RowMatrixXd& t 每行一条扩展向量
+ * @return RowMatrixXd 每行一条密文
+ */
+RowMatrixXd blockKeyEncryptRows(const BlockKey& key, const RowMatrixXd& t);
+
+/**
+ * @Method: blockKeyDecryptRows
+ * @Description: 批量解密 t_i = E^{-T} c_i，每行代价 O(D·b)
+ * @param const BlockKey& key 分块密钥
+ * @param const MatrixXd& rows 每行一条密文
+ * @return MatrixXd 每行一条扩展向量
+ */
+MatrixXd blockKeyDecryptRows(const BlockKey& key, const MatrixXd& rows);
+
+/**
+ * @Method: blockKeyEncryptQuery
+ * @Description: 加密扩展后的查询向量 q = E^{-1} q'，代价 O(D·b)
+ * @param const BlockKey& key 分块密钥
+ * @param const VectorXd& augmented augmentQuery 得到的扩展查询向量
+ * @return VectorXd 加密后的查询向量
+ */
+VectorXd blockKeyEncryptQuery(const BlockKey& key, const VectorXd& augmented);
+
+/**
+ * @Method: dealDataBlockKey
+ * @Description: 读取数据集并用分块密钥加密，稠密加密矩阵 encryptMatrix 被清空
+ * @param char* fileString 读取数据集的地址
+ * @param int blockSize 对角块大小 b
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataBlockKey(char* fileString, int blockSize = 64);
+
+/**
+ * @Method: SSQBlockKey
+ * @Description: 在分块密钥加密的数据集上发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQBlockKey(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+/**
+ * @Method: benchmarkKeyModes
+ * @Description: 在随机数据上比较稠密密钥与分块密钥的生成、求逆、加密、解密时间与密钥大小
+ * @param int d 数据维度
+ * @param long rows 加密的行数
+ * @param int blockSize 分块密钥的块大小
+ */
+void benchmarkKeyModes(int d, long rows, int blockSize = 64);
+
+
+#endif //BLOCK_KEY_H
@@ -0,0 +1,78 @@
+/**
+* @author: WTY
+* @date: 2024/8/30
+* @description: 可断点续传的数据加密外包：先持久化密钥，再分块提交密文并定期写检查点，重启后从检查点继续
+*/
+
+#ifndef CHECKPOINT_INGEST_H
+#define CHECKPOINT_INGEST_H
+
+#include "SSQ.h"
+#include "Snapshot.h"
+
+/*
+ * 同一次导入的状态文件都以 statePrefix 开头：
+ *   <prefix>.key   密钥文件，导入开始时最先写入：KeyFileHeader + dim×dim 个 double（列主序）
+ *   <prefix>.snap  密文快照，按块追加
+ *   <prefix>.ckpt  检查点 IngestCheckpoint，每次先写临时文件再 rename，任何时刻都是完整的
+ * r11 由密钥文件中的种子初始化的 mt19937_64 生成，每行恰好消耗引擎的一个输出并自行换算到 [1, 100)
+ * （不经过 uniform_real_distribution，结果与标准库实现无关），因此检查点记录的引擎位置即可让续传
+ * 生成与不中断时完全相同的随机数，快照逐字节一致。密钥文件创建时权限即为 0600。
+ */
+struct KeyFileHeader {
+    char magic[8];          // "SSQKEY"
+    uint32_t version;
+    uint32_t dim;           // 密文维度 d+3
+    uint64_t seed;          // r11 随机数流的种子
+    uint64_t reserved[5];
+};
+
+struct IngestCheckpoint {
+    char magic[8];          // "SSQCKPT"
+    uint32_t version;
+    uint32_t dim;
+    uint64_t inputOffset;   // 已提交的输入字节数，续传时从这里开始读取
+    uint64_t inputSize;     // 输入文件大小，与当前文件不同时拒绝续传
+    uint64_t rows;          // 已提交的密文行数
+    uint64_t rngDraws;      // 随机数引擎已产生的输出个数
+    uint64_t complete;      // 1 表示导入已完成
+    uint64_t reserved;
+};
+
+const char KEY_FILE_MAGIC[8] = {'S', 'S', 'Q', 'K', 'E', 'Y', '\0', '\0'};
+const char CHECKPOINT_MAGIC[8] = {'S', 'S', 'Q', 'C', 'K', 'P', 'T', '\0'};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+/**
+ * 断点续传导入配置
+ */
+struct CheckpointConfig {
+    size_t chunkRows;           // 每块的行数
+    int checkpointEveryChunks;  // 每提交多少块写一次检查点
+    bool loadWhenDone;          // 完成后把密钥与快照载入 encryptMatrix 与 ciphertext
+
+    CheckpointConfig() : chunkRows(65536), checkpointEveryChunks(1), loadWhenDone(true) {
+    }
+};
+
+/**
+ * @Method: readCheckpoint
+ * @Description: 读取并校验检查点文件
+ * @param const char* path 检查点文件
+ * @param IngestCheckpoint& checkpoint 返回的检查点
+ * @return 状态码，1：成功；0：失败
+ */
+int readCheckpoint(const char* path, IngestCheckpoint& checkpoint);
+
+/**
+ * @Method: dealDataCheckpointed
+ * @Description: 读取文本数据集并加密，密文按块写入快照；statePrefix 下已有检查点时跳过已提交的块继续导入
+ * @param char* fileString 读取数据集的地址（文本格式）
+ * @param const char* statePrefix 状态文件前缀
+ * @param const CheckpointConfig& config 导入配置
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataCheckpointed(char* fileString, const char* statePrefix, const CheckpointConfig& config = CheckpointConfig());
+
+
+#endif //CHECKPOINT_INGEST_H
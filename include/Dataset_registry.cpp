@@ -0,0 +1,477 @@
+/**
+* @author: WTY
+* @date: 2024/9/6
+* @description: 服务器进程内的多租户数据集注册表：数据集号映射到密文快照，首次查询时读入或映射，
+*               在全局内存上限内按LRU保留热数据集，有查询进行中的数据集被固定不会淘汰
+*/
+
+#include "Dataset_registry.h"
+#include "Task_runtime.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstring>
+
+// 服务器进程的数据集注册表
+DatasetRegistry datasetRegistry;
+
+// 扫描时每个任务与每次交给SIMD内核的行数，与 scanTopK 一致
+static const long REGISTRY_SCAN_TASK_ROWS = 256 * 64;
+static const long REGISTRY_SCAN_BLOCK_ROWS = 256;
+
+/**
+ * 驻留的数据：读入的缓冲或只读映射
+ */
+struct DatasetHandle::Residency {
+    RowMatrixXd buffer;         // RESIDENCY_LOAD
+    vector<uint64_t> idBuffer;
+    void* map;                  // RESIDENCY_MMAP
+    size_t mapBytes;
+    const double* rows;
+    const uint64_t* ids;        // 快照不带行号时为 NULL
+    long count;
+    int dim;
+
+    Residency() : map(NULL), mapBytes(0), rows(NULL), ids(NULL), count(0), dim(0) {
+    }
+
+    ~Residency() {
+        if (map != NULL) {
+            munmap(map, mapBytes);
+        }
+    }
+};
+
+/**
+ * 一次固定，析构时通知注册表
+ */
+struct DatasetHandle::Pin {
+    DatasetRegistry* registry;
+    string id;
+    shared_ptr<Residency> data;
+
+    ~Pin() {
+        registry->release(id);
+    }
+};
+
+const double* DatasetHandle::rows() const {
+    return pin->data->rows;
+}
+
+long DatasetHandle::count() const {
+    return pin->data->count;
+}
+
+int DatasetHandle::dim() const {
+    return pin->data->dim;
+}
+
+long DatasetHandle::rowId(long position) const {
+    return pin->data->ids != NULL ? (long) pin->data->ids[position] : position;
+}
+
+static size_t residentBytesOf(const SnapshotHeader& header) {
+    size_t bytes = (size_t) header.rows * header.dim * sizeof(double);
+    if (header.flags & SNAPSHOT_FLAG_ROW_IDS) {
+        bytes += (size_t) header.rows * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+/**
+ * @Method: loadResidency
+ * @Description: 按驻留方式读入或映射快照，在注册表的锁外调用
+ */
+shared_ptr<DatasetHandle::Residency> DatasetRegistry::loadResidency(const string& path, const SnapshotHeader& header,
+                                                                   int mode) {
+    shared_ptr<DatasetHandle::Residency> data(new DatasetHandle::Residency());
+    data->count = (long) header.rows;
+    data->dim = (int) header.dim;
+    const size_t rowBytes = (size_t) header.rows * header.dim * sizeof(double);
+    const bool hasIds = (header.flags & SNAPSHOT_FLAG_ROW_IDS) != 0;
+
+    if (mode == RESIDENCY_MMAP) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "Unable to open file " << path << endl;
+            return NULL;
+        }
+        struct stat info;
+        data->mapBytes = SNAPSHOT_HEADER_SIZE + residentBytesOf(header);
+        if (fstat(fd, &info) != 0 || (size_t) info.st_size < data->mapBytes) {
+            cerr << "Truncated snapshot file " << path << endl;
+            close(fd);
+            return NULL;
+        }
+        void* map = mmap(NULL, data->mapBytes, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) {
+            cerr << "Unable to map file " << path << endl;
+            return NULL;
+        }
+        // 查询总是顺序扫描全部行
+        madvise(map, data->mapBytes, MADV_SEQUENTIAL);
+        data->map = map;
+        const char* bytes = (const char*) map;
+        data->rows = (const double*) (bytes + SNAPSHOT_HEADER_SIZE);
+        data->ids = hasIds ? (const uint64_t*) (bytes + SNAPSHOT_HEADER_SIZE + rowBytes) : NULL;
+        return data;
+    }
+
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return NULL;
+    }
+    data->buffer.resize(header.rows, header.dim);
+    if (hasIds) {
+        data->idBuffer.resize(header.rows);
+    }
+    bool ok = fseek(file, SNAPSHOT_HEADER_SIZE, SEEK_SET) == 0 &&
+              fread(data->buffer.data(), 1, rowBytes, file) == rowBytes &&
+              (!hasIds || fread(data->idBuffer.data(), sizeof(uint64_t), header.rows, file) == header.rows);
+    fclose(file);
+    if (!ok) {
+        cerr << "Truncated snapshot file " << path << endl;
+        return NULL;
+    }
+    data->rows = data->buffer.data();
+    data->ids = hasIds ? data->idBuffer.data() : NULL;
+    return data;
+}
+
+DatasetRegistry::DatasetRegistry(size_t memoryCapBytes) : memoryCap(memoryCapBytes), residentBytes(0),
+                                                          overCapLoads(0) {
+}
+
+DatasetRegistry::~DatasetRegistry() {
+    lock_guard<mutex> lock(mtx);
+    entries.clear();
+    lruList.clear();
+}
+
+TenantStats& DatasetRegistry::tenantLocked(const string& tenant) {
+    map<string, TenantStats>::iterator it = tenants.find(tenant);
+    if (it == tenants.end()) {
+        TenantStats stats;
+        memset(&stats, 0, sizeof(stats));
+        it = tenants.insert(make_pair(tenant, stats)).first;
+    }
+    return it->second;
+}
+
+int DatasetRegistry::registerDataset(const string& id, const string& tenant, const string& snapshotPath, int mode) {
+    SnapshotHeader header;
+    if (!readSnapshotHeader(snapshotPath.c_str(), header)) {
+        return 0;
+    }
+    lock_guard<mutex> lock(mtx);
+    if (entries.count(id) > 0) {
+        cerr << "Dataset " << id << " is already registered" << endl;
+        return 0;
+    }
+    Entry& entry = entries[id];
+    entry.id = id;
+    entry.tenant = tenant;
+    entry.path = snapshotPath;
+    entry.mode = mode;
+    entry.header = header;
+    entry.bytes = residentBytesOf(header);
+    entry.loading = false;
+    entry.pins = 0;
+    tenantLocked(tenant).datasets++;
+    return 1;
+}
+
+int DatasetRegistry::unregisterDataset(const string& id) {
+    lock_guard<mutex> lock(mtx);
+    unordered_map<string, Entry>::iterator it = entries.find(id);
+    if (it == entries.end()) {
+        return 0;
+    }
+    if (it->second.pins > 0 || it->second.loading) {
+        cerr << "Dataset " << id << " is in use" << endl;
+        return 0;
+    }
+    if (it->second.data) {
+        dropLocked(it->second);
+    }
+    tenantLocked(it->second.tenant).datasets--;
+    entries.erase(it);
+    return 1;
+}
+
+/**
+ * @Method: dropLocked
+ * @Description: 释放一个驻留的数据集，调用时需持有锁
+ */
+void DatasetRegistry::dropLocked(Entry& entry) {
+    lruList.erase(entry.lru);
+    residentBytes -= entry.bytes;
+    tenantLocked(entry.tenant).residentBytes -= entry.bytes;
+    entry.data.reset();
+}
+
+/**
+ * @Method: evictLocked
+ * @Description: 从最久未使用的未固定数据集开始淘汰，直到再放入 needed 字节不超过上限，调用时需持有锁
+ */
+void DatasetRegistry::evictLocked(size_t needed, const string& keep) {
+    list<string>::iterator it = lruList.end();
+    while (residentBytes + needed > memoryCap && it != lruList.begin()) {
+        --it;
+        Entry& entry = entries[*it];
+        if (entry.pins > 0 || entry.id == keep) {
+            continue;
+        }
+        // dropLocked 会删除当前节点，之后从它的后继继续向前查找
+        list<string>::iterator next = it;
+        ++next;
+        tenantLocked(entry.tenant).evictions++;
+        dropLocked(entry);
+        it = next;
+    }
+}
+
+DatasetHandle DatasetRegistry::acquire(const string& id) {
+    DatasetHandle handle;
+    unique_lock<mutex> lock(mtx);
+    Entry* entry = NULL;
+    bool waited = false;
+    while (entry == NULL) {
+        unordered_map<string, Entry>::iterator it = entries.find(id);
+        if (it == entries.end()) {
+            cerr << "Unknown dataset " << id << endl;
+            return handle;
+        }
+        Entry& candidate = it->second;
+        TenantStats& tenant = tenantLocked(candidate.tenant);
+        if (!waited) {
+            tenant.queries++;
+        }
+        if (candidate.data) {
+            if (!waited) {
+                tenant.hits++;
+            }
+            lruList.splice(lruList.begin(), lruList, candidate.lru);
+            entry = &candidate;
+        } else if (candidate.loading) {
+            // 其他查询正在读入，等待同一次读入。醒来时数据集可能已被注销，或读入完成后又被淘汰、读入失败，
+            // 不能继续使用等待前的引用，回到开头按 id 重新查找，没有驻留时自己读入
+            if (!waited) {
+                tenant.misses++;
+            }
+            waited = true;
+            loaded.wait(lock, [this, &id] {
+                unordered_map<string, Entry>::iterator found = entries.find(id);
+                return found == entries.end() || !found->second.loading;
+            });
+        } else {
+            if (!waited) {
+                tenant.misses++;
+            }
+            // 读入中的数据集不会被注销，锁外持有引用是安全的
+            candidate.loading = true;
+            // 先预留字节数，并发读入的其他数据集不会一起超出上限
+            evictLocked(candidate.bytes, id);
+            if (residentBytes + candidate.bytes > memoryCap) {
+                overCapLoads++;
+            }
+            residentBytes += candidate.bytes;
+            lock.unlock();
+
+            auto start = chrono::high_resolution_clock::now();
+            shared_ptr<DatasetHandle::Residency> data = loadResidency(candidate.path, candidate.header, candidate.mode);
+            double millis = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+            lock.lock();
+            candidate.loading = false;
+            if (!data) {
+                residentBytes -= candidate.bytes;
+                loaded.notify_all();
+                return handle;
+            }
+            candidate.data = data;
+            lruList.push_front(id);
+            candidate.lru = lruList.begin();
+            tenant.loads++;
+            tenant.loadMillis += millis;
+            tenant.maxLoadMillis = max(tenant.maxLoadMillis, millis);
+            tenant.residentBytes += candidate.bytes;
+            loaded.notify_all();
+            entry = &candidate;
+        }
+    }
+    entry->pins++;
+    handle.pin.reset(new DatasetHandle::Pin());
+    handle.pin->registry = this;
+    handle.pin->id = id;
+    handle.pin->data = entry->data;
+    return handle;
+}
+
+void DatasetRegistry::release(const string& id) {
+    lock_guard<mutex> lock(mtx);
+    unordered_map<string, Entry>::iterator it = entries.find(id);
+    if (it != entries.end() && it->second.pins > 0 && --it->second.pins == 0 && residentBytes > memoryCap) {
+        // 固定期间的读入可能超出上限，解除固定后回到上限以内
+        evictLocked(0, string());
+    }
+}
+
+void DatasetRegistry::setMemoryCap(size_t bytes) {
+    lock_guard<mutex> lock(mtx);
+    memoryCap = bytes;
+    evictLocked(0, string());
+}
+
+void DatasetRegistry::evictAll() {
+    lock_guard<mutex> lock(mtx);
+    size_t cap = memoryCap;
+    memoryCap = 0;
+    evictLocked(0, string());
+    memoryCap = cap;
+}
+
+RegistryStats DatasetRegistry::stats() {
+    lock_guard<mutex> lock(mtx);
+    RegistryStats stats;
+    stats.datasets = entries.size();
+    stats.resident = lruList.size();
+    stats.pinned = 0;
+    for (unordered_map<string, Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+        stats.pinned += it->second.pins > 0 ? 1 : 0;
+    }
+    stats.residentBytes = residentBytes;
+    stats.memoryCapBytes = memoryCap;
+    stats.overCapLoads = overCapLoads;
+    return stats;
+}
+
+map<string, TenantStats> DatasetRegistry::tenantStats() {
+    lock_guard<mutex> lock(mtx);
+    return tenants;
+}
+
+void DatasetRegistry::resetStats() {
+    lock_guard<mutex> lock(mtx);
+    overCapLoads = 0;
+    for (map<string, TenantStats>::iterator it = tenants.begin(); it != tenants.end(); ++it) {
+        TenantStats& t = it->second;
+        t.queries = t.hits = t.misses = t.loads = t.evictions = 0;
+        t.loadMillis = t.maxLoadMillis = 0;
+    }
+}
+
+/**
+ * @Method: registryTopK
+ * @Description: 在注册表的数据集上扫描，查询期间数据集被固定
+ * @param const string& datasetId 数据集号
+ * @param const VectorXd& q 用该数据集的密钥加密的查询向量
+ * @param int k 返回的结果数
+ * @param MatrixXd* rows 同时返回结果行的密文，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；数据集不可用时为空
+ */
+vector<pair<double, long>> registryTopK(const string& datasetId, const VectorXd& q, int k, MatrixXd* rows) {
+    DatasetHandle handle = datasetRegistry.acquire(datasetId);
+    if (!handle.valid()) {
+        return vector<pair<double, long>>();
+    }
+    const long n = handle.count(), dim = handle.dim();
+    if (q.size() != dim) {
+        cerr << "Query dimension does not match dataset " << datasetId << endl;
+        return vector<pair<double, long>>();
+    }
+    const double* data = handle.rows();
+    const SimdKernels& kernels = simdKernels();
+    const long tasks = (n + REGISTRY_SCAN_TASK_ROWS - 1) / REGISTRY_SCAN_TASK_ROWS;
+    const int slots = (int) min((long) taskRuntime().threads(), max(1L, tasks));
+    vector<TopKHeap> heaps(slots, TopKHeap(k));
+    vector<vector<double>> scores(slots, vector<double>(REGISTRY_SCAN_BLOCK_ROWS));
+    parallelChunks(TASK_QUERY, slots, tasks, [&](long task, int slot) {
+        long end = min(n, (task + 1) * REGISTRY_SCAN_TASK_ROWS);
+        double* slotScores = scores[slot].data();
+        for (long b = task * REGISTRY_SCAN_TASK_ROWS; b < end; b += REGISTRY_SCAN_BLOCK_ROWS) {
+            long count = min(REGISTRY_SCAN_BLOCK_ROWS, end - b);
+            kernels.scanBlock(data + b * dim, count, dim, q.data(), dim, slotScores);
+            for (long i = 0; i < count; i++) {
+                heaps[slot].push(slotScores[i], b + i);
+            }
+        }
+    });
+    for (int s = 1; s < slots; s++) {
+        heaps[0].merge(heaps[s]);
+    }
+    vector<pair<double, long>> winners = heaps[0].extractDescending();
+
+    // 句柄仍然固定着数据集，按位置取出结果行后再换成行号
+    if (rows != NULL) {
+        rows->resize(winners.size(), dim);
+        for (size_t i = 0; i < winners.size(); i++) {
+            rows->row(i) = VectorXd::Map(data + winners[i].second * dim, dim).transpose();
+        }
+    }
+    for (size_t i = 0; i < winners.size(); i++) {
+        winners[i].second = handle.rowId(winners[i].second);
+    }
+    return winners;
+}
+
+/**
+ * @Method: printRegistryReport
+ * @Description: 输出注册表的驻留情况以及各租户的命中率与读入延迟
+ */
+void printRegistryReport() {
+    const double mb = 1024.0 * 1024.0;
+    RegistryStats s = datasetRegistry.stats();
+    printf("数据集注册表：%zu 个数据集，驻留 %zu 个（固定 %zu 个），%.2f / %.2f MB，超出上限的读入 %llu 次\n",
+           s.datasets, s.resident, s.pinned, s.residentBytes / mb, s.memoryCapBytes / mb,
+           (unsigned long long) s.overCapLoads);
+    printf("%-16s %8s %10s %10s %8s %8s %10s %14s %14s %12s\n", "tenant", "datasets", "queries", "misses",
+           "hit(%)", "loads", "evictions", "avgLoad(ms)", "maxLoad(ms)", "resident(MB)");
+    map<string, TenantStats> tenants = datasetRegistry.tenantStats();
+    for (map<string, TenantStats>::const_iterator it = tenants.begin(); it != tenants.end(); ++it) {
+        const TenantStats& t = it->second;
+        printf("%-16s %8llu %10llu %10llu %8.2f %8llu %10llu %14.3f %14.3f %12.2f\n", it->first.c_str(),
+               (unsigned long long) t.datasets, (unsigned long long) t.queries, (unsigned long long) t.misses,
+               t.queries > 0 ? 100.0 * t.hits / t.queries : 0.0, (unsigned long long) t.loads,
+               (unsigned long long) t.evictions, t.loads > 0 ? t.loadMillis / t.loads : 0.0, t.maxLoadMillis,
+               t.residentBytes / mb);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @Method: SSQRegistry
+ * @Description: 租户客户端用自己的密钥加密查询，在注册表的数据集上发起查询请求并解密结果
+ * @param const string& datasetId 数据集号
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const MatrixXd& key 该数据集的加密矩阵
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQRegistry(const string& datasetId, char* fileString, char* resultFilePath, const MatrixXd& key,
+                int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point)) {
+        return 0;
+    }
+    if ((long) point.size() + 3 != key.rows()) {
+        cerr << "Query dimension does not match the key of dataset " << datasetId << endl;
+        return 0;
+    }
+
+    MatrixXd keyInverse = calculateInverseMatrix(key);
+    VectorXd q = encryptQuery(point, keyInverse);
+
+    MatrixXd rows;
+    vector<pair<double, long>> winners = registryTopK(datasetId, q, k, &rows);
+    if (winners.empty() && k > 0) {
+        return 0;
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, keyInverse), resultFormat);
+}
@@ -0,0 +1,213 @@
+/**
+* @author: WTY
+* @date: 2024/9/6
+* @description: 服务器进程内的多租户数据集注册表：数据集号映射到密文快照，首次查询时读入或映射，
+*               在全局内存上限内按LRU保留热数据集，有查询进行中的数据集被固定不会淘汰
+*/
+
+#ifndef DATASET_REGISTRY_H
+#define DATASET_REGISTRY_H
+
+#include "SSQ.h"
+#include "Snapshot.h"
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+/**
+ * 数据集的驻留方式
+ */
+enum ResidencyMode {
+    RESIDENCY_LOAD = 0,     // 一次读入内存，之后的查询不再访问磁盘
+    RESIDENCY_MMAP = 1      // 只读映射快照文件，页面在第一次扫描时由内核按需读入
+};
+
+/**
+ * 一个租户的统计
+ */
+struct TenantStats {
+    uint64_t datasets;          // 注册的数据集数
+    uint64_t queries;           // acquire 次数
+    uint64_t hits;              // 数据集已驻留
+    uint64_t misses;            // 需要读入（或等待其他查询读入）
+    uint64_t loads;
+    uint64_t evictions;
+    double loadMillis;          // 读入或映射的总时间
+    double maxLoadMillis;
+    size_t residentBytes;
+};
+
+/**
+ * 注册表统计
+ */
+struct RegistryStats {
+    size_t datasets;
+    size_t resident;
+    size_t pinned;
+    size_t residentBytes;
+    size_t memoryCapBytes;
+    uint64_t overCapLoads;      // 可淘汰的数据集不足（都被固定）而超出上限的读入次数
+};
+
+class DatasetRegistry;
+
+/**
+ * @Class: DatasetHandle
+ * @Description: 已驻留数据集的固定句柄，副本共享同一次固定，最后一个副本析构时解除固定
+ */
+class DatasetHandle {
+public:
+    bool valid() const {
+        return pin != NULL;
+    }
+
+    /**
+     * @Method: rows
+     * @Description: 行主序的密文，第 i 行从 rows() + i * dim() 开始
+     */
+    const double* rows() const;
+    long count() const;
+    int dim() const;
+
+    /**
+     * @Method: rowId
+     * @Description: 快照中第 position 行的行号（快照带行号时取文件中的行号，否则即位置）
+     */
+    long rowId(long position) const;
+
+private:
+    friend class DatasetRegistry;
+    struct Residency;
+    struct Pin;
+    shared_ptr<Pin> pin;
+};
+
+/**
+ * @Class: DatasetRegistry
+ * @Description: 数据集号到快照文件的映射。acquire 在数据集未驻留时读入，读入在锁外进行，
+ *               同一数据集的并发 acquire 等待同一次读入；读入前先预留字节数并从最久未使用的
+ *               未固定数据集开始淘汰，直到不超过内存上限。服务器只持有密文，密钥留在各租户的客户端
+ */
+class DatasetRegistry {
+public:
+    explicit DatasetRegistry(size_t memoryCapBytes = (size_t) 1 << 30);
+    ~DatasetRegistry();
+
+    /**
+     * @Method: registerDataset
+     * @Description: 注册数据集，只读取并校验快照文件头，不读入数据
+     * @param const string& id 数据集号
+     * @param const string& tenant 所属租户
+     * @param const string& snapshotPath 密文快照文件
+     * @param int mode 驻留方式 ResidencyMode
+     * @return 状态码，1：成功；0：失败
+     */
+    int registerDataset(const string& id, const string& tenant, const string& snapshotPath,
+                        int mode = RESIDENCY_MMAP);
+
+    /**
+     * @Method: unregisterDataset
+     * @Description: 注销数据集并释放其内存，数据集被固定时失败
+     * @return 状态码，1：成功；0：失败
+     */
+    int unregisterDataset(const string& id);
+
+    /**
+     * @Method: acquire
+     * @Description: 取得数据集的固定句柄，未驻留时读入；数据集不存在或读入失败时句柄无效
+     */
+    DatasetHandle acquire(const string& id);
+
+    /**
+     * @Method: setMemoryCap
+     * @Description: 修改内存上限，立即淘汰未固定的数据集直到不超过上限
+     */
+    void setMemoryCap(size_t bytes);
+
+    /**
+     * @Method: evictAll
+     * @Description: 释放所有未固定的数据集
+     */
+    void evictAll();
+
+    RegistryStats stats();
+
+    map<string, TenantStats> tenantStats();
+
+    void resetStats();
+
+private:
+    struct Entry {
+        string id;
+        string tenant;
+        string path;
+        int mode;
+        SnapshotHeader header;
+        size_t bytes;                               // 驻留时占用的字节数
+        shared_ptr<DatasetHandle::Residency> data;  // 驻留时非空
+        bool loading;
+        long pins;
+        list<string>::iterator lru;                 // 驻留时在 lruList 中的位置
+    };
+
+    friend struct DatasetHandle::Pin;
+
+    /**
+     * @Method: loadResidency
+     * @Description: 按驻留方式读入或映射快照，在锁外调用
+     */
+    static shared_ptr<DatasetHandle::Residency> loadResidency(const string& path, const SnapshotHeader& header,
+                                                              int mode);
+    void release(const string& id);
+    void evictLocked(size_t needed, const string& keep);
+    void dropLocked(Entry& entry);
+    TenantStats& tenantLocked(const string& tenant);
+
+    size_t memoryCap;
+    size_t residentBytes;
+    uint64_t overCapLoads;
+    unordered_map<string, Entry> entries;
+    list<string> lruList;                           // 驻留的数据集，最近使用的在前
+    map<string, TenantStats> tenants;
+    mutex mtx;
+    condition_variable loaded;
+};
+
+// 服务器进程的数据集注册表
+extern DatasetRegistry datasetRegistry;
+
+/**
+ * @Method: registryTopK
+ * @Description: 在注册表的数据集上扫描，查询期间数据集被固定
+ * @param const string& datasetId 数据集号
+ * @param const VectorXd& q 用该数据集的密钥加密的查询向量
+ * @param int k 返回的结果数
+ * @param MatrixXd* rows 同时返回结果行的密文，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；数据集不可用时为空
+ */
+vector<pair<double, long>> registryTopK(const string& datasetId, const VectorXd& q, int k, MatrixXd* rows = NULL);
+
+/**
+ * @Method: printRegistryReport
+ * @Description: 输出注册表的驻留情况以及各租户的命中率与读入延迟
+ */
+void printRegistryReport();
+
+/**
+ * @Method: SSQRegistry
+ * @Description: 租户客户端用自己的密钥加密查询，在注册表的数据集上发起查询请求并解密结果
+ * @param const string& datasetId 数据集号
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const MatrixXd& key 该数据集的加密矩阵
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQRegistry(const string& datasetId, char* fileString, char* resultFilePath, const MatrixXd& key,
+                int resultFormat = RESULT_TEXT);
+
+
+#endif //DATASET_REGISTRY_H
@@ -0,0 +1,362 @@
+/**
+* @author: WTY
+* @date: 2024/9/5
+* @description: 数据拥有者在加密前降维：在明文上拟合PCA或随机投影，加密低维密文用于第一阶段扫描，
+*               同时保留全维密文，对第一阶段的候选重新计算精确距离
+*/
+
+#include "Dim_reduction.h"
+#include "Task_runtime.h"
+#include "Memory_accounting.h"
+#include <Eigen/Eigenvalues>
+#include <unordered_set>
+
+// 降维结构
+DimReduction dimReduction = {REDUCE_PCA, MatrixXd(), VectorXd(), 0, MatrixXd(), RowMatrixXd(), 4, 0};
+
+// 投影与加密时每个任务处理的行数，每块交给SIMD内核的行数
+static const long REDUCE_TASK_ROWS = 4096;
+static const long REDUCE_BLOCK_ROWS = 256;
+// 第一阶段扫描每个任务处理的行数，与 scanTopK 一致
+static const long REDUCED_SCAN_TASK_ROWS = 256 * 64;
+
+/**
+ * @Method: fitPca
+ * @Description: 在抽样的行上计算协方差矩阵，取特征值最大的 r 个特征向量
+ */
+static void fitPca(const vector<vector<double>>& data_list, int r, long sampleRows, unsigned int seed,
+                   MatrixXd& projection, VectorXd& mean, double& explained) {
+    const long n = (long) data_list.size(), d = (long) data_list[0].size();
+    vector<long> ids(n);
+    for (long i = 0; i < n; i++) {
+        ids[i] = i;
+    }
+    long s = sampleRows > 0 ? min(n, sampleRows) : n;
+    mt19937 rng(seed);
+    for (long i = 0; i < s; i++) {
+        swap(ids[i], ids[i + (long) (rng() % (n - i))]);
+    }
+
+    MatrixXd sample(s, d);
+    for (long i = 0; i < s; i++) {
+        sample.row(i) = VectorXd::Map(data_list[ids[i]].data(), d).transpose();
+    }
+    mean = sample.colwise().mean().transpose();
+    sample.rowwise() -= mean.transpose();
+    MatrixXd covariance = sample.transpose() * sample / max(1L, s - 1);
+
+    // 特征值按从小到大排列，取最后 r 个
+    Eigen::SelfAdjointEigenSolver<MatrixXd> solver(covariance);
+    projection = solver.eigenvectors().rightCols(r).rowwise().reverse();
+    double total = solver.eigenvalues().sum();
+    explained = total > 0 ? solver.eigenvalues().tail(r).sum() / total : 0;
+}
+
+/**
+ * @Method: fitRandomProjection
+ * @Description: 元素独立服从 N(0, 1/r) 的投影矩阵，期望上保持距离
+ */
+static void fitRandomProjection(const vector<vector<double>>& data_list, int r, unsigned int seed,
+                                MatrixXd& projection, VectorXd& mean) {
+    const long d = (long) data_list[0].size();
+    mt19937 rng(seed);
+    normal_distribution<double> normal(0, 1 / sqrt((double) r));
+    projection.resize(d, r);
+    for (long j = 0; j < r; j++) {
+        for (long i = 0; i < d; i++) {
+            projection(i, j) = normal(rng);
+        }
+    }
+    mean = VectorXd::Zero(d);
+}
+
+/**
+ * @Method: encryptReduced
+ * @Description: 按块投影、扩展并加密，各块作为批量任务并行执行
+ */
+static void encryptReduced(const vector<vector<double>>& data_list, const MatrixXd& projection,
+                           const VectorXd& mean, const MatrixXd& key, RowMatrixXd& out) {
+    const long n = (long) data_list.size(), d = projection.rows(), r = projection.cols();
+    const long dim = r + 3;
+    out.resize(n, dim);
+    RowMatrixXd rowKey = key;
+    const SimdKernels& kernels = simdKernels();
+    const int slots = taskRuntime().threads();
+    vector<RowMatrixXd> x(slots, RowMatrixXd(REDUCE_BLOCK_ROWS, d));
+    vector<RowMatrixXd> y(slots, RowMatrixXd(REDUCE_BLOCK_ROWS, r));
+    vector<RowMatrixXd> t(slots, RowMatrixXd(REDUCE_BLOCK_ROWS, dim));
+    const long tasks = (n + REDUCE_TASK_ROWS - 1) / REDUCE_TASK_ROWS;
+    parallelChunks(TASK_BULK, slots, tasks, [&](long task, int slot) {
+        long end = min(n, (task + 1) * REDUCE_TASK_ROWS);
+        for (long b = task * REDUCE_TASK_ROWS; b < end; b += REDUCE_BLOCK_ROWS) {
+            long count = min(REDUCE_BLOCK_ROWS, end - b);
+            for (long i = 0; i < count; i++) {
+                x[slot].row(i) = VectorXd::Map(data_list[b + i].data(), d).transpose() - mean.transpose();
+            }
+            y[slot].topRows(count).noalias() = x[slot].topRows(count) * projection;
+            for (long i = 0; i < count; i++) {
+                augmentRecord(y[slot].row(i).data(), r, generateRandomDouble(), t[slot].row(i).data());
+            }
+            kernels.encryptRows(t[slot].data(), count, dim, rowKey.data(), out.row(b).data());
+        }
+    });
+}
+
+/**
+ * @Method: dealDataReduced
+ * @Description: 读取数据集，拟合投影，分别加密全维密文 ciphertext 与低维密文 reducedCiphertext
+ * @param char* fileString 读取数据集的地址
+ * @param const ReductionConfig& config 降维配置
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataReduced(char* fileString, const ReductionConfig& config) {
+    vector<vector<double>> data_list = readDataFromFile(fileString);
+    if (data_list.empty()) {
+        return 0;
+    }
+    const int d = (int) data_list[0].size();
+    const int r = max(1, min(config.dim, d));
+    ScopedMemoryCharge plaintext(MEM_PLAINTEXT, estimatePlaintextBytes(data_list.size(), d));
+
+    auto start_time = chrono::high_resolution_clock::now();
+    DimReduction reduction;
+    reduction.method = config.method;
+    reduction.rerank = max(1, config.rerank);
+    reduction.explainedVariance = 0;
+    if (config.method == REDUCE_RANDOM) {
+        fitRandomProjection(data_list, r, config.seed, reduction.projection, reduction.mean);
+    } else {
+        fitPca(data_list, r, config.sampleRows, config.seed, reduction.projection, reduction.mean,
+               reduction.explainedVariance);
+    }
+    auto fit_time = chrono::high_resolution_clock::now();
+
+    // 全维密文用于重新排序与返回结果
+    encryptMatrix = generateInvertibleMatrix(d + 3);
+    keyMode = KEY_DENSE;
+    encryptDataList(data_list, NULL, ciphertext);
+    auto full_time = chrono::high_resolution_clock::now();
+
+    reduction.reducedKey = generateInvertibleMatrix(r + 3);
+    encryptReduced(data_list, reduction.projection, reduction.mean, reduction.reducedKey,
+                   reduction.reducedCiphertext);
+    auto end_time = chrono::high_resolution_clock::now();
+
+    reduction.version = ++datasetVersion;
+    dimReduction = reduction;
+    refreshMemoryAccounting();
+
+    chrono::duration<double, milli> fit_duration = fit_time - start_time;
+    chrono::duration<double, milli> full_duration = full_time - fit_time;
+    chrono::duration<double, milli> reduced_duration = end_time - full_time;
+    printf("降维：%s，%d -> %d 维", config.method == REDUCE_RANDOM ? "随机投影" : "PCA", d, r);
+    if (config.method != REDUCE_RANDOM) {
+        printf("，保留方差 %.2f%%", reduction.explainedVariance * 100);
+    }
+    printf("，拟合时间 %f 毫秒\n", fit_duration.count());
+    printf("全维密文 %d 维，加密时间 %f 毫秒；低维密文 %d 维，加密时间 %f 毫秒\n", d + 3, full_duration.count(), r + 3,
+           reduced_duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: projectPoint
+ * @Description: 用降维结构的投影把明文点映射到低维空间
+ * @param const vector<double>& point 明文点
+ * @return vector<double> 低维点
+ */
+vector<double> projectPoint(const vector<double>& point) {
+    const long r = dimReduction.projection.cols();
+    vector<double> y(r);
+    VectorXd::Map(y.data(), r) = dimReduction.projection.transpose() *
+                                 (VectorXd::Map(point.data(), point.size()) - dimReduction.mean);
+    return y;
+}
+
+/**
+ * @Method: encryptReducedQuery
+ * @Description: 客户端投影查询点并用低维密钥的逆矩阵加密
+ * @param const vector<double>& point 查询点
+ * @param const MatrixXd& reducedKeyInverse 低维加密矩阵的逆矩阵
+ * @return VectorXd 加密后的低维查询向量
+ */
+VectorXd encryptReducedQuery(const vector<double>& point, const MatrixXd& reducedKeyInverse) {
+    return encryptQuery(projectPoint(point), reducedKeyInverse);
+}
+
+/**
+ * @Method: reducedTopK
+ * @Description: 第一阶段并行扫描低维密文保留 rerank * k 个候选，第二阶段用全维密文计算候选的精确距离
+ * @param const VectorXd& q 加密后的全维查询向量
+ * @param const VectorXd& reducedQ 加密后的低维查询向量
+ * @param int k 返回的结果数
+ * @param int rerank 候选倍数，0 表示使用建立时的配置
+ * @param ReductionStats* stats 返回统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；降维结构失效时为空
+ */
+vector<pair<double, long>> reducedTopK(const VectorXd& q, const VectorXd& reducedQ, int k, int rerank,
+                                       ReductionStats* stats) {
+    const RowMatrixXd& reduced = dimReduction.reducedCiphertext;
+    const long n = reduced.rows(), dim = reduced.cols();
+    if (dimReduction.version != datasetVersion || n != (long) ciphertext.size() || reducedQ.size() != dim) {
+        cerr << "Reduced ciphertext does not match the current dataset" << endl;
+        return vector<pair<double, long>>();
+    }
+    auto start = chrono::high_resolution_clock::now();
+    const long candidates = min(n, (long) k * (rerank > 0 ? rerank : dimReduction.rerank));
+
+    // 第一阶段：低维密文按块连续存放，直接交给 scanBlock
+    const SimdKernels& kernels = simdKernels();
+    const long tasks = (n + REDUCED_SCAN_TASK_ROWS - 1) / REDUCED_SCAN_TASK_ROWS;
+    const int slots = (int) min((long) taskRuntime().threads(), max(1L, tasks));
+    vector<TopKHeap> heaps(slots, TopKHeap(candidates));
+    vector<vector<double>> scores(slots, vector<double>(REDUCE_BLOCK_ROWS));
+    parallelChunks(TASK_QUERY, slots, tasks, [&](long task, int slot) {
+        long end = min(n, (task + 1) * REDUCED_SCAN_TASK_ROWS);
+        double* slotScores = scores[slot].data();
+        for (long b = task * REDUCED_SCAN_TASK_ROWS; b < end; b += REDUCE_BLOCK_ROWS) {
+            long count = min(REDUCE_BLOCK_ROWS, end - b);
+            kernels.scanBlock(reduced.row(b).data(), count, dim, reducedQ.data(), dim, slotScores);
+            for (long i = 0; i < count; i++) {
+                heaps[slot].push(slotScores[i], b + i);
+            }
+        }
+    });
+    for (int s = 1; s < slots; s++) {
+        heaps[0].merge(heaps[s]);
+    }
+    vector<pair<double, long>> firstStage = heaps[0].extractDescending();
+    auto first_time = chrono::high_resolution_clock::now();
+
+    // 第二阶段：候选的全维密文精确距离
+    vector<const double*> rows(firstStage.size());
+    vector<double> distances(firstStage.size());
+    for (size_t i = 0; i < firstStage.size(); i++) {
+        rows[i] = ciphertext[firstStage[i].second].data();
+    }
+    kernels.scanRows(rows.data(), rows.size(), q.data(), q.size(), distances.data());
+    TopKHeap heap(k);
+    for (size_t i = 0; i < firstStage.size(); i++) {
+        heap.push(distances[i], firstStage[i].second);
+    }
+    auto end_time = chrono::high_resolution_clock::now();
+
+    if (stats != NULL) {
+        stats->candidates = (long) firstStage.size();
+        stats->firstStageMillis = chrono::duration<double, milli>(first_time - start).count();
+        stats->rerankMillis = chrono::duration<double, milli>(end_time - first_time).count();
+    }
+    return heap.extractDescending();
+}
+
+static long overlap(const vector<pair<double, long>>& truth, const vector<pair<double, long>>& result, int k) {
+    unordered_set<long> ids;
+    for (size_t i = 0; i < truth.size(); i++) {
+        ids.insert(truth[i].second);
+    }
+    long hits = 0;
+    // result 距离从大到小，最后 k 条是最近的 k 条
+    for (size_t i = result.size() > (size_t) k ? result.size() - k : 0; i < result.size(); i++) {
+        hits += ids.count(result[i].second);
+    }
+    return hits;
+}
+
+/**
+ * @Method: evaluateReduction
+ * @Description: 对一组查询点分别执行全维扫描与两阶段查询，统计召回率与加速比
+ * @param const vector<vector<double>>& queries 明文查询点
+ * @param int k 返回的结果数
+ * @param int rerank 候选倍数，0 表示使用建立时的配置
+ * @return ReductionReport 降维效果
+ */
+ReductionReport evaluateReduction(const vector<vector<double>>& queries, int k, int rerank) {
+    ReductionReport report = {0, k, 0, 0, 0, 0, 0};
+    if (queries.empty() || !denseKeyReady(queries[0].size())) {
+        return report;
+    }
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    MatrixXd reducedKeyInverse = calculateInverseMatrix(dimReduction.reducedKey);
+    long firstHits = 0, hits = 0, expected = 0;
+    for (size_t i = 0; i < queries.size(); i++) {
+        VectorXd q = encryptQuery(queries[i], encryptMatrixInverse);
+        VectorXd reducedQ = encryptReducedQuery(queries[i], reducedKeyInverse);
+
+        auto t0 = chrono::high_resolution_clock::now();
+        vector<pair<double, long>> truth = scanTopK(q, k);
+        auto t1 = chrono::high_resolution_clock::now();
+        vector<pair<double, long>> result = reducedTopK(q, reducedQ, k, rerank);
+        auto t2 = chrono::high_resolution_clock::now();
+        if (result.empty() && !truth.empty()) {
+            return report;
+        }
+
+        // 只用低维密文时的 top-k：第一阶段取 k 个候选
+        vector<pair<double, long>> first = reducedTopK(q, reducedQ, k, 1);
+        report.fullMillis += chrono::duration<double, milli>(t1 - t0).count();
+        report.reducedMillis += chrono::duration<double, milli>(t2 - t1).count();
+        firstHits += overlap(truth, first, k);
+        hits += overlap(truth, result, k);
+        expected += (long) truth.size();
+        report.queries++;
+    }
+    if (report.queries > 0) {
+        report.firstStageRecall = expected > 0 ? (double) firstHits / expected : 1;
+        report.recall = expected > 0 ? (double) hits / expected : 1;
+        report.fullMillis /= report.queries;
+        report.reducedMillis /= report.queries;
+        report.speedup = report.reducedMillis > 0 ? report.fullMillis / report.reducedMillis : 0;
+    }
+    return report;
+}
+
+/**
+ * @Method: printReductionReport
+ * @Description: 输出降维方法、维度与召回率、加速比
+ */
+void printReductionReport(const ReductionReport& report) {
+    printf("降维效果：%s，%ld -> %ld 维，%ld 个查询，k=%d，候选 %d*k\n",
+           dimReduction.method == REDUCE_RANDOM ? "随机投影" : "PCA", (long) dimReduction.projection.rows(),
+           (long) dimReduction.projection.cols(), report.queries, report.k, dimReduction.rerank);
+    printf("召回率：仅低维 %.4f，重新排序后 %.4f\n", report.firstStageRecall, report.recall);
+    printf("平均查询时间：全维扫描 %f 毫秒，两阶段 %f 毫秒，加速 %.2f 倍\n", report.fullMillis, report.reducedMillis,
+           report.speedup);
+    fflush(stdout);
+}
+
+/**
+ * @Method: SSQReduced
+ * @Description: 客户端投影并加密两种查询向量，使用两阶段查询发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQReduced(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || !denseKeyReady(point.size())) {
+        return 0;
+    }
+    if ((long) point.size() != dimReduction.projection.rows()) {
+        cerr << "Query dimension does not match the reduction" << endl;
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    MatrixXd reducedKeyInverse = calculateInverseMatrix(dimReduction.reducedKey);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+    VectorXd reducedQ = encryptReducedQuery(point, reducedKeyInverse);
+
+    ReductionStats stats;
+    vector<pair<double, long>> winners = reducedTopK(q, reducedQ, k, 0, &stats);
+    if (winners.empty() && k > 0 && !ciphertext.empty()) {
+        return 0;
+    }
+    printf("两阶段查询：%ld 个候选，低维扫描 %f 毫秒，全维重新排序 %f 毫秒\n", stats.candidates,
+           stats.firstStageMillis, stats.rerankMillis);
+    fflush(stdout);
+
+    return outputResults(resultFilePath, winners, encryptMatrixInverse, resultFormat);
+}
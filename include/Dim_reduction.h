@@ -0,0 +1,140 @@
+/**
+* @author: WTY
+* @date: 2024/9/5
+* @description: 数据拥有者在加密前降维：在明文上拟合PCA或随机投影，加密低维密文用于第一阶段扫描，
+*               同时保留全维密文，对第一阶段的候选重新计算精确距离
+*/
+
+#ifndef DIM_REDUCTION_H
+#define DIM_REDUCTION_H
+
+#include "SSQ.h"
+
+/**
+ * 降维方法
+ */
+enum ReductionMethod {
+    REDUCE_PCA = 0,         // 主成分分析，取方差最大的 dim 个方向
+    REDUCE_RANDOM = 1       // 高斯随机投影，不需要拟合，近似保持距离
+};
+
+/**
+ * 降维配置
+ */
+struct ReductionConfig {
+    int method;             // ReductionMethod
+    int dim;                // 降维后的维度，不超过原始维度
+    int rerank;             // 第一阶段保留 rerank * k 个候选用全维密文重新排序
+    long sampleRows;        // 拟合PCA时使用的行数，0 表示全部
+    unsigned int seed;      // 抽样与随机投影的种子
+
+    ReductionConfig() : method(REDUCE_PCA), dim(64), rerank(4), sampleRows(20000), seed(1) {
+    }
+};
+
+/**
+ * 降维结构，只有投影与低维密钥留在数据拥有者/客户端，服务器只持有两份密文
+ */
+struct DimReduction {
+    int method;
+    MatrixXd projection;            // d×r，y = projection^T (x - mean)
+    VectorXd mean;
+    double explainedVariance;       // PCA保留的方差比例，随机投影为 0
+    MatrixXd reducedKey;            // (r+3)×(r+3) 的低维加密矩阵
+    RowMatrixXd reducedCiphertext;  // N×(r+3)，每行一条低维密文，与 ciphertext 行号一致
+    int rerank;
+    uint64_t version;               // 建立时的 datasetVersion，与当前版本不同说明已失效
+};
+
+/**
+ * 两阶段查询统计
+ */
+struct ReductionStats {
+    long candidates;                // 第一阶段保留的候选数
+    double firstStageMillis;        // 低维密文扫描
+    double rerankMillis;            // 全维密文重新排序
+};
+
+/**
+ * 降维效果：与全维扫描比较的召回率与加速比
+ */
+struct ReductionReport {
+    long queries;
+    int k;
+    double firstStageRecall;        // 只用低维密文时 top-k 的召回率
+    double recall;                  // 重新排序后 top-k 的召回率
+    double fullMillis;              // 全维扫描的平均时间
+    double reducedMillis;           // 两阶段查询的平均时间
+    double speedup;
+};
+
+// 降维结构，由 dealDataReduced 建立
+extern DimReduction dimReduction;
+
+/**
+ * @Method: dealDataReduced
+ * @Description: 读取数据集，拟合投影，分别加密全维密文 ciphertext 与低维密文 reducedCiphertext
+ * @param char* fileString 读取数据集的地址
+ * @param const ReductionConfig& config 降维配置
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataReduced(char* fileString, const ReductionConfig& config = ReductionConfig());
+
+/**
+ * @Method: projectPoint
+ * @Description: 用降维结构的投影把明文点映射到低维空间
+ * @param const vector<double>& point 明文点
+ * @return vector<double> 低维点
+ */
+vector<double> projectPoint(const vector<double>& point);
+
+/**
+ * @Method: encryptReducedQuery
+ * @Description: 客户端投影查询点并用低维密钥的逆矩阵加密
+ * @param const vector<double>& point 查询点
+ * @param const MatrixXd& reducedKeyInverse 低维加密矩阵的逆矩阵
+ * @return VectorXd 加密后的低维查询向量
+ */
+VectorXd encryptReducedQuery(const vector<double>& point, const MatrixXd& reducedKeyInverse);
+
+/**
+ * @Method: reducedTopK
+ * @Description: 第一阶段并行扫描低维密文保留 rerank * k 个候选，第二阶段用全维密文计算候选的精确距离
+ * @param const VectorXd& q 加密后的全维查询向量
+ * @param const VectorXd& reducedQ 加密后的低维查询向量
+ * @param int k 返回的结果数
+ * @param int rerank 候选倍数，0 表示使用建立时的配置
+ * @param ReductionStats* stats 返回统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；降维结构失效时为空
+ */
+vector<pair<double, long>> reducedTopK(const VectorXd& q, const VectorXd& reducedQ, int k, int rerank = 0,
+                                       ReductionStats* stats = NULL);
+
+/**
+ * @Method: evaluateReduction
+ * @Description: 对一组查询点分别执行全维扫描与两阶段查询，统计召回率与加速比
+ * @param const vector<vector<double>>& queries 明文查询点
+ * @param int k 返回的结果数
+ * @param int rerank 候选倍数，0 表示使用建立时的配置
+ * @return ReductionReport 降维效果
+ */
+ReductionReport evaluateReduction(const vector<vector<double>>& queries, int k, int rerank = 0);
+
+/**
+ * @Method: printReductionReport
+ * @Description: 输出降维方法、维度与召回率、加速比
+ */
+void printReductionReport(const ReductionReport& report);
+
+/**
+ * @Method: SSQReduced
+ * @Description: 客户端投影并加密两种查询向量，使用两阶段查询发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQReduced(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //DIM_REDUCTION_H
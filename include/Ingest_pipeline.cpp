@@ -0,0 +1,359 @@
+/**
+* @author: WTY
+* @date: 2024/8/17
+* @description: 多阶段流水线数据加密外包：分块读取、解析、扩展、加密、写快照并发执行
+*/
+
+#include "Ingest_pipeline.h"
+#include "Block_index.h"
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <cstdlib>
+#include <sstream>
+#include <memory>
+
+// 在阶段之间传递的块，每个阶段读取上一阶段的字段并释放
+struct PipelineChunk {
+    uint64_t seq;
+    string bytes;               // 读取：原始文本
+    vector<double> values;      // 解析：rows × d 的明文
+    size_t rows;
+    RowMatrixXd t;              // 扩展：rows × (d+3)
+    RowMatrixXd c;              // 加密：rows × (d+3) 的密文
+    chrono::high_resolution_clock::time_point queued;   // 进入当前输入队列的时间
+
+    PipelineChunk() : seq(0), rows(0) {
+    }
+};
+
+// 阶段统计，多个线程并发累加
+struct StageStats {
+    atomic<uint64_t> chunks;
+    atomic<uint64_t> rows;
+    atomic<uint64_t> bytes;
+    atomic<uint64_t> busyNanos;
+    atomic<uint64_t> waitNanos;
+
+    StageStats() : chunks(0), rows(0), bytes(0), busyNanos(0), waitNanos(0) {
+    }
+};
+
+typedef chrono::high_resolution_clock PipelineClock;
+
+static uint64_t elapsedNanos(const PipelineClock::time_point& since) {
+    return (uint64_t) chrono::duration_cast<chrono::nanoseconds>(PipelineClock::now() - since).count();
+}
+
+// 处理阶段：解析、扩展、加密、写出，输入队列依次为 queues[0..3]
+const int PROCESS_STAGES = 4;
+
+static int stageLimit(int configured) {
+    return configured > 0 ? configured : taskRuntime().threads();
+}
+
+/**
+ * @Method: pipelineInFlightChunks
+ * @Description: 流水线中同时存在的块数上限
+ */
+size_t pipelineInFlightChunks(const IngestPipelineConfig& config) {
+    return max((size_t) 1, config.queueCapacity) * PROCESS_STAGES + stageLimit(config.parserThreads) +
+           stageLimit(config.augmentThreads) + stageLimit(config.encryptThreads) + 1;
+}
+
+/**
+ * @Method: parseChunk
+ * @Description: 将文本块解析为定长的明文行，维度与 dim 不符的行被跳过
+ */
+static size_t parseChunk(string& bytes, size_t dim, vector<double>& values) {
+    size_t skipped = 0;
+    char* p = &bytes[0];
+    char* end = p + bytes.size();
+    vector<double> row;
+    row.reserve(dim);
+    while (p < end) {
+        char* lineEnd = static_cast<char*>(memchr(p, '\n', end - p));
+        if (lineEnd == NULL) {
+            lineEnd = end;
+        }
+        *lineEnd = '\0';  // bytes 末尾预留了一个字节，可以安全写入
+        row.clear();
+        char* cur = p;
+        while (true) {
+            char* next;
+            double number = strtod(cur, &next);
+            if (next == cur) {
+                break;
+            }
+            row.push_back(number);
+            cur = next;
+        }
+        if (row.size() == dim) {
+            values.insert(values.end(), row.begin(), row.end());
+        } else if (!row.empty()) {
+            skipped++;
+        }
+        p = lineEnd + 1;
+    }
+    return skipped;
+}
+
+/**
+ * @Method: readDimension
+ * @Description: 读取第一条非空数据的维度，用于在流水线启动前生成加密矩阵
+ */
+static size_t readDimension(const char* fileString) {
+    ifstream infile(fileString);
+    string line;
+    while (getline(infile, line)) {
+        istringstream iss(line);
+        double number;
+        size_t dim = 0;
+        while (iss >> number) {
+            dim++;
+        }
+        if (dim > 0) {
+            return dim;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @Method: dealDataPipelined
+ * @Description: 以流水线方式读取数据集并加密，各阶段并发执行
+ * @param char* fileString 读取数据集的地址
+ * @param const IngestPipelineConfig& config 流水线配置
+ * @param vector<StageCounters>* counters 返回各阶段统计，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataPipelined(char* fileString, const IngestPipelineConfig& config, vector<StageCounters>* counters) {
+    auto start_time = chrono::high_resolution_clock::now();
+
+    size_t dim = readDimension(fileString);
+    FILE* input = fopen(fileString, "rb");
+    if (dim == 0 || input == NULL) {
+        cerr << "Error opening file" << endl;
+        if (input != NULL) {
+            fclose(input);
+        }
+        return 0;
+    }
+
+    // 旧密文与剪枝重排的行号映射属于旧密钥，无论新密文是否留在内存中都先释放，
+    // 否则只写快照时旧密文会在新密钥下被当作当前数据集扫描
+    {
+        CiphertextWriteGuard guard;
+        vector<VectorXd>().swap(ciphertext);
+        vector<long>().swap(blockIndex.originalIds);
+    }
+
+    // 生成加密矩阵，之后各阶段只读；加密内核使用行主序副本
+    encryptMatrix = generateInvertibleMatrix(dim + 3);
+    keyMode = KEY_DENSE;
+    datasetVersion++;
+    const RowMatrixXd key = encryptMatrix;
+
+    SnapshotWriter snapshot;
+    if (config.snapshotPath != NULL && !snapshot.open(config.snapshotPath, (uint32_t) (dim + 3))) {
+        fclose(input);
+        return 0;
+    }
+
+    const int stageCount = 5;
+    StageStats stats[stageCount];
+    const char* names[stageCount] = {"读取", "解析", "扩展", "加密", "写出"};
+    int threads[stageCount] = {1, stageLimit(config.parserThreads), stageLimit(config.augmentThreads),
+                               stageLimit(config.encryptThreads), 1};
+    const size_t capacity = max((size_t) 1, config.queueCapacity);
+    const size_t maxInFlight = pipelineInFlightChunks(config);
+    atomic<uint64_t> skippedRows(0);
+    bool writeFailed = false;
+
+    // 各处理阶段的输入队列按块序号排列，先处理序号小的块；写出阶段只处理序号为 nextWrite 的块
+    map<uint64_t, shared_ptr<PipelineChunk>> queues[PROCESS_STAGES];
+    int running[PROCESS_STAGES] = {0, 0, 0, 0};
+    uint64_t nextWrite = 0;
+    mutex mtx;
+    condition_variable progress;
+    TaskGroup group(TASK_BULK, config.cancel);
+
+    // 每块的 r11 来自以块序号区分的随机数引擎，扩展阶段可以并发
+    random_device rd;
+    const uint64_t seedBase = ((uint64_t) rd() << 32) | rd();
+    auto work = [&, dim](int stage, PipelineChunk& chunk) {
+        if (stage == 0) {
+            stats[1].bytes += chunk.bytes.size();
+            chunk.bytes.push_back('\0');
+            chunk.values.reserve(chunk.bytes.size() / 8);
+            skippedRows += parseChunk(chunk.bytes, dim, chunk.values);
+            string().swap(chunk.bytes);
+            chunk.rows = chunk.values.size() / dim;
+        } else if (stage == 1) {
+            mt19937 generator((uint32_t) (seedBase ^ (chunk.seq * 0x9e3779b97f4a7c15ULL) ^ (seedBase >> 32)));
+            uniform_real_distribution<double> distribution(1, 100);
+            chunk.t.resize(chunk.rows, dim + 3);
+            for (size_t i = 0; i < chunk.rows; i++) {
+                augmentRecord(&chunk.values[i * dim], dim, distribution(generator), chunk.t.row(i).data());
+            }
+            vector<double>().swap(chunk.values);
+        } else if (stage == 2) {
+            // 整块交给SIMD加密内核，第i行为 (encryptMatrix^T * t_i)^T
+            chunk.c.resize(chunk.rows, key.cols());
+            simdKernels().encryptRows(chunk.t.data(), chunk.rows, key.cols(), key.data(), chunk.c.data());
+            chunk.t.resize(0, 0);
+        } else {
+            // 写出阶段同一时刻只有一个任务，按块序号写快照并保存到内存
+            const RowMatrixXd& c = chunk.c;
+            if (config.snapshotPath != NULL && !writeFailed && !snapshot.append(c.data(), c.rows())) {
+                writeFailed = true;
+            }
+            if (config.keepInMemory) {
+                for (long i = 0; i < c.rows(); i++) {
+                    ciphertext.push_back(c.row(i).transpose());
+                }
+            }
+            stats[4].bytes += c.size() * sizeof(double);
+        }
+    };
+
+    // 在持有 mtx 时调用：从下游到上游，为有空闲并发且下游队列未满的阶段开始新的块。
+    // 序号为 nextWrite 的块不受队列容量限制，否则乱序完成的块占满队列时会互相等待
+    function<void(int, shared_ptr<PipelineChunk>)> runStage;
+    function<void()> schedule = [&]() {
+        for (int stage = PROCESS_STAGES - 1; stage >= 0; stage--) {
+            while (!queues[stage].empty() && running[stage] < threads[stage + 1]) {
+                auto first = queues[stage].begin();
+                bool head = first->first == nextWrite;
+                if (stage == PROCESS_STAGES - 1 ? !head
+                                                : !head && queues[stage + 1].size() + running[stage] >= capacity) {
+                    break;
+                }
+                shared_ptr<PipelineChunk> chunk = first->second;
+                queues[stage].erase(first);
+                running[stage]++;
+                group.run([&runStage, stage, chunk]() { runStage(stage, chunk); });
+            }
+        }
+    };
+    runStage = [&](int stage, shared_ptr<PipelineChunk> chunk) {
+        StageStats& stat = stats[stage + 1];
+        stat.waitNanos += elapsedNanos(chunk->queued);
+        PipelineClock::time_point busyStart = PipelineClock::now();
+        work(stage, *chunk);
+        stat.busyNanos += elapsedNanos(busyStart);
+        stat.chunks++;
+        stat.rows += chunk->rows;
+        lock_guard<mutex> lock(mtx);
+        running[stage]--;
+        if (stage + 1 < PROCESS_STAGES) {
+            chunk->queued = PipelineClock::now();
+            queues[stage + 1][chunk->seq] = chunk;
+        } else {
+            nextWrite++;
+        }
+        schedule();
+        progress.notify_all();
+    };
+
+    // 读取阶段：调用线程按 chunkBytes 顺序读取，并在最后一个换行处切分；
+    // 在途的块达到上限或解析队列已满时先帮忙执行批量任务（背压）
+    auto waitUntil = [&](const function<bool()>& ready) {
+        PipelineClock::time_point waitStart = PipelineClock::now();
+        while (!config.cancel.cancelled()) {
+            {
+                lock_guard<mutex> lock(mtx);
+                if (ready()) {
+                    break;
+                }
+            }
+            if (!taskRuntime().runPending(TASK_BULK)) {
+                unique_lock<mutex> lock(mtx);
+                progress.wait_for(lock, chrono::milliseconds(1), ready);
+            }
+        }
+        stats[0].waitNanos += elapsedNanos(waitStart);
+    };
+    string carry;
+    vector<char> buffer(config.chunkBytes);
+    uint64_t seq = 0;
+    bool more = true;
+    while (more && !config.cancel.cancelled()) {
+        waitUntil([&]() { return seq - nextWrite < maxInFlight && queues[0].size() < capacity; });
+        if (config.cancel.cancelled()) {
+            break;
+        }
+        PipelineClock::time_point busyStart = PipelineClock::now();
+        size_t n = fread(buffer.data(), 1, buffer.size(), input);
+        shared_ptr<PipelineChunk> chunk(new PipelineChunk());
+        chunk->seq = seq;
+        chunk->bytes.swap(carry);
+        chunk->bytes.append(buffer.data(), n);
+        if (n == buffer.size()) {
+            size_t cut = chunk->bytes.rfind('\n');
+            if (cut != string::npos) {
+                carry.assign(chunk->bytes, cut + 1, string::npos);
+                chunk->bytes.resize(cut + 1);
+            }
+        } else {
+            more = false;
+        }
+        stats[0].busyNanos += elapsedNanos(busyStart);
+        if (!chunk->bytes.empty()) {
+            stats[0].chunks++;
+            stats[0].bytes += chunk->bytes.size();
+            chunk->queued = PipelineClock::now();
+            lock_guard<mutex> lock(mtx);
+            queues[0][seq++] = chunk;
+            schedule();
+        }
+    }
+    waitUntil([&]() { return nextWrite == seq; });
+    // 取消后未开始的块被跳过
+    bool cancelled = !group.wait();
+    fclose(input);
+    if (config.snapshotPath != NULL && !snapshot.close()) {
+        writeFailed = true;
+    }
+
+    auto end_time = chrono::high_resolution_clock::now();
+    chrono::duration<double, milli> total_duration = end_time - start_time;
+
+    stats[0].rows = stats[1].rows.load();
+    for (int s = 0; s < stageCount; s++) {
+        double busy = stats[s].busyNanos / 1e6;
+        printf("%s阶段：线程 %d，块 %llu，行 %llu，忙碌 %f 毫秒，等待 %f 毫秒，%f 行/秒\n", names[s], threads[s],
+               (unsigned long long) stats[s].chunks.load(), (unsigned long long) stats[s].rows.load(), busy,
+               stats[s].waitNanos / 1e6, busy > 0 ? stats[s].rows * 1000.0 / (busy / threads[s]) : 0.0);
+        if (counters != NULL) {
+            StageCounters c;
+            c.name = names[s];
+            c.threads = threads[s];
+            c.chunks = stats[s].chunks;
+            c.rows = stats[s].rows;
+            c.bytes = stats[s].bytes;
+            c.busyMillis = busy;
+            c.waitMillis = stats[s].waitNanos / 1e6;
+            counters->push_back(c);
+        }
+    }
+    if (skippedRows > 0) {
+        printf("跳过维度不符的行：%llu\n", (unsigned long long) skippedRows.load());
+    }
+    printf("流水线加密数据的总时间是：%f 毫秒\n", total_duration.count());
+    fflush(stdout);
+    cout << "--------------------------------------------" << endl;
+
+    if (writeFailed) {
+        cerr << "Error writing file " << config.snapshotPath << endl;
+        return 0;
+    }
+    if (cancelled) {
+        cerr << "Ingest of " << fileString << " cancelled" << endl;
+        return 0;
+    }
+    return stats[4].rows > 0 ? 1 : 0;
+}
@@ -0,0 +1,66 @@
+/**
+* @author: WTY
+* @date: 2024/8/17
+* @description: 多阶段流水线数据加密外包：分块读取、解析、扩展、加密、写快照并发执行
+*/
+
+#ifndef INGEST_PIPELINE_H
+#define INGEST_PIPELINE_H
+
+#include "SSQ.h"
+#include "Snapshot.h"
+#include "Task_runtime.h"
+
+/**
+ * 流水线配置。读取在调用线程上进行，解析、扩展、加密与写出各自作为批量任务在任务运行时上执行，
+ * 每个阶段同时执行的任务数不超过该阶段的线程数；阶段之间是容量为 queueCapacity 的有界队列，
+ * 下游跟不上时上游不再开始新的块（背压），内存占用约为 (pipelineInFlightChunks × chunkBytes) 的常数倍。
+ */
+struct IngestPipelineConfig {
+    size_t chunkBytes;          // 读取阶段每块的字节数（按行边界对齐）
+    size_t queueCapacity;       // 每个阶段间队列可容纳的块数
+    int parserThreads;          // 同时解析的块数，0 表示任务运行时的线程数
+    int augmentThreads;         // 同时扩展(加随机掩码)的块数，0 表示任务运行时的线程数
+    int encryptThreads;         // 同时加密(GEMM)的块数，0 表示任务运行时的线程数
+    const char* snapshotPath;   // 快照输出文件，为 NULL 时不写快照
+    bool keepInMemory;          // 是否同时保存到全局密文数据集 ciphertext；为 false 时导入后 ciphertext 为空
+    CancellationToken cancel;   // 取消后停止读取与开始新的块，返回失败
+
+    IngestPipelineConfig()
+            : chunkBytes(4 << 20), queueCapacity(4), parserThreads(2), augmentThreads(1), encryptThreads(2),
+              snapshotPath(NULL), keepInMemory(true) {
+    }
+};
+
+/**
+ * @Method: pipelineInFlightChunks
+ * @Description: 流水线中同时存在的块数上限
+ */
+size_t pipelineInFlightChunks(const IngestPipelineConfig& config);
+
+/**
+ * 每个阶段的吞吐统计
+ */
+struct StageCounters {
+    const char* name;
+    int threads;
+    uint64_t chunks;        // 处理的块数
+    uint64_t rows;          // 处理的行数
+    uint64_t bytes;         // 处理的字节数
+    double busyMillis;      // 所有线程处理数据的时间之和
+    double waitMillis;      // 读取阶段为背压阻塞的时间，其他阶段为块在输入队列中等待的时间之和
+};
+
+/**
+ * @Method: dealDataPipelined
+ * @Description: 以流水线方式读取数据集并加密，各阶段并发执行
+ * @param char* fileString 读取数据集的地址
+ * @param const IngestPipelineConfig& config 流水线配置
+ * @param vector<StageCounters>* counters 返回各阶段统计，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataPipelined(char* fileString, const IngestPipelineConfig& config,
+                      vector<StageCounters>* counters = NULL);
+
+
+#endif //INGEST_PIPELINE_H
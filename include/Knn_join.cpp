@@ -0,0 +1,230 @@
+/**
+* @author: WTY
+* @date: 2024/8/28
+* @description: 两个外包数据集之间的加密 k 近邻连接：A 的全部查询一次加密，服务器分块矩阵乘法并在块内直接选top-k
+*/
+
+#include "Knn_join.h"
+#include "Block_index.h"
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// 结果文件中每条近邻的布局
+struct JoinEntry {
+    int64_t id;
+    double distance;
+};
+
+struct JoinFileHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t queries;
+    uint32_t k;
+};
+
+static bool pwriteFully(int fd, const void* buffer, size_t bytes, off_t offset) {
+    const char* p = (const char*) buffer;
+    while (bytes > 0) {
+        ssize_t n = pwrite(fd, p, bytes, offset);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * @Method: encryptQueries
+ * @Description: 数据拥有者为 A 的每一行生成随机数并扩展，再用一次矩阵乘法全部加密；每行需为 d 个值（readDataFromFile 已校验）
+ * @param const vector<vector<double>>& points A 的明文数据
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @return MatrixXd (d+3)×|A|，第 i 列为 A 第 i 行的加密查询向量
+ */
+MatrixXd encryptQueries(const vector<vector<double>>& points, const MatrixXd& encryptMatrixInverse) {
+    const long dim = encryptMatrixInverse.rows();
+    MatrixXd augmented(dim, points.size());
+    random_device rd;
+    mt19937 generator(rd());
+    uniform_real_distribution<double> distribution(1, 100);
+    for (size_t i = 0; i < points.size(); i++) {
+        // 与 augmentQuery 相同：r21 * [1, p, r22, r22]，每个查询独立的 r21、r22
+        double r21 = distribution(generator), r22 = distribution(generator);
+        augmented(0, i) = r21;
+        for (long j = 0; j < dim - 3; j++) {
+            augmented(j + 1, i) = points[i][j] * r21;
+        }
+        augmented(dim - 2, i) = r21 * r22;
+        augmented(dim - 1, i) = r21 * r22;
+    }
+    return encryptMatrixInverse * augmented;
+}
+
+/**
+ * @Method: knnJoin
+ * @Description: 服务器将当前密文数据集 B 与全部加密查询分块相乘，每块结果直接进入各查询的top-k堆，
+ *               |A|×|B| 的分数矩阵不会生成；每个查询块完成后立即写入结果文件，行号为 originalRowId
+ * @param const MatrixXd& queries encryptQueries 得到的加密查询矩阵
+ * @param int k 每个查询返回的结果数
+ * @param const char* resultFilePath 连接结果文件
+ * @param const JoinConfig& config 连接配置
+ * @param JoinStats* stats 返回统计，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int knnJoin(const MatrixXd& queries, int k, const char* resultFilePath, const JoinConfig& config, JoinStats* stats) {
+    typedef chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+    // 连接期间 B 不能被追加或替换，行号映射也需与扫描的密文一致
+    CiphertextReadGuard guard;
+    const long n = (long) ciphertext.size();
+    const long m = queries.cols();
+    const long dim = queries.rows();
+    if (k <= 0 || (n > 0 && ciphertext[0].size() != dim)) {
+        return 0;
+    }
+
+    int fd = open(resultFilePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Unable to open file " << resultFilePath << endl;
+        return 0;
+    }
+    JoinFileHeader header;
+    memcpy(header.magic, JOIN_MAGIC, sizeof(header.magic));
+    header.version = JOIN_VERSION;
+    header.queries = (uint32_t) m;
+    header.k = (uint32_t) k;
+    const size_t groupBytes = (size_t) k * sizeof(JoinEntry);
+    if (!pwriteFully(fd, &header, sizeof(header), 0) ||
+        ftruncate(fd, (off_t) (sizeof(header) + groupBytes * m)) != 0) {
+        cerr << "Unable to write file " << resultFilePath << endl;
+        close(fd);
+        return 0;
+    }
+
+    long tileRows = max(1L, config.tileRows);
+    long tileQueries = max(1L, config.tileQueries);
+    int threads = config.threads > 0 ? config.threads : taskRuntime().threads();
+    // 每个线程的临时空间为 B 块、分数块以及一个查询块的堆与结果；超出内存预算时依次缩小查询块、B 块与线程数
+    const size_t headroom = memoryAccountant.headroom();
+    size_t scratchBytes;
+    while (true) {
+        long active = max(1L, min((long) threads, (m + tileQueries - 1) / tileQueries));
+        scratchBytes = active * ((tileRows * dim + tileRows * tileQueries) * sizeof(double) +
+                                 tileQueries * k * (sizeof(pair<double, long>) + sizeof(JoinEntry)));
+        if (scratchBytes <= headroom) {
+            break;
+        }
+        if (tileQueries > 1) {
+            tileQueries = (tileQueries + 1) / 2;
+        } else if (tileRows > 64) {
+            tileRows /= 2;
+        } else if (threads > 1) {
+            threads--;
+        } else {
+            break;
+        }
+    }
+    ScopedMemoryCharge scratch(MEM_QUERY_SCRATCH, scratchBytes);
+    const long queryTiles = (m + tileQueries - 1) / tileQueries;
+    threads = (int) max(1L, min((long) threads, queryTiles));
+
+    atomic<long> tiles(0);
+    atomic<bool> failed(false);
+    vector<double> gemmMillis(threads, 0), selectMillis(threads, 0);
+    vector<RowMatrixXd> blocks(threads, RowMatrixXd(tileRows, dim));
+    vector<MatrixXd> tileScores(threads, MatrixXd(tileRows, tileQueries));
+    vector<vector<JoinEntry>> tileEntries(threads);
+    // 每个查询块是一个批量任务，对整个 B 扫描一遍；块之间工作线程可以先执行查询任务
+    auto work = [&](long qt, int t) {
+        RowMatrixXd& block = blocks[t];
+        MatrixXd& scores = tileScores[t];
+        vector<JoinEntry>& entries = tileEntries[t];
+        if (!failed) {
+            long q0 = qt * tileQueries, qn = min(tileQueries, m - q0);
+            vector<TopKHeap> heaps(qn, TopKHeap(k));
+            // 块内直接更新各查询的堆，分数只在块内存在
+            scanTilesTopK(queries.middleCols(q0, qn), 0, n, block, scores, heaps.data(), &gemmMillis[t],
+                          &selectMillis[t]);
+            tiles += (n + tileRows - 1) / tileRows;
+
+            // 查询块完成后按固定偏移写出，距离从小到大
+            entries.assign(qn * k, JoinEntry());
+            for (long j = 0; j < qn; j++) {
+                vector<pair<double, long>> winners = heaps[j].extractDescending();
+                for (int e = 0; e < k; e++) {
+                    JoinEntry& entry = entries[j * k + e];
+                    if (e < (int) winners.size()) {
+                        // 与 outputResults 一致，密文被剪枝索引重排过时写出原数据集的行号
+                        entry.id = originalRowId(winners[winners.size() - 1 - e].second);
+                        entry.distance = winners[winners.size() - 1 - e].first;
+                    } else {
+                        entry.id = -1;
+                        entry.distance = 0;
+                    }
+                }
+            }
+            if (!pwriteFully(fd, entries.data(), entries.size() * sizeof(JoinEntry),
+                             (off_t) (sizeof(header) + groupBytes * q0))) {
+                failed = true;
+            }
+        }
+    };
+    bool completed = parallelChunks(TASK_BULK, threads, queryTiles, work, config.cancel);
+    if (close(fd) != 0 || failed) {
+        cerr << "Unable to write file " << resultFilePath << endl;
+        return 0;
+    }
+    if (!completed) {
+        cerr << "Join cancelled, " << resultFilePath << " is incomplete" << endl;
+        return 0;
+    }
+
+    if (stats != NULL) {
+        stats->tiles = tiles;
+        stats->gemmMillis = 0;
+        stats->selectMillis = 0;
+        for (int t = 0; t < threads; t++) {
+            stats->gemmMillis += gemmMillis[t];
+            stats->selectMillis += selectMillis[t];
+        }
+        stats->totalMillis = chrono::duration<double, milli>(Clock::now() - start).count();
+    }
+    return 1;
+}
+
+/**
+ * @Method: SSQJoin
+ * @Description: 读取数据集 A，对当前密文数据集 B 做 k 近邻连接
+ * @param char* fileString 数据集 A 的地址
+ * @param int k 每行返回的近邻数
+ * @param char* resultFilePath 连接结果文件
+ * @param const JoinConfig& config 连接配置
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQJoin(char* fileString, int k, char* resultFilePath, const JoinConfig& config) {
+    vector<vector<double>> points = readDataFromFile(fileString);
+    if (points.empty() || ciphertext.empty() || !denseKeyReady(points[0].size())) {
+        return 0;
+    }
+
+    // 整个连接只求一次逆矩阵
+    auto start_time = chrono::high_resolution_clock::now();
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    MatrixXd queries = encryptQueries(points, encryptMatrixInverse);
+    chrono::duration<double, milli> encrypt_duration = chrono::high_resolution_clock::now() - start_time;
+
+    JoinStats stats;
+    if (!knnJoin(queries, k, resultFilePath, config, &stats)) {
+        return 0;
+    }
+    double flops = 2.0 * queries.rows() * queries.cols() * (double) ciphertext.size();
+    printf("k近邻连接：|A|=%ld，|B|=%zu，加密查询 %f 毫秒，连接 %f 毫秒（矩阵乘法 %f，选择 %f），%.2f GFLOP/s\n",
+           (long) queries.cols(), ciphertext.size(), encrypt_duration.count(), stats.totalMillis, stats.gemmMillis,
+           stats.selectMillis, flops / stats.totalMillis / 1e6);
+    fflush(stdout);
+    return 1;
+}
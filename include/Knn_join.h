@@ -0,0 +1,83 @@
+/**
+* @author: WTY
+* @date: 2024/8/28
+* @description: 两个外包数据集之间的加密 k 近邻连接：A 的全部查询一次加密，服务器分块矩阵乘法并在块内直接选top-k
+*/
+
+#ifndef KNN_JOIN_H
+#define KNN_JOIN_H
+
+#include "SSQ.h"
+#include "Task_runtime.h"
+
+/*
+ * 连接结果文件布局（小端）：
+ *   char     magic[4]   "SSQJ"
+ *   uint32_t version    1
+ *   uint32_t queries    A 的行数
+ *   uint32_t k
+ *   queries × k × { int64_t id; double distance; }   第 i 组为 A 第 i 行在 B 中的近邻，距离从小到大
+ * B 不足 k 行时用 id = -1 补齐。每组定长，工作线程按组的偏移直接写入文件。
+ */
+const char JOIN_MAGIC[4] = {'S', 'S', 'Q', 'J'};
+const uint32_t JOIN_VERSION = 1;
+
+/**
+ * 连接配置
+ */
+struct JoinConfig {
+    int threads;            // 在任务运行时上最多同时处理的查询块数，0 表示线程池的线程数
+    long tileRows;          // 每块 B 的密文行数
+    long tileQueries;       // 每块 A 的查询数，同一块 B 与这些查询做一次矩阵乘法
+    CancellationToken cancel;   // 取消后不再开始新的查询块，knnJoin 返回失败
+
+    JoinConfig() : threads(0), tileRows(512), tileQueries(64) {
+    }
+};
+
+/**
+ * 连接统计
+ */
+struct JoinStats {
+    long tiles;             // 计算的 (B块, 查询块) 数
+    double gemmMillis;      // 各线程矩阵乘法时间之和
+    double selectMillis;    // 各线程块内选择top-k时间之和
+    double totalMillis;
+};
+
+/**
+ * @Method: encryptQueries
+ * @Description: 数据拥有者为 A 的每一行生成随机数并扩展，再用一次矩阵乘法全部加密；每行需为 d 个值（readDataFromFile 已校验）
+ * @param const vector<vector<double>>& points A 的明文数据
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @return MatrixXd (d+3)×|A|，第 i 列为 A 第 i 行的加密查询向量
+ */
+MatrixXd encryptQueries(const vector<vector<double>>& points, const MatrixXd& encryptMatrixInverse);
+
+/**
+ * @Method: knnJoin
+ * @Description: 服务器将当前密文数据集 B 与全部加密查询分块相乘，每块结果直接进入各查询的top-k堆，
+ *               |A|×|B| 的分数矩阵不会生成；每个查询块完成后立即写入结果文件，行号为 originalRowId
+ * @param const MatrixXd& queries encryptQueries 得到的加密查询矩阵
+ * @param int k 每个查询返回的结果数
+ * @param const char* resultFilePath 连接结果文件
+ * @param const JoinConfig& config 连接配置
+ * @param JoinStats* stats 返回统计，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int knnJoin(const MatrixXd& queries, int k, const char* resultFilePath, const JoinConfig& config = JoinConfig(),
+            JoinStats* stats = NULL);
+
+/**
+ * @Method: SSQJoin
+ * @Description: 读取数据集 A，对当前密文数据集 B 做 k 近邻连接
+ * @param char* fileString 数据集 A 的地址
+ * @param int k 每行返回的近邻数
+ * @param char* resultFilePath 连接结果文件
+ * @param const JoinConfig& config 连接配置
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQJoin(char* fileString, int k, char* resultFilePath, const JoinConfig& config = JoinConfig());
+
+
+#endif //KNN_JOIN_H
@@ -19,6 +19,9 @@ using namespace std;
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 
+// 行主序矩阵，每行一条记录，便于整块写入文件或逐行扫描
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMatrixXd;
+
 
 /**
  * @Method: generateInvertibleMatrix
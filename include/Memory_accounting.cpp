@@ -0,0 +1,410 @@
+/**
+* @author: WTY
+* @date: 2024/9/1
+* @description: 内存记账与预算：按组件统计当前与峰值字节数，超出预算时改用流式导入、外存扫描或更小的批
+*/
+
+#include "Memory_accounting.h"
+#include "SSQ.h"
+#include "Block_index.h"
+#include "Proximity_graph.h"
+#include "Attribute_index.h"
+#include "Numa.h"
+#include "Query_cache.h"
+#include "Ingest_pipeline.h"
+#include "Out_of_core.h"
+#include "Dim_reduction.h"
+#include "Dataset_registry.h"
+#include <climits>
+#include <cstring>
+#include <sys/stat.h>
+
+MemoryAccountant memoryAccountant;
+
+// 每次堆分配的估计开销（glibc malloc 的块头与16字节对齐）
+static const size_t MALLOC_OVERHEAD = 16;
+
+// 流式导入的最小块
+static const size_t MIN_CHUNK_BYTES = 64 << 10;
+
+const char* memoryComponentName(int component) {
+    static const char* names[MEM_COMPONENT_COUNT] = {"plaintext", "ciphertext", "index", "query scratch", "result"};
+    return component >= 0 && component < MEM_COMPONENT_COUNT ? names[component] : "unknown";
+}
+
+MemoryAccountant::MemoryAccountant() : totalBytes(0), totalPeakBytes(0), budgetBytes(0) {
+    for (int i = 0; i < MEM_COMPONENT_COUNT; i++) {
+        currentBytes[i] = 0;
+        peakBytes[i] = 0;
+    }
+}
+
+static void raisePeak(atomic<int64_t>& peak, int64_t value) {
+    int64_t seen = peak.load(memory_order_relaxed);
+    while (value > seen && !peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+    }
+}
+
+void MemoryAccountant::add(int component, int64_t delta) {
+    int64_t value = currentBytes[component].fetch_add(delta, memory_order_relaxed) + delta;
+    int64_t total = totalBytes.fetch_add(delta, memory_order_relaxed) + delta;
+    if (delta > 0) {
+        raisePeak(peakBytes[component], value);
+        raisePeak(totalPeakBytes, total);
+    }
+}
+
+void MemoryAccountant::charge(int component, size_t bytes) {
+    add(component, (int64_t) bytes);
+}
+
+bool MemoryAccountant::tryCharge(int component, size_t bytes) {
+    size_t limit = budgetBytes.load(memory_order_relaxed);
+    if (limit == 0) {
+        charge(component, bytes);
+        return true;
+    }
+    // 先比较再记账，与其他线程竞争时用 CAS 保证总量不越过预算
+    int64_t total = totalBytes.load(memory_order_relaxed);
+    do {
+        if (total + (int64_t) bytes > (int64_t) limit) {
+            return false;
+        }
+    } while (!totalBytes.compare_exchange_weak(total, total + (int64_t) bytes, memory_order_relaxed));
+    int64_t value = currentBytes[component].fetch_add((int64_t) bytes, memory_order_relaxed) + (int64_t) bytes;
+    raisePeak(peakBytes[component], value);
+    raisePeak(totalPeakBytes, total + (int64_t) bytes);
+    return true;
+}
+
+void MemoryAccountant::release(int component, size_t bytes) {
+    add(component, -(int64_t) bytes);
+}
+
+void MemoryAccountant::set(int component, size_t bytes) {
+    int64_t previous = currentBytes[component].load(memory_order_relaxed);
+    add(component, (int64_t) bytes - previous);
+}
+
+size_t MemoryAccountant::current(int component) const {
+    return (size_t) max((int64_t) 0, currentBytes[component].load(memory_order_relaxed));
+}
+
+size_t MemoryAccountant::peak(int component) const {
+    return (size_t) peakBytes[component].load(memory_order_relaxed);
+}
+
+size_t MemoryAccountant::totalCurrent() const {
+    return (size_t) max((int64_t) 0, totalBytes.load(memory_order_relaxed));
+}
+
+size_t MemoryAccountant::totalPeak() const {
+    return (size_t) totalPeakBytes.load(memory_order_relaxed);
+}
+
+void MemoryAccountant::setBudget(size_t bytes) {
+    budgetBytes = bytes;
+}
+
+size_t MemoryAccountant::budget() const {
+    return budgetBytes.load(memory_order_relaxed);
+}
+
+size_t MemoryAccountant::headroom() const {
+    size_t limit = budget();
+    if (limit == 0) {
+        return SIZE_MAX;
+    }
+    size_t used = totalCurrent();
+    return used < limit ? limit - used : 0;
+}
+
+void MemoryAccountant::resetPeaks() {
+    for (int i = 0; i < MEM_COMPONENT_COUNT; i++) {
+        peakBytes[i] = currentBytes[i].load(memory_order_relaxed);
+    }
+    totalPeakBytes = totalBytes.load(memory_order_relaxed);
+}
+
+ScopedScratchCharge::ScopedScratchCharge(int component, size_t baseBytes, size_t unitBytes, size_t wanted)
+        : component(component), bytes(0), count(max((size_t) 1, wanted)) {
+    // 先按剩余空间估计能放下的份数，再用 tryCharge 记账，与其他线程竞争失败时继续减半
+    size_t room = memoryAccountant.headroom();
+    if (room != SIZE_MAX && unitBytes > 0) {
+        count = max((size_t) 1, min(count, room > baseBytes ? (room - baseBytes) / unitBytes : 0));
+    }
+    while (count > 1 && !memoryAccountant.tryCharge(component, baseBytes + unitBytes * count)) {
+        count /= 2;
+    }
+    bytes = baseBytes + unitBytes * count;
+    if (count == 1 && !memoryAccountant.tryCharge(component, bytes)) {
+        memoryAccountant.charge(component, bytes);
+    }
+}
+
+ScopedScratchCharge::~ScopedScratchCharge() {
+    memoryAccountant.release(component, bytes);
+}
+
+static size_t heapBlockBytes(size_t bytes) {
+    return ((bytes + 15) & ~(size_t) 15) + MALLOC_OVERHEAD;
+}
+
+/**
+ * @Method: estimatePlaintextBytes
+ * @Description: vector<vector<double>> 保存 rows 行 dim 维明文的估计字节数（含每行的对象与分配开销）
+ */
+size_t estimatePlaintextBytes(size_t rows, size_t dim) {
+    return rows * (sizeof(vector<double>) + heapBlockBytes(dim * sizeof(double)));
+}
+
+/**
+ * @Method: estimateCiphertextBytes
+ * @Description: vector<VectorXd> 保存 rows 行 dim 维密文的估计字节数（含每行的对象与分配开销）
+ */
+size_t estimateCiphertextBytes(size_t rows, size_t dim) {
+    return rows * (sizeof(VectorXd) + heapBlockBytes(dim * sizeof(double)));
+}
+
+/**
+ * @Method: refreshMemoryAccounting
+ * @Description: 按当前大小重新测量密文数据集、各索引与查询缓存
+ */
+void refreshMemoryAccounting() {
+    size_t cipher = estimateCiphertextBytes(ciphertext.size(), ciphertext.empty() ? 0 : ciphertext[0].size());
+    for (size_t i = 0; i < numaCiphertext.size(); i++) {
+        cipher += (size_t) numaCiphertext[i].rows.size() * sizeof(double);
+    }
+    cipher += (size_t) dimReduction.reducedCiphertext.size() * sizeof(double);
+    cipher += datasetRegistry.stats().residentBytes;
+    memoryAccountant.set(MEM_CIPHERTEXT, cipher);
+
+    size_t index = blockIndex.originalIds.size() * sizeof(long);
+    for (size_t b = 0; b < blockIndex.blocks.size(); b++) {
+        index += sizeof(CiphertextBlock) + heapBlockBytes(blockIndex.blocks[b].center.size() * sizeof(double));
+    }
+    index += proximityGraph.memoryBytes();
+    for (unordered_map<string, RowBitmap>::const_iterator it = attributeIndex.bitmaps.begin();
+         it != attributeIndex.bitmaps.end(); ++it) {
+        index += it->first.size() + it->second.memoryBytes();
+    }
+    memoryAccountant.set(MEM_INDEX, index);
+
+    // 结果缓冲由 BufferedWriter 的分配器记账，这里加上查询缓存
+    static atomic<size_t> cached(0);
+    size_t now = queryCache.stats().bytes;
+    memoryAccountant.charge(MEM_RESULT, now);
+    memoryAccountant.release(MEM_RESULT, cached.exchange(now));
+}
+
+/**
+ * @Method: printMemoryReport
+ * @Description: 输出各组件的当前与峰值字节数以及预算
+ */
+void printMemoryReport() {
+    refreshMemoryAccounting();
+    const double mb = 1024.0 * 1024.0;
+    printf("%-14s %14s %14s\n", "component", "current(MB)", "peak(MB)");
+    for (int i = 0; i < MEM_COMPONENT_COUNT; i++) {
+        printf("%-14s %14.2f %14.2f\n", memoryComponentName(i), memoryAccountant.current(i) / mb,
+               memoryAccountant.peak(i) / mb);
+    }
+    printf("%-14s %14.2f %14.2f\n", "total", memoryAccountant.totalCurrent() / mb, memoryAccountant.totalPeak() / mb);
+    if (memoryAccountant.budget() > 0) {
+        printf("预算 %.2f MB，剩余 %.2f MB\n", memoryAccountant.budget() / mb, memoryAccountant.headroom() / mb);
+    } else {
+        printf("未设置预算\n");
+    }
+    fflush(stdout);
+}
+
+/**
+ * @Method: countTextRows
+ * @Description: 统计文本文件的行数（不解析内容）
+ */
+static size_t countTextRows(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    vector<char> buffer(1 << 20);
+    size_t rows = 0, n;
+    char last = '\n';
+    while ((n = fread(buffer.data(), 1, buffer.size(), file)) > 0) {
+        for (const char* p = buffer.data(); (p = (const char*) memchr(p, '\n', buffer.data() + n - p)) != NULL; p++) {
+            rows++;
+        }
+        last = buffer[n - 1];
+    }
+    fclose(file);
+    return rows + (last != '\n' ? 1 : 0);
+}
+
+static size_t pipelineBytes(size_t chunkBytes, size_t queueCapacity) {
+    // 文本块解析为 double 后体积相近，处理中的块同时持有扩展与加密两份，按两倍估计
+    IngestPipelineConfig config;
+    config.chunkBytes = chunkBytes;
+    config.queueCapacity = queueCapacity;
+    return pipelineInFlightChunks(config) * chunkBytes * 2;
+}
+
+/**
+ * @Method: planIngest
+ * @Description: 根据数据集大小与当前预算选择导入方式
+ * @param char* fileString 数据集地址
+ * @param IngestPlan& plan 返回的方案
+ * @return 状态码，1：成功；0：失败
+ */
+int planIngest(char* fileString, IngestPlan& plan) {
+    memset(&plan, 0, sizeof(plan));
+    struct stat info;
+    if (stat(fileString, &info) != 0) {
+        cerr << "Unable to open file " << fileString << endl;
+        return 0;
+    }
+    if (isVecsFile(fileString)) {
+        // 只读第一行得到维度，行数由文件大小算出
+        vector<vector<double>> first = readVecsFile(fileString, 1);
+        if (first.empty()) {
+            return 0;
+        }
+        plan.dim = first[0].size();
+        size_t element = string(fileString).rfind(".bvecs") != string::npos ? 1 : sizeof(float);
+        plan.rows = (size_t) info.st_size / (sizeof(int32_t) + plan.dim * element);
+        if (vecsRowLimit > 0) {
+            plan.rows = min(plan.rows, (size_t) vecsRowLimit);
+        }
+    } else {
+        vector<double> first;
+        ifstream infile(fileString);
+        string line;
+        while (first.empty() && getline(infile, line)) {
+            istringstream iss(line);
+            double number;
+            while (iss >> number) {
+                first.push_back(number);
+            }
+        }
+        if (first.empty()) {
+            return 0;
+        }
+        plan.dim = first.size();
+        plan.rows = countTextRows(fileString);
+    }
+    plan.plaintextBytes = estimatePlaintextBytes(plan.rows, plan.dim);
+    plan.ciphertextBytes = estimateCiphertextBytes(plan.rows, plan.dim + 3);
+
+    // 导入会替换现有的密文，它占用的空间也可以使用
+    refreshMemoryAccounting();
+    size_t headroom = memoryAccountant.headroom();
+    size_t available = headroom == SIZE_MAX ? SIZE_MAX : headroom + memoryAccountant.current(MEM_CIPHERTEXT);
+
+    plan.chunkBytes = IngestPipelineConfig().chunkBytes;
+    plan.queueCapacity = IngestPipelineConfig().queueCapacity;
+    if (available == SIZE_MAX || plan.plaintextBytes + plan.ciphertextBytes <= available) {
+        plan.strategy = INGEST_IN_MEMORY;
+        return 1;
+    }
+
+    // 缩小块与队列，直到流水线缓冲放进密文之外的空间
+    plan.strategy = plan.ciphertextBytes < available ? INGEST_STREAMING : INGEST_OUT_OF_CORE;
+    size_t rest = plan.strategy == INGEST_STREAMING ? available - plan.ciphertextBytes : available;
+    while (pipelineBytes(plan.chunkBytes, plan.queueCapacity) > rest) {
+        if (plan.queueCapacity > 1) {
+            plan.queueCapacity--;
+        } else if (plan.chunkBytes > MIN_CHUNK_BYTES) {
+            plan.chunkBytes /= 2;
+        } else if (plan.strategy == INGEST_STREAMING) {
+            // 密文放得下但流水线缓冲放不下，改为只写快照
+            plan.strategy = INGEST_OUT_OF_CORE;
+            plan.chunkBytes = IngestPipelineConfig().chunkBytes;
+            plan.queueCapacity = IngestPipelineConfig().queueCapacity;
+            rest = available;
+        } else {
+            break;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @Method: dealDataBudgeted
+ * @Description: 在 memoryAccountant 的预算内导入数据集，必要时改用流式导入或只写快照
+ * @param char* fileString 读取数据集的地址
+ * @param const char* spillPath 密文放不下时写入的快照文件
+ * @param IngestPlan* plan 返回选用的方案，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataBudgeted(char* fileString, const char* spillPath, IngestPlan* plan) {
+    IngestPlan chosen;
+    if (!planIngest(fileString, chosen)) {
+        return 0;
+    }
+    if (plan != NULL) {
+        *plan = chosen;
+    }
+    static const char* names[] = {"整体读入", "流式导入", "只写快照"};
+    const double mb = 1024.0 * 1024.0;
+    printf("内存预算：估计 %zu 行，明文 %.2f MB，密文 %.2f MB，选择%s（块 %.2f MB，队列 %zu）\n", chosen.rows,
+           chosen.plaintextBytes / mb, chosen.ciphertextBytes / mb, names[chosen.strategy], chosen.chunkBytes / mb,
+           chosen.queueCapacity);
+    fflush(stdout);
+
+    int ok;
+    if (chosen.strategy == INGEST_IN_MEMORY) {
+        ok = dealData(fileString);
+    } else if (isVecsFile(fileString)) {
+        // 流水线只解析文本格式
+        cerr << "Dataset " << fileString << " exceeds the memory budget and cannot be streamed" << endl;
+        return 0;
+    } else {
+        IngestPipelineConfig config;
+        config.chunkBytes = chosen.chunkBytes;
+        config.queueCapacity = chosen.queueCapacity;
+        config.keepInMemory = chosen.strategy == INGEST_STREAMING;
+        config.snapshotPath = chosen.strategy == INGEST_OUT_OF_CORE ? spillPath : NULL;
+        if (config.snapshotPath == NULL && !config.keepInMemory) {
+            return 0;
+        }
+        ScopedMemoryCharge buffers(MEM_PLAINTEXT, pipelineBytes(config.chunkBytes, config.queueCapacity));
+        ok = dealDataPipelined(fileString, config);
+    }
+    refreshMemoryAccounting();
+    return ok;
+}
+
+/**
+ * @Method: SSQBudgeted
+ * @Description: 密文在内存中时全量扫描，否则在预算剩余的空间内外存扫描 spillPath
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const char* spillPath dealDataBudgeted 写入的快照文件
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQBudgeted(char* fileString, char* resultFilePath, const char* spillPath, int resultFormat) {
+    if (!ciphertext.empty()) {
+        return SSQ(fileString, resultFilePath, resultFormat);
+    }
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || spillPath == NULL || !denseKeyReady(point.size())) {
+        return 0;
+    }
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    // 扫描缓冲加上结果写出缓冲不超过预算剩余的空间
+    OutOfCoreConfig config;
+    size_t headroom = memoryAccountant.headroom();
+    size_t writerBytes = 1 << 20;
+    headroom = headroom > writerBytes + MIN_CHUNK_BYTES ? headroom - writerBytes : MIN_CHUNK_BYTES;
+    config.memoryBudgetBytes = min(config.memoryBudgetBytes, headroom);
+    ScopedMemoryCharge scratch(MEM_QUERY_SCRATCH, config.memoryBudgetBytes);
+    vector<pair<double, long>> winners = outOfCoreTopK(spillPath, q, k, config);
+    MatrixXd rows;
+    if (winners.empty() || !readSnapshotRows(spillPath, winners, rows)) {
+        return 0;
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
@@ -0,0 +1,253 @@
+/**
+* @author: WTY
+* @date: 2024/9/1
+* @description: 内存记账与预算：按组件统计当前与峰值字节数，超出预算时改用流式导入、外存扫描或更小的批
+*/
+
+#ifndef MEMORY_ACCOUNTING_H
+#define MEMORY_ACCOUNTING_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * 记账的组件
+ */
+enum MemoryComponent {
+    MEM_PLAINTEXT = 0,      // 明文数据与导入缓冲
+    MEM_CIPHERTEXT = 1,     // 密文数据集
+    MEM_INDEX = 2,          // 剪枝索引、近邻图、属性索引
+    MEM_QUERY_SCRATCH = 3,  // 查询时的临时空间
+    MEM_RESULT = 4,         // 结果缓冲与查询缓存
+    MEM_COMPONENT_COUNT = 5
+};
+
+/**
+ * @Method: memoryComponentName
+ * @Description: 组件名称，用于报告
+ */
+const char* memoryComponentName(int component);
+
+/**
+ * @Class: MemoryAccountant
+ * @Description: 各组件的当前与峰值字节数，全部为原子计数，可在任意线程记账。
+ *               charge 无条件记账，tryCharge 只在不超过预算时记账，预算为 0 表示不限
+ */
+class MemoryAccountant {
+public:
+    MemoryAccountant();
+
+    void charge(int component, size_t bytes);
+    bool tryCharge(int component, size_t bytes);
+    void release(int component, size_t bytes);
+
+    /**
+     * @Method: set
+     * @Description: 直接设置组件的当前字节数，用于按大小测量而不经过分配器的结构
+     */
+    void set(int component, size_t bytes);
+
+    size_t current(int component) const;
+    size_t peak(int component) const;
+    size_t totalCurrent() const;
+    size_t totalPeak() const;
+
+    void setBudget(size_t bytes);
+    size_t budget() const;
+
+    /**
+     * @Method: headroom
+     * @Description: 预算内剩余的字节数，不限预算时为 SIZE_MAX
+     */
+    size_t headroom() const;
+
+    void resetPeaks();
+
+private:
+    void add(int component, int64_t delta);
+
+    std::atomic<int64_t> currentBytes[MEM_COMPONENT_COUNT];
+    std::atomic<int64_t> peakBytes[MEM_COMPONENT_COUNT];
+    std::atomic<int64_t> totalBytes;
+    std::atomic<int64_t> totalPeakBytes;
+    std::atomic<size_t> budgetBytes;
+};
+
+// 全局内存记账
+extern MemoryAccountant memoryAccountant;
+
+/**
+ * @Class: TrackedAllocator
+ * @Description: 把分配与释放记到指定组件上的STL分配器
+ */
+template<typename T>
+class TrackedAllocator {
+public:
+    typedef T value_type;
+
+    explicit TrackedAllocator(int component = MEM_QUERY_SCRATCH) : component(component) {
+    }
+
+    template<typename U>
+    TrackedAllocator(const TrackedAllocator<U>& other) : component(other.component) {
+    }
+
+    T* allocate(size_t n) {
+        T* p = std::allocator<T>().allocate(n);
+        memoryAccountant.charge(component, n * sizeof(T));
+        return p;
+    }
+
+    void deallocate(T* p, size_t n) {
+        memoryAccountant.release(component, n * sizeof(T));
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    int component;
+};
+
+template<typename T, typename U>
+bool operator==(const TrackedAllocator<T>& a, const TrackedAllocator<U>& b) {
+    return a.component == b.component;
+}
+
+template<typename T, typename U>
+bool operator!=(const TrackedAllocator<T>& a, const TrackedAllocator<U>& b) {
+    return a.component != b.component;
+}
+
+/**
+ * @Class: ScopedMemoryCharge
+ * @Description: 作用域内记账，析构时释放
+ */
+class ScopedMemoryCharge {
+public:
+    ScopedMemoryCharge(int component, size_t bytes) : component(component), bytes(bytes) {
+        memoryAccountant.charge(component, bytes);
+    }
+
+    ~ScopedMemoryCharge() {
+        memoryAccountant.release(component, bytes);
+    }
+
+    void resize(size_t newBytes) {
+        memoryAccountant.charge(component, newBytes);
+        memoryAccountant.release(component, bytes);
+        bytes = newBytes;
+    }
+
+private:
+    ScopedMemoryCharge(const ScopedMemoryCharge&);
+    ScopedMemoryCharge& operator=(const ScopedMemoryCharge&);
+
+    int component;
+    size_t bytes;
+};
+
+/**
+ * @Class: ScopedScratchCharge
+ * @Description: 为 baseBytes 加上至多 wanted 份、每份 unitBytes 字节的临时空间在预算内记账（tryCharge），
+ *               放不下时减少份数；只剩1份时无条件记账，保证查询总能进行。析构时释放
+ */
+class ScopedScratchCharge {
+public:
+    ScopedScratchCharge(int component, size_t baseBytes, size_t unitBytes, size_t wanted);
+    ~ScopedScratchCharge();
+
+    /**
+     * @Method: units
+     * @Description: 实际记账的份数，调用者按它缩小批或并行度
+     */
+    size_t units() const {
+        return count;
+    }
+
+private:
+    ScopedScratchCharge(const ScopedScratchCharge&);
+    ScopedScratchCharge& operator=(const ScopedScratchCharge&);
+
+    int component;
+    size_t bytes;
+    size_t count;
+};
+
+/**
+ * @Method: estimatePlaintextBytes
+ * @Description: vector<vector<double>> 保存 rows 行 dim 维明文的估计字节数（含每行的对象与分配开销）
+ */
+size_t estimatePlaintextBytes(size_t rows, size_t dim);
+
+/**
+ * @Method: estimateCiphertextBytes
+ * @Description: vector<VectorXd> 保存 rows 行 dim 维密文的估计字节数（含每行的对象与分配开销）
+ */
+size_t estimateCiphertextBytes(size_t rows, size_t dim);
+
+/**
+ * @Method: refreshMemoryAccounting
+ * @Description: 按当前大小重新测量密文数据集、各索引与查询缓存
+ */
+void refreshMemoryAccounting();
+
+/**
+ * @Method: printMemoryReport
+ * @Description: 输出各组件的当前与峰值字节数以及预算
+ */
+void printMemoryReport();
+
+/**
+ * 导入方式
+ */
+enum IngestStrategy {
+    INGEST_IN_MEMORY = 0,   // 明文与密文都放得下：dealData
+    INGEST_STREAMING = 1,   // 只放得下密文：流水线分块导入，明文不整体驻留
+    INGEST_OUT_OF_CORE = 2  // 密文也放不下：流水线只写快照，查询时外存扫描
+};
+
+/**
+ * 按预算选出的导入方案
+ */
+struct IngestPlan {
+    int strategy;               // IngestStrategy
+    size_t rows;                // 估计的行数
+    size_t dim;                 // 明文维度
+    size_t plaintextBytes;      // 整体读入明文的估计字节数
+    size_t ciphertextBytes;     // 密文驻留内存的估计字节数
+    size_t chunkBytes;          // 流式导入每块的字节数
+    size_t queueCapacity;       // 流式导入阶段间队列的容量
+};
+
+/**
+ * @Method: planIngest
+ * @Description: 根据数据集大小与当前预算选择导入方式
+ * @param char* fileString 数据集地址
+ * @param IngestPlan& plan 返回的方案
+ * @return 状态码，1：成功；0：失败
+ */
+int planIngest(char* fileString, IngestPlan& plan);
+
+/**
+ * @Method: dealDataBudgeted
+ * @Description: 在 memoryAccountant 的预算内导入数据集，必要时改用流式导入或只写快照
+ * @param char* fileString 读取数据集的地址
+ * @param const char* spillPath 密文放不下时写入的快照文件
+ * @param IngestPlan* plan 返回选用的方案，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataBudgeted(char* fileString, const char* spillPath, IngestPlan* plan = NULL);
+
+/**
+ * @Method: SSQBudgeted
+ * @Description: 密文在内存中时全量扫描，否则在预算剩余的空间内外存扫描 spillPath
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const char* spillPath dealDataBudgeted 写入的快照文件
+ * @param int resultFormat 结果格式 ResultFormat，默认 RESULT_TEXT（本头文件被 Result_writer.h 包含，这里写作 0）
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQBudgeted(char* fileString, char* resultFilePath, const char* spillPath, int resultFormat = 0);
+
+
+#endif //MEMORY_ACCOUNTING_H
@@ -0,0 +1,297 @@
+/**
+* @author: WTY
+* @date: 2024/8/18
+* @description: NUMA 感知的密文存放与扫描：按节点分区、绑定线程首次写入、本地扫描后跨节点合并
+*/
+
+#include "Numa.h"
+#include "Task_runtime.h"
+#include <functional>
+#include <sstream>
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+// 按NUMA节点分区的密文数据集
+vector<NumaPartition> numaCiphertext;
+
+// 建立分区时的 datasetVersion
+uint64_t numaCiphertextVersion = 0;
+
+// 加密与扫描时每次处理的行数
+static const long NUMA_BLOCK_ROWS = 1024;
+
+/**
+ * @Method: parseCpuList
+ * @Description: 解析 sysfs 的 cpulist 格式，例如 "0-3,8-11"
+ */
+static vector<int> parseCpuList(const string& text) {
+    vector<int> cpus;
+    stringstream ss(text);
+    string range;
+    while (getline(ss, range, ',')) {
+        int first, last;
+        if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+            for (int c = first; c <= last; c++) {
+                cpus.push_back(c);
+            }
+        } else if (sscanf(range.c_str(), "%d", &first) == 1) {
+            cpus.push_back(first);
+        }
+    }
+    return cpus;
+}
+
+/**
+ * @Method: detectNumaTopology
+ * @Description: 读取 /sys/devices/system/node 检测NUMA拓扑
+ * @return NumaTopology 检测到的拓扑
+ */
+NumaTopology detectNumaTopology() {
+    NumaTopology topology;
+    topology.detected = false;
+
+    DIR* dir = opendir("/sys/devices/system/node");
+    if (dir != NULL) {
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            int id;
+            char tail;
+            if (sscanf(entry->d_name, "node%d%c", &id, &tail) != 1) {
+                continue;
+            }
+            ifstream infile(string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            string line;
+            if (!getline(infile, line)) {
+                continue;
+            }
+            NumaNode node;
+            node.id = id;
+            node.cpus = parseCpuList(line);
+            if (!node.cpus.empty()) {   // 没有CPU的节点（纯内存节点）不参与调度
+                topology.nodes.push_back(node);
+            }
+        }
+        closedir(dir);
+    }
+
+    if (!topology.nodes.empty()) {
+        topology.detected = true;
+        sort(topology.nodes.begin(), topology.nodes.end(),
+             [](const NumaNode& a, const NumaNode& b) { return a.id < b.id; });
+    } else {
+        // 单节点退化
+        NumaNode node;
+        node.id = 0;
+        int count = max(1, (int) thread::hardware_concurrency());
+        for (int c = 0; c < count; c++) {
+            node.cpus.push_back(c);
+        }
+        topology.nodes.push_back(node);
+    }
+    return topology;
+}
+
+/**
+ * @Method: numaTopology
+ * @Description: 返回启动时检测到的拓扑（只检测一次）
+ */
+const NumaTopology& numaTopology() {
+    static NumaTopology topology = detectNumaTopology();
+    return topology;
+}
+
+/**
+ * @Method: pinThreadToNode
+ * @Description: 将当前线程绑定到节点的CPU上
+ * @return bool 是否绑定成功
+ */
+bool pinThreadToNode(const NumaNode& node) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (size_t i = 0; i < node.cpus.size(); i++) {
+        if (node.cpus[i] < CPU_SETSIZE) {
+            CPU_SET(node.cpus[i], &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+static int threadsOnNode(const NumaNode& node, int threadsPerNode) {
+    return threadsPerNode > 0 ? threadsPerNode : max(1, (int) node.cpus.size());
+}
+
+/**
+ * @Method: runOnNodes
+ * @Description: 在任务运行时上执行 body(n, 0..tasks[n]-1)，全部完成后返回。执行每个任务的工作线程临时绑定到节点 n 的CPU上，
+ *               结束后恢复原来的绑定；不另建每节点的线程池，与任务运行时共用同一组线程，CPU 不会被两组线程超额占用
+ * @param int priority 优先级 TaskPriority
+ * @param const vector<int>& tasks 每个节点的任务数
+ * @param const function<void(size_t, int)>& body body(节点, 节点内的任务号)
+ */
+static void runOnNodes(int priority, const vector<int>& tasks, const function<void(size_t, int)>& body) {
+    const NumaTopology& topology = numaTopology();
+    vector<pair<size_t, int>> jobs;
+    for (size_t n = 0; n < tasks.size(); n++) {
+        for (int w = 0; w < tasks[n]; w++) {
+            jobs.push_back(make_pair(n, w));
+        }
+    }
+    parallelChunks(priority, 0, (long) jobs.size(), [&](long job, int) {
+        size_t n = jobs[job].first;
+        cpu_set_t previous;
+        bool pinned = pthread_getaffinity_np(pthread_self(), sizeof(previous), &previous) == 0 &&
+                      n < topology.nodes.size() && pinThreadToNode(topology.nodes[n]);
+        body(n, jobs[job].second);
+        if (pinned) {
+            pthread_setaffinity_np(pthread_self(), sizeof(previous), &previous);
+        }
+    });
+}
+
+/**
+ * @Method: dealDataNuma
+ * @Description: 读取数据集并加密，密文按节点分区，由绑定在该节点上的线程首次写入
+ * @param char* fileString 读取数据集的地址
+ * @param int threadsPerNode 每个节点的加密线程数，0 表示该节点的CPU数
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataNuma(char* fileString, int threadsPerNode) {
+    auto start_time = chrono::high_resolution_clock::now();
+    vector<vector<double>> data_list = readDataFromFile(fileString);
+    if (data_list.empty()) {
+        return 0;
+    }
+    const size_t d = data_list[0].size();
+    encryptMatrix = generateInvertibleMatrix(d + 3);
+    keyMode = KEY_DENSE;
+    numaCiphertextVersion = ++datasetVersion;
+    const RowMatrixXd key = encryptMatrix; // 行主序副本供加密内核使用
+
+    // 按节点的CPU数成比例划分行
+    const NumaTopology& topology = numaTopology();
+    size_t totalCpus = 0;
+    for (size_t n = 0; n < topology.nodes.size(); n++) {
+        totalCpus += topology.nodes[n].cpus.size();
+    }
+    numaCiphertext.assign(topology.nodes.size(), NumaPartition());
+    long firstRow = 0;
+    size_t cpusBefore = 0;
+    for (size_t n = 0; n < topology.nodes.size(); n++) {
+        cpusBefore += topology.nodes[n].cpus.size();
+        long lastRow = (long) (data_list.size() * cpusBefore / totalCpus);
+        numaCiphertext[n].node = topology.nodes[n].id;
+        numaCiphertext[n].firstRow = firstRow;
+        firstRow = lastRow;
+    }
+
+    // 只分配不写入，页面由下面绑定在本节点上的线程首次写入
+    vector<int> tasks(topology.nodes.size());
+    for (size_t n = 0; n < topology.nodes.size(); n++) {
+        long end = n + 1 < numaCiphertext.size() ? numaCiphertext[n + 1].firstRow : (long) data_list.size();
+        numaCiphertext[n].rows.resize(end - numaCiphertext[n].firstRow, d + 3);
+        tasks[n] = threadsOnNode(topology.nodes[n], threadsPerNode);
+    }
+    runOnNodes(TASK_BULK, tasks, [&](size_t n, int w) {
+        NumaPartition& partition = numaCiphertext[n];
+        const long rows = partition.rows.rows();
+        const int threads = tasks[n];
+        random_device rd;
+        mt19937 generator(rd());
+        uniform_real_distribution<double> distribution(1, 100);
+        RowMatrixXd t(NUMA_BLOCK_ROWS, d + 3);
+        long begin = rows * w / threads, end = rows * (w + 1) / threads;
+        for (long b = begin; b < end; b += NUMA_BLOCK_ROWS) {
+            long count = min(NUMA_BLOCK_ROWS, end - b);
+            for (long i = 0; i < count; i++) {
+                augmentRecord(data_list[partition.firstRow + b + i].data(), d, distribution(generator),
+                              t.row(i).data());
+            }
+            simdKernels().encryptRows(t.data(), count, d + 3, key.data(), partition.rows.row(b).data());
+        }
+    });
+
+    chrono::duration<double, milli> total_duration = chrono::high_resolution_clock::now() - start_time;
+    printf("NUMA节点数：%zu（%s），加密数据的总时间是：%f 毫秒\n", topology.nodes.size(),
+           topology.detected ? "sysfs" : "单节点退化", total_duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: numaTopK
+ * @Description: 每个线程只扫描本节点的密文分区，最后跨节点合并top-k
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param int threadsPerNode 每个节点的扫描线程数，0 表示该节点的CPU数
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> numaTopK(const VectorXd& q, int k, int threadsPerNode) {
+    const NumaTopology& topology = numaTopology();
+    vector<vector<TopKHeap>> heaps(numaCiphertext.size());
+    vector<int> tasks(numaCiphertext.size());
+    for (size_t n = 0; n < numaCiphertext.size(); n++) {
+        tasks[n] = threadsOnNode(topology.nodes[n < topology.nodes.size() ? n : 0], threadsPerNode);
+        heaps[n].assign(tasks[n], TopKHeap(k));
+    }
+    runOnNodes(TASK_QUERY, tasks, [&](size_t n, int w) {
+        const NumaPartition& partition = numaCiphertext[n];
+        long rows = partition.rows.rows();
+        long begin = rows * w / tasks[n], end = rows * (w + 1) / tasks[n];
+        VectorXd scores(NUMA_BLOCK_ROWS);
+        TopKHeap& heap = heaps[n][w];
+        for (long b = begin; b < end; b += NUMA_BLOCK_ROWS) {
+            long count = min(NUMA_BLOCK_ROWS, end - b);
+            simdKernels().scanBlock(partition.rows.row(b).data(), count, partition.rows.cols(), q.data(), q.size(),
+                                    scores.data());
+            for (long i = 0; i < count; i++) {
+                heap.push(scores[i], partition.firstRow + b + i);
+            }
+        }
+    });
+
+    // 跨节点合并
+    TopKHeap merged(k);
+    for (size_t n = 0; n < heaps.size(); n++) {
+        for (size_t w = 0; w < heaps[n].size(); w++) {
+            merged.merge(heaps[n][w]);
+        }
+    }
+    return merged.extractDescending();
+}
+
+/**
+ * @Method: SSQNuma
+ * @Description: 在按节点分区的密文上发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQNuma(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || numaCiphertext.empty() || !denseKeyReady(point.size())) {
+        return 0;
+    }
+    // 之后其他导入方式换了密钥时，分区仍是旧密钥下的密文
+    if (numaCiphertextVersion != datasetVersion) {
+        cerr << "NUMA partitions are stale, rebuild them with dealDataNuma" << endl;
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+    vector<pair<double, long>> winners = numaTopK(q, k);
+
+    // 按行号找到所在分区取出结果行
+    MatrixXd rows(winners.size(), encryptMatrix.rows());
+    for (size_t i = 0; i < winners.size(); i++) {
+        size_t n = numaCiphertext.size() - 1;
+        while (n > 0 && numaCiphertext[n].firstRow > winners[i].second) {
+            n--;
+        }
+        rows.row(i) = numaCiphertext[n].rows.row(winners[i].second - numaCiphertext[n].firstRow);
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
@@ -0,0 +1,93 @@
+/**
+* @author: WTY
+* @date: 2024/8/18
+* @description: NUMA 感知的密文存放与扫描：按节点分区、绑定线程首次写入、本地扫描后跨节点合并
+*/
+
+#ifndef NUMA_H
+#define NUMA_H
+
+#include "SSQ.h"
+
+/**
+ * NUMA 节点及其CPU
+ */
+struct NumaNode {
+    int id;
+    vector<int> cpus;
+};
+
+/**
+ * NUMA 拓扑。sysfs 不可用或只有一个节点时退化为包含全部CPU的单节点
+ */
+struct NumaTopology {
+    vector<NumaNode> nodes;
+    bool detected;      // 是否从 sysfs 读到了节点信息
+};
+
+/**
+ * 某个节点上的密文分区，行号从 firstRow 开始连续
+ */
+struct NumaPartition {
+    int node;
+    long firstRow;
+    RowMatrixXd rows;
+};
+
+// 按NUMA节点分区的密文数据集
+extern vector<NumaPartition> numaCiphertext;
+
+// 建立分区时的 datasetVersion，与当前版本不同说明分区已失效
+extern uint64_t numaCiphertextVersion;
+
+/**
+ * @Method: detectNumaTopology
+ * @Description: 读取 /sys/devices/system/node 检测NUMA拓扑
+ * @return NumaTopology 检测到的拓扑
+ */
+NumaTopology detectNumaTopology();
+
+/**
+ * @Method: numaTopology
+ * @Description: 返回启动时检测到的拓扑（只检测一次）
+ */
+const NumaTopology& numaTopology();
+
+/**
+ * @Method: pinThreadToNode
+ * @Description: 将当前线程绑定到节点的CPU上
+ * @return bool 是否绑定成功
+ */
+bool pinThreadToNode(const NumaNode& node);
+
+/**
+ * @Method: dealDataNuma
+ * @Description: 读取数据集并加密，密文按节点分区，由临时绑定在该节点上的任务运行时线程首次写入
+ * @param char* fileString 读取数据集的地址
+ * @param int threadsPerNode 每个节点的加密任务数，0 表示该节点的CPU数；同时执行的任务数受任务运行时的线程数限制
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataNuma(char* fileString, int threadsPerNode = 0);
+
+/**
+ * @Method: numaTopK
+ * @Description: 任务运行时的线程临时绑定到节点上，只扫描本节点的密文分区，最后跨节点合并top-k
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param int threadsPerNode 每个节点的扫描任务数，0 表示该节点的CPU数
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> numaTopK(const VectorXd& q, int k, int threadsPerNode = 0);
+
+/**
+ * @Method: SSQNuma
+ * @Description: 在按节点分区的密文上发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQNuma(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //NUMA_H
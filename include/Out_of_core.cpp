@@ -0,0 +1,331 @@
+/**
+* @author: WTY
+* @date: 2024/8/18
+* @description: 密文大于内存时的外存查询：双缓冲预读快照文件并逐块计算距离
+*/
+
+#include "Out_of_core.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @Class: ReadAheadReader
+ * @Description: 双缓冲预读。后台线程用 pread 顺序读取下一块到空闲缓冲区，
+ *               计算线程处理完一块后归还缓冲区，两者交替进行
+ */
+class ReadAheadReader {
+public:
+    ReadAheadReader(int fd, uint64_t totalRows, size_t dim, size_t blockRows)
+            : fd(fd), totalRows(totalRows), dim(dim), blockRows(blockRows), failed(false), stopped(false) {
+        for (int s = 0; s < 2; s++) {
+            buffers[s].resize(blockRows * dim);
+            rowsIn[s] = 0;
+            full[s] = false;
+            finished[s] = false;
+        }
+        worker = thread(&ReadAheadReader::run, this);
+    }
+
+    ~ReadAheadReader() {
+        {
+            lock_guard<mutex> lock(mtx);
+            stopped = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+
+    /**
+     * @Method: acquire
+     * @Description: 等待第 slot 块数据就绪
+     * @return size_t 块中的行数，0 表示读取结束
+     */
+    size_t acquire(int slot, const double*& data) {
+        unique_lock<mutex> lock(mtx);
+        changed.wait(lock, [this, slot] { return full[slot] || finished[slot]; });
+        data = buffers[slot].data();
+        return full[slot] ? rowsIn[slot] : 0;
+    }
+
+    /**
+     * @Method: release
+     * @Description: 归还第 slot 块缓冲区，后台线程可继续读入
+     */
+    void release(int slot) {
+        {
+            lock_guard<mutex> lock(mtx);
+            full[slot] = false;
+        }
+        changed.notify_all();
+    }
+
+    bool good() const {
+        return !failed;
+    }
+
+private:
+    void run() {
+        uint64_t nextRow = 0;
+        int slot = 0;
+        const uint64_t rowBytes = dim * sizeof(double);
+        while (true) {
+            {
+                unique_lock<mutex> lock(mtx);
+                changed.wait(lock, [this, slot] { return !full[slot] || stopped; });
+                if (stopped) {
+                    return;
+                }
+            }
+            size_t rows = (size_t) min<uint64_t>(blockRows, totalRows - nextRow);
+            if (rows == 0) {
+                break;
+            }
+            off_t offset = (off_t) (SNAPSHOT_HEADER_SIZE + nextRow * rowBytes);
+            if (!readFully(reinterpret_cast<char*>(buffers[slot].data()), rows * rowBytes, offset)) {
+                failed = true;
+                break;
+            }
+            // 数据已复制到缓冲区，不必再占用页缓存
+            posix_fadvise(fd, offset, (off_t) (rows * rowBytes), POSIX_FADV_DONTNEED);
+            nextRow += rows;
+            {
+                lock_guard<mutex> lock(mtx);
+                rowsIn[slot] = rows;
+                full[slot] = true;
+            }
+            changed.notify_all();
+            slot = 1 - slot;
+        }
+        {
+            lock_guard<mutex> lock(mtx);
+            finished[0] = finished[1] = true;
+        }
+        changed.notify_all();
+    }
+
+    bool readFully(char* p, size_t size, off_t offset) {
+        while (size > 0) {
+            ssize_t n = pread(fd, p, size, offset);
+            if (n <= 0) {
+                return false;
+            }
+            p += n;
+            size -= (size_t) n;
+            offset += n;
+        }
+        return true;
+    }
+
+    int fd;
+    uint64_t totalRows;
+    size_t dim;
+    size_t blockRows;
+    vector<double> buffers[2];
+    size_t rowsIn[2];
+    bool full[2];
+    bool finished[2];
+    bool failed;
+    bool stopped;
+    mutex mtx;
+    condition_variable changed;
+    thread worker;
+};
+
+/**
+ * @Method: outOfCoreTopK
+ * @Description: 顺序扫描磁盘上的密文快照，返回距离最小的k条
+ * @param const char* snapshotPath 快照文件
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param const OutOfCoreConfig& config 扫描配置
+ * @param OutOfCoreStats* stats 返回扫描统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；失败时为空
+ */
+vector<pair<double, long>> outOfCoreTopK(const char* snapshotPath, const VectorXd& q, int k,
+                                         const OutOfCoreConfig& config, OutOfCoreStats* stats) {
+    auto start_time = chrono::high_resolution_clock::now();
+    vector<pair<double, long>> winners;
+
+    SnapshotHeader header;
+    if (!readSnapshotHeader(snapshotPath, header)) {
+        return winners;
+    }
+    if (header.dim != (uint32_t) q.size()) {
+        cerr << "Query dimension does not match snapshot " << snapshotPath << endl;
+        return winners;
+    }
+    int fd = open(snapshotPath, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Unable to open file " << snapshotPath << endl;
+        return winners;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // 每行占用：两块缓冲区各一份密文 + 一个距离
+    const size_t rowBytes = header.dim * sizeof(double);
+    size_t budget = config.memoryBudgetBytes > (size_t) k * 16 ? config.memoryBudgetBytes - (size_t) k * 16 : 0;
+    size_t blockRows = budget / (2 * rowBytes + sizeof(double));
+    blockRows = min(blockRows, max<size_t>(1, config.maxBlockBytes / rowBytes));
+    blockRows = max<size_t>(1, min<uint64_t>(blockRows, max<uint64_t>(1, header.rows)));
+
+    TopKHeap heap(k);
+    const SimdKernels& kernels = simdKernels();
+    VectorXd scores(blockRows);
+    double ioWait = 0, scoreTime = 0;
+    uint64_t scanned = 0;
+    bool ok;
+    {
+        ReadAheadReader reader(fd, header.rows, header.dim, blockRows);
+        int slot = 0;
+        while (true) {
+            auto wait_start = chrono::high_resolution_clock::now();
+            const double* data;
+            size_t rows = reader.acquire(slot, data);
+            auto score_start = chrono::high_resolution_clock::now();
+            ioWait += chrono::duration<double, milli>(score_start - wait_start).count();
+            if (rows == 0) {
+                break;
+            }
+
+            kernels.scanBlock(data, rows, header.dim, q.data(), header.dim, scores.data());
+            for (size_t i = 0; i < rows; i++) {
+                heap.push(scores[i], (long) (scanned + i));
+            }
+            scanned += rows;
+            reader.release(slot);
+            slot = 1 - slot;
+            scoreTime += chrono::duration<double, milli>(chrono::high_resolution_clock::now() - score_start).count();
+        }
+        ok = reader.good() && scanned == header.rows;
+    }
+    close(fd);
+    if (!ok) {
+        cerr << "Error reading file " << snapshotPath << endl;
+        return winners;
+    }
+    winners = heap.extractDescending();
+
+    if (stats != NULL) {
+        stats->rows = scanned;
+        stats->bytes = scanned * rowBytes;
+        stats->blockRows = blockRows;
+        stats->ioWaitMillis = ioWait;
+        stats->scoreMillis = scoreTime;
+        stats->totalMillis = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start_time).count();
+        stats->bandwidthMBs = stats->totalMillis > 0 ? stats->bytes / (stats->totalMillis * 1000.0) : 0;
+    }
+    return winners;
+}
+
+/**
+ * @Method: readSnapshotRows
+ * @Description: 按行号随机读取快照中的若干行（用于取出结果行解密）
+ * @param const char* snapshotPath 快照文件
+ * @param const vector<pair<double, long>>& winners (距离, 行号)
+ * @param MatrixXd& rows 返回的密文行，与winners逐行对应
+ * @return 状态码，1：成功；0：失败
+ */
+int readSnapshotRows(const char* snapshotPath, const vector<pair<double, long>>& winners, MatrixXd& rows) {
+    SnapshotHeader header;
+    if (!readSnapshotHeader(snapshotPath, header)) {
+        return 0;
+    }
+    int fd = open(snapshotPath, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    const size_t rowBytes = header.dim * sizeof(double);
+    rows.resize(winners.size(), header.dim);
+    VectorXd row(header.dim);
+    for (size_t i = 0; i < winners.size(); i++) {
+        off_t offset = (off_t) (SNAPSHOT_HEADER_SIZE + (uint64_t) winners[i].second * rowBytes);
+        if (pread(fd, row.data(), rowBytes, offset) != (ssize_t) rowBytes) {
+            close(fd);
+            cerr << "Error reading file " << snapshotPath << endl;
+            return 0;
+        }
+        rows.row(i) = row.transpose();
+    }
+    close(fd);
+    return 1;
+}
+
+/**
+ * @Method: readSnapshotRowIds
+ * @Description: 把结果中的行位置换成快照行号列中记录的行号，没有行号列时结果不变
+ * @param const char* snapshotPath 快照文件
+ * @param vector<pair<double, long>>& winners (距离, 行位置)，返回 (距离, 行号)
+ * @return 状态码，1：成功；0：失败
+ */
+int readSnapshotRowIds(const char* snapshotPath, vector<pair<double, long>>& winners) {
+    SnapshotHeader header;
+    if (!readSnapshotHeader(snapshotPath, header)) {
+        return 0;
+    }
+    if (!(header.flags & SNAPSHOT_FLAG_ROW_IDS)) {
+        return 1;
+    }
+    int fd = open(snapshotPath, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Unable to open file " << snapshotPath << endl;
+        return 0;
+    }
+    // 行号列紧跟在全部密文行之后
+    const uint64_t idsOffset = SNAPSHOT_HEADER_SIZE + header.rows * header.dim * sizeof(double);
+    for (size_t i = 0; i < winners.size(); i++) {
+        uint64_t id;
+        off_t offset = (off_t) (idsOffset + (uint64_t) winners[i].second * sizeof(uint64_t));
+        if (winners[i].second < 0 || (uint64_t) winners[i].second >= header.rows ||
+            pread(fd, &id, sizeof(id), offset) != (ssize_t) sizeof(id)) {
+            close(fd);
+            cerr << "Error reading file " << snapshotPath << endl;
+            return 0;
+        }
+        winners[i].second = (long) id;
+    }
+    close(fd);
+    return 1;
+}
+
+/**
+ * @Method: SSQOutOfCore
+ * @Description: 在磁盘上的密文快照上发起查询请求，内存占用受 memoryBudgetBytes 限制
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param char* snapshotPath 密文快照文件
+ * @param size_t memoryBudgetBytes 扫描可用的内存上限
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQOutOfCore(char* fileString, char* resultFilePath, char* snapshotPath, size_t memoryBudgetBytes,
+                 int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || !denseKeyReady(point.size())) {
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    OutOfCoreConfig config;
+    config.memoryBudgetBytes = memoryBudgetBytes;
+    OutOfCoreStats stats;
+    vector<pair<double, long>> winners = outOfCoreTopK(snapshotPath, q, k, config, &stats);
+    if (winners.empty()) {
+        return 0;
+    }
+    printf("外存扫描：%llu 行，每块 %zu 行，等待读取 %f 毫秒，计算 %f 毫秒，带宽 %f MB/s\n",
+           (unsigned long long) stats.rows, stats.blockRows, stats.ioWaitMillis, stats.scoreMillis,
+           stats.bandwidthMBs);
+    fflush(stdout);
+
+    MatrixXd rows;
+    if (!readSnapshotRows(snapshotPath, winners, rows) || !readSnapshotRowIds(snapshotPath, winners)) {
+        return 0;
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
@@ -0,0 +1,86 @@
+/**
+* @author: WTY
+* @date: 2024/8/18
+* @description: 密文大于内存时的外存查询：双缓冲预读快照文件并逐块计算距离
+*/
+
+#ifndef OUT_OF_CORE_H
+#define OUT_OF_CORE_H
+
+#include "SSQ.h"
+#include "Snapshot.h"
+
+/**
+ * 外存扫描配置。两块读缓冲轮流使用：后台线程读取下一块的同时，当前块参与计算，
+ * 缓冲区与计算临时空间之和不超过 memoryBudgetBytes。
+ */
+struct OutOfCoreConfig {
+    size_t memoryBudgetBytes;   // 扫描可用的内存上限
+    size_t maxBlockBytes;       // 单块读取的上限，过大的块会拉长首块等待时间
+
+    OutOfCoreConfig() : memoryBudgetBytes(256 << 20), maxBlockBytes(64 << 20) {
+    }
+};
+
+/**
+ * 外存扫描统计
+ */
+struct OutOfCoreStats {
+    uint64_t rows;          // 扫描的行数
+    uint64_t bytes;         // 读取的字节数
+    size_t blockRows;       // 每块行数
+    double ioWaitMillis;    // 计算线程等待数据的时间
+    double scoreMillis;     // 计算距离与维护堆的时间
+    double totalMillis;     // 扫描总时间
+    double bandwidthMBs;    // 有效读取带宽 MB/s
+};
+
+/**
+ * @Method: outOfCoreTopK
+ * @Description: 顺序扫描磁盘上的密文快照，返回距离最小的k条；返回的是行在快照中的位置，
+ *               快照带行号列时用 readSnapshotRowIds 换成行号
+ * @param const char* snapshotPath 快照文件
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param const OutOfCoreConfig& config 扫描配置
+ * @param OutOfCoreStats* stats 返回扫描统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；失败时为空
+ */
+vector<pair<double, long>> outOfCoreTopK(const char* snapshotPath, const VectorXd& q, int k,
+                                         const OutOfCoreConfig& config, OutOfCoreStats* stats = NULL);
+
+/**
+ * @Method: readSnapshotRows
+ * @Description: 按行号随机读取快照中的若干行（用于取出结果行解密）
+ * @param const char* snapshotPath 快照文件
+ * @param const vector<pair<double, long>>& winners (距离, 行号)
+ * @param MatrixXd& rows 返回的密文行，与winners逐行对应
+ * @return 状态码，1：成功；0：失败
+ */
+int readSnapshotRows(const char* snapshotPath, const vector<pair<double, long>>& winners, MatrixXd& rows);
+
+/**
+ * @Method: readSnapshotRowIds
+ * @Description: 把结果中的行位置换成快照行号列中记录的行号（写前日志合并生成的快照），
+ *               没有行号列时行号即位置，结果不变；需在 readSnapshotRows 之后调用
+ * @param const char* snapshotPath 快照文件
+ * @param vector<pair<double, long>>& winners (距离, 行位置)，返回 (距离, 行号)
+ * @return 状态码，1：成功；0：失败
+ */
+int readSnapshotRowIds(const char* snapshotPath, vector<pair<double, long>>& winners);
+
+/**
+ * @Method: SSQOutOfCore
+ * @Description: 在磁盘上的密文快照上发起查询请求，内存占用受 memoryBudgetBytes 限制
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param char* snapshotPath 密文快照文件
+ * @param size_t memoryBudgetBytes 扫描可用的内存上限
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQOutOfCore(char* fileString, char* resultFilePath, char* snapshotPath, size_t memoryBudgetBytes,
+                 int resultFormat = RESULT_TEXT);
+
+
+#endif //OUT_OF_CORE_H
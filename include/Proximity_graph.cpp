@@ -0,0 +1,562 @@
+/**
+* @author: WTY
+* @date: 2024/8/27
+* @description: 数据拥有者在明文上建立分层近邻图（HNSW），与密文一起外包，服务器只对访问到的节点计算内积
+*/
+
+#include "Proximity_graph.h"
+#include <cmath>
+#include <cstring>
+#include <functional>
+
+// 近邻图，由 dealDataGraph 建立或 loadGraph 载入
+ProximityGraph proximityGraph;
+
+// 查询时默认的候选集大小
+int graphEfSearch = 64;
+
+// 近邻图文件格式
+static const char GRAPH_MAGIC[8] = "SSQGRPH";
+static const uint32_t GRAPH_VERSION = 2;
+
+struct GraphFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t M;
+    int64_t entryPoint;
+    uint32_t levels;
+    uint32_t dim;           // 建图时密文的维度 D
+    uint64_t rows;          // 建图时的数据集行数，载入时需与当前密文一致
+};
+
+// (距离, 节点)
+typedef pair<double, uint32_t> Candidate;
+
+// 一个节点的邻居 [first, second)
+typedef pair<const uint32_t*, const uint32_t*> NeighborRange;
+
+/**
+ * @Class: VisitedSet
+ * @Description: 访问标记，每次搜索递增 epoch，不需要每次清空 O(N) 的数组
+ */
+class VisitedSet {
+public:
+    VisitedSet() : epoch(0) {
+    }
+
+    void reset(size_t n) {
+        if (tags.size() < n) {
+            tags.assign(n, 0);
+            epoch = 0;
+        }
+        if (++epoch == 0) {
+            fill(tags.begin(), tags.end(), 0);
+            epoch = 1;
+        }
+    }
+
+    bool insert(uint32_t id) {
+        if (tags[id] == epoch) {
+            return false;
+        }
+        tags[id] = epoch;
+        return true;
+    }
+
+private:
+    vector<uint32_t> tags;
+    uint32_t epoch;
+};
+
+size_t ProximityGraph::memoryBytes() const {
+    size_t bytes = 0;
+    for (size_t l = 0; l < levels.size(); l++) {
+        bytes += (levels[l].nodes.size() + levels[l].offsets.size() + levels[l].neighbors.size()) * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+/**
+ * @Method: searchLayer
+ * @Description: 在一层上做束搜索，返回按距离从小到大排列的至多 ef 个节点
+ */
+template<typename Distance, typename Neighbors>
+static vector<Candidate> searchLayer(const vector<Candidate>& entries, size_t ef, Distance distance,
+                                     Neighbors neighbors, VisitedSet& visited, long& hops) {
+    priority_queue<Candidate, vector<Candidate>, greater<Candidate>> candidates;   // 最近的在堆顶
+    priority_queue<Candidate> results;                                              // 最远的在堆顶
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (visited.insert(entries[i].second)) {
+            candidates.push(entries[i]);
+            results.push(entries[i]);
+        }
+    }
+    while (results.size() > ef) {
+        results.pop();
+    }
+    while (!candidates.empty()) {
+        Candidate current = candidates.top();
+        if (results.size() >= ef && current.first > results.top().first) {
+            break;  // 候选集中最近的也比结果中最远的远
+        }
+        candidates.pop();
+        hops++;
+        NeighborRange range = neighbors(current.second);
+        for (const uint32_t* n = range.first; n != range.second; ++n) {
+            if (!visited.insert(*n)) {
+                continue;
+            }
+            double d = distance(*n);
+            if (results.size() < ef || d < results.top().first) {
+                candidates.push(Candidate(d, *n));
+                results.push(Candidate(d, *n));
+                if (results.size() > ef) {
+                    results.pop();
+                }
+            }
+        }
+    }
+    vector<Candidate> out;
+    while (!results.empty()) {
+        out.push_back(results.top());
+        results.pop();
+    }
+    reverse(out.begin(), out.end());
+    return out;
+}
+
+/**
+ * @Method: greedyDescend
+ * @Description: 在一层上从 current 出发贪心地移动到更近的邻居，直到不能再改进
+ */
+template<typename Distance, typename Neighbors>
+static Candidate greedyDescend(Candidate current, Distance distance, Neighbors neighbors) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        NeighborRange range = neighbors(current.second);
+        for (const uint32_t* n = range.first; n != range.second; ++n) {
+            double d = distance(*n);
+            if (d < current.first) {
+                current = Candidate(d, *n);
+                changed = true;
+            }
+        }
+    }
+    return current;
+}
+
+static double squaredDistance(const vector<double>& a, const vector<double>& b) {
+    double sum = 0;
+    for (size_t j = 0; j < a.size(); j++) {
+        double diff = a[j] - b[j];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+/**
+ * @Method: selectNeighbors
+ * @Description: HNSW 的启发式邻居选择：候选按距离从小到大考察，只有当它离基准点比离所有已选邻居都近时才保留，
+ *               使邻居分布在不同方向上
+ */
+static vector<uint32_t> selectNeighbors(const vector<Candidate>& sorted, size_t M,
+                                        const vector<vector<double>>& data_list) {
+    vector<uint32_t> selected;
+    for (size_t i = 0; i < sorted.size() && selected.size() < M; i++) {
+        bool keep = true;
+        for (size_t j = 0; j < selected.size() && keep; j++) {
+            keep = squaredDistance(data_list[sorted[i].second], data_list[selected[j]]) >= sorted[i].first;
+        }
+        if (keep) {
+            selected.push_back(sorted[i].second);
+        }
+    }
+    return selected;
+}
+
+/**
+ * @Method: buildProximityGraph
+ * @Description: 数据拥有者在明文上按HNSW的方式逐点插入建图，邻居选择使用启发式剪枝
+ * @param const vector<vector<double>>& data_list 明文数据集
+ * @param const GraphConfig& config 建图参数
+ * @return ProximityGraph 压缩后的近邻图
+ */
+ProximityGraph buildProximityGraph(const vector<vector<double>>& data_list, const GraphConfig& config) {
+    ProximityGraph graph;
+    graph.M = max(2, config.M);
+    graph.entryPoint = -1;
+    graph.version = datasetVersion;
+    const uint32_t n = (uint32_t) data_list.size();
+    if (n == 0) {
+        return graph;
+    }
+    const size_t maxDegree0 = 2 * graph.M;
+    const size_t efConstruction = max(config.efConstruction, graph.M);
+    const double levelMultiplier = 1 / log((double) graph.M);
+
+    // 随机层数服从几何分布
+    mt19937 generator(random_device{}());
+    uniform_real_distribution<double> distribution(0, 1);
+    vector<int> nodeLevel(n);
+    vector<vector<vector<uint32_t>>> links(n);
+    for (uint32_t i = 0; i < n; i++) {
+        nodeLevel[i] = (int) (-log(1 - distribution(generator)) * levelMultiplier);
+        links[i].resize(nodeLevel[i] + 1);
+    }
+
+    VisitedSet visited;
+    long hops = 0;
+    uint32_t entry = 0;
+    int maxLevel = nodeLevel[0];
+    for (uint32_t i = 1; i < n; i++) {
+        const vector<double>& x = data_list[i];
+        auto toX = [&](uint32_t node) { return squaredDistance(data_list[node], x); };
+        Candidate current(toX(entry), entry);
+        for (int l = maxLevel; l > nodeLevel[i]; l--) {
+            current = greedyDescend(current, toX, [&](uint32_t node) {
+                const vector<uint32_t>& v = links[node][l];
+                return NeighborRange(v.data(), v.data() + v.size());
+            });
+        }
+        vector<Candidate> entries(1, current);
+        for (int l = min(nodeLevel[i], maxLevel); l >= 0; l--) {
+            auto neighborsAt = [&](uint32_t node) {
+                const vector<uint32_t>& v = links[node][l];
+                return NeighborRange(v.data(), v.data() + v.size());
+            };
+            visited.reset(n);
+            vector<Candidate> found = searchLayer(entries, efConstruction, toX, neighborsAt, visited, hops);
+            links[i][l] = selectNeighbors(found, graph.M, data_list);
+
+            // 反向连边，超过度数上限时对该节点重新做邻居选择
+            size_t limit = l == 0 ? maxDegree0 : (size_t) graph.M;
+            for (size_t s = 0; s < links[i][l].size(); s++) {
+                uint32_t other = links[i][l][s];
+                vector<uint32_t>& back = links[other][l];
+                back.push_back(i);
+                if (back.size() > limit) {
+                    vector<Candidate> sorted;
+                    for (size_t b = 0; b < back.size(); b++) {
+                        sorted.push_back(Candidate(squaredDistance(data_list[other], data_list[back[b]]), back[b]));
+                    }
+                    sort(sorted.begin(), sorted.end());
+                    back = selectNeighbors(sorted, limit, data_list);
+                }
+            }
+            entries = found;
+        }
+        if (nodeLevel[i] > maxLevel) {
+            maxLevel = nodeLevel[i];
+            entry = i;
+        }
+    }
+
+    // 压缩为每层一个 CSR
+    graph.entryPoint = entry;
+    graph.levels.resize(maxLevel + 1);
+    for (int l = 0; l <= maxLevel; l++) {
+        GraphLevel& level = graph.levels[l];
+        level.offsets.push_back(0);
+        for (uint32_t i = 0; i < n; i++) {
+            if (nodeLevel[i] < l) {
+                continue;
+            }
+            if (l > 0) {
+                level.nodes.push_back(i);
+            }
+            level.neighbors.insert(level.neighbors.end(), links[i][l].begin(), links[i][l].end());
+            level.offsets.push_back((uint32_t) level.neighbors.size());
+        }
+        level.neighbors.shrink_to_fit();
+    }
+    return graph;
+}
+
+/**
+ * @Method: dealDataGraph
+ * @Description: 读取数据集，在明文上建立近邻图，再加密数据
+ * @param char* fileString 读取数据集的地址
+ * @param const GraphConfig& config 建图参数
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataGraph(char* fileString, const GraphConfig& config) {
+    vector<vector<double>> data_list = readDataFromFile(fileString);
+    if (data_list.empty()) {
+        return 0;
+    }
+
+    auto start_time = chrono::high_resolution_clock::now();
+    proximityGraph = buildProximityGraph(data_list, config);
+    graphEfSearch = config.efSearch;
+    auto build_time = chrono::high_resolution_clock::now();
+
+    encryptMatrix = generateInvertibleMatrix(data_list[0].size() + 3);
+    keyMode = KEY_DENSE;
+    proximityGraph.version = ++datasetVersion;
+    encryptDataList(data_list, NULL, ciphertext);
+    auto end_time = chrono::high_resolution_clock::now();
+
+    chrono::duration<double, milli> build_duration = build_time - start_time;
+    chrono::duration<double, milli> encrypt_duration = end_time - build_time;
+    printf("近邻图：%zu 层，M=%d，邻接表 %zu 字节，建图时间 %f 毫秒，加密时间 %f 毫秒\n", proximityGraph.levels.size(),
+           proximityGraph.M, proximityGraph.memoryBytes(), build_duration.count(), encrypt_duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: validCsr
+ * @Description: 检查一层的 CSR 结构：offsets 共 count+1 项、从0开始单调不减、末项等于邻居数
+ */
+static bool validCsr(const GraphLevel& level, size_t count) {
+    if (level.offsets.size() != count + 1 || level.offsets[0] != 0 || level.offsets[count] != level.neighbors.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (level.offsets[i] > level.offsets[i + 1]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @Method: validateGraph
+ * @Description: 检查近邻图能否在 rows 行的密文上安全搜索：入口节点、各层节点、偏移与邻居都不越界，
+ *               上层的节点与邻居都出现在该层的节点表中，且每层的节点也出现在下一层
+ * @return const char* 不合法的原因，合法时为 NULL
+ */
+static const char* validateGraph(const ProximityGraph& graph, size_t rows) {
+    if (graph.levels.empty() || rows == 0 || rows > (size_t) UINT32_MAX) {
+        return "empty graph or dataset";
+    }
+    if (graph.entryPoint < 0 || (size_t) graph.entryPoint >= rows) {
+        return "entry point out of range";
+    }
+    const GraphLevel& bottom = graph.levels[0];
+    if (!bottom.nodes.empty() || !validCsr(bottom, rows)) {
+        return "malformed level 0";
+    }
+    for (size_t i = 0; i < bottom.neighbors.size(); i++) {
+        if (bottom.neighbors[i] >= rows) {
+            return "level 0 neighbor out of range";
+        }
+    }
+    for (size_t l = 1; l < graph.levels.size(); l++) {
+        const GraphLevel& level = graph.levels[l];
+        const vector<uint32_t>& nodes = level.nodes;
+        if (nodes.empty() || !validCsr(level, nodes.size())) {
+            return "malformed upper level";
+        }
+        for (size_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i] >= rows || (i > 0 && nodes[i] <= nodes[i - 1])) {
+                return "upper level nodes out of range or not increasing";
+            }
+            // 贪心下降到下一层时从同一节点出发
+            if (l > 1 && !binary_search(graph.levels[l - 1].nodes.begin(), graph.levels[l - 1].nodes.end(), nodes[i])) {
+                return "upper level node missing from the level below";
+            }
+        }
+        for (size_t i = 0; i < level.neighbors.size(); i++) {
+            if (!binary_search(nodes.begin(), nodes.end(), level.neighbors[i])) {
+                return "upper level neighbor is not a node of its level";
+            }
+        }
+    }
+    if (graph.levels.size() > 1) {
+        const vector<uint32_t>& top = graph.levels.back().nodes;
+        if (!binary_search(top.begin(), top.end(), (uint32_t) graph.entryPoint)) {
+            return "entry point missing from the top level";
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @Method: graphTopK
+ * @Description: 服务器在近邻图上贪心下降并在第0层做束搜索，只对访问到的节点计算 c·q
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param int ef 候选集大小，不小于k，0 表示使用 graphEfSearch
+ * @param GraphSearchStats* stats 返回搜索统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> graphTopK(const VectorXd& q, int k, int ef, GraphSearchStats* stats) {
+    const ProximityGraph& graph = proximityGraph;
+    // 图在建立或载入时已对当时的密文检查过，数据集之后被替换或追加时不再使用
+    if (graph.levels.empty() || graph.version != datasetVersion || ciphertext.empty() ||
+        graph.levels[0].offsets.size() != ciphertext.size() + 1) {
+        return vector<pair<double, long>>();
+    }
+    ef = max(ef > 0 ? ef : graphEfSearch, k);
+
+    // c·q = r21 (||x-p||^2 - ||p||^2)，与距离单调一致，可直接作为图搜索的距离
+    long scored = 0, hops = 0;
+    auto score = [&](uint32_t node) {
+        scored++;
+        return ciphertext[node].dot(q);
+    };
+    Candidate current(score((uint32_t) graph.entryPoint), (uint32_t) graph.entryPoint);
+    for (int l = (int) graph.levels.size() - 1; l > 0; l--) {
+        const GraphLevel& level = graph.levels[l];
+        current = greedyDescend(current, score, [&](uint32_t node) {
+            size_t i = lower_bound(level.nodes.begin(), level.nodes.end(), node) - level.nodes.begin();
+            if (i == level.nodes.size() || level.nodes[i] != node) {
+                return NeighborRange(NULL, NULL);
+            }
+            return NeighborRange(level.neighbors.data() + level.offsets[i],
+                                 level.neighbors.data() + level.offsets[i + 1]);
+        });
+    }
+    const GraphLevel& bottom = graph.levels[0];
+    static thread_local VisitedSet visited;
+    visited.reset(ciphertext.size());
+    vector<Candidate> found = searchLayer(vector<Candidate>(1, current), (size_t) ef, score, [&](uint32_t node) {
+        return NeighborRange(bottom.neighbors.data() + bottom.offsets[node],
+                             bottom.neighbors.data() + bottom.offsets[node + 1]);
+    }, visited, hops);
+
+    TopKHeap heap(k);
+    for (size_t i = 0; i < found.size(); i++) {
+        heap.push(found[i].first, (long) found[i].second);
+    }
+    if (stats != NULL) {
+        stats->scored = scored;
+        stats->hops = hops;
+    }
+    return heap.extractDescending();
+}
+
+/**
+ * @Method: saveGraph
+ * @Description: 将近邻图写入文件，与密文快照一起交给服务器
+ * @param const char* path 文件路径
+ * @return 状态码，1：成功；0：失败
+ */
+int saveGraph(const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return 0;
+    }
+    GraphFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GRAPH_MAGIC, sizeof(header.magic));
+    header.version = GRAPH_VERSION;
+    header.M = (uint32_t) proximityGraph.M;
+    header.entryPoint = proximityGraph.entryPoint;
+    header.levels = (uint32_t) proximityGraph.levels.size();
+    header.dim = ciphertext.empty() ? 0 : (uint32_t) ciphertext[0].size();
+    header.rows = proximityGraph.levels.empty() ? 0 : proximityGraph.levels[0].offsets.size() - 1;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (size_t l = 0; l < proximityGraph.levels.size() && ok; l++) {
+        const vector<uint32_t>* arrays[3] = {&proximityGraph.levels[l].nodes, &proximityGraph.levels[l].offsets,
+                                             &proximityGraph.levels[l].neighbors};
+        for (int a = 0; a < 3 && ok; a++) {
+            uint64_t count = arrays[a]->size();
+            ok = fwrite(&count, sizeof(count), 1, file) == 1 &&
+                 fwrite(arrays[a]->data(), sizeof(uint32_t), count, file) == count;
+        }
+    }
+    if (fclose(file) != 0 || !ok) {
+        cerr << "Unable to write file " << path << endl;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @Method: loadGraph
+ * @Description: 从文件载入近邻图，图需与当前载入的密文数据集配套：行数与维度一致，
+ *               入口节点、偏移与邻居都在密文范围内，否则拒绝载入
+ * @param const char* path 文件路径
+ * @return 状态码，1：成功；0：失败
+ */
+int loadGraph(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return 0;
+    }
+    GraphFileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, GRAPH_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != GRAPH_VERSION || header.levels > 64) {
+        cerr << "Invalid graph file " << path << endl;
+        fclose(file);
+        return 0;
+    }
+    if (ciphertext.empty() || header.rows != ciphertext.size() || header.dim != (uint32_t) ciphertext[0].size()) {
+        cerr << "Graph file " << path << " was built for " << header.rows << " rows of dimension " << header.dim
+             << ", not the loaded dataset" << endl;
+        fclose(file);
+        return 0;
+    }
+    // 数组长度不可能超过文件剩余的字节数，避免按损坏的长度分配内存
+    long dataStart = ftell(file);
+    fseek(file, 0, SEEK_END);
+    uint64_t remaining = (uint64_t) (ftell(file) - dataStart);
+    fseek(file, dataStart, SEEK_SET);
+
+    ProximityGraph graph;
+    graph.M = (int) header.M;
+    graph.entryPoint = header.entryPoint;
+    graph.levels.resize(header.levels);
+    bool ok = true;
+    for (size_t l = 0; l < graph.levels.size() && ok; l++) {
+        vector<uint32_t>* arrays[3] = {&graph.levels[l].nodes, &graph.levels[l].offsets, &graph.levels[l].neighbors};
+        for (int a = 0; a < 3 && ok; a++) {
+            uint64_t count = 0;
+            ok = fread(&count, sizeof(count), 1, file) == 1;
+            remaining -= ok ? sizeof(count) : 0;
+            ok = ok && count <= remaining / sizeof(uint32_t);
+            if (ok) {
+                arrays[a]->resize(count);
+                ok = fread(arrays[a]->data(), sizeof(uint32_t), count, file) == count;
+                remaining -= count * sizeof(uint32_t);
+            }
+        }
+    }
+    fclose(file);
+    if (!ok) {
+        cerr << "Truncated graph file " << path << endl;
+        return 0;
+    }
+    const char* reason = validateGraph(graph, ciphertext.size());
+    if (reason != NULL) {
+        cerr << "Invalid graph file " << path << ": " << reason << endl;
+        return 0;
+    }
+    graph.version = datasetVersion;
+    proximityGraph = graph;
+    return 1;
+}
+
+/**
+ * @Method: SSQGraph
+ * @Description: 使用近邻图发起查询请求，结果为近似top-k
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQGraph(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || proximityGraph.levels.empty() || !denseKeyReady(point.size())) {
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    auto start_time = chrono::high_resolution_clock::now();
+    GraphSearchStats stats;
+    vector<pair<double, long>> winners = graphTopK(q, k, 0, &stats);
+    chrono::duration<double, milli> total_duration = chrono::high_resolution_clock::now() - start_time;
+    printf("近邻图搜索：ef=%d，计算 %ld/%zu 行内积，展开 %ld 个节点，时间 %f 毫秒\n", max(graphEfSearch, k),
+           stats.scored, ciphertext.size(), stats.hops, total_duration.count());
+    fflush(stdout);
+
+    return outputResults(resultFilePath, winners, encryptMatrixInverse, resultFormat);
+}
@@ -0,0 +1,121 @@
+/**
+* @author: WTY
+* @date: 2024/8/27
+* @description: 数据拥有者在明文上建立分层近邻图（HNSW），与密文一起外包，服务器只对访问到的节点计算内积
+*/
+
+#ifndef PROXIMITY_GRAPH_H
+#define PROXIMITY_GRAPH_H
+
+#include "SSQ.h"
+
+/**
+ * 建图与搜索参数
+ */
+struct GraphConfig {
+    int M;                  // 上层每个节点的最大邻居数，第0层为 2M
+    int efConstruction;     // 建图时的候选集大小
+    int efSearch;           // 查询时的候选集大小，越大召回率越高、访问的节点越多
+
+    GraphConfig() : M(16), efConstruction(100), efSearch(64) {
+    }
+};
+
+/**
+ * 一层的邻接表，CSR 格式：第 i 个节点的邻居为 neighbors[offsets[i], offsets[i+1])
+ * 第0层包含全部节点，nodes 为空，i 即行号；上层只包含部分节点，nodes 为这些节点的行号（递增）
+ */
+struct GraphLevel {
+    vector<uint32_t> nodes;
+    vector<uint32_t> offsets;
+    vector<uint32_t> neighbors;
+};
+
+/**
+ * 外包给服务器的近邻图，只含邻接关系，不含任何明文距离
+ */
+struct ProximityGraph {
+    int M;
+    long entryPoint;            // 最高层的入口节点
+    vector<GraphLevel> levels;  // levels[0] 为最底层
+    uint64_t version;           // 建图或载入时的 datasetVersion，与当前版本不同说明图已失效
+
+    /**
+     * @Method: memoryBytes
+     * @Description: 邻接表占用的字节数
+     */
+    size_t memoryBytes() const;
+};
+
+/**
+ * 图搜索统计
+ */
+struct GraphSearchStats {
+    long scored;        // 计算了内积的密文行数
+    long hops;          // 从候选集中展开的节点数
+};
+
+// 近邻图，由 dealDataGraph 建立或 loadGraph 载入
+extern ProximityGraph proximityGraph;
+
+// 查询时默认的候选集大小
+extern int graphEfSearch;
+
+/**
+ * @Method: buildProximityGraph
+ * @Description: 数据拥有者在明文上按HNSW的方式逐点插入建图，邻居选择使用启发式剪枝
+ * @param const vector<vector<double>>& data_list 明文数据集
+ * @param const GraphConfig& config 建图参数
+ * @return ProximityGraph 压缩后的近邻图
+ */
+ProximityGraph buildProximityGraph(const vector<vector<double>>& data_list, const GraphConfig& config);
+
+/**
+ * @Method: dealDataGraph
+ * @Description: 读取数据集，在明文上建立近邻图，再加密数据
+ * @param char* fileString 读取数据集的地址
+ * @param const GraphConfig& config 建图参数
+ * @return 状态码，1：成功；0：失败
+ */
+int dealDataGraph(char* fileString, const GraphConfig& config = GraphConfig());
+
+/**
+ * @Method: graphTopK
+ * @Description: 服务器在近邻图上贪心下降并在第0层做束搜索，只对访问到的节点计算 c·q
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param int ef 候选集大小，不小于k，0 表示使用 graphEfSearch
+ * @param GraphSearchStats* stats 返回搜索统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> graphTopK(const VectorXd& q, int k, int ef = 0, GraphSearchStats* stats = NULL);
+
+/**
+ * @Method: saveGraph
+ * @Description: 将近邻图写入文件，与密文快照一起交给服务器
+ * @param const char* path 文件路径
+ * @return 状态码，1：成功；0：失败
+ */
+int saveGraph(const char* path);
+
+/**
+ * @Method: loadGraph
+ * @Description: 从文件载入近邻图。图需与当前载入的密文数据集配套（行数与维度一致），入口节点、
+ *               偏移与邻居都需在密文范围内，否则拒绝载入
+ * @param const char* path 文件路径
+ * @return 状态码，1：成功；0：失败
+ */
+int loadGraph(const char* path);
+
+/**
+ * @Method: SSQGraph
+ * @Description: 使用近邻图发起查询请求，结果为近似top-k
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQGraph(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //PROXIMITY_GRAPH_H
@@ -0,0 +1,165 @@
+/**
+* @author: WTY
+* @date: 2024/8/22
+* @description: 客户端明文查询结果缓存：相同的明文查询在数据集未变化时直接返回已解密的结果
+*/
+
+#include "Query_cache.h"
+#include "Block_index.h"
+#include <cstring>
+
+// 客户端查询缓存，由 SSQCached 使用
+QueryCache queryCache;
+
+QueryCache::QueryCache(const QueryCacheConfig& config) : config(config), version(datasetVersion), bytes(0) {
+    memset(&counters, 0, sizeof(counters));
+}
+
+/**
+ * @Method: hashQuery
+ * @Description: 对查询点的字节与k做FNV-1a哈希，-0.0 与 0.0 视为相同
+ */
+uint64_t QueryCache::hashQuery(const vector<double>& point, int k) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (size_t i = 0; i <= point.size(); i++) {
+        double value = i < point.size() ? point[i] + 0.0 : (double) k;
+        unsigned char bytes[sizeof(double)];
+        memcpy(bytes, &value, sizeof(double));
+        for (size_t j = 0; j < sizeof(double); j++) {
+            hash ^= bytes[j];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @Method: checkVersion
+ * @Description: 数据集版本号变化后清空所有条目，调用时需持有锁
+ */
+void QueryCache::checkVersion() {
+    uint64_t current = datasetVersion;
+    if (current != version) {
+        if (!entries.empty()) {
+            counters.invalidations++;
+        }
+        entries.clear();
+        index.clear();
+        bytes = 0;
+        version = current;
+    }
+}
+
+/**
+ * @Method: evict
+ * @Description: 从最久未使用的条目开始淘汰，直到满足容量上限，调用时需持有锁
+ */
+void QueryCache::evict() {
+    while (!entries.empty() && (entries.size() > config.maxEntries || bytes > config.maxBytes)) {
+        bytes -= entries.back().bytes;
+        index.erase(entries.back().hash);
+        entries.pop_back();
+        counters.evictions++;
+    }
+}
+
+bool QueryCache::lookup(const vector<double>& point, int k, vector<pair<double, long>>& winners,
+                        MatrixXd& decrypted) {
+    lock_guard<mutex> lock(mtx);
+    checkVersion();
+    auto it = index.find(hashQuery(point, k));
+    if (it == index.end() || it->second->k != k || it->second->point != point) {
+        counters.misses++;
+        return false;
+    }
+    // 移到最前
+    entries.splice(entries.begin(), entries, it->second);
+    winners = it->second->winners;
+    decrypted = it->second->decrypted;
+    counters.hits++;
+    return true;
+}
+
+void QueryCache::insert(const vector<double>& point, int k, const vector<pair<double, long>>& winners,
+                        const MatrixXd& decrypted) {
+    size_t entryBytes = sizeof(Entry) + point.size() * sizeof(double) +
+                        winners.size() * sizeof(pair<double, long>) + decrypted.size() * sizeof(double);
+    if (config.maxEntries == 0 || entryBytes > config.maxBytes) {
+        return;
+    }
+
+    lock_guard<mutex> lock(mtx);
+    checkVersion();
+    uint64_t hash = hashQuery(point, k);
+    auto it = index.find(hash);
+    if (it != index.end()) {
+        // 相同的查询或哈希冲突，都用新结果替换
+        bytes -= it->second->bytes;
+        entries.erase(it->second);
+        index.erase(it);
+    }
+    Entry entry;
+    entry.hash = hash;
+    entry.point = point;
+    entry.k = k;
+    entry.winners = winners;
+    entry.decrypted = decrypted;
+    entry.bytes = entryBytes;
+    entries.push_front(std::move(entry));
+    index[hash] = entries.begin();
+    bytes += entryBytes;
+    evict();
+}
+
+void QueryCache::clear() {
+    lock_guard<mutex> lock(mtx);
+    entries.clear();
+    index.clear();
+    bytes = 0;
+}
+
+QueryCacheStats QueryCache::stats() {
+    lock_guard<mutex> lock(mtx);
+    QueryCacheStats s = counters;
+    s.entries = entries.size();
+    s.bytes = bytes;
+    return s;
+}
+
+/**
+ * @Method: SSQCached
+ * @Description: 发起查询请求，相同的明文查询在数据集未变化时直接使用缓存的解密结果，不再扫描密文
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQCached(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point)) {
+        return 0;
+    }
+
+    vector<pair<double, long>> winners;
+    MatrixXd decrypted;
+    if (queryCache.lookup(point, k, winners, decrypted)) {
+        return writeResults(resultFilePath, winners, decrypted, resultFormat);
+    }
+
+    if (!denseKeyReady(point.size())) {
+        return 0;
+    }
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+    winners = scanTopK(q, k);
+
+    MatrixXd rows(winners.size(), encryptMatrix.rows());
+    for (size_t i = 0; i < winners.size(); i++) {
+        rows.row(i) = ciphertext[winners[i].second].transpose();
+        winners[i].second = originalRowId(winners[i].second);
+    }
+    decrypted = decryptRows(rows, encryptMatrixInverse);
+    queryCache.insert(point, k, winners, decrypted);
+    return writeResults(resultFilePath, winners, decrypted, resultFormat);
+}
@@ -0,0 +1,107 @@
+/**
+* @author: WTY
+* @date: 2024/8/22
+* @description: 客户端明文查询结果缓存：相同的明文查询在数据集未变化时直接返回已解密的结果
+*/
+
+#ifndef QUERY_CACHE_H
+#define QUERY_CACHE_H
+
+#include "SSQ.h"
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * 缓存配置，两个上限任一超过都会按LRU淘汰
+ */
+struct QueryCacheConfig {
+    size_t maxEntries;  // 最多缓存的查询数
+    size_t maxBytes;    // 缓存结果占用的最大字节数
+
+    QueryCacheConfig() : maxEntries(1024), maxBytes(64 << 20) {
+    }
+};
+
+/**
+ * 缓存统计
+ */
+struct QueryCacheStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;         // 因容量上限被淘汰的条目数
+    uint64_t invalidations;     // 因数据集版本变化整体失效的次数
+    size_t entries;
+    size_t bytes;
+};
+
+/**
+ * @Class: QueryCache
+ * @Description: 以 (明文查询点的哈希, k, 数据集版本号) 为键的LRU缓存。
+ *               缓存只保存在客户端，服务器看到的每次查询仍使用新的随机数 r21、r22 加密；
+ *               数据集版本号 datasetVersion 变化时所有条目失效
+ */
+class QueryCache {
+public:
+    explicit QueryCache(const QueryCacheConfig& config = QueryCacheConfig());
+
+    /**
+     * @Method: lookup
+     * @Description: 查找缓存的结果
+     * @param const vector<double>& point 明文查询点
+     * @param int k 返回的结果数
+     * @param vector<pair<double, long>>& winners 命中时返回 (距离, 行号)
+     * @param MatrixXd& decrypted 命中时返回解密后的结果行
+     * @return bool 是否命中
+     */
+    bool lookup(const vector<double>& point, int k, vector<pair<double, long>>& winners, MatrixXd& decrypted);
+
+    /**
+     * @Method: insert
+     * @Description: 缓存一次查询的结果，单条结果超过字节上限时不缓存
+     */
+    void insert(const vector<double>& point, int k, const vector<pair<double, long>>& winners,
+                const MatrixXd& decrypted);
+
+    void clear();
+
+    QueryCacheStats stats();
+
+private:
+    struct Entry {
+        uint64_t hash;
+        vector<double> point;   // 用于排除哈希冲突
+        int k;
+        vector<pair<double, long>> winners;
+        MatrixXd decrypted;
+        size_t bytes;
+    };
+
+    static uint64_t hashQuery(const vector<double>& point, int k);
+    void checkVersion();
+    void evict();
+
+    QueryCacheConfig config;
+    list<Entry> entries;    // 最近使用的在前
+    unordered_map<uint64_t, list<Entry>::iterator> index;
+    uint64_t version;       // 缓存条目对应的数据集版本号
+    size_t bytes;
+    QueryCacheStats counters;
+    mutex mtx;
+};
+
+// 客户端查询缓存，由 SSQCached 使用
+extern QueryCache queryCache;
+
+/**
+ * @Method: SSQCached
+ * @Description: 发起查询请求，相同的明文查询在数据集未变化时直接使用缓存的解密结果，不再扫描密文
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQCached(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //QUERY_CACHE_H
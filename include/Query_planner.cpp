@@ -0,0 +1,697 @@
+/**
+* @author: WTY
+* @date: 2024/9/4
+* @description: 基于代价的查询规划：根据数据集统计与查询参数估计各执行方式的代价并选择一种，
+*               记录估计与实际代价用于校准，并给出 EXPLAIN 形式的说明
+*/
+
+#include "Query_planner.h"
+#include "Block_index.h"
+#include "Proximity_graph.h"
+#include "Attribute_index.h"
+#include "Numa.h"
+#include "Out_of_core.h"
+#include "Anytime_query.h"
+#include "Snapshot.h"
+#include "Task_runtime.h"
+#include <mutex>
+#include <cmath>
+#include <sstream>
+#include <chrono>
+
+// 为 true 时 SSQ 在标准输出打印每个查询的 EXPLAIN
+bool queryPlannerExplain = false;
+
+// 与 scanTopK、批量扫描的任务划分一致
+static const long PLAN_SCAN_TASK_ROWS = 256 * 64;
+static const long PLAN_BATCH_TILE_ROWS = 256;
+
+// 校准系数的滑动平均权重与范围
+static const double CALIBRATION_ALPHA = 0.2;
+static const double MIN_FACTOR = 0.05;
+static const double MAX_FACTOR = 20;
+
+/**
+ * 代价模型的单位代价与从已执行查询中学到的量，受 plannerMutex 保护
+ */
+struct CostModel {
+    double scanNs;              // 内存扫描每个 行×维 的纳秒数（单线程）
+    double rowNs;               // 每行维护堆的纳秒数
+    double gemmNs;              // 批量扫描中每个 行×维×查询 的纳秒数
+    double gatherPenalty;       // 按位图或近邻图随机访问相对顺序扫描的倍数
+    double taskMillis;          // 一次并行分发的固定开销
+    double prunedFraction;      // 剪枝扫描实际访问的行比例
+    double graphScored;         // 近邻图搜索每次计算内积的行数
+    double diskMBs;             // 外存扫描的有效带宽
+};
+
+static CostModel costModel = {0.5, 2, 0.15, 3, 0.02, 0.5, 0, 1000};
+static PlanCalibration calibration[PLAN_KIND_COUNT];
+static bool calibrationInitialized = false;
+static mutex plannerMutex;
+
+static const char* PLAN_NAMES[PLAN_KIND_COUNT] = {"scan", "batch-scan", "pruned", "numa", "graph", "filtered",
+                                                  "outofcore", "anytime"};
+
+const char* planKindName(int kind) {
+    return kind >= 0 && kind < PLAN_KIND_COUNT ? PLAN_NAMES[kind] : "none";
+}
+
+static void initCalibrationLocked() {
+    if (!calibrationInitialized) {
+        for (int i = 0; i < PLAN_KIND_COUNT; i++) {
+            calibration[i] = PlanCalibration();
+            calibration[i].samples = 0;
+            calibration[i].factor = 1;
+            calibration[i].meanEstimated = 0;
+            calibration[i].meanActual = 0;
+            calibration[i].meanAbsError = 0;
+        }
+        calibrationInitialized = true;
+    }
+}
+
+/**
+ * @Method: collectDatasetStats
+ * @Description: 读取当前的数据集统计
+ */
+DatasetStats collectDatasetStats() {
+    DatasetStats stats;
+    const uint64_t version = datasetVersion;
+    stats.numa = !numaCiphertext.empty() && numaCiphertextVersion == version;
+    // dealDataNuma 只建立分区，不更新 ciphertext，此时 ciphertext 对应旧的加密矩阵；
+    // 维度与加密矩阵不符时（例如换了密钥而密文未更新）内存中的密文也不能使用
+    stats.dimMismatch = !ciphertext.empty() && !stats.numa && (long) ciphertext[0].size() != encryptMatrix.rows();
+    stats.resident = !ciphertext.empty() && !stats.numa && !stats.dimMismatch;
+    stats.rows = 0;
+    stats.dim = encryptMatrix.rows();
+    if (stats.numa) {
+        for (size_t n = 0; n < numaCiphertext.size(); n++) {
+            stats.rows += numaCiphertext[n].rows.rows();
+        }
+    } else if (stats.resident) {
+        stats.rows = (long) ciphertext.size();
+        stats.dim = ciphertext[0].size();
+    }
+    stats.prunedIndex = stats.resident && !blockIndex.blocks.empty() && blockIndex.version == version;
+    stats.blocks = stats.prunedIndex ? (long) blockIndex.blocks.size() : 0;
+    stats.graph = stats.resident && !proximityGraph.levels.empty() && proximityGraph.version == version &&
+                  (long) proximityGraph.levels[0].offsets.size() == stats.rows + 1;
+    stats.attributeRows = stats.resident && attributeIndex.version == version && attributeIndex.rows == stats.rows
+                          ? attributeIndex.rows : 0;
+    stats.threads = taskRuntime().threads();
+    return stats;
+}
+
+static PlanCandidate candidate(int kind, bool exact) {
+    PlanCandidate c;
+    c.kind = kind;
+    c.available = false;
+    c.exact = exact;
+    c.rawMillis = 0;
+    c.estimatedMillis = 0;
+    c.factor = 1;
+    return c;
+}
+
+/**
+ * @Method: parallelScanMillis
+ * @Description: 内存全量扫描 rows 行的估计时间，按 scanTopK 的任务划分计算并行度
+ */
+static double parallelScanMillis(const CostModel& model, double rows, double dim, int threads) {
+    double tasks = ceil(rows / PLAN_SCAN_TASK_ROWS);
+    double parallel = max(1.0, min((double) threads, tasks));
+    return rows * (dim * model.scanNs + model.rowNs) / parallel / 1e6 + (tasks > 1 ? model.taskMillis : 0);
+}
+
+/**
+ * @Method: planQuery
+ * @Description: 估计各执行方式的代价并选择：优先满足精确性要求，其次满足截止时间，最后取代价最低的
+ * @param const QueryParams& params 查询参数
+ * @return QueryPlan 查询计划
+ */
+QueryPlan planQuery(const QueryParams& params) {
+    QueryPlan plan;
+    plan.kind = -1;
+    plan.estimatedMillis = 0;
+    plan.dataset = collectDatasetStats();
+    plan.params = params;
+    plan.executed = false;
+    plan.actualMillis = 0;
+    plan.rowsTouched = 0;
+    plan.exact = false;
+
+    const DatasetStats& ds = plan.dataset;
+    const double n = (double) ds.rows, d = (double) ds.dim;
+    const int k = max(1, params.k);
+    const double batch = max(1, params.batchSize);
+    const bool filtered = !params.filters.empty();
+
+    CostModel model;
+    {
+        lock_guard<mutex> lock(plannerMutex);
+        initCalibrationLocked();
+        model = costModel;
+    }
+    // 每个候选的估计为整批查询的总时间
+    vector<PlanCandidate>& cs = plan.candidates;
+
+    PlanCandidate scan = candidate(PLAN_SCAN, true);
+    if (!ds.resident) {
+        scan.note = "密文不在内存中";
+    } else if (filtered) {
+        scan.note = "不支持属性过滤";
+    } else {
+        scan.available = true;
+        scan.rawMillis = batch * parallelScanMillis(model, n, d, ds.threads);
+        scan.note = "全量扫描 " + to_string(ds.rows) + " 行";
+    }
+    cs.push_back(scan);
+
+    PlanCandidate batchScan = candidate(PLAN_BATCH_SCAN, true);
+    if (!ds.resident) {
+        batchScan.note = "密文不在内存中";
+    } else if (filtered) {
+        batchScan.note = "不支持属性过滤";
+    } else if (batch < 2) {
+        batchScan.note = "只有一个查询";
+    } else {
+        double tasks = ceil(n / PLAN_SCAN_TASK_ROWS);
+        double parallel = max(1.0, min((double) ds.threads, tasks));
+        // 每块密文复制一次，与全部查询一次矩阵乘法，再逐个查询维护堆
+        batchScan.available = true;
+        batchScan.rawMillis = n * (d * model.scanNs + batch * (d * model.gemmNs + model.rowNs)) / parallel / 1e6 +
+                              model.taskMillis;
+        batchScan.note = to_string((int) batch) + " 个查询共享一次扫描";
+    }
+    cs.push_back(batchScan);
+
+    PlanCandidate pruned = candidate(PLAN_PRUNED, true);
+    if (!ds.prunedIndex) {
+        pruned.note = "没有与当前数据集一致的剪枝索引";
+    } else if (filtered) {
+        pruned.note = "不支持属性过滤";
+    } else {
+        // 块下界计算与排序，加上预计访问的行（单线程）
+        double blocks = (double) ds.blocks;
+        pruned.available = true;
+        pruned.rawMillis = batch * (blocks * (d * model.scanNs + log2(max(2.0, blocks)) * model.rowNs) +
+                                    model.prunedFraction * n * (d * model.scanNs + model.rowNs)) / 1e6;
+        char note[96];
+        snprintf(note, sizeof(note), "%ld 块，预计访问 %.0f%% 的行", ds.blocks, model.prunedFraction * 100);
+        pruned.note = note;
+    }
+    cs.push_back(pruned);
+
+    PlanCandidate numa = candidate(PLAN_NUMA, true);
+    if (!ds.numa) {
+        numa.note = "没有与当前数据集一致的NUMA分区";
+    } else if (filtered) {
+        numa.note = "不支持属性过滤";
+    } else {
+        size_t cpus = 0;
+        for (size_t i = 0; i < numaTopology().nodes.size(); i++) {
+            cpus += numaTopology().nodes[i].cpus.size();
+        }
+        numa.available = true;
+        numa.rawMillis = batch * (n * (d * model.scanNs + model.rowNs) / max((size_t) 1, cpus) / 1e6 +
+                                  model.taskMillis);
+        numa.note = to_string(numaCiphertext.size()) + " 个节点分区";
+    }
+    cs.push_back(numa);
+
+    PlanCandidate graph = candidate(PLAN_GRAPH, false);
+    if (!ds.graph) {
+        graph.note = "没有与当前数据集一致的近邻图";
+    } else if (filtered) {
+        graph.note = "不支持属性过滤";
+    } else if (params.requireExact) {
+        graph.note = "需要精确结果";
+    } else {
+        int ef = max(graphEfSearch, k);
+        double scored = model.graphScored > 0 ? model.graphScored
+                                              : min(n, (double) ef * 2 * max(2, proximityGraph.M) * 2);
+        graph.available = true;
+        graph.rawMillis = batch * scored * (d * model.scanNs * model.gatherPenalty + model.rowNs * 4) / 1e6;
+        char note[96];
+        snprintf(note, sizeof(note), "ef=%d，预计计算 %.0f 行内积", ef, scored);
+        graph.note = note;
+    }
+    cs.push_back(graph);
+
+    PlanCandidate filter = candidate(PLAN_FILTERED, true);
+    if (!filtered) {
+        filter.note = "没有过滤条件";
+    } else if (ds.attributeRows == 0) {
+        filter.note = "没有与数据集对应的属性索引";
+    } else {
+        // 选中行数精确已知
+        double selected = (double) filterRows(params.filters).cardinality();
+        filter.available = true;
+        filter.rawMillis = batch * (n / 64 * model.rowNs +
+                                    selected * (d * model.scanNs * model.gatherPenalty + model.rowNs)) / 1e6;
+        char note[96];
+        snprintf(note, sizeof(note), "选中 %.0f/%.0f 行", selected, n);
+        filter.note = note;
+    }
+    cs.push_back(filter);
+
+    PlanCandidate outOfCore = candidate(PLAN_OUT_OF_CORE, true);
+    SnapshotHeader header;
+    if (params.snapshotPath == NULL) {
+        outOfCore.note = "未提供快照文件";
+    } else if (filtered) {
+        outOfCore.note = "不支持属性过滤";
+    } else if (!readSnapshotHeader(params.snapshotPath, header) || (long) header.dim != ds.dim) {
+        outOfCore.note = "快照文件不可用或维度不符";
+    } else {
+        double bytes = (double) header.rows * header.dim * sizeof(double);
+        double ioMillis = bytes / (model.diskMBs * 1e6) * 1e3;
+        double cpuMillis = header.rows * (header.dim * model.scanNs + model.rowNs) / 1e6;
+        // 读取与计算重叠，取较慢者
+        outOfCore.available = true;
+        outOfCore.rawMillis = batch * max(ioMillis, cpuMillis);
+        char note[96];
+        snprintf(note, sizeof(note), "读取 %.1f MB，带宽 %.0f MB/s", bytes / (1 << 20), model.diskMBs);
+        outOfCore.note = note;
+    }
+    cs.push_back(outOfCore);
+
+    PlanCandidate anytime = candidate(PLAN_ANYTIME, false);
+    if (!ds.resident) {
+        anytime.note = "密文不在内存中";
+    } else if (filtered) {
+        anytime.note = "不支持属性过滤";
+    } else if (params.deadlineMillis <= 0) {
+        anytime.note = "没有截止时间";
+    } else if (params.requireExact) {
+        anytime.note = "需要精确结果";
+    } else {
+        anytime.available = true;
+        anytime.rawMillis = batch * min(params.deadlineMillis, n * (d * model.scanNs + model.rowNs) / 1e6);
+        anytime.note = string("截止时间内") + (ds.prunedIndex ? "按最优优先" : "按随机") + "顺序扫描";
+    }
+    cs.push_back(anytime);
+
+    {
+        lock_guard<mutex> lock(plannerMutex);
+        for (size_t i = 0; i < cs.size(); i++) {
+            cs[i].factor = calibration[cs[i].kind].factor;
+            cs[i].estimatedMillis = cs[i].rawMillis * cs[i].factor;
+        }
+    }
+
+    // 选择：精确 > 满足截止时间 > 代价低
+    const double deadline = params.deadlineMillis > 0 ? params.deadlineMillis * batch : 0;
+    int best = -1;
+    for (int pass = 0; pass < 2 && best < 0; pass++) {
+        for (size_t i = 0; i < cs.size(); i++) {
+            const PlanCandidate& c = cs[i];
+            if (!c.available || (c.kind == PLAN_ANYTIME && pass == 0)) {
+                continue;
+            }
+            if (pass == 0 && deadline > 0 && c.estimatedMillis > deadline) {
+                continue;
+            }
+            if (best < 0 || c.estimatedMillis < cs[best].estimatedMillis) {
+                best = (int) i;
+            }
+        }
+        if (best < 0 && deadline > 0) {
+            // 没有能在截止时间内完成的方式：允许近似时改用随时查询，否则取最快的精确方式
+            for (size_t i = 0; i < cs.size(); i++) {
+                if (cs[i].kind == PLAN_ANYTIME && cs[i].available) {
+                    best = (int) i;
+                }
+            }
+        }
+    }
+    if (best < 0) {
+        plan.reason = ds.dimMismatch ? "没有可用的执行方式：密文维度与加密矩阵不符"
+                                     : filtered ? "没有可用于属性过滤的索引" : "没有可用的密文数据";
+        return plan;
+    }
+
+    const PlanCandidate& chosen = cs[best];
+    plan.kind = chosen.kind;
+    plan.estimatedMillis = chosen.estimatedMillis;
+    int alternatives = 0;
+    for (size_t i = 0; i < cs.size(); i++) {
+        alternatives += cs[i].available ? 1 : 0;
+    }
+    if (chosen.kind == PLAN_ANYTIME) {
+        plan.reason = "没有能在截止时间内完成的精确方式，允许近似结果";
+    } else if (deadline > 0 && chosen.estimatedMillis > deadline) {
+        plan.reason = "所有精确方式都预计超过截止时间，选择最快的一种";
+    } else if (alternatives == 1) {
+        plan.reason = "唯一可用的执行方式";
+    } else {
+        plan.reason = string("可用方式中估计代价最低") + (deadline > 0 ? "且满足截止时间" : "");
+    }
+    return plan;
+}
+
+/**
+ * @Method: recordExecution
+ * @Description: 用实际代价更新执行方式的校准系数
+ */
+static void recordExecution(QueryPlan& plan, double actualMillis) {
+    plan.executed = true;
+    plan.actualMillis = actualMillis;
+    double raw = 0;
+    for (size_t i = 0; i < plan.candidates.size(); i++) {
+        if (plan.candidates[i].kind == plan.kind) {
+            raw = plan.candidates[i].rawMillis;
+        }
+    }
+    if (raw <= 0) {
+        return;
+    }
+    lock_guard<mutex> lock(plannerMutex);
+    PlanCalibration& c = calibration[plan.kind];
+    double n = (double) ++c.samples;
+    c.meanEstimated += (raw - c.meanEstimated) / n;
+    c.meanActual += (actualMillis - c.meanActual) / n;
+    c.meanAbsError += (fabs(plan.estimatedMillis - actualMillis) - c.meanAbsError) / n;
+    double ratio = min(MAX_FACTOR, max(MIN_FACTOR, actualMillis / raw));
+    c.factor = c.samples == 1 ? ratio : c.factor * (1 - CALIBRATION_ALPHA) + ratio * CALIBRATION_ALPHA;
+}
+
+static void learn(double& value, double observed) {
+    lock_guard<mutex> lock(plannerMutex);
+    value = value > 0 ? value * (1 - CALIBRATION_ALPHA) + observed * CALIBRATION_ALPHA : observed;
+}
+
+/**
+ * @Method: executeOne
+ * @Description: 按执行方式执行一个查询，返回计算了内积的行数与结果是否精确
+ */
+static vector<pair<double, long>> executeOne(const QueryPlan& plan, const VectorXd& q, long& touched, bool& exact) {
+    const int k = max(1, plan.params.k);
+    const long n = plan.dataset.rows;
+    touched = n;
+    exact = true;
+    switch (plan.kind) {
+        case PLAN_PRUNED: {
+            PruningStats stats;
+            vector<pair<double, long>> winners = prunedTopK(q, k, &stats);
+            touched = stats.rowsScanned;
+            if (n > 0) {
+                learn(costModel.prunedFraction, (double) stats.rowsScanned / n);
+            }
+            return winners;
+        }
+        case PLAN_NUMA:
+            return numaTopK(q, k);
+        case PLAN_GRAPH: {
+            GraphSearchStats stats;
+            vector<pair<double, long>> winners = graphTopK(q, k, 0, &stats);
+            touched = stats.scored;
+            exact = false;
+            learn(costModel.graphScored, (double) stats.scored);
+            return winners;
+        }
+        case PLAN_FILTERED: {
+            FilterStats stats;
+            vector<pair<double, long>> winners = filteredTopK(q, k, filterRows(plan.params.filters), &stats);
+            touched = stats.rowsSelected;
+            return winners;
+        }
+        case PLAN_OUT_OF_CORE: {
+            OutOfCoreConfig config;
+            OutOfCoreStats stats;
+            vector<pair<double, long>> winners = outOfCoreTopK(plan.params.snapshotPath, q, k, config, &stats);
+            touched = (long) stats.rows;
+            if (stats.bandwidthMBs > 0) {
+                learn(costModel.diskMBs, stats.bandwidthMBs);
+            }
+            return winners;
+        }
+        case PLAN_ANYTIME: {
+            AnytimeBudget budget;
+            budget.millis = plan.params.deadlineMillis;
+            budget.order = plan.dataset.prunedIndex ? ANYTIME_BEST_FIRST : ANYTIME_RANDOM;
+            AnytimeStats stats;
+            vector<pair<double, long>> winners = anytimeTopK(q, k, budget, &stats);
+            touched = stats.rowsScanned;
+            exact = stats.exact;
+            return winners;
+        }
+        default:
+            return scanTopK(q, k);
+    }
+}
+
+/**
+ * @Method: executePlan
+ * @Description: 按计划执行一个查询，记录实际代价用于校准
+ * @param QueryPlan& plan 查询计划，执行后填写实际代价
+ * @param const VectorXd& q 加密后的查询向量
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；行号为该执行方式的存储位置
+ */
+vector<pair<double, long>> executePlan(QueryPlan& plan, const VectorXd& q) {
+    if (plan.kind < 0) {
+        return vector<pair<double, long>>();
+    }
+    if (plan.kind == PLAN_BATCH_SCAN) {
+        MatrixXd queries = q;
+        return executePlanBatch(plan, queries)[0];
+    }
+    auto start = chrono::steady_clock::now();
+    vector<pair<double, long>> winners = executeOne(plan, q, plan.rowsTouched, plan.exact);
+    double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    // 计划按整批估计，单个查询按比例比较
+    recordExecution(plan, millis * max(1, plan.params.batchSize));
+    return winners;
+}
+
+/**
+ * @Method: executePlanBatch
+ * @Description: 按计划执行一批查询，PLAN_BATCH_SCAN 共享一次扫描，其他方式逐个执行
+ * @param QueryPlan& plan 查询计划
+ * @param const MatrixXd& queries (d+3)×b，每列一个加密后的查询向量
+ * @return vector<vector<pair<double, long>>> 每个查询的结果
+ */
+vector<vector<pair<double, long>>> executePlanBatch(QueryPlan& plan, const MatrixXd& queries) {
+    vector<vector<pair<double, long>>> results;
+    if (plan.kind < 0) {
+        return results;
+    }
+    auto start = chrono::steady_clock::now();
+    long touched = 0;
+    bool exact = true;
+    if (plan.kind == PLAN_BATCH_SCAN) {
+        results = batchScanTopK(queries, vector<int>(queries.cols(), max(1, plan.params.k)), taskRuntime().threads(),
+                                PLAN_BATCH_TILE_ROWS);
+        touched = plan.dataset.rows;
+    } else {
+        for (long j = 0; j < queries.cols(); j++) {
+            long rows;
+            bool oneExact;
+            results.push_back(executeOne(plan, queries.col(j), rows, oneExact));
+            touched += rows;
+            exact = exact && oneExact;
+        }
+    }
+    double millis = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    plan.rowsTouched = touched;
+    plan.exact = exact;
+    // 按实际查询数折算到计划的批大小
+    recordExecution(plan, millis * max(1, plan.params.batchSize) / max(1L, (long) queries.cols()));
+    return results;
+}
+
+/**
+ * @Method: outputPlanResults
+ * @Description: 按执行方式取出结果行（内存、NUMA分区或快照），解密并写入文件；剪枝重排过的行号换回原行号，
+ *               快照带行号列时换成其中的行号
+ * @return 状态码，1：成功；0：失败
+ */
+int outputPlanResults(const char* resultFilePath, const QueryPlan& plan, vector<pair<double, long>> winners,
+                      const MatrixXd& encryptMatrixInverse, int resultFormat) {
+    MatrixXd rows(winners.size(), encryptMatrixInverse.rows());
+    if (plan.kind == PLAN_OUT_OF_CORE) {
+        if (!readSnapshotRows(plan.params.snapshotPath, winners, rows) ||
+            !readSnapshotRowIds(plan.params.snapshotPath, winners)) {
+            return 0;
+        }
+    } else if (plan.kind == PLAN_NUMA) {
+        for (size_t i = 0; i < winners.size(); i++) {
+            for (size_t p = 0; p < numaCiphertext.size(); p++) {
+                const NumaPartition& partition = numaCiphertext[p];
+                long local = winners[i].second - partition.firstRow;
+                if (local >= 0 && local < partition.rows.rows()) {
+                    rows.row(i) = partition.rows.row(local);
+                }
+            }
+        }
+    } else {
+        // 密文被剪枝索引重排过时换回原数据集的行号（索引因追加过期后映射依然有效）
+        CiphertextReadGuard guard;
+        for (size_t i = 0; i < winners.size(); i++) {
+            rows.row(i) = ciphertext[winners[i].second].transpose();
+            winners[i].second = originalRowId(winners[i].second);
+        }
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
+
+static string formatMillis(double millis) {
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "%.3f", millis);
+    return buffer;
+}
+
+/**
+ * @Method: explainPlan
+ * @Description: EXPLAIN 形式的说明：数据集统计、各执行方式的估计与不可用原因、选择理由，执行后附实际代价
+ */
+string explainPlan(const QueryPlan& plan) {
+    const QueryParams& p = plan.params;
+    const DatasetStats& ds = plan.dataset;
+    ostringstream out;
+    out << "EXPLAIN k=" << p.k << " exact=" << (p.requireExact ? "yes" : "no")
+        << " deadline=" << (p.deadlineMillis > 0 ? formatMillis(p.deadlineMillis) + "ms" : "-")
+        << " batch=" << p.batchSize << " filters=" << p.filters.size() << "\n";
+    out << "  数据集：N=" << ds.rows << " dim=" << ds.dim << " 存放=" << (ds.numa ? "NUMA分区" : ds.resident ? "内存" : ds.dimMismatch ? "内存（维度不符）" : "外存")
+        << " 剪枝索引=" << (ds.prunedIndex ? to_string(ds.blocks) + "块" : "无") << " 近邻图=" << (ds.graph ? "有" : "无")
+        << " 属性索引=" << (ds.attributeRows > 0 ? "有" : "无") << " 线程=" << ds.threads << "\n";
+    char line[256];
+    snprintf(line, sizeof(line), "  %-1s %-11s %12s %8s %12s %6s  %s\n", "", "plan", "model(ms)", "factor", "est(ms)",
+             "exact", "note");
+    out << line;
+    for (size_t i = 0; i < plan.candidates.size(); i++) {
+        const PlanCandidate& c = plan.candidates[i];
+        if (c.available) {
+            snprintf(line, sizeof(line), "  %-1s %-11s %12.3f %8.2f %12.3f %6s  %s\n",
+                     c.kind == plan.kind ? "*" : "", planKindName(c.kind), c.rawMillis, c.factor,
+                     c.estimatedMillis, c.exact ? "yes" : "no", c.note.c_str());
+        } else {
+            snprintf(line, sizeof(line), "  %-1s %-11s %12s %8s %12s %6s  %s\n", "", planKindName(c.kind), "-", "-",
+                     "-", c.exact ? "yes" : "no", c.note.c_str());
+        }
+        out << line;
+    }
+    out << "  选择：" << planKindName(plan.kind) << "，" << plan.reason << "\n";
+    if (plan.executed) {
+        snprintf(line, sizeof(line), "  实际：%.3f 毫秒（估计 %.3f 毫秒），计算 %ld 行内积，结果%s\n", plan.actualMillis,
+                 plan.estimatedMillis, plan.rowsTouched, plan.exact ? "精确" : "近似");
+        out << line;
+    }
+    return out.str();
+}
+
+/**
+ * @Method: plannerCalibration
+ * @Description: 返回某种执行方式的校准统计
+ */
+PlanCalibration plannerCalibration(int kind) {
+    lock_guard<mutex> lock(plannerMutex);
+    initCalibrationLocked();
+    return calibration[kind >= 0 && kind < PLAN_KIND_COUNT ? kind : 0];
+}
+
+/**
+ * @Method: calibrateQueryPlanner
+ * @Description: 在合成数据上测量扫描内核的单位代价，替换代价模型的默认值
+ */
+void calibrateQueryPlanner() {
+    const long rows = 16384, dim = 64, batch = 32;
+    RowMatrixXd data = RowMatrixXd::Random(rows, dim);
+    VectorXd q = VectorXd::Random(dim);
+    VectorXd scores(rows);
+    const SimdKernels& kernels = simdKernels();
+
+    // 取多次中最快的一次，排除缺页与频率爬升
+    double scanBest = 1e30;
+    for (int r = 0; r < 5; r++) {
+        auto t0 = chrono::steady_clock::now();
+        kernels.scanBlock(data.data(), rows, dim, q.data(), dim, scores.data());
+        scanBest = min(scanBest, chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count());
+    }
+
+    TopKHeap heap(10);
+    auto t0 = chrono::steady_clock::now();
+    for (long i = 0; i < rows; i++) {
+        heap.push(scores[i], i);
+    }
+    double heapNanos = chrono::duration<double, nano>(chrono::steady_clock::now() - t0).count();
+
+    MatrixXd queries = MatrixXd::Random(dim, batch);
+    MatrixXd products(PLAN_BATCH_TILE_ROWS, batch);
+    double gemmBest = 1e30;
+    for (int r = 0; r < 5; r++) {
+        auto t1 = chrono::steady_clock::now();
+        for (long b = 0; b + PLAN_BATCH_TILE_ROWS <= rows; b += PLAN_BATCH_TILE_ROWS) {
+            products.noalias() = data.middleRows(b, PLAN_BATCH_TILE_ROWS) * queries;
+        }
+        gemmBest = min(gemmBest, chrono::duration<double, nano>(chrono::steady_clock::now() - t1).count());
+    }
+
+    lock_guard<mutex> lock(plannerMutex);
+    costModel.scanNs = max(0.01, scanBest / (rows * dim));
+    costModel.rowNs = max(0.1, heapNanos / rows);
+    costModel.gemmNs = max(0.005, gemmBest / (rows * dim * batch));
+    printf("查询规划校准：扫描 %.3f 纳秒/元素，堆 %.3f 纳秒/行，批量矩阵乘法 %.3f 纳秒/元素\n", costModel.scanNs,
+           costModel.rowNs, costModel.gemmNs);
+    fflush(stdout);
+}
+
+/**
+ * @Method: printPlannerCalibration
+ * @Description: 输出各执行方式的估计与实际代价
+ */
+void printPlannerCalibration() {
+    printf("%-11s %8s %14s %14s %14s %8s\n", "plan", "samples", "model(ms)", "actual(ms)", "|err|(ms)", "factor");
+    for (int kind = 0; kind < PLAN_KIND_COUNT; kind++) {
+        PlanCalibration c = plannerCalibration(kind);
+        if (c.samples == 0) {
+            continue;
+        }
+        printf("%-11s %8llu %14.3f %14.3f %14.3f %8.2f\n", planKindName(kind), (unsigned long long) c.samples,
+               c.meanEstimated, c.meanActual, c.meanAbsError, c.factor);
+    }
+    fflush(stdout);
+}
+
+/**
+ * @Method: SSQPlanned
+ * @Description: 由查询规划选择执行方式并发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const QueryParams& params 查询参数，k 取查询文件中的值
+ * @param int resultFormat 结果格式 ResultFormat
+ * @param QueryPlan* plan 返回执行的计划，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQPlanned(char* fileString, char* resultFilePath, const QueryParams& params, int resultFormat,
+               QueryPlan* plan) {
+    QueryParams actual = params;
+    vector<double> point;
+    if (!readQuery(fileString, actual.k, point) || !denseKeyReady(point.size())) {
+        return 0;
+    }
+    actual.batchSize = 1;
+
+    QueryPlan chosen = planQuery(actual);
+    if (chosen.kind < 0) {
+        cerr << "No execution strategy for query: " << chosen.reason << endl;
+        if (plan != NULL) {
+            *plan = chosen;
+        }
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+    vector<pair<double, long>> winners = executePlan(chosen, q);
+    if (queryPlannerExplain) {
+        printf("%s", explainPlan(chosen).c_str());
+        fflush(stdout);
+    }
+    int ok = outputPlanResults(resultFilePath, chosen, winners, encryptMatrixInverse, resultFormat);
+    if (plan != NULL) {
+        *plan = chosen;
+    }
+    return ok;
+}
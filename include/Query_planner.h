@@ -0,0 +1,188 @@
+/**
+* @author: WTY
+* @date: 2024/9/4
+* @description: 基于代价的查询规划：根据数据集统计与查询参数估计各执行方式的代价并选择一种，
+*               记录估计与实际代价用于校准，并给出 EXPLAIN 形式的说明
+*/
+
+#ifndef QUERY_PLANNER_H
+#define QUERY_PLANNER_H
+
+#include "SSQ.h"
+
+/**
+ * 执行方式
+ */
+enum PlanKind {
+    PLAN_SCAN = 0,          // 内存中全量扫描（任务运行时并行）
+    PLAN_BATCH_SCAN = 1,    // 一批查询共享一次分块矩阵乘法扫描
+    PLAN_PRUNED = 2,        // 剪枝索引，按块下界跳过
+    PLAN_NUMA = 3,          // 按NUMA节点分区扫描
+    PLAN_GRAPH = 4,         // 近邻图搜索，近似
+    PLAN_FILTERED = 5,      // 属性过滤后只扫描选中的行
+    PLAN_OUT_OF_CORE = 6,   // 从快照文件流式扫描
+    PLAN_ANYTIME = 7,       // 在截止时间内返回已扫描部分的top-k，可能近似
+    PLAN_KIND_COUNT = 8
+};
+
+/**
+ * @Method: planKindName
+ * @Description: 执行方式的名称，用于 EXPLAIN 与统计
+ */
+const char* planKindName(int kind);
+
+/**
+ * 数据集统计，由各导入方式留下的全局结构得出
+ */
+struct DatasetStats {
+    long rows;
+    long dim;                   // 密文维度 d+3
+    bool resident;              // 密文数据集 ciphertext 在内存中且与当前加密矩阵对应
+    bool dimMismatch;           // ciphertext 的维度与当前加密矩阵不符，内存中的密文不可用
+    bool prunedIndex;           // 剪枝索引与当前数据集版本一致
+    long blocks;                // 剪枝索引的块数
+    bool graph;                 // 近邻图与当前数据集版本一致
+    bool numa;                  // NUMA 分区与当前数据集版本一致
+    long attributeRows;         // 属性索引覆盖的行数，0 表示没有属性索引
+    int threads;                // 任务运行时的线程数
+};
+
+/**
+ * @Method: collectDatasetStats
+ * @Description: 读取当前的数据集统计
+ */
+DatasetStats collectDatasetStats();
+
+/**
+ * 查询参数
+ */
+struct QueryParams {
+    int k;
+    vector<string> filters;     // 属性令牌，全部满足的行才参与排序
+    double deadlineMillis;      // 截止时间，0 表示没有
+    int batchSize;              // 同时执行的查询数
+    bool requireExact;          // 是否必须与全量扫描结果一致
+    const char* snapshotPath;   // 密文不在内存中时可以扫描的快照文件
+
+    QueryParams() : k(10), deadlineMillis(0), batchSize(1), requireExact(true), snapshotPath(NULL) {
+    }
+};
+
+/**
+ * 一种执行方式的估计
+ */
+struct PlanCandidate {
+    int kind;                   // PlanKind
+    bool available;             // 数据结构存在且满足查询要求
+    bool exact;                 // 结果是否精确
+    double rawMillis;           // 代价模型的估计
+    double estimatedMillis;     // 乘以校准系数后的估计
+    double factor;              // 校准系数
+    string note;                // 不可用的原因或估计依据
+};
+
+/**
+ * 查询计划与执行结果
+ */
+struct QueryPlan {
+    int kind;                           // 选中的 PlanKind，-1 表示没有可用的执行方式
+    double estimatedMillis;
+    string reason;
+    DatasetStats dataset;
+    QueryParams params;
+    vector<PlanCandidate> candidates;
+
+    // 执行后填写
+    bool executed;
+    double actualMillis;                // 与 estimatedMillis 同口径，按 batchSize 个查询折算
+    long rowsTouched;                   // 计算了内积的行数
+    bool exact;                         // 实际结果是否精确（随时查询可能提前扫描完）
+};
+
+/**
+ * @Method: planQuery
+ * @Description: 估计各执行方式的代价并选择：优先满足精确性要求，其次满足截止时间，最后取代价最低的
+ * @param const QueryParams& params 查询参数
+ * @return QueryPlan 查询计划
+ */
+QueryPlan planQuery(const QueryParams& params);
+
+/**
+ * @Method: executePlan
+ * @Description: 按计划执行一个查询，记录实际代价用于校准
+ * @param QueryPlan& plan 查询计划，执行后填写实际代价
+ * @param const VectorXd& q 加密后的查询向量
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；行号为该执行方式的存储位置
+ */
+vector<pair<double, long>> executePlan(QueryPlan& plan, const VectorXd& q);
+
+/**
+ * @Method: executePlanBatch
+ * @Description: 按计划执行一批查询，PLAN_BATCH_SCAN 共享一次扫描，其他方式逐个执行
+ * @param QueryPlan& plan 查询计划
+ * @param const MatrixXd& queries (d+3)×b，每列一个加密后的查询向量
+ * @return vector<vector<pair<double, long>>> 每个查询的结果
+ */
+vector<vector<pair<double, long>>> executePlanBatch(QueryPlan& plan, const MatrixXd& queries);
+
+/**
+ * @Method: outputPlanResults
+ * @Description: 按执行方式取出结果行（内存、NUMA分区或快照），解密并写入文件；剪枝重排过的行号换回原行号
+ * @return 状态码，1：成功；0：失败
+ */
+int outputPlanResults(const char* resultFilePath, const QueryPlan& plan, vector<pair<double, long>> winners,
+                      const MatrixXd& encryptMatrixInverse, int resultFormat);
+
+/**
+ * @Method: explainPlan
+ * @Description: EXPLAIN 形式的说明：数据集统计、各执行方式的估计与不可用原因、选择理由，执行后附实际代价
+ */
+string explainPlan(const QueryPlan& plan);
+
+// 为 true 时 SSQ 在标准输出打印每个查询的 EXPLAIN
+extern bool queryPlannerExplain;
+
+/**
+ * 一种执行方式的校准统计
+ */
+struct PlanCalibration {
+    uint64_t samples;
+    double factor;              // 实际/估计 的指数滑动平均，下一次估计乘以该系数
+    double meanEstimated;       // 校准前估计的平均值
+    double meanActual;
+    double meanAbsError;        // |校准后估计 - 实际| 的平均值
+};
+
+/**
+ * @Method: plannerCalibration
+ * @Description: 返回某种执行方式的校准统计
+ */
+PlanCalibration plannerCalibration(int kind);
+
+/**
+ * @Method: calibrateQueryPlanner
+ * @Description: 在合成数据上测量扫描内核的单位代价，替换代价模型的默认值
+ */
+void calibrateQueryPlanner();
+
+/**
+ * @Method: printPlannerCalibration
+ * @Description: 输出各执行方式的估计与实际代价
+ */
+void printPlannerCalibration();
+
+/**
+ * @Method: SSQPlanned
+ * @Description: 由查询规划选择执行方式并发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param const QueryParams& params 查询参数，k 取查询文件中的值
+ * @param int resultFormat 结果格式 ResultFormat
+ * @param QueryPlan* plan 返回执行的计划，可为 NULL
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQPlanned(char* fileString, char* resultFilePath, const QueryParams& params,
+               int resultFormat = RESULT_TEXT, QueryPlan* plan = NULL);
+
+
+#endif //QUERY_PLANNER_H
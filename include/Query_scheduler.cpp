@@ -0,0 +1,232 @@
+/**
+* @author: WTY
+* @date: 2024/8/21
+* @description: 异步查询调度器：把短时间窗口内到达的并发查询合并成一次分块的多查询扫描
+*/
+
+#include "Query_scheduler.h"
+#include <cstring>
+#include <iterator>
+
+// 多查询扫描时每块的密文行数
+static const long SCHEDULER_TILE_ROWS = 256;
+
+QueryScheduler::QueryScheduler(const SchedulerConfig& config)
+        : config(config), stopping(false), totalQueueMillis(0) {
+    memset(&counters, 0, sizeof(counters));
+    worker = thread(&QueryScheduler::run, this);
+}
+
+QueryScheduler::~QueryScheduler() {
+    stop();
+}
+
+future<QueryResult> QueryScheduler::submit(const VectorXd& q, int k, double deadlineMillis) {
+    PendingQuery pending;
+    pending.q = q;
+    pending.k = k;
+    pending.submitted = Clock::now();
+    pending.hasDeadline = deadlineMillis > 0;
+    pending.deadline = pending.submitted + chrono::microseconds((long long) (deadlineMillis * 1000));
+    pending.result = make_shared<promise<QueryResult>>();
+    future<QueryResult> result = pending.result->get_future();
+    enqueue(std::move(pending));
+    return result;
+}
+
+void QueryScheduler::submit(const VectorXd& q, int k, double deadlineMillis, QueryCallback callback) {
+    PendingQuery pending;
+    pending.q = q;
+    pending.k = k;
+    pending.submitted = Clock::now();
+    pending.hasDeadline = deadlineMillis > 0;
+    pending.deadline = pending.submitted + chrono::microseconds((long long) (deadlineMillis * 1000));
+    pending.callback = callback;
+    enqueue(std::move(pending));
+}
+
+/**
+ * @Method: currentDim
+ * @Description: 当前密文的维度，没有密文时为 -1
+ */
+static long currentDim() {
+    CiphertextReadGuard guard;
+    return ciphertext.empty() ? -1 : (long) ciphertext[0].size();
+}
+
+void QueryScheduler::enqueue(PendingQuery pending) {
+    // 维度不符的查询进入批量扫描会越界写查询矩阵，k 不是正数时没有结果，都不进入队列
+    bool valid = pending.k > 0 && pending.q.size() == currentDim();
+    unique_lock<mutex> lock(mtx);
+    counters.submitted++;
+    if (!valid) {
+        counters.invalid++;
+        lock.unlock();
+        QueryResult result;
+        result.status = QUERY_INVALID;
+        finish(pending, result);
+        return;
+    }
+    // 准入控制
+    if (stopping || pendingQueries.size() >= config.maxPending) {
+        QueryResult result;
+        result.status = stopping ? QUERY_SHUTDOWN : QUERY_REJECTED;
+        if (!stopping) {
+            counters.rejected++;
+        }
+        lock.unlock();
+        finish(pending, result);
+        return;
+    }
+    pendingQueries.push_back(std::move(pending));
+    arrived.notify_one();
+}
+
+void QueryScheduler::finish(PendingQuery& pending, QueryResult& result) {
+    if (pending.result) {
+        pending.result->set_value(result);
+    }
+    if (pending.callback) {
+        pending.callback(result);
+    }
+}
+
+SchedulerStats QueryScheduler::stats() {
+    lock_guard<mutex> lock(mtx);
+    SchedulerStats s = counters;
+    s.avgBatchSize = s.batches > 0 ? (double) s.completed / s.batches : 0;
+    s.avgQueueMillis = s.completed > 0 ? totalQueueMillis / s.completed : 0;
+    s.queriesPerScanSecond = s.scanMillis > 0 ? s.completed * 1000.0 / s.scanMillis : 0;
+    return s;
+}
+
+void QueryScheduler::stop() {
+    {
+        lock_guard<mutex> lock(mtx);
+        if (stopping) {
+            return;
+        }
+        stopping = true;
+    }
+    arrived.notify_all();
+    worker.join();
+}
+
+void QueryScheduler::run() {
+    while (true) {
+        vector<PendingQuery> batch;
+        {
+            unique_lock<mutex> lock(mtx);
+            arrived.wait(lock, [this] { return !pendingQueries.empty() || stopping; });
+            if (stopping) {
+                break;
+            }
+            // 窗口从最早的查询到达时开始，遇到更早的截止时间则提前结束
+            Clock::time_point closeAt = pendingQueries.front().submitted +
+                                        chrono::microseconds((long long) (config.windowMillis * 1000));
+            for (size_t i = 0; i < pendingQueries.size(); i++) {
+                if (pendingQueries[i].hasDeadline && pendingQueries[i].deadline < closeAt) {
+                    closeAt = pendingQueries[i].deadline;
+                }
+            }
+            arrived.wait_until(lock, closeAt,
+                               [this] { return pendingQueries.size() >= config.maxBatch || stopping; });
+            if (stopping) {
+                break;
+            }
+            while (!pendingQueries.empty() && batch.size() < config.maxBatch) {
+                batch.push_back(std::move(pendingQueries.front()));
+                pendingQueries.pop_front();
+            }
+        }
+
+        // 已过截止时间的查询不再扫描；排队期间重新导入了数据集、维度不再相符的查询以 QUERY_INVALID 结束
+        Clock::time_point now = Clock::now();
+        const long dim = currentDim();
+        vector<PendingQuery> live;
+        for (size_t i = 0; i < batch.size(); i++) {
+            bool expired = batch[i].hasDeadline && batch[i].deadline <= now;
+            if (expired || batch[i].q.size() != dim) {
+                QueryResult result;
+                result.status = expired ? QUERY_EXPIRED : QUERY_INVALID;
+                result.queueMillis = chrono::duration<double, milli>(now - batch[i].submitted).count();
+                {
+                    lock_guard<mutex> lock(mtx);
+                    (expired ? counters.expired : counters.invalid)++;
+                }
+                finish(batch[i], result);
+            } else {
+                live.push_back(std::move(batch[i]));
+            }
+        }
+        // 扫描的临时空间在内存预算内记账，放不下时把本批拆成更小的批依次扫描
+        const long threads = max(1, config.scanThreads);
+        int maxK = 0;
+        for (size_t i = 0; i < live.size(); i++) {
+            maxK = max(maxK, live[i].k);
+        }
+        for (size_t begin = 0; begin < live.size();) {
+            ScopedScratchCharge scratch(MEM_QUERY_SCRATCH, threads * SCHEDULER_TILE_ROWS * dim * sizeof(double),
+                                        (threads * SCHEDULER_TILE_ROWS + dim) * sizeof(double) +
+                                        threads * maxK * sizeof(pair<double, long>),
+                                        live.size() - begin);
+            vector<PendingQuery> part(make_move_iterator(live.begin() + begin),
+                                      make_move_iterator(live.begin() + begin + scratch.units()));
+            scanBatch(part);
+            begin += part.size();
+        }
+    }
+
+    // 停止时未开始的查询全部结束
+    deque<PendingQuery> remaining;
+    {
+        lock_guard<mutex> lock(mtx);
+        remaining.swap(pendingQueries);
+    }
+    for (size_t i = 0; i < remaining.size(); i++) {
+        QueryResult result;
+        result.status = QUERY_SHUTDOWN;
+        finish(remaining[i], result);
+    }
+}
+
+void QueryScheduler::scanBatch(vector<PendingQuery>& batch) {
+    Clock::time_point start = Clock::now();
+    const long b = (long) batch.size();
+    // run 已保证本批查询的维度相同，扫描时 batchScanTopK 在读锁内再与密文比较
+    const long dim = batch[0].q.size();
+
+    MatrixXd Q(dim, b);
+    for (long j = 0; j < b; j++) {
+        Q.col(j) = batch[j].q;
+    }
+
+    // 密文按段作为查询任务提交到任务运行时，每块密文与本批全部查询一次矩阵乘法
+    vector<int> ks(b);
+    for (long j = 0; j < b; j++) {
+        ks[j] = batch[j].k;
+    }
+    vector<vector<pair<double, long>>> winners = batchScanTopK(Q, ks, config.scanThreads, SCHEDULER_TILE_ROWS);
+
+    Clock::time_point end = Clock::now();
+    double scanMillis = chrono::duration<double, milli>(end - start).count();
+    double queueMillis = 0;
+    vector<QueryResult> results(b);
+    for (long j = 0; j < b; j++) {
+        results[j].status = QUERY_OK;
+        results[j].winners.swap(winners[j]);
+        results[j].queueMillis = chrono::duration<double, milli>(start - batch[j].submitted).count();
+        results[j].batchSize = (int) b;
+        queueMillis += results[j].queueMillis;
+    }
+    {
+        lock_guard<mutex> lock(mtx);
+        counters.batches++;
+        counters.completed += b;
+        counters.scanMillis += scanMillis;
+        totalQueueMillis += queueMillis;
+    }
+    for (long j = 0; j < b; j++) {
+        finish(batch[j], results[j]);
+    }
+}
@@ -0,0 +1,136 @@
+/**
+* @author: WTY
+* @date: 2024/8/21
+* @description: 异步查询调度器：把短时间窗口内到达的并发查询合并成一次分块的多查询扫描
+*/
+
+#ifndef QUERY_SCHEDULER_H
+#define QUERY_SCHEDULER_H
+
+#include "SSQ.h"
+#include <future>
+#include <functional>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// 查询状态
+enum QueryStatus {
+    QUERY_OK = 0,           // 成功
+    QUERY_REJECTED = 1,     // 排队的查询过多，被准入控制拒绝
+    QUERY_EXPIRED = 2,      // 开始扫描前已超过截止时间
+    QUERY_SHUTDOWN = 3,     // 调度器已停止
+    QUERY_INVALID = 4       // 查询向量的维度与密文不符，或 k 不是正数
+};
+
+/**
+ * 单个查询的结果
+ */
+struct QueryResult {
+    int status;                             // QueryStatus
+    vector<pair<double, long>> winners;     // (距离, 行号)，距离从大到小
+    double queueMillis;                     // 从提交到开始扫描的等待时间
+    int batchSize;                          // 与之合并扫描的查询数
+
+    QueryResult() : status(QUERY_OK), queueMillis(0), batchSize(0) {
+    }
+};
+
+/**
+ * 调度器配置
+ */
+struct SchedulerConfig {
+    double windowMillis;    // 第一个查询到达后最多等待多久再开始扫描
+    size_t maxBatch;        // 每批最多合并的查询数，攒满立即开始；内存预算放不下时拆成更小的批
+    size_t maxPending;      // 排队查询数上限，超过时拒绝新查询
+    int scanThreads;        // 每批扫描在任务运行时上最多同时执行的任务数
+
+    SchedulerConfig() : windowMillis(2), maxBatch(32), maxPending(1024), scanThreads(1) {
+    }
+};
+
+/**
+ * 调度统计
+ */
+struct SchedulerStats {
+    uint64_t submitted;
+    uint64_t completed;
+    uint64_t rejected;
+    uint64_t expired;
+    uint64_t invalid;
+    uint64_t batches;
+    double avgBatchSize;        // 平均每批查询数，即每次全量扫描服务的查询数
+    double avgQueueMillis;      // 因合并而增加的平均排队时间
+    double scanMillis;          // 扫描总时间
+    double queriesPerScanSecond;// 每秒扫描时间完成的查询数
+};
+
+typedef function<void(const QueryResult&)> QueryCallback;
+
+/**
+ * @Class: QueryScheduler
+ * @Description: 后台线程收集窗口内的查询，对全局密文数据集做一次多查询的分块扫描，
+ *               每块密文与所有查询做一次矩阵乘法，再分别维护各自的top-k。
+ *               扫描持有 ciphertext 的读锁，可与 insertBatch 并发；整体替换数据集的导入之前需先 stop
+ */
+class QueryScheduler {
+public:
+    explicit QueryScheduler(const SchedulerConfig& config = SchedulerConfig());
+    ~QueryScheduler();
+
+    /**
+     * @Method: submit
+     * @Description: 提交一个加密后的查询
+     * @param const VectorXd& q 加密后的查询向量
+     * @param int k 返回的结果数
+     * @param double deadlineMillis 从现在起的截止时间，0 表示没有截止时间
+     * @return future<QueryResult> 查询结果
+     */
+    future<QueryResult> submit(const VectorXd& q, int k, double deadlineMillis = 0);
+
+    /**
+     * @Method: submit
+     * @Description: 提交一个加密后的查询，完成时在调度线程上调用 callback
+     */
+    void submit(const VectorXd& q, int k, double deadlineMillis, QueryCallback callback);
+
+    SchedulerStats stats();
+
+    /**
+     * @Method: stop
+     * @Description: 停止调度线程，尚未开始的查询以 QUERY_SHUTDOWN 结束
+     */
+    void stop();
+
+private:
+    typedef chrono::steady_clock Clock;
+
+    struct PendingQuery {
+        VectorXd q;
+        int k;
+        Clock::time_point submitted;
+        Clock::time_point deadline;
+        bool hasDeadline;
+        shared_ptr<promise<QueryResult>> result;
+        QueryCallback callback;
+    };
+
+    void enqueue(PendingQuery pending);
+    void run();
+    void scanBatch(vector<PendingQuery>& batch);
+    static void finish(PendingQuery& pending, QueryResult& result);
+
+    SchedulerConfig config;
+    deque<PendingQuery> pendingQueries;
+    mutex mtx;
+    condition_variable arrived;
+    bool stopping;
+    thread worker;
+
+    SchedulerStats counters;
+    double totalQueueMillis;
+};
+
+
+#endif //QUERY_SCHEDULER_H
@@ -0,0 +1,237 @@
+/**
+* @author: WTY
+* @date: 2024/8/16
+* @description: 查询结果的批量解密与带缓冲的文本/二进制写出
+*/
+
+#include "Result_writer.h"
+#include <cmath>
+#include <cstring>
+
+// 10的整数次幂，用于定点格式化
+static const double POW10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11};
+static const uint64_t POW10_INT[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+                                     10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+                                     100000000000ULL};
+
+// 与 ostream 默认精度一致
+static const int FORMAT_PRECISION = 6;
+
+BufferedWriter::BufferedWriter(size_t bufferSize) : file(NULL), buffer(bufferSize, 0, TrackedAllocator<char>(MEM_RESULT)), used(0), failed(false) {
+}
+
+BufferedWriter::~BufferedWriter() {
+    close();
+}
+
+bool BufferedWriter::open(const char* path) {
+    close();
+    file = fopen(path, "wb");
+    used = 0;
+    failed = (file == NULL);
+    return !failed;
+}
+
+void BufferedWriter::close() {
+    if (file != NULL) {
+        flush();
+        if (fclose(file) != 0) {
+            failed = true;
+        }
+        file = NULL;
+    }
+}
+
+bool BufferedWriter::good() const {
+    return !failed;
+}
+
+void BufferedWriter::flush() {
+    if (used > 0 && file != NULL) {
+        if (fwrite(buffer.data(), 1, used, file) != used) {
+            failed = true;
+        }
+    }
+    used = 0;
+}
+
+void BufferedWriter::write(const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        if (used == buffer.size()) {
+            flush();
+        }
+        size_t n = min(size, buffer.size() - used);
+        memcpy(buffer.data() + used, p, n);
+        used += n;
+        p += n;
+        size -= n;
+    }
+}
+
+void BufferedWriter::writeChar(char c) {
+    if (used == buffer.size()) {
+        flush();
+    }
+    buffer[used++] = c;
+}
+
+void BufferedWriter::writeDouble(double value) {
+    if (buffer.size() - used < 32) {
+        flush();
+    }
+    used += formatDouble(value, buffer.data() + used);
+}
+
+/**
+ * @Method: formatDouble
+ * @Description: 快速格式化浮点数，输出与 ostream 默认格式(%g，6位有效数字)一致；
+ *               舍入位接近 .5 以及需要科学计数法时回退到 snprintf
+ * @param double value 待格式化的数
+ * @param char* out 输出缓冲区，至少32字节
+ * @return int 写入的字符数
+ */
+int formatDouble(double value, char* out) {
+    if (value == 0) {
+        if (signbit(value)) {
+            out[0] = '-';
+            out[1] = '0';
+            return 2;
+        }
+        out[0] = '0';
+        return 1;
+    }
+    if (!std::isfinite(value)) {
+        return snprintf(out, 32, "%g", value);
+    }
+
+    double a = fabs(value);
+    int exponent = (int) floor(log10(a));
+    uint64_t mantissa = 0;
+    int decimals = 0;
+    // log10 可能有一位误差，四舍五入也可能进位到下一个数量级，最多修正两次
+    for (int attempt = 0; attempt < 3; attempt++) {
+        if (exponent < -4 || exponent >= FORMAT_PRECISION) {
+            // 科学计数法的情况很少出现，交给 snprintf
+            return snprintf(out, 32, "%g", value);
+        }
+        decimals = FORMAT_PRECISION - 1 - exponent;
+        double scaled = a * POW10[decimals];
+        // 乘法有舍入误差，且 llround 对恰好的 .5 向远离0舍入而 printf 按精确值就近取偶；
+        // 接近 .5 时无法确定舍入方向，交给 snprintf
+        if (fabs(scaled - floor(scaled) - 0.5) < 1e-6) {
+            return snprintf(out, 32, "%g", value);
+        }
+        mantissa = (uint64_t) llround(scaled);
+        if (mantissa >= POW10_INT[FORMAT_PRECISION]) {
+            exponent++;
+        } else if (mantissa < POW10_INT[FORMAT_PRECISION - 1]) {
+            exponent--;
+        } else {
+            break;
+        }
+    }
+
+    // 去掉小数部分末尾的0
+    while (decimals > 0 && mantissa % 10 == 0) {
+        mantissa /= 10;
+        decimals--;
+    }
+
+    char digits[24];
+    int n = 0;
+    do {
+        digits[n++] = (char) ('0' + mantissa % 10);
+        mantissa /= 10;
+    } while (mantissa > 0);
+    // 纯小数需要补足前导0，例如 0.00123
+    while (n <= decimals) {
+        digits[n++] = '0';
+    }
+
+    int length = 0;
+    if (value < 0) {
+        out[length++] = '-';
+    }
+    for (int i = n - 1; i >= 0; i--) {
+        out[length++] = digits[i];
+        if (i == decimals && decimals > 0) {
+            out[length++] = '.';
+        }
+    }
+    return length;
+}
+
+/**
+ * @Method: decryptRows
+ * @Description: 一次矩阵乘法解密全部结果行
+ * @param const MatrixXd& rows 密文行，每行一条 k×(d+3)
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @return MatrixXd 解密后的扩展向量，每行一条
+ */
+MatrixXd decryptRows(const MatrixXd& rows, const MatrixXd& encryptMatrixInverse) {
+    MatrixXd decrypted;
+    decrypted.noalias() = rows * encryptMatrixInverse;
+    return decrypted;
+}
+
+/**
+ * @Method: writeResults
+ * @Description: 将解密后的结果写入文件
+ * @param const char* resultFilePath 输出文件
+ * @param const vector<pair<double, long>>& winners (分数, 行号)，按输出顺序排列
+ * @param const MatrixXd& decrypted 解密后的扩展向量 [平方和, -2x, r11, -r11]，与winners逐行对应
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int writeResults(const char* resultFilePath, const vector<pair<double, long>>& winners,
+                 const MatrixXd& decrypted, int resultFormat) {
+    if (resultFormat != RESULT_TEXT && resultFormat != RESULT_BINARY && resultFormat != RESULT_BINARY_WITH_VECTORS) {
+        cerr << "Unknown result format " << resultFormat << endl;
+        return 0;
+    }
+    BufferedWriter writer;
+    if (!writer.open(resultFilePath)) {
+        cerr << "Unable to open file " << resultFilePath << endl;
+        return 0;
+    }
+
+    // 扩展向量的第1到第d个分量为 -2x
+    long dim = decrypted.cols() >= 3 ? decrypted.cols() - 3 : 0;
+
+    if (resultFormat == RESULT_TEXT) {
+        for (size_t i = 0; i < winners.size(); i++) {
+            for (long j = 1; j <= dim; j++) {
+                writer.writeDouble(decrypted(i, j) / (-2));
+                writer.writeChar(' ');
+            }
+            writer.writeChar('\n');
+        }
+    } else {
+        bool withVectors = (resultFormat == RESULT_BINARY_WITH_VECTORS);
+        uint32_t header[3] = {RESULT_VERSION, (uint32_t) winners.size(), withVectors ? (uint32_t) dim : 0};
+        writer.write(RESULT_MAGIC, sizeof(RESULT_MAGIC));
+        writer.write(header, sizeof(header));
+        for (size_t i = 0; i < winners.size(); i++) {
+            int64_t id = winners[i].second;
+            writer.write(&id, sizeof(id));
+            writer.write(&winners[i].first, sizeof(double));
+        }
+        if (withVectors) {
+            vector<double> point(dim);
+            for (size_t i = 0; i < winners.size(); i++) {
+                for (long j = 1; j <= dim; j++) {
+                    point[j - 1] = decrypted(i, j) / (-2);
+                }
+                writer.write(point.data(), point.size() * sizeof(double));
+            }
+        }
+    }
+
+    writer.close();
+    if (!writer.good()) {
+        cerr << "Error writing file " << resultFilePath << endl;
+        return 0;
+    }
+    return 1;
+}
@@ -0,0 +1,97 @@
+/**
+* @author: WTY
+* @date: 2024/8/16
+* @description: 查询结果的批量解密与带缓冲的文本/二进制写出
+*/
+
+#ifndef RESULT_WRITER_H
+#define RESULT_WRITER_H
+
+#include "Matrix_encryption.h"
+#include "Memory_accounting.h"
+#include <cstdio>
+#include <cstdint>
+#include <string>
+
+// 结果文件格式
+enum ResultFormat {
+    RESULT_TEXT = 0,                // 文本：每行一个解密后的数据点（与原输出一致）
+    RESULT_BINARY = 1,              // 二进制：只写行号与分数
+    RESULT_BINARY_WITH_VECTORS = 2  // 二进制：行号、分数以及解密后的数据点
+};
+
+/*
+ * 二进制结果文件布局（小端）：
+ *   char     magic[4]   "SSQR"
+ *   uint32_t version    1
+ *   uint32_t count      结果条数
+ *   uint32_t dim        数据点维度，不含向量时为0
+ *   count × { int64_t id; double score; }
+ *   count × dim 个 double（仅 RESULT_BINARY_WITH_VECTORS）
+ * 结果顺序与文本格式相同：score 从大到小。
+ * score 是服务器在密文上算出的掩码分数 r21·(|x|² − 2x·p) = r21·(|x − p|² − |p|²)，不是距离：
+ * r21 是每次查询随机生成的正数，同一查询内 score 与平方距离 |x − p|² 单调对应，不同查询之间不可比较。
+ * 需要真实距离时用 RESULT_BINARY_WITH_VECTORS 取回数据点在客户端计算。
+ */
+const char RESULT_MAGIC[4] = {'S', 'S', 'Q', 'R'};
+const uint32_t RESULT_VERSION = 1;
+
+/**
+ * @Class: BufferedWriter
+ * @Description: 带大缓冲区的文件写出器，避免 ofstream 逐个数字格式化以及 endl 每行刷新
+ */
+class BufferedWriter {
+public:
+    explicit BufferedWriter(size_t bufferSize = 1 << 20);
+    ~BufferedWriter();
+
+    bool open(const char* path);
+    void close();
+    bool good() const;
+
+    void write(const void* data, size_t size);
+    void writeChar(char c);
+    void writeDouble(double value);
+
+private:
+    void flush();
+
+    FILE* file;
+    vector<char, TrackedAllocator<char>> buffer;    // 记在 MEM_RESULT 上
+    size_t used;
+    bool failed;
+};
+
+/**
+ * @Method: formatDouble
+ * @Description: 快速格式化浮点数，输出与 ostream 默认格式(%g，6位有效数字)一致；
+ *               舍入位接近 .5 以及需要科学计数法时回退到 snprintf
+ * @param double value 待格式化的数
+ * @param char* out 输出缓冲区，至少32字节
+ * @return int 写入的字符数
+ */
+int formatDouble(double value, char* out);
+
+/**
+ * @Method: decryptRows
+ * @Description: 一次矩阵乘法解密全部结果行
+ * @param const MatrixXd& rows 密文行，每行一条 k×(d+3)
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @return MatrixXd 解密后的扩展向量，每行一条
+ */
+MatrixXd decryptRows(const MatrixXd& rows, const MatrixXd& encryptMatrixInverse);
+
+/**
+ * @Method: writeResults
+ * @Description: 将解密后的结果写入文件
+ * @param const char* resultFilePath 输出文件
+ * @param const vector<pair<double, long>>& winners (分数, 行号)，按输出顺序排列
+ * @param const MatrixXd& decrypted 解密后的扩展向量 [平方和, -2x, r11, -r11]，与winners逐行对应
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int writeResults(const char* resultFilePath, const vector<pair<double, long>>& winners,
+                 const MatrixXd& decrypted, int resultFormat);
+
+
+#endif //RESULT_WRITER_H
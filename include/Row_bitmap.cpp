@@ -0,0 +1,136 @@
+/**
+* @author: WTY
+* @date: 2024/8/22
+* @description: 行号集合的压缩位图：按高16位分容器，稀疏容器存有序数组，稠密容器存位图
+*/
+
+#include "Row_bitmap.h"
+#include <algorithm>
+#include <iterator>
+
+const size_t RowBitmap::ARRAY_MAX;
+const size_t RowBitmap::BITSET_WORDS;
+
+void RowBitmap::toBitset(Container& container) {
+    container.bits.assign(BITSET_WORDS, 0);
+    for (size_t i = 0; i < container.array.size(); i++) {
+        uint16_t low = container.array[i];
+        container.bits[low >> 6] |= 1ULL << (low & 63);
+    }
+    vector<uint16_t>().swap(container.array);
+}
+
+void RowBitmap::toArray(Container& container) {
+    container.array.clear();
+    container.array.reserve(container.cardinality);
+    for (size_t w = 0; w < BITSET_WORDS; w++) {
+        uint64_t word = container.bits[w];
+        while (word != 0) {
+            container.array.push_back((uint16_t) (w * 64 + __builtin_ctzll(word)));
+            word &= word - 1;
+        }
+    }
+    vector<uint64_t>().swap(container.bits);
+}
+
+void RowBitmap::add(uint32_t row) {
+    uint32_t key = row >> 16;
+    uint16_t low = (uint16_t) (row & 0xFFFF);
+    if (containers.empty() || containers.back().key != key) {
+        Container container;
+        container.key = key;
+        containers.push_back(container);
+    }
+    Container& container = containers.back();
+    if (container.bits.empty()) {
+        if (!container.array.empty() && container.array.back() >= low) {
+            return;     // 重复加入
+        }
+        if (container.array.size() < ARRAY_MAX) {
+            container.array.push_back(low);
+            container.cardinality++;
+            count++;
+            return;
+        }
+        toBitset(container);
+    }
+    uint64_t mask = 1ULL << (low & 63);
+    if ((container.bits[low >> 6] & mask) == 0) {
+        container.bits[low >> 6] |= mask;
+        container.cardinality++;
+        count++;
+    }
+}
+
+bool RowBitmap::contains(uint32_t row) const {
+    uint32_t key = row >> 16;
+    uint16_t low = (uint16_t) (row & 0xFFFF);
+    auto it = lower_bound(containers.begin(), containers.end(), key,
+                          [](const Container& c, uint32_t k) { return c.key < k; });
+    if (it == containers.end() || it->key != key) {
+        return false;
+    }
+    if (it->bits.empty()) {
+        return binary_search(it->array.begin(), it->array.end(), low);
+    }
+    return (it->bits[low >> 6] >> (low & 63)) & 1;
+}
+
+size_t RowBitmap::memoryBytes() const {
+    size_t bytes = containers.size() * sizeof(Container);
+    for (size_t c = 0; c < containers.size(); c++) {
+        bytes += containers[c].array.capacity() * sizeof(uint16_t) + containers[c].bits.capacity() * sizeof(uint64_t);
+    }
+    return bytes;
+}
+
+RowBitmap RowBitmap::intersect(const RowBitmap& a, const RowBitmap& b) {
+    RowBitmap result;
+    size_t i = 0, j = 0;
+    while (i < a.containers.size() && j < b.containers.size()) {
+        const Container& x = a.containers[i];
+        const Container& y = b.containers[j];
+        if (x.key < y.key) {
+            i++;
+            continue;
+        }
+        if (y.key < x.key) {
+            j++;
+            continue;
+        }
+        Container out;
+        out.key = x.key;
+        if (x.bits.empty() && y.bits.empty()) {
+            set_intersection(x.array.begin(), x.array.end(), y.array.begin(), y.array.end(),
+                             back_inserter(out.array));
+            out.cardinality = (uint32_t) out.array.size();
+        } else if (x.bits.empty() || y.bits.empty()) {
+            // 数组容器逐个检查位图容器
+            const Container& sparse = x.bits.empty() ? x : y;
+            const Container& dense = x.bits.empty() ? y : x;
+            for (size_t n = 0; n < sparse.array.size(); n++) {
+                uint16_t low = sparse.array[n];
+                if ((dense.bits[low >> 6] >> (low & 63)) & 1) {
+                    out.array.push_back(low);
+                }
+            }
+            out.cardinality = (uint32_t) out.array.size();
+        } else {
+            out.bits.resize(BITSET_WORDS);
+            for (size_t w = 0; w < BITSET_WORDS; w++) {
+                out.bits[w] = x.bits[w] & y.bits[w];
+                out.cardinality += (uint32_t) __builtin_popcountll(out.bits[w]);
+            }
+            if (out.cardinality <= ARRAY_MAX) {
+                toArray(out);
+            }
+        }
+        if (out.cardinality > 0) {
+            result.count += out.cardinality;
+            result.containers.push_back(out);
+        }
+        i++;
+        j++;
+    }
+    return result;
+}
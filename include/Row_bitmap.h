@@ -0,0 +1,103 @@
+/**
+* @author: WTY
+* @date: 2024/8/22
+* @description: 行号集合的压缩位图：按高16位分容器，稀疏容器存有序数组，稠密容器存位图
+*/
+
+#ifndef ROW_BITMAP_H
+#define ROW_BITMAP_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+/**
+ * @Class: RowBitmap
+ * @Description: 类似 Roaring 的压缩位图。行号的高16位决定容器，容器内元素不超过
+ *               ARRAY_MAX 个时存为有序 uint16 数组，否则存为 65536 位的位图。
+ *               遍历时跳过不存在的容器和全零的字，不会访问未选中行的密文。
+ */
+class RowBitmap {
+public:
+    // 数组容器的最大元素数，超过后转为位图容器（两者占用内存相同的分界点）
+    static const size_t ARRAY_MAX = 4096;
+    static const size_t BITSET_WORDS = 1024;
+
+    RowBitmap() : count(0) {
+    }
+
+    /**
+     * @Method: add
+     * @Description: 加入一个行号，行号需递增加入（建立索引时按行顺序扫描）
+     */
+    void add(uint32_t row);
+
+    /**
+     * @Method: contains
+     * @Description: 行号是否在集合中
+     */
+    bool contains(uint32_t row) const;
+
+    size_t cardinality() const {
+        return count;
+    }
+
+    /**
+     * @Method: memoryBytes
+     * @Description: 容器占用的字节数
+     */
+    size_t memoryBytes() const;
+
+    /**
+     * @Method: intersect
+     * @Description: 两个集合的交集，只比较两边都存在的容器
+     */
+    static RowBitmap intersect(const RowBitmap& a, const RowBitmap& b);
+
+    /**
+     * @Method: forEach
+     * @Description: 按行号递增顺序对每个元素调用 f(uint32_t row)
+     */
+    template<typename F>
+    void forEach(F f) const {
+        for (size_t c = 0; c < containers.size(); c++) {
+            const Container& container = containers[c];
+            uint32_t high = container.key << 16;
+            if (container.bits.empty()) {
+                for (size_t i = 0; i < container.array.size(); i++) {
+                    f(high | container.array[i]);
+                }
+            } else {
+                for (size_t w = 0; w < BITSET_WORDS; w++) {
+                    uint64_t word = container.bits[w];
+                    while (word != 0) {
+                        f(high | (uint32_t) (w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    struct Container {
+        uint32_t key;               // 行号的高16位
+        uint32_t cardinality;
+        vector<uint16_t> array;     // 数组容器
+        vector<uint64_t> bits;      // 位图容器，非空时使用
+
+        Container() : key(0), cardinality(0) {
+        }
+    };
+
+    static void toBitset(Container& container);
+    static void toArray(Container& container);
+
+    vector<Container> containers;   // 按 key 递增
+    size_t count;
+};
+
+
+#endif //ROW_BITMAP_H
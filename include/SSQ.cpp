@@ -5,6 +5,11 @@
 */
 
 #include "SSQ.h"
+#include "Task_runtime.h"
+#include "Query_planner.h"
+#include "Block_index.h"
+#include <climits>
+#include <cmath>
 
 // 密文数据集
 vector<VectorXd> ciphertext;
@@ -12,21 +17,35 @@ vector<VectorXd> ciphertext;
 // 加密矩阵
 MatrixXd encryptMatrix;
 
-// 自定义比较器，仅根据 double 值排序
-struct Compare {
-    bool operator()(const pair<double, VectorXd>& a, const pair<double, VectorXd>& b) {
-        return a.first < b.first;  // 使 priority_queue 按降序排序
-    }
-};
+// 数据集版本号
+atomic<uint64_t> datasetVersion(0);
+
+// 当前密钥类型
+atomic<int> keyMode(KEY_DENSE);
+
+// ciphertext 的读写锁
+pthread_rwlock_t ciphertextLock = PTHREAD_RWLOCK_INITIALIZER;
+
+// 加密与扫描时每次交给SIMD内核的行数
+const size_t ENCRYPT_BLOCK_ROWS = 256;
+const size_t SCAN_BLOCK_ROWS = 256;
+// 交给任务运行时的每个任务处理的行数，任务之间可以切换到更高优先级的任务
+const size_t ENCRYPT_TASK_ROWS = ENCRYPT_BLOCK_ROWS * 16;
+const size_t SCAN_TASK_ROWS = SCAN_BLOCK_ROWS * 64;
 
 
 /**
  * @Method: readDataFromFile
- * @Description: 读取文件中的doubles，并返回一个vector<vector<double>>类型的数据
+ * @Description: 读取文件中的doubles，并返回一个vector<vector<double>>类型的数据；
+ *               扩展名为 .fvecs/.bvecs 时按二进制格式读取（最多 vecsRowLimit 行）。
+ *               空行被跳过；各行的数值个数必须相同，否则返回空数据集，加密与降维等调用者可以按第一行的长度访问每一行
  * @param char* filename 文件名
- * @return vector<vector<double>> doubles数据
+ * @return vector<vector<double>> doubles数据，打开失败或行长不一致时为空
  */
 vector<vector<double>> readDataFromFile(char* filename) {
+    if (isVecsFile(filename)) {
+        return readVecsFile(filename, vecsRowLimit);
+    }
     vector<vector<double>> data_list;
     ifstream infile(filename);
 
@@ -36,7 +55,9 @@ vector<vector<double>> readDataFromFile(char* filename) {
     }
 
     string line;
+    long lineNumber = 0;
     while (getline(infile, line)) {
+        lineNumber++;
         vector<double> row;
         stringstream ss(line);
         double number;
@@ -45,6 +66,15 @@ vector<vector<double>> readDataFromFile(char* filename) {
             row.push_back(number);
         }
 
+        // 例如文件末尾的空行
+        if (row.empty()) {
+            continue;
+        }
+        if (!data_list.empty() && row.size() != data_list[0].size()) {
+            cerr << "Line " << lineNumber << " of " << filename << " has " << row.size() << " values, expected "
+                 << data_list[0].size() << endl;
+            return vector<vector<double>>();
+        }
         data_list.push_back(row);
     }
 
@@ -79,6 +109,66 @@ vector<double> readDataFromFile(const char* filename, int lineNumber) {
     return result;
 }
 
+/**
+ * @Method: augmentRecord
+ * @Description: 将明文数据点扩展为 [平方和, -2x, r11, -r11] 的 d+3 维向量
+ * @param const double* x 明文数据点
+ * @param size_t d 数据点维度
+ * @param double r11 随机数，r11 > 0
+ * @param double* t 输出，长度为 d+3
+ */
+void augmentRecord(const double* x, size_t d, double r11, double* t) {
+    // 计算每一维数据的平方和
+    double quadratic_sum = 0;
+    for (size_t j = 0; j < d; j++) {
+        quadratic_sum += x[j] * x[j];
+        t[j + 1] = x[j] * -2;
+    }
+    t[0] = quadratic_sum;
+    t[d + 1] = r11;
+    t[d + 2] = -r11;
+}
+
+/**
+ * @Method: encryptDataList
+ * @Description: 用全局加密矩阵加密明文数据集，按块调用SIMD内核：密文第i行为 (encryptMatrix^T * t_i)^T；
+ *               各块作为批量任务在任务运行时上并行执行。各行长度需相同（readDataFromFile 已校验）
+ * @param const vector<vector<double>>& data_list 明文数据集
+ * @param const long* order 加密顺序，out[i] 为 data_list[order[i]] 的密文；为 NULL 时按原顺序
+ * @param vector<VectorXd>& out 输出的密文数据集
+ */
+void encryptDataList(const vector<vector<double>>& data_list, const long* order, vector<VectorXd>& out) {
+    out.resize(data_list.size()); // 初始化密文数据集的大小
+    if (data_list.empty()) {
+        return;
+    }
+
+    const size_t dim = data_list[0].size() + 3;
+    RowMatrixXd key = encryptMatrix; // 行主序副本供内核使用
+    const SimdKernels& kernels = simdKernels();
+    const int slots = taskRuntime().threads();
+    vector<RowMatrixXd> t(slots, RowMatrixXd(ENCRYPT_BLOCK_ROWS, dim));
+    vector<RowMatrixXd> c(slots, RowMatrixXd(ENCRYPT_BLOCK_ROWS, dim));
+    const long tasks = (long) ((data_list.size() + ENCRYPT_TASK_ROWS - 1) / ENCRYPT_TASK_ROWS);
+    parallelChunks(TASK_BULK, slots, tasks, [&](long task, int slot) {
+        size_t end = min(data_list.size(), (task + 1) * ENCRYPT_TASK_ROWS);
+        for (size_t b = task * ENCRYPT_TASK_ROWS; b < end; b += ENCRYPT_BLOCK_ROWS) {
+            size_t count = min(ENCRYPT_BLOCK_ROWS, end - b);
+            for (size_t i = 0; i < count; i++) {
+                const vector<double>& row = data_list[order != NULL ? order[b + i] : b + i];
+                // 生成一个随机数r11，确保r11 > 0
+                double r11 = generateRandomDouble();
+                augmentRecord(row.data(), dim - 3, r11, t[slot].row(i).data());
+            }
+            // 加密
+            kernels.encryptRows(t[slot].data(), count, dim, key.data(), c[slot].data());
+            for (size_t i = 0; i < count; i++) {
+                out[b + i] = c[slot].row(i).transpose();
+            }
+        }
+    });
+}
+
 /**
  * @Method: 读取数据集
  * @param char* fileString 读取数据集的地址
@@ -100,11 +190,14 @@ int dealData(char* fileString) {
     if (data_list.empty()) {
         return 0;
     }
+    ScopedMemoryCharge plaintext(MEM_PLAINTEXT, estimatePlaintextBytes(data_list.size(), data_list[0].size()));
 
     start_time = chrono::high_resolution_clock::now();
 
     // 生成加密矩阵
     encryptMatrix = generateInvertibleMatrix(data_list[0].size() + 3);
+    keyMode = KEY_DENSE;
+    datasetVersion++;
 
     end_time = chrono::high_resolution_clock::now();
     total_duration = end_time - start_time;
@@ -114,30 +207,9 @@ int dealData(char* fileString) {
 
     start_time = chrono::high_resolution_clock::now();
 
-    ciphertext.resize(data_list.size()); // 初始化密文数据集的大小
-
     // 对每一个明文数据进行加密
-    for (int i = 0; i < data_list.size(); i++) {
-        vector<double> t(data_list[i].size() + 3);
-        // 计算每一维数据的平方和
-        double quadratic_sum = 0;
-        for (int j = 0; j < data_list[i].size(); j++) {
-            quadratic_sum += data_list[i][j] * data_list[i][j];
-            t[j + 1] = data_list[i][j] * -2;
-        }
-        t[0] = quadratic_sum;
-
-        // 生成一个随机数r11，确保r11 > 0
-        double r11 = generateRandomDouble();
-        t[data_list[i].size() + 1] = r11;
-        t[data_list[i].size() + 2] = -r11;
-
-        VectorXd v = Eigen::Map<VectorXd>(t.data(), t.size()); // 将vector<double>转换为Eigen::VectorXd
-        // 加密
-        v = encryptMatrix.transpose() * v;
-
-        ciphertext[i] = v;
-    }
+    encryptDataList(data_list, NULL, ciphertext);
+    memoryAccountant.set(MEM_CIPHERTEXT, estimateCiphertextBytes(ciphertext.size(), data_list[0].size() + 3));
 
     end_time = chrono::high_resolution_clock::now();
     total_duration = end_time - start_time;
@@ -150,69 +222,238 @@ int dealData(char* fileString) {
 }
 
 /**
- * @Method: SSQ
- * @Description: 发起查询请求，并返回查询结果
- * @param char* fileString 读取数据的地址
- * @param char* resultFilePath 输出数据的地址
+ * @Method: readQuery
+ * @Description: 读取查询文件，第一行为k（正整数），第二行为查询点
+ * @param const char* fileString 查询文件
+ * @param int& k 返回的k
+ * @param vector<double>& point 返回的查询点
  * @return 状态码，1：成功；0：失败
  */
-int SSQ(char* fileString, char* resultFilePath) {
-    vector<vector<double>> query_data(2); // 读取查询数据
-    query_data[0] = readDataFromFile(fileString, 1);
-    query_data[1] = readDataFromFile(fileString, 2);
-
-    // 逆矩阵，用于解密
-    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+int readQuery(const char* fileString, int& k, vector<double>& point) {
+    vector<double> first = readDataFromFile(fileString, 1);
+    point = readDataFromFile(fileString, 2);
+    if (first.empty() || point.empty()) {
+        cerr << "Error reading query file " << fileString << endl;
+        return 0;
+    }
+    // k 为正整数，负数转成 size_t 后会让 TopKHeap 预留极大的空间
+    if (!(first[0] >= 1 && first[0] <= INT_MAX) || first[0] != floor(first[0])) {
+        cerr << "Invalid k " << first[0] << " in query file " << fileString << endl;
+        return 0;
+    }
+    k = (int) first[0];
+    return 1;
+}
 
-    // 将查询数据加密
-    vector<double> t(query_data[1].size() + 3);
+/**
+ * @Method: augmentQuery
+ * @Description: 生成随机数r21,r22，将查询点扩展为 r21 * [1, p, r22, r22] 的 d+3 维向量
+ * @param const vector<double>& point 查询点
+ * @return VectorXd 扩展后的查询向量（未加密）
+ */
+VectorXd augmentQuery(const vector<double>& point) {
+    vector<double> t(point.size() + 3);
 
     // 生成两个随机数r21,r22，确保r21 > 0
     double r21 = generateRandomDouble();
     double r22 = generateRandomDouble();
 
-    for (int i = 0; i < query_data[1].size(); i++) {
-        t[i + 1] = query_data[1][i] * r21;
+    for (size_t i = 0; i < point.size(); i++) {
+        t[i + 1] = point[i] * r21;
     }
     t[0] = r21;
 
-    t[query_data[1].size() + 1] = r21 * r22;
-    t[query_data[1].size() + 2] = r21 * r22;
-    VectorXd q = Eigen::Map<VectorXd>(t.data(), t.size());
-    q = encryptMatrixInverse * q; // 将q用逆矩阵进行加密
+    t[point.size() + 1] = r21 * r22;
+    t[point.size() + 2] = r21 * r22;
+    return Eigen::Map<VectorXd>(t.data(), t.size());
+}
 
-    priority_queue<pair<double, VectorXd>, vector<pair<double, VectorXd>>, Compare> heap; // 优先队列，用于存储查询结果
+/**
+ * @Method: denseKeyReady
+ * @Description: 当前数据集由稠密加密矩阵加密且其维度与 pointDim 维的明文一致；否则打印原因
+ * @param size_t pointDim 查询或插入的明文维度
+ * @return bool 能否使用 encryptMatrix 加密查询、插入数据与解密结果
+ */
+bool denseKeyReady(size_t pointDim) {
+    if (keyMode != KEY_DENSE) {
+        cerr << "Dataset is encrypted with a block key, use SSQBlockKey" << endl;
+        return false;
+    }
+    if (encryptMatrix.rows() == 0 || (size_t) encryptMatrix.rows() != pointDim + 3) {
+        cerr << "Dimension " << pointDim << " does not match the encryption key" << endl;
+        return false;
+    }
+    return true;
+}
 
-    double distance; // 欧式平方距离
+/**
+ * @Method: encryptQuery
+ * @Description: 生成随机数r21,r22并用逆矩阵加密查询点
+ * @param const vector<double>& point 查询点
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @return VectorXd 加密后的查询向量
+ */
+VectorXd encryptQuery(const vector<double>& point, const MatrixXd& encryptMatrixInverse) {
+    return encryptMatrixInverse * augmentQuery(point); // 将q用逆矩阵进行加密
+}
 
-    for (int i = 0; i < ciphertext.size(); i++) {
-        distance = ciphertext[i].dot(q);
-        if (heap.size() < query_data[0][0]) { // 维护大小为k的优先队列
-            heap.push(make_pair(distance, ciphertext[i]));
-        } else {
-            if (heap.top().first > distance) {
-                heap.pop();
-                heap.push(make_pair(distance, ciphertext[i]));
+/**
+ * @Method: scanTopK
+ * @Description: 扫描全部密文，返回距离最小的k条；数据较多时按段作为查询任务并行扫描，最后合并各段的堆
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> scanTopK(const VectorXd& q, int k) {
+    CiphertextReadGuard guard;
+    const SimdKernels& kernels = simdKernels();
+    const long tasks = (long) ((ciphertext.size() + SCAN_TASK_ROWS - 1) / SCAN_TASK_ROWS);
+    // 每个 slot 的临时空间在内存预算内记账，放不下时减少并行的 slot
+    ScopedScratchCharge scratch(MEM_QUERY_SCRATCH, 0,
+                                SCAN_BLOCK_ROWS * (sizeof(const double*) + sizeof(double)) +
+                                max(k, 0) * sizeof(pair<double, long>),
+                                (size_t) min((long) taskRuntime().threads(), max(1L, tasks)));
+    const int slots = (int) scratch.units();
+    vector<TopKHeap> heaps(slots, TopKHeap(k)); // 每个 slot 维护大小为k的最大堆，只记录行号
+    vector<const double*> rows(slots * SCAN_BLOCK_ROWS, NULL);
+    vector<double> distances(slots * SCAN_BLOCK_ROWS, 0); // 欧式平方距离
+
+    parallelChunks(TASK_QUERY, slots, tasks, [&](long task, int slot) {
+        const double** slotRows = &rows[slot * SCAN_BLOCK_ROWS];
+        double* slotDistances = &distances[slot * SCAN_BLOCK_ROWS];
+        TopKHeap& heap = heaps[slot];
+        size_t end = min(ciphertext.size(), (task + 1) * SCAN_TASK_ROWS);
+        for (size_t b = task * SCAN_TASK_ROWS; b < end; b += SCAN_BLOCK_ROWS) {
+            size_t count = min(SCAN_BLOCK_ROWS, end - b);
+            for (size_t i = 0; i < count; i++) {
+                slotRows[i] = ciphertext[b + i].data();
+            }
+            kernels.scanRows(slotRows, count, q.data(), q.size(), slotDistances);
+            for (size_t i = 0; i < count; i++) {
+                heap.push(slotDistances[i], (long) (b + i));
             }
         }
+    });
+    for (int s = 1; s < slots; s++) {
+        heaps[0].merge(heaps[s]);
     }
+    return heaps[0].extractDescending();
+}
 
-    // 将heap内的数据写入文件
-    ofstream resultFile(resultFilePath);
-    if (resultFile.is_open()) {
-        while (!heap.empty()) {
-            // 将ciphertext[i]解密
-            VectorXd decryptedVector = heap.top().second.transpose() * encryptMatrixInverse;
-            for (int j = 1; j < decryptedVector.size() - 2; j++) {
-                resultFile << decryptedVector[j] / (-2) << " "; // 写入文件
+/**
+ * @Method: scanTilesTopK
+ * @Description: 多查询扫描的公共部分：ciphertext[begin, end) 每 tile.rows() 行复制成一块，与 queries 的全部列做一次
+ *               矩阵乘法，第 j 列的分数进入 heaps[j]；分数只在块内存在，不会生成 行数×查询数 的矩阵
+ */
+void scanTilesTopK(const Eigen::Ref<const MatrixXd>& queries, long begin, long end, RowMatrixXd& tile,
+                   MatrixXd& scores, TopKHeap* heaps, double* gemmMillis, double* selectMillis) {
+    typedef chrono::steady_clock Clock;
+    const bool timed = gemmMillis != NULL || selectMillis != NULL;
+    const long tileRows = tile.rows(), b = queries.cols();
+    for (long r = begin; r < end; r += tileRows) {
+        long count = min(tileRows, end - r);
+        for (long i = 0; i < count; i++) {
+            tile.row(i) = ciphertext[r + i].transpose();
+        }
+        Clock::time_point t0 = timed ? Clock::now() : Clock::time_point();
+        scores.topLeftCorner(count, b).noalias() = tile.topRows(count) * queries;
+        Clock::time_point t1 = timed ? Clock::now() : Clock::time_point();
+        for (long j = 0; j < b; j++) {
+            TopKHeap& heap = heaps[j];
+            const double* column = scores.col(j).data();
+            for (long i = 0; i < count; i++) {
+                heap.push(column[i], r + i);
+            }
+        }
+        if (timed) {
+            Clock::time_point t2 = Clock::now();
+            if (gemmMillis != NULL) {
+                *gemmMillis += chrono::duration<double, milli>(t1 - t0).count();
+            }
+            if (selectMillis != NULL) {
+                *selectMillis += chrono::duration<double, milli>(t2 - t1).count();
             }
-            resultFile << endl; // 换行
-            heap.pop(); // 弹出堆顶元素
         }
-        resultFile.close(); // 关闭文件
-    } else {
-        cerr << "Unable to open file " << resultFilePath << endl;
-        return 0;
     }
-    return 1;
-}
\ No newline at end of file
+}
+
+/**
+ * @Method: batchScanTopK
+ * @Description: 一批查询共享一次全量扫描：密文每 tileRows*64 行作为一个查询任务，每个 slot 的每个查询各有一个堆，最后合并
+ * @param const MatrixXd& queries (d+3)×b，每列一个加密后的查询向量
+ * @param const vector<int>& ks 每个查询返回的结果数
+ * @param int maxSlots 最多同时执行的任务数
+ * @param long tileRows 每块的密文行数
+ * @return vector<vector<pair<double, long>>> 每个查询的 (距离, 行号)，距离从大到小
+ */
+vector<vector<pair<double, long>>> batchScanTopK(const MatrixXd& queries, const vector<int>& ks, int maxSlots,
+                                                 long tileRows) {
+    CiphertextReadGuard guard;
+    const long n = (long) ciphertext.size();
+    const long dim = queries.rows(), b = queries.cols();
+    // 维度与当前密文不符（例如排队期间重新导入了数据集）时不扫描，每个查询返回空结果
+    if (n > 0 && ciphertext[0].size() != dim) {
+        return vector<vector<pair<double, long>>>(b);
+    }
+    tileRows = max(1L, tileRows);
+    const long taskRows = tileRows * 64;
+    const long tasks = (n + taskRows - 1) / taskRows;
+    const int slots = (int) max(1L, min((long) max(1, maxSlots), tasks));
+    vector<vector<TopKHeap>> heaps(slots);
+    for (int s = 0; s < slots; s++) {
+        for (long j = 0; j < b; j++) {
+            heaps[s].push_back(TopKHeap(ks[j]));
+        }
+    }
+    vector<RowMatrixXd> tiles(slots, RowMatrixXd(tileRows, dim));
+    vector<MatrixXd> scores(slots, MatrixXd(tileRows, b));
+    parallelChunks(TASK_QUERY, slots, tasks, [&](long task, int slot) {
+        long begin = task * taskRows;
+        scanTilesTopK(queries, begin, min(n, begin + taskRows), tiles[slot], scores[slot], heaps[slot].data());
+    });
+    vector<vector<pair<double, long>>> results(b);
+    for (long j = 0; j < b; j++) {
+        for (int s = 1; s < slots; s++) {
+            heaps[0][j].merge(heaps[s][j]);
+        }
+        results[j] = heaps[0][j].extractDescending();
+    }
+    return results;
+}
+
+/**
+ * @Method: outputResults
+ * @Description: 取出结果对应的密文行，一次性解密并写入文件
+ * @param const char* resultFilePath 输出数据的地址
+ * @param vector<pair<double, long>> winners (距离, ciphertext中的行号)，写出时换回原数据集的行号
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int outputResults(const char* resultFilePath, vector<pair<double, long>> winners,
+                  const MatrixXd& encryptMatrixInverse, int resultFormat) {
+    MatrixXd rows(winners.size(), encryptMatrixInverse.rows());
+    {
+        CiphertextReadGuard guard;
+        for (size_t i = 0; i < winners.size(); i++) {
+            rows.row(i) = ciphertext[winners[i].second].transpose();
+            // 密文被剪枝索引重排过时换回原数据集的行号
+            winners[i].second = originalRowId(winners[i].second);
+        }
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
+
+/**
+ * @Method: SSQ
+ * @Description: 发起查询请求，并返回查询结果
+ * @param char* fileString 读取数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式，默认为文本 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQ(char* fileString, char* resultFilePath, int resultFormat) {
+    // 由查询规划在内存扫描、剪枝索引与NUMA分区等当前可用的精确方式中选择
+    QueryParams params;
+    return SSQPlanned(fileString, resultFilePath, params, resultFormat);
+}
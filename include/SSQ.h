@@ -8,15 +8,94 @@
 #define SSQ_H
 
 #include "Matrix_encryption.h"
+#include "Top_k.h"
+#include "Result_writer.h"
+#include "Simd_kernels.h"
+#include "Vecs_io.h"
 #include<queue>
 #include <fstream>
 #include <string>
+#include <atomic>
+#include <pthread.h>
+
+// 密文数据集
+extern vector<VectorXd> ciphertext;
+
+// 加密矩阵
+extern MatrixXd encryptMatrix;
+
+// 数据集版本号，重新加密、载入快照、插入数据或轮换密钥后递增，客户端缓存据此失效
+extern atomic<uint64_t> datasetVersion;
+
+/**
+ * 当前密文数据集使用的密钥类型
+ */
+enum KeyMode {
+    KEY_DENSE = 0,      // 稠密加密矩阵 encryptMatrix
+    KEY_BLOCK = 1       // 分块密钥 blockKey（见 Block_key.h），encryptMatrix 为空，只能用 SSQBlockKey 查询
+};
+
+// 当前密钥类型，生成或载入密钥时设置
+extern atomic<int> keyMode;
+
+// ciphertext 的读写锁，用法见 CiphertextReadGuard
+extern pthread_rwlock_t ciphertextLock;
+
+/**
+ * @Class: CiphertextReadGuard
+ * @Description: 作用域内持有 ciphertext 的读锁。全量扫描、批量扫描、剪枝扫描与取结果行持读锁，
+ *               insertBatch 原地追加时持写锁（CiphertextWriteGuard），扫描中的 vector 不会被扩容；
+ *               整体替换数据集的导入不持锁，调用者需保证导入期间没有并发查询（例如先停止 QueryScheduler）
+ */
+class CiphertextReadGuard {
+public:
+    CiphertextReadGuard() {
+        pthread_rwlock_rdlock(&ciphertextLock);
+    }
+
+    ~CiphertextReadGuard() {
+        pthread_rwlock_unlock(&ciphertextLock);
+    }
+
+private:
+    CiphertextReadGuard(const CiphertextReadGuard&);
+    CiphertextReadGuard& operator=(const CiphertextReadGuard&);
+};
+
+/**
+ * @Class: CiphertextWriteGuard
+ * @Description: 作用域内持有 ciphertext 的写锁，用于原地追加
+ */
+class CiphertextWriteGuard {
+public:
+    CiphertextWriteGuard() {
+        pthread_rwlock_wrlock(&ciphertextLock);
+    }
+
+    ~CiphertextWriteGuard() {
+        pthread_rwlock_unlock(&ciphertextLock);
+    }
+
+private:
+    CiphertextWriteGuard(const CiphertextWriteGuard&);
+    CiphertextWriteGuard& operator=(const CiphertextWriteGuard&);
+};
+
+/**
+ * @Method: denseKeyReady
+ * @Description: 当前数据集由稠密加密矩阵加密且其维度与 pointDim 维的明文一致；否则打印原因
+ * @param size_t pointDim 查询或插入的明文维度
+ * @return bool 能否使用 encryptMatrix 加密查询、插入数据与解密结果
+ */
+bool denseKeyReady(size_t pointDim);
 
 /**
  * @Method: readDataFromFile
- * @Description: 读取文件中的doubles，并返回一个vector<vector<double>>类型的数据
+ * @Description: 读取文件中的doubles，并返回一个vector<vector<double>>类型的数据；
+ *               扩展名为 .fvecs/.bvecs 时按二进制格式读取（最多 vecsRowLimit 行）。
+ *               空行被跳过；各行的数值个数必须相同，否则返回空数据集，加密与降维等调用者可以按第一行的长度访问每一行
  * @param char* filename 文件名
- * @return vector<vector<double>> doubles数据
+ * @return vector<vector<double>> doubles数据，打开失败或行长不一致时为空
  */
 vector<vector<double>> readDataFromFile(char* filename);
 
@@ -29,6 +108,25 @@ vector<vector<double>> readDataFromFile(char* filename);
  */
 vector<double> readDataFromFile(const char* filename, int lineNumber);
 
+/**
+ * @Method: augmentRecord
+ * @Description: 将明文数据点扩展为 [平方和, -2x, r11, -r11] 的 d+3 维向量
+ * @param const double* x 明文数据点
+ * @param size_t d 数据点维度
+ * @param double r11 随机数，r11 > 0
+ * @param double* t 输出，长度为 d+3
+ */
+void augmentRecord(const double* x, size_t d, double r11, double* t);
+
+/**
+ * @Method: encryptDataList
+ * @Description: 用全局加密矩阵加密明文数据集
+ * @param const vector<vector<double>>& data_list 明文数据集
+ * @param const long* order 加密顺序，out[i] 为 data_list[order[i]] 的密文；为 NULL 时按原顺序
+ * @param vector<VectorXd>& out 输出的密文数据集
+ */
+void encryptDataList(const vector<vector<double>>& data_list, const long* order, vector<VectorXd>& out);
+
 /**
  * @Method: 读取数据集
  * @param char* fileString 读取数据集的地址
@@ -36,14 +134,91 @@ vector<double> readDataFromFile(const char* filename, int lineNumber);
  */
 int dealData(char* fileString);
 
+/**
+ * @Method: readQuery
+ * @Description: 读取查询文件，第一行为k（正整数），第二行为查询点
+ * @param const char* fileString 查询文件
+ * @param int& k 返回的k
+ * @param vector<double>& point 返回的查询点
+ * @return 状态码，1：成功；0：失败
+ */
+int readQuery(const char* fileString, int& k, vector<double>& point);
+
+/**
+ * @Method: augmentQuery
+ * @Description: 生成随机数r21,r22，将查询点扩展为 r21 * [1, p, r22, r22] 的 d+3 维向量
+ * @param const vector<double>& point 查询点
+ * @return VectorXd 扩展后的查询向量（未加密）
+ */
+VectorXd augmentQuery(const vector<double>& point);
+
+/**
+ * @Method: encryptQuery
+ * @Description: 生成随机数r21,r22并用逆矩阵加密查询点
+ * @param const vector<double>& point 查询点
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @return VectorXd 加密后的查询向量
+ */
+VectorXd encryptQuery(const vector<double>& point, const MatrixXd& encryptMatrixInverse);
+
+/**
+ * @Method: scanTopK
+ * @Description: 顺序扫描全部密文，返回距离最小的k条
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+ */
+vector<pair<double, long>> scanTopK(const VectorXd& q, int k);
+
+/**
+ * @Method: scanTilesTopK
+ * @Description: 多查询扫描的公共部分：ciphertext[begin, end) 每 tile.rows() 行复制成一块，与 queries 的全部列做一次
+ *               矩阵乘法，第 j 列的分数进入 heaps[j]；tile 为 块行数×维度，scores 至少为 块行数×查询数，由调用者持有
+ * @param const Eigen::Ref<const MatrixXd>& queries (d+3)×b，每列一个加密后的查询向量
+ * @param long begin 起始行
+ * @param long end 结束行（不含）
+ * @param RowMatrixXd& tile 密文块
+ * @param MatrixXd& scores 分数块
+ * @param TopKHeap* heaps b 个堆
+ * @param double* gemmMillis 累加矩阵乘法的时间，可为 NULL
+ * @param double* selectMillis 累加维护堆的时间，可为 NULL
+ */
+void scanTilesTopK(const Eigen::Ref<const MatrixXd>& queries, long begin, long end, RowMatrixXd& tile,
+                   MatrixXd& scores, TopKHeap* heaps, double* gemmMillis = NULL, double* selectMillis = NULL);
+
+/**
+ * @Method: batchScanTopK
+ * @Description: 一批查询共享一次全量扫描：密文每 tileRows*64 行作为一个查询任务，每个 slot 的每个查询各有一个堆，最后合并
+ * @param const MatrixXd& queries (d+3)×b，每列一个加密后的查询向量
+ * @param const vector<int>& ks 每个查询返回的结果数
+ * @param int maxSlots 最多同时执行的任务数
+ * @param long tileRows 每块的密文行数
+ * @return vector<vector<pair<double, long>>> 每个查询的 (距离, 行号)，距离从大到小
+ */
+vector<vector<pair<double, long>>> batchScanTopK(const MatrixXd& queries, const vector<int>& ks, int maxSlots,
+                                                 long tileRows = 256);
+
+/**
+ * @Method: outputResults
+ * @Description: 取出结果对应的密文行，一次性解密并写入文件
+ * @param const char* resultFilePath 输出数据的地址
+ * @param vector<pair<double, long>> winners (距离, ciphertext中的行号)，写出时换回原数据集的行号
+ * @param const MatrixXd& encryptMatrixInverse 加密矩阵的逆矩阵
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int outputResults(const char* resultFilePath, vector<pair<double, long>> winners,
+                  const MatrixXd& encryptMatrixInverse, int resultFormat);
+
 /**
  * @Method: SSQ
  * @Description: 发起查询请求，并返回查询结果
  * @param char* fileString 读取数据的地址
  * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式，默认为文本 ResultFormat
  * @return 状态码，1：成功；0：失败
  */
-int SSQ(char* fileString, char* resultFilePath);
+int SSQ(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
 
 
 #endif //SSQ_H
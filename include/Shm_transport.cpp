@@ -0,0 +1,780 @@
+/**
+* @author: WTY
+* @date: 2024/9/7
+* @description: 本机客户端与服务器之间的共享内存传输：请求与响应各用一个单生产者单消费者环形缓冲，
+*               消息带固定布局的头部并在环内原地读写，只有对方空闲等待时才用 futex 唤醒
+*/
+
+#include "Shm_transport.h"
+#include "Block_index.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+/**
+ * 共享内存区域的头部，其后依次为请求环与响应环
+ */
+struct ShmRegionHeader {
+    char magic[8];          // "SSQSHM"
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t ringBytes;     // 每个环的数据字节数
+    uint64_t padding[5];
+};
+
+const char SHM_MAGIC[8] = {'S', 'S', 'Q', 'S', 'H', 'M', '\0', '\0'};
+const uint32_t SHM_VERSION = 2;
+
+static size_t alignRecord(size_t bytes) {
+    return (bytes + SHM_RECORD_ALIGN - 1) / SHM_RECORD_ALIGN * SHM_RECORD_ALIGN;
+}
+
+static size_t ringStride(size_t capacity) {
+    return alignRecord(sizeof(ShmRingHeader)) + capacity;
+}
+
+static inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+/**
+ * @Method: futexWait
+ * @Description: *word 仍等于 expected 时睡眠，直到被唤醒或超时；共享映射跨进程使用，不能用 FUTEX_PRIVATE_FLAG
+ */
+static bool futexWait(atomic<uint32_t>& word, uint32_t expected, int timeoutMillis) {
+    timespec timeout;
+    timeout.tv_sec = timeoutMillis / 1000;
+    timeout.tv_nsec = (long) (timeoutMillis % 1000) * 1000000;
+    long ret = syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected,
+                       timeoutMillis >= 0 ? &timeout : NULL, NULL, 0);
+    return !(ret != 0 && errno == ETIMEDOUT);
+}
+
+static void futexWake(atomic<uint32_t>& word) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+ShmRing::ShmRing() : ring(NULL), data(NULL), spin(0), pending(0), reading(0) {
+    memset(&counters, 0, sizeof(counters));
+}
+
+void ShmRing::bind(ShmRingHeader* header, char* buffer, int spinIterations) {
+    ring = header;
+    data = buffer;
+    spin = spinIterations;
+    pending = ring->head.load();
+    reading = ring->tail.load();
+}
+
+/**
+ * @Method: waitFor
+ * @Description: 等待 watched 不再等于 seen：先自旋，再声明等待并在 signal 上睡眠。
+ *               声明等待与对方发布都使用顺序一致的原子操作，对方要么看到等待标志，要么这里看到新位置
+ * @return bool 是否等到了变化（超时为 false）
+ */
+bool ShmRing::waitFor(atomic<uint64_t>& watched, uint64_t seen, atomic<uint32_t>& signal,
+                      atomic<uint32_t>& waiting, int timeoutMillis) {
+    for (int i = 0; i < spin; i++) {
+        if (watched.load(memory_order_acquire) != seen) {
+            return true;
+        }
+        cpuRelax();
+    }
+    waiting.store(1);
+    // futex 被信号中断或被无关的唤醒时会提前返回，重新检查并睡到截止时间为止
+    chrono::steady_clock::time_point deadline =
+            chrono::steady_clock::now() + chrono::milliseconds(max(0, timeoutMillis));
+    bool changed = false;
+    while (true) {
+        uint32_t observed = signal.load();
+        changed = watched.load() != seen;
+        if (changed) {
+            break;
+        }
+        int remaining = -1;
+        if (timeoutMillis >= 0) {
+            chrono::microseconds left =
+                    chrono::duration_cast<chrono::microseconds>(deadline - chrono::steady_clock::now());
+            if (left.count() <= 0) {
+                break;
+            }
+            remaining = (int) ((left.count() + 999) / 1000);
+        }
+        counters.sleeps++;
+        futexWait(signal, observed, remaining);
+    }
+    waiting.store(0);
+    return changed;
+}
+
+void* ShmRing::reserve(uint32_t type, size_t payloadBytes, ShmMessageHeader*& header) {
+    const uint64_t capacity = ring->capacity;
+    const size_t record = alignRecord(sizeof(ShmMessageHeader) + payloadBytes);
+    if (record > capacity) {
+        cerr << "Message of " << payloadBytes << " bytes does not fit the shared memory ring" << endl;
+        return NULL;
+    }
+    size_t contiguous;
+    while (true) {
+        contiguous = capacity - pending % capacity;
+        size_t needed = record <= contiguous ? record : contiguous + record;
+        uint64_t tail = ring->tail.load(memory_order_acquire);
+        if (pending + needed - tail <= capacity) {
+            break;
+        }
+        // 已预留的消息先发布，否则消费者无法释放空间
+        commit();
+        ring->producerWaiting.store(1);
+        waitFor(ring->tail, tail, ring->spaceSignal, ring->producerWaiting, -1);
+    }
+    if (record > contiguous) {
+        ShmMessageHeader* pad = (ShmMessageHeader*) (data + pending % capacity);
+        pad->type = SHM_PAD;
+        pad->bytes = contiguous - sizeof(ShmMessageHeader);
+        pending += contiguous;
+    }
+    header = (ShmMessageHeader*) (data + pending % capacity);
+    header->type = type;
+    header->flags = 0;
+    header->requestId = 0;
+    header->count = 0;
+    header->dim = 0;
+    header->bytes = payloadBytes;
+    pending += record;
+    counters.messages++;
+    return header + 1;
+}
+
+void ShmRing::commit() {
+    if (pending == ring->head.load(memory_order_relaxed)) {
+        return;
+    }
+    ring->head.store(pending);
+    counters.commits++;
+    if (ring->consumerWaiting.load()) {
+        ring->dataSignal.fetch_add(1);
+        futexWake(ring->dataSignal);
+        counters.wakes++;
+    }
+}
+
+const ShmMessageHeader* ShmRing::peek(int timeoutMillis) {
+    const uint64_t capacity = ring->capacity;
+    while (true) {
+        uint64_t tail = ring->tail.load(memory_order_relaxed);
+        if (ring->head.load(memory_order_acquire) == tail) {
+            if (!waitFor(ring->head, tail, ring->dataSignal, ring->consumerWaiting, timeoutMillis)) {
+                return NULL;
+            }
+            continue;
+        }
+        const ShmMessageHeader* header = (const ShmMessageHeader*) (data + tail % capacity);
+        reading = tail + alignRecord(sizeof(ShmMessageHeader) + header->bytes);
+        if (header->type != SHM_PAD) {
+            return header;
+        }
+        release();
+    }
+}
+
+void ShmRing::release() {
+    ring->tail.store(reading);
+    if (ring->producerWaiting.load()) {
+        ring->spaceSignal.fetch_add(1);
+        futexWake(ring->spaceSignal);
+        counters.wakes++;
+    }
+}
+
+bool ShmRing::empty() const {
+    return ring->head.load(memory_order_acquire) == ring->tail.load(memory_order_relaxed);
+}
+
+ShmChannel::ShmChannel() : nextRequestId(1), region(NULL), regionBytes(0) {
+}
+
+ShmChannel::~ShmChannel() {
+    close();
+}
+
+/**
+ * @Method: setup
+ * @Description: 在映射好的区域上初始化或校验头部，绑定两个环
+ */
+int ShmChannel::setup(void* mapped, size_t bytes, bool initialize, int spinIterations) {
+    region = mapped;
+    regionBytes = bytes;
+    ShmRegionHeader* header = (ShmRegionHeader*) region;
+    if (initialize) {
+        memset(header, 0, sizeof(ShmRegionHeader));
+        memcpy(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+        header->version = SHM_VERSION;
+        header->ringBytes = (bytes - alignRecord(sizeof(ShmRegionHeader))) / 2 - alignRecord(sizeof(ShmRingHeader));
+    } else if (bytes < sizeof(ShmRegionHeader) || memcmp(header->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+               header->version != SHM_VERSION ||
+               alignRecord(sizeof(ShmRegionHeader)) + 2 * ringStride(header->ringBytes) > bytes) {
+        cerr << "Invalid shared memory channel" << endl;
+        close();
+        return 0;
+    }
+    char* base = (char*) region + alignRecord(sizeof(ShmRegionHeader));
+    for (int i = 0; i < 2; i++) {
+        char* at = base + i * ringStride(header->ringBytes);
+        ShmRingHeader* ring = (ShmRingHeader*) at;
+        if (initialize) {
+            ring = new (at) ShmRingHeader();
+            ring->head.store(0);
+            ring->tail.store(0);
+            ring->dataSignal.store(0);
+            ring->spaceSignal.store(0);
+            ring->producerWaiting.store(0);
+            ring->consumerWaiting.store(0);
+            ring->capacity = header->ringBytes;
+        }
+        (i == 0 ? requests : responses).bind(ring, at + alignRecord(sizeof(ShmRingHeader)), spinIterations);
+    }
+    return 1;
+}
+
+static size_t regionBytesFor(const ShmConfig& config) {
+    return alignRecord(sizeof(ShmRegionHeader)) + 2 * ringStride(alignRecord(max((size_t) 4096, config.ringBytes)));
+}
+
+int ShmChannel::create(const char* name, const ShmConfig& config) {
+    close();
+    size_t bytes = regionBytesFor(config);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        cerr << "Unable to create shared memory " << name << endl;
+        return 0;
+    }
+    void* mapped = ftruncate(fd, bytes) == 0 ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                                             : MAP_FAILED;
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "Unable to map shared memory " << name << endl;
+        shm_unlink(name);
+        return 0;
+    }
+    ownedName = name;
+    return setup(mapped, bytes, true, config.spinIterations);
+}
+
+int ShmChannel::attach(const char* name, const ShmConfig& config) {
+    close();
+    int fd = shm_open(name, O_RDWR, 0600);
+    if (fd < 0) {
+        cerr << "Unable to open shared memory " << name << endl;
+        return 0;
+    }
+    struct stat info;
+    void* mapped = fstat(fd, &info) == 0 && info.st_size > 0
+                   ? mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        cerr << "Unable to map shared memory " << name << endl;
+        return 0;
+    }
+    return setup(mapped, info.st_size, false, config.spinIterations);
+}
+
+int ShmChannel::createAnonymous(const ShmConfig& config) {
+    close();
+    size_t bytes = regionBytesFor(config);
+    void* mapped = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        cerr << "Unable to map shared memory" << endl;
+        return 0;
+    }
+    return setup(mapped, bytes, true, config.spinIterations);
+}
+
+void ShmChannel::close() {
+    if (region != NULL) {
+        munmap(region, regionBytes);
+        region = NULL;
+        regionBytes = 0;
+    }
+    if (!ownedName.empty()) {
+        shm_unlink(ownedName.c_str());
+        ownedName.clear();
+    }
+}
+
+/**
+ * @Method: resultPayloadBytes
+ * @Description: 结果消息的负载字节数
+ */
+static size_t resultPayloadBytes(size_t count, size_t dim, bool withRows) {
+    return count * sizeof(ShmWinner) + (withRows ? count * dim * sizeof(double) : 0);
+}
+
+/**
+ * @Method: writeResultPayload
+ * @Description: 写出结果与（可选的）密文行，共享内存与套接字两条路径共用
+ */
+static void writeResultPayload(char* payload, const vector<pair<double, long>>& winners, size_t dim,
+                               bool withRows) {
+    CiphertextReadGuard guard;
+    ShmWinner* out = (ShmWinner*) payload;
+    double* rows = (double*) (out + winners.size());
+    for (size_t i = 0; i < winners.size(); i++) {
+        out[i].distance = winners[i].first;
+        out[i].id = originalRowId(winners[i].second);
+        if (withRows) {
+            memcpy(rows + i * dim, ciphertext[winners[i].second].data(), dim * sizeof(double));
+        }
+    }
+}
+
+static void readResultPayload(const ShmMessageHeader& header, const char* payload,
+                              vector<pair<double, long>>& winners, MatrixXd* rows) {
+    const ShmWinner* in = (const ShmWinner*) payload;
+    winners.resize(header.count);
+    for (uint32_t i = 0; i < header.count; i++) {
+        winners[i] = make_pair(in[i].distance, (long) in[i].id);
+    }
+    if (rows != NULL && (header.flags & SHM_WITH_ROWS)) {
+        typedef Eigen::Map<const RowMatrixXd> ConstRowMap;
+        *rows = ConstRowMap((const double*) (in + header.count), header.count, header.dim);
+    }
+}
+
+/**
+ * @Method: validQuery
+ * @Description: 校验客户端的请求头：负载恰为 dim 个 double，dim 与当前密文一致，k 为正数
+ * @param size_t& rowDim 返回当前密文的维度
+ * @param size_t& rowCount 返回当前密文的行数
+ */
+static bool validQuery(const ShmMessageHeader& request, size_t& rowDim, size_t& rowCount) {
+    {
+        CiphertextReadGuard guard;
+        rowDim = ciphertext.empty() ? 0 : ciphertext[0].size();
+        rowCount = ciphertext.size();
+    }
+    return rowDim != 0 && request.dim == rowDim && request.bytes == rowDim * sizeof(double) && request.count > 0;
+}
+
+/**
+ * @Method: answerQuery
+ * @Description: 扫描一个已校验的查询，k 超过行数时按行数
+ */
+static vector<pair<double, long>> answerQuery(const double* q, size_t rowDim, size_t rowCount, uint32_t k) {
+    return scanTopK(VectorXd::Map(q, rowDim), (int) min<size_t>(k, rowCount));
+}
+
+/**
+ * @Method: shmReplyError
+ * @Description: 回复 SHM_ERROR，无负载的消息总能放进响应环
+ */
+static void shmReplyError(ShmChannel& channel, uint64_t requestId, uint32_t code) {
+    ShmMessageHeader* response;
+    if (channel.responses.reserve(SHM_ERROR, 0, response) != NULL) {
+        response->requestId = requestId;
+        response->count = code;
+    }
+}
+
+/**
+ * @Method: serveShmChannel
+ * @Description: 服务器循环：原地读取查询向量扫描密文，把结果（及可选的密文行）原地写入响应环，收到 SHM_EXIT 时返回
+ * @param ShmChannel& channel 已 create 的通道
+ * @return long 处理的查询数
+ */
+long serveShmChannel(ShmChannel& channel) {
+    long served = 0;
+    while (true) {
+        const ShmMessageHeader* request = channel.requests.peek();
+        if (request == NULL) {
+            continue;
+        }
+        if (request->type == SHM_EXIT) {
+            channel.requests.release();
+            break;
+        }
+        if (request->type == SHM_QUERY) {
+            size_t rowDim, rowCount;
+            if (!validQuery(*request, rowDim, rowCount)) {
+                shmReplyError(channel, request->requestId, SHM_ERROR_INVALID_REQUEST);
+            } else {
+                vector<pair<double, long>> winners = answerQuery((const double*) (request + 1), rowDim, rowCount,
+                                                                 request->count);
+                bool withRows = (request->flags & SHM_WITH_ROWS) != 0;
+                ShmMessageHeader* response;
+                void* payload = channel.responses.reserve(SHM_RESULT,
+                                                          resultPayloadBytes(winners.size(), rowDim, withRows),
+                                                          response);
+                if (payload == NULL) {
+                    shmReplyError(channel, request->requestId, SHM_ERROR_TOO_LARGE);
+                } else {
+                    response->flags = withRows ? SHM_WITH_ROWS : 0;
+                    response->requestId = request->requestId;
+                    response->count = (uint32_t) winners.size();
+                    response->dim = (uint32_t) rowDim;
+                    writeResultPayload((char*) payload, winners, rowDim, withRows);
+                }
+            }
+            served++;
+        }
+        channel.requests.release();
+        // 批量到达的请求处理完再一起发布响应
+        if (channel.requests.empty()) {
+            channel.responses.commit();
+        }
+    }
+    channel.responses.commit();
+    return served;
+}
+
+/**
+ * @Method: shmSubmitQuery
+ * @Description: 客户端把查询向量写入请求环，commit 为 false 时只预留，用于批量提交；
+ *               一批中尚未读取的响应需要能放进响应环
+ * @return 状态码，1：成功；0：失败
+ */
+int shmSubmitQuery(ShmChannel& channel, uint64_t requestId, const VectorXd& q, int k, uint32_t flags,
+                   bool commit) {
+    ShmMessageHeader* header;
+    void* payload = channel.requests.reserve(SHM_QUERY, q.size() * sizeof(double), header);
+    if (payload == NULL) {
+        return 0;
+    }
+    header->flags = flags;
+    header->requestId = requestId;
+    header->count = (uint32_t) k;
+    header->dim = (uint32_t) q.size();
+    memcpy(payload, q.data(), q.size() * sizeof(double));
+    if (commit) {
+        channel.requests.commit();
+    }
+    return 1;
+}
+
+int shmReceiveResult(ShmChannel& channel, uint64_t& requestId, vector<pair<double, long>>& winners, MatrixXd* rows,
+                     int timeoutMillis) {
+    const ShmMessageHeader* response = channel.responses.peek(timeoutMillis);
+    if (response == NULL) {
+        return 0;
+    }
+    requestId = response->requestId;
+    if (response->type != SHM_RESULT) {
+        channel.responses.release();
+        return 0;
+    }
+    readResultPayload(*response, (const char*) (response + 1), winners, rows);
+    channel.responses.release();
+    return 1;
+}
+
+void shmShutdown(ShmChannel& channel) {
+    ShmMessageHeader* header;
+    if (channel.requests.reserve(SHM_EXIT, 0, header) != NULL) {
+        channel.requests.commit();
+    }
+}
+
+static bool readFully(int fd, void* buffer, size_t bytes) {
+    char* p = (char*) buffer;
+    while (bytes > 0) {
+        ssize_t n = read(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+static bool writeFully(int fd, const void* buffer, size_t bytes) {
+    const char* p = (const char*) buffer;
+    while (bytes > 0) {
+        ssize_t n = write(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+/**
+ * @Method: serveSocket
+ * @Description: 套接字路径的服务器循环，消息格式与共享内存相同，经 read/write 复制
+ */
+static long serveSocket(int fd) {
+    long served = 0;
+    ShmMessageHeader request;
+    vector<double> q;
+    vector<char> response;
+    while (readFully(fd, &request, sizeof(request)) && request.type == SHM_QUERY) {
+        size_t rowDim, rowCount;
+        if (!validQuery(request, rowDim, rowCount)) {
+            // 负载长度不可信，无法再定位下一条消息，回复错误后断开
+            ShmMessageHeader error = {SHM_ERROR, 0, request.requestId, SHM_ERROR_INVALID_REQUEST, 0, 0};
+            writeFully(fd, &error, sizeof(error));
+            break;
+        }
+        q.resize(rowDim);
+        if (!readFully(fd, q.data(), rowDim * sizeof(double))) {
+            break;
+        }
+        vector<pair<double, long>> winners = answerQuery(q.data(), rowDim, rowCount, request.count);
+        bool withRows = (request.flags & SHM_WITH_ROWS) != 0;
+        ShmMessageHeader header = {SHM_RESULT, withRows ? SHM_WITH_ROWS : 0, request.requestId,
+                                   (uint32_t) winners.size(), (uint32_t) rowDim,
+                                   resultPayloadBytes(winners.size(), rowDim, withRows)};
+        response.resize(sizeof(header) + header.bytes);
+        memcpy(response.data(), &header, sizeof(header));
+        writeResultPayload(response.data() + sizeof(header), winners, rowDim, withRows);
+        if (!writeFully(fd, response.data(), response.size())) {
+            break;
+        }
+        served++;
+    }
+    return served;
+}
+
+static bool socketSubmit(int fd, uint64_t requestId, const VectorXd& q, int k, uint32_t flags) {
+    ShmMessageHeader header = {SHM_QUERY, flags, requestId, (uint32_t) k, (uint32_t) q.size(),
+                               q.size() * sizeof(double)};
+    return writeFully(fd, &header, sizeof(header)) && writeFully(fd, q.data(), header.bytes);
+}
+
+static bool socketReceive(int fd, vector<char>& buffer, vector<pair<double, long>>& winners, MatrixXd* rows) {
+    ShmMessageHeader header;
+    if (!readFully(fd, &header, sizeof(header)) || header.type != SHM_RESULT) {
+        return false;
+    }
+    buffer.resize(header.bytes);
+    if (!readFully(fd, buffer.data(), header.bytes)) {
+        return false;
+    }
+    readResultPayload(header, buffer.data(), winners, rows);
+    return true;
+}
+
+/**
+ * 一种传输的测量结果
+ */
+struct TransportTiming {
+    vector<double> micros;      // 单条往返延迟
+    double batchQps;            // 批量提交的吞吐
+    bool ok;
+};
+
+static double percentile(vector<double> values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    size_t index = min(values.size() - 1, (size_t) (p * (values.size() - 1) + 0.5));
+    nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void printTiming(const char* name, const TransportTiming& t) {
+    double sum = 0;
+    for (size_t i = 0; i < t.micros.size(); i++) {
+        sum += t.micros[i];
+    }
+    printf("%-8s %12.2f %12.2f %12.2f %12.2f %14.0f\n", name, t.micros.empty() ? 0 : sum / t.micros.size(),
+           percentile(t.micros, 0.5), percentile(t.micros, 0.99), percentile(t.micros, 0.999), t.batchQps);
+}
+
+/**
+ * @Method: benchmarkTransports
+ * @Description: 在本进程的服务线程上分别用 unix 套接字与共享内存传输执行同一组加密查询，
+ *               输出单条往返延迟的分位数与批量提交的吞吐
+ * @param const vector<vector<double>>& points 明文查询点
+ * @param int k 返回的结果数
+ * @param int batchSize 批量提交时每批的查询数
+ * @param bool withRows 是否返回结果行的密文
+ * @return 状态码，1：成功；0：失败
+ */
+int benchmarkTransports(const vector<vector<double>>& points, int k, int batchSize, bool withRows) {
+    if (ciphertext.empty() || points.empty() || !denseKeyReady(points[0].size())) {
+        return 0;
+    }
+    typedef chrono::high_resolution_clock Clock;
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    vector<VectorXd> queries;
+    for (size_t i = 0; i < points.size(); i++) {
+        queries.push_back(encryptQuery(points[i], encryptMatrixInverse));
+    }
+    const uint32_t flags = withRows ? SHM_WITH_ROWS : 0;
+    batchSize = max(1, batchSize);
+    const size_t n = queries.size();
+    vector<pair<double, long>> winners;
+    MatrixXd rows;
+
+    // 套接字：每条查询 write 请求、read 响应；批量时先写完一批再依次读取
+    TransportTiming socketTiming = {vector<double>(), 0, false};
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        cerr << "Unable to create socket pair" << endl;
+        return 0;
+    }
+    {
+        thread server([&fds]() { serveSocket(fds[1]); });
+        vector<char> buffer;
+        bool ok = true;
+        for (size_t i = 0; i < n && ok; i++) {
+            Clock::time_point t0 = Clock::now();
+            ok = socketSubmit(fds[0], i, queries[i], k, flags) && socketReceive(fds[0], buffer, winners, &rows);
+            socketTiming.micros.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+        }
+        Clock::time_point t0 = Clock::now();
+        for (size_t b = 0; b < n && ok; b += batchSize) {
+            size_t end = min(n, b + batchSize);
+            for (size_t i = b; i < end && ok; i++) {
+                ok = socketSubmit(fds[0], i, queries[i], k, flags);
+            }
+            for (size_t i = b; i < end && ok; i++) {
+                ok = socketReceive(fds[0], buffer, winners, &rows);
+            }
+        }
+        socketTiming.batchQps = n / chrono::duration<double>(Clock::now() - t0).count();
+        socketTiming.ok = ok;
+        ShmMessageHeader exit = {SHM_EXIT, 0, 0, 0, 0, 0};
+        writeFully(fds[0], &exit, sizeof(exit));
+        server.join();
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+
+    // 共享内存：服务器与客户端各自映射同一命名区域
+    TransportTiming shmTiming = {vector<double>(), 0, false};
+    ShmStats clientStats, serverStats;
+    {
+        string name = "/ssq-bench-" + to_string(getpid());
+        ShmChannel serverChannel, clientChannel;
+        if (!serverChannel.create(name.c_str()) || !clientChannel.attach(name.c_str())) {
+            return 0;
+        }
+        thread server([&serverChannel]() { serveShmChannel(serverChannel); });
+        bool ok = true;
+        uint64_t id;
+        for (size_t i = 0; i < n && ok; i++) {
+            Clock::time_point t0 = Clock::now();
+            ok = shmSubmitQuery(clientChannel, i, queries[i], k, flags) &&
+                 shmReceiveResult(clientChannel, id, winners, &rows) && id == i;
+            shmTiming.micros.push_back(chrono::duration<double, micro>(Clock::now() - t0).count());
+        }
+        Clock::time_point t0 = Clock::now();
+        for (size_t b = 0; b < n && ok; b += batchSize) {
+            size_t end = min(n, b + batchSize);
+            for (size_t i = b; i < end && ok; i++) {
+                ok = shmSubmitQuery(clientChannel, i, queries[i], k, flags, i + 1 == end);
+            }
+            for (size_t i = b; i < end && ok; i++) {
+                ok = shmReceiveResult(clientChannel, id, winners, &rows) && id == i;
+            }
+        }
+        shmTiming.batchQps = n / chrono::duration<double>(Clock::now() - t0).count();
+        shmTiming.ok = ok;
+        shmShutdown(clientChannel);
+        server.join();
+        clientStats = clientChannel.requests.stats();
+        serverStats = serverChannel.responses.stats();
+    }
+
+    printf("传输对比：%zu 个查询，k=%d，%s密文行，批量 %d\n", n, k, withRows ? "返回" : "不返回", batchSize);
+    printf("%-8s %12s %12s %12s %12s %14s\n", "path", "mean(us)", "p50(us)", "p99(us)", "p999(us)", "batch(q/s)");
+    printTiming("socket", socketTiming);
+    printTiming("shm", shmTiming);
+    printf("共享内存：请求 %llu 条 %llu 次发布，唤醒服务器 %llu 次；响应 %llu 次发布，唤醒客户端 %llu 次\n",
+           (unsigned long long) clientStats.messages, (unsigned long long) clientStats.commits,
+           (unsigned long long) clientStats.wakes, (unsigned long long) serverStats.commits,
+           (unsigned long long) serverStats.wakes);
+    fflush(stdout);
+    return socketTiming.ok && shmTiming.ok ? 1 : 0;
+}
+
+/**
+ * @Method: SSQShm
+ * @Description: 通过共享内存传输发起查询请求：查询向量直接加密到请求环内，结果行从响应环解密
+ * @param ShmChannel& channel 已 attach 的通道
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQShm(ShmChannel& channel, char* fileString, char* resultFilePath, int resultFormat, int timeoutMillis) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || !denseKeyReady(point.size())) {
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    const size_t dim = point.size() + 3;
+    ShmMessageHeader* request;
+    double* payload = (double*) channel.requests.reserve(SHM_QUERY, dim * sizeof(double), request);
+    if (payload == NULL) {
+        return 0;
+    }
+    request->flags = SHM_WITH_ROWS;
+    const uint64_t requestId = channel.nextRequestId++;
+    request->requestId = requestId;
+    request->count = (uint32_t) k;
+    request->dim = (uint32_t) dim;
+    VectorXd::Map(payload, dim).noalias() = encryptMatrixInverse * augmentQuery(point);
+    channel.requests.commit();
+
+    // 跳过之前放弃等待的请求留下的响应，只接受回显本次请求号的结果；总等待时间不超过 timeoutMillis
+    typedef chrono::steady_clock Clock;
+    const Clock::time_point deadline = Clock::now() + chrono::milliseconds(max(timeoutMillis, 0));
+    const ShmMessageHeader* response;
+    while (true) {
+        int remaining = -1;
+        if (timeoutMillis >= 0) {
+            remaining = (int) max<long long>(0, chrono::duration_cast<chrono::milliseconds>(
+                    deadline - Clock::now()).count());
+        }
+        response = channel.responses.peek(remaining);
+        if (response == NULL || (response->type != SHM_RESULT && response->type != SHM_ERROR) ||
+            response->requestId >= requestId) {
+            break;
+        }
+        channel.responses.release();
+    }
+    if (response == NULL) {
+        cerr << "Timed out waiting for shared memory response" << endl;
+        return 0;
+    }
+    if (response->type == SHM_ERROR && response->requestId == requestId) {
+        cerr << (response->count == SHM_ERROR_TOO_LARGE ? "Result does not fit the shared memory ring"
+                                                        : "Server rejected the shared memory request") << endl;
+        channel.responses.release();
+        return 0;
+    }
+    if (response->type != SHM_RESULT || response->requestId != requestId ||
+        (response->count != 0 && response->dim != dim)) {
+        channel.responses.release();
+        cerr << "Invalid response from shared memory channel" << endl;
+        return 0;
+    }
+    vector<pair<double, long>> winners;
+    MatrixXd rows;
+    readResultPayload(*response, (const char*) (response + 1), winners, &rows);
+    channel.responses.release();
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
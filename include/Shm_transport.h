@@ -0,0 +1,263 @@
+/**
+* @author: WTY
+* @date: 2024/9/7
+* @description: 本机客户端与服务器之间的共享内存传输：请求与响应各用一个单生产者单消费者环形缓冲，
+*               消息带固定布局的头部并在环内原地读写，只有对方空闲等待时才用 futex 唤醒
+*/
+
+#ifndef SHM_TRANSPORT_H
+#define SHM_TRANSPORT_H
+
+#include "SSQ.h"
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+/*
+ * 共享内存布局：ShmRegionHeader，请求环（ShmRingHeader + capacity 字节），响应环（同上）。
+ * 环内每条消息为 ShmMessageHeader + 负载，按 SHM_RECORD_ALIGN 对齐；消息放不下环尾的剩余空间时
+ * 写一条 SHM_PAD 占满剩余空间，从环首继续。位置 head、tail 单调递增，对 capacity 取模得到偏移。
+ *   SHM_QUERY  负载为 dim 个 double 的加密查询向量，k 为返回的结果数
+ *   SHM_RESULT 负载为 count 个 ShmWinner，flags 含 SHM_WITH_ROWS 时其后为 count × dim 个 double 的密文行
+ *   SHM_ERROR  无负载，count 为 ShmErrorCode；请求无效或结果放不下响应环时代替 SHM_RESULT 回复
+ */
+enum ShmMessageType {
+    SHM_PAD = 0,
+    SHM_QUERY = 1,
+    SHM_RESULT = 2,
+    SHM_EXIT = 3,
+    SHM_ERROR = 4
+};
+
+// SHM_ERROR 的错误码
+enum ShmErrorCode {
+    SHM_ERROR_INVALID_REQUEST = 1,  // 负载长度与 dim 不符、dim 与密文不符或 k 不是正数
+    SHM_ERROR_TOO_LARGE = 2         // 结果大于响应环
+};
+
+const uint32_t SHM_WITH_ROWS = 1;          // 响应同时返回结果行的密文，客户端不必再取行
+const size_t SHM_RECORD_ALIGN = 32;
+
+struct ShmMessageHeader {
+    uint32_t type;          // ShmMessageType
+    uint32_t flags;
+    uint64_t requestId;     // 响应与请求相同
+    uint32_t count;         // 查询：k；结果：结果数
+    uint32_t dim;           // 查询向量或结果行的维度
+    uint64_t bytes;         // 负载字节数，不含头部
+};
+
+struct ShmWinner {
+    double distance;
+    int64_t id;
+};
+
+/**
+ * 一个环的控制字段，生产者与消费者写的字段分处不同缓存行
+ */
+struct ShmRingHeader {
+    alignas(64) atomic<uint64_t> head;          // 生产者已发布的位置
+    atomic<uint32_t> dataSignal;                // 消费者在此 futex 上等待新消息
+    atomic<uint32_t> producerWaiting;           // 生产者正在等待空间
+    alignas(64) atomic<uint64_t> tail;          // 消费者已释放的位置
+    atomic<uint32_t> spaceSignal;               // 生产者在此 futex 上等待空间
+    atomic<uint32_t> consumerWaiting;           // 消费者正在等待消息
+    alignas(64) uint64_t capacity;
+};
+
+/**
+ * 传输配置
+ */
+struct ShmConfig {
+    size_t ringBytes;       // 每个环的数据字节数，向上取整到 SHM_RECORD_ALIGN
+    int spinIterations;     // 进入 futex 等待前自旋检查的次数，单核上自旋只会占用对方的时间片
+
+    ShmConfig() : ringBytes(4 << 20), spinIterations(thread::hardware_concurrency() > 1 ? 4000 : 0) {
+    }
+};
+
+/**
+ * 传输统计（本端）
+ */
+struct ShmStats {
+    uint64_t messages;      // 发布的消息数
+    uint64_t commits;       // 发布次数，批量提交时小于消息数
+    uint64_t wakes;         // 发出的 futex 唤醒数
+    uint64_t sleeps;        // 进入 futex 等待的次数
+};
+
+/**
+ * @Class: ShmRing
+ * @Description: 环的一端。生产者 reserve 若干条消息后一次 commit 发布；消费者 peek 取得下一条消息的
+ *               指针直接读取负载，读完 release。每一端只能由一个线程使用
+ */
+class ShmRing {
+public:
+    ShmRing();
+
+    void bind(ShmRingHeader* header, char* data, int spinIterations);
+
+    /**
+     * @Method: reserve
+     * @Description: 在环内预留一条消息，返回负载指针由调用者原地填写；空间不足时先发布已预留的消息再等待
+     * @param uint32_t type 消息类型 ShmMessageType
+     * @param size_t payloadBytes 负载字节数
+     * @param ShmMessageHeader*& header 返回消息头，调用者填写 flags、requestId、count、dim
+     * @return void* 负载指针，消息大于环时为 NULL
+     */
+    void* reserve(uint32_t type, size_t payloadBytes, ShmMessageHeader*& header);
+
+    /**
+     * @Method: commit
+     * @Description: 发布已预留的全部消息，消费者在等待时唤醒
+     */
+    void commit();
+
+    /**
+     * @Method: peek
+     * @Description: 取得下一条消息，没有时先自旋再在 futex 上等待
+     * @param int timeoutMillis 等待上限，-1 表示一直等待
+     * @return const ShmMessageHeader* 消息头，负载紧随其后；超时为 NULL
+     */
+    const ShmMessageHeader* peek(int timeoutMillis = -1);
+
+    /**
+     * @Method: release
+     * @Description: 释放 peek 返回的消息，生产者在等待空间时唤醒
+     */
+    void release();
+
+    /**
+     * @Method: empty
+     * @Description: 消费者端：当前没有已发布未读取的消息
+     */
+    bool empty() const;
+
+    ShmStats stats() const {
+        return counters;
+    }
+
+private:
+    bool waitFor(atomic<uint64_t>& watched, uint64_t seen, atomic<uint32_t>& signal, atomic<uint32_t>& waiting,
+                 int timeoutMillis);
+
+    ShmRingHeader* ring;
+    char* data;
+    int spin;
+    uint64_t pending;       // 生产者：已预留但未发布的位置
+    uint64_t reading;       // 消费者：peek 返回的消息之后的位置
+    ShmStats counters;
+};
+
+/**
+ * @Class: ShmChannel
+ * @Description: 一对请求/响应环。服务器 create 创建命名共享内存，客户端 attach 映射同一区域；
+ *               也可以 createAnonymous 后在同一进程的线程之间或 fork 出的子进程中使用
+ */
+class ShmChannel {
+public:
+    ShmChannel();
+    ~ShmChannel();
+
+    /**
+     * @Method: create
+     * @Description: 创建并初始化命名共享内存（/dev/shm 下），已存在时失败
+     * @return 状态码，1：成功；0：失败
+     */
+    int create(const char* name, const ShmConfig& config = ShmConfig());
+
+    /**
+     * @Method: attach
+     * @Description: 映射服务器创建的命名共享内存
+     * @return 状态码，1：成功；0：失败
+     */
+    int attach(const char* name, const ShmConfig& config = ShmConfig());
+
+    /**
+     * @Method: createAnonymous
+     * @Description: 创建匿名共享映射，fork 后父子进程共享
+     * @return 状态码，1：成功；0：失败
+     */
+    int createAnonymous(const ShmConfig& config = ShmConfig());
+
+    void close();
+
+    // 客户端写请求、读响应；服务器读请求、写响应。同一个 ShmChannel 对象只扮演一端
+    ShmRing requests;
+    ShmRing responses;
+
+    // 客户端：SSQShm 下一个请求的请求号，响应必须回显同一个号
+    uint64_t nextRequestId;
+
+private:
+    int setup(void* region, size_t bytes, bool initialize, int spinIterations);
+
+    void* region;
+    size_t regionBytes;
+    string ownedName;       // create 的名字，close 时删除
+};
+
+/**
+ * @Method: serveShmChannel
+ * @Description: 服务器循环：原地读取查询向量扫描密文，把结果（及可选的密文行）原地写入响应环，收到 SHM_EXIT 时返回。
+ *               每个查询都有回复：请求头无效或结果放不下响应环时回复 SHM_ERROR
+ * @param ShmChannel& channel 已 create 的通道
+ * @return long 处理的查询数
+ */
+long serveShmChannel(ShmChannel& channel);
+
+/**
+ * @Method: shmSubmitQuery
+ * @Description: 客户端把查询向量写入请求环，commit 为 false 时只预留，用于批量提交；
+ *               一批中尚未读取的响应需要能放进响应环
+ * @return 状态码，1：成功；0：失败
+ */
+int shmSubmitQuery(ShmChannel& channel, uint64_t requestId, const VectorXd& q, int k, uint32_t flags,
+                   bool commit = true);
+
+/**
+ * @Method: shmReceiveResult
+ * @Description: 客户端读取下一条响应，SHM_ERROR 也返回失败
+ * @param ShmChannel& channel 通道
+ * @param uint64_t& requestId 返回响应对应的请求号，超时时不变
+ * @param vector<pair<double, long>>& winners 返回 (距离, 行号)，距离从大到小
+ * @param MatrixXd* rows 请求带 SHM_WITH_ROWS 时返回结果行的密文，可为 NULL
+ * @param int timeoutMillis 等待上限，-1 表示一直等待
+ * @return 状态码，1：成功；0：失败
+ */
+int shmReceiveResult(ShmChannel& channel, uint64_t& requestId, vector<pair<double, long>>& winners,
+                     MatrixXd* rows = NULL, int timeoutMillis = -1);
+
+/**
+ * @Method: shmShutdown
+ * @Description: 通知服务器循环退出
+ */
+void shmShutdown(ShmChannel& channel);
+
+/**
+ * @Method: benchmarkTransports
+ * @Description: 在本进程的服务线程上分别用 unix 套接字与共享内存传输执行同一组加密查询，
+ *               输出单条往返延迟的分位数与批量提交的吞吐
+ * @param const vector<vector<double>>& points 明文查询点
+ * @param int k 返回的结果数
+ * @param int batchSize 批量提交时每批的查询数
+ * @param bool withRows 是否返回结果行的密文
+ * @return 状态码，1：成功；0：失败
+ */
+int benchmarkTransports(const vector<vector<double>>& points, int k, int batchSize = 32, bool withRows = true);
+
+/**
+ * @Method: SSQShm
+ * @Description: 通过共享内存传输发起查询请求：查询向量直接加密到请求环内，结果行从响应环解密
+ * @param ShmChannel& channel 已 attach 的通道
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @param int timeoutMillis 等待响应的上限，-1 表示一直等待
+ * @return 状态码，1：成功；0：失败（包括服务器回复 SHM_ERROR 与等待超时）
+ */
+int SSQShm(ShmChannel& channel, char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT,
+           int timeoutMillis = 30000);
+
+
+#endif //SHM_TRANSPORT_H
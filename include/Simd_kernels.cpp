@@ -0,0 +1,121 @@
+/**
+* @author: WTY
+* @date: 2024/8/19
+* @description: 扫描与加密的SIMD内核，编译多个指令集版本，启动时按CPUID选择
+*/
+
+#include "Simd_kernels.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void scalarScanRows(const double* const* rows, size_t n, const double* q, size_t dim, double* out) {
+    for (size_t i = 0; i < n; i++) {
+        double sum = 0;
+        for (size_t j = 0; j < dim; j++) {
+            sum += rows[i][j] * q[j];
+        }
+        out[i] = sum;
+    }
+}
+
+static void scalarScanBlock(const double* base, size_t n, size_t stride, const double* q, size_t dim, double* out) {
+    for (size_t i = 0; i < n; i++) {
+        const double* row = base + i * stride;
+        double sum = 0;
+        for (size_t j = 0; j < dim; j++) {
+            sum += row[j] * q[j];
+        }
+        out[i] = sum;
+    }
+}
+
+static void scalarEncryptRows(const double* t, size_t n, size_t dim, const double* key, double* out) {
+    for (size_t r = 0; r < n; r++) {
+        double* o = out + r * dim;
+        const double* x = t + r * dim;
+        for (size_t j = 0; j < dim; j++) {
+            o[j] = 0;
+        }
+        for (size_t i = 0; i < dim; i++) {
+            const double* k = key + i * dim;
+            for (size_t j = 0; j < dim; j++) {
+                o[j] += x[i] * k[j];
+            }
+        }
+    }
+}
+
+const SimdKernels* scalarKernels() {
+    static const SimdKernels kernels = {"scalar", scalarScanRows, scalarScanBlock, scalarEncryptRows};
+    return &kernels;
+}
+
+/**
+ * @Method: cpuSupports
+ * @Description: 通过CPUID判断是否支持某个指令集（同时检查操作系统是否保存对应寄存器）
+ */
+static bool cpuSupports(const char* isa) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (strcmp(isa, "sse2") == 0) {
+        return __builtin_cpu_supports("sse2");
+    }
+    if (strcmp(isa, "avx2") == 0) {
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    }
+    if (strcmp(isa, "avx512") == 0) {
+        return __builtin_cpu_supports("avx512f");
+    }
+#endif
+    return strcmp(isa, "scalar") == 0;
+}
+
+/**
+ * @Method: selectKernels
+ * @Description: 选择编译进来且CPU支持的最高指令集版本
+ * @param const char* forced 指定的指令集，NULL 表示自动选择；不可用时退回自动选择
+ */
+static const SimdKernels* selectKernels(const char* forced) {
+    const SimdKernels* candidates[] = {avx512Kernels(), avx2Kernels(), sse2Kernels(), scalarKernels()};
+    const char* isas[] = {"avx512", "avx2", "sse2", "scalar"};
+    for (int i = 0; i < 4; i++) {
+        if (candidates[i] == NULL || !cpuSupports(isas[i])) {
+            continue;
+        }
+        if (forced == NULL || strcmp(forced, isas[i]) == 0) {
+            return candidates[i];
+        }
+    }
+    if (forced != NULL) {
+        fprintf(stderr, "SSQ_SIMD=%s is not available, using the default kernels\n", forced);
+        return selectKernels(NULL);
+    }
+    return scalarKernels();
+}
+
+/**
+ * @Method: simdKernels
+ * @Description: 返回启动时按CPUID选中的内核，可用环境变量 SSQ_SIMD=scalar|sse2|avx2|avx512 强制指定
+ */
+const SimdKernels& simdKernels() {
+    // 选择结果只在这里保存一次，不修改进程的环境变量
+    static const SimdKernels* selected = selectKernels(getenv("SSQ_SIMD"));
+    return *selected;
+}
+
+/**
+ * @Method: printSimdReport
+ * @Description: 输出CPU支持的指令集以及选中的内核
+ */
+void printSimdReport() {
+    const SimdKernels* candidates[] = {sse2Kernels(), avx2Kernels(), avx512Kernels()};
+    const char* isas[] = {"sse2", "avx2", "avx512"};
+    printf("SIMD内核：%s（", simdKernels().name);
+    for (int i = 0; i < 3; i++) {
+        printf("%s%s:%s%s", i > 0 ? " " : "", isas[i], cpuSupports(isas[i]) ? "CPU支持" : "CPU不支持",
+               candidates[i] != NULL ? "" : "/未编译");
+    }
+    printf("）\n");
+    fflush(stdout);
+}
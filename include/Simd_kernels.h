@@ -0,0 +1,59 @@
+/**
+* @author: WTY
+* @date: 2024/8/19
+* @description: 扫描与加密的SIMD内核，编译多个指令集版本，启动时按CPUID选择
+*/
+
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+
+/**
+ * @Description: 计算 n 条密文与查询向量的内积，rows[i] 指向第 i 条密文
+ */
+typedef void (*ScanRowsKernel)(const double* const* rows, size_t n, const double* q, size_t dim, double* out);
+
+/**
+ * @Description: 计算连续存放的 n 条密文与查询向量的内积，第 i 条从 base + i * stride 开始
+ */
+typedef void (*ScanBlockKernel)(const double* base, size_t n, size_t stride, const double* q, size_t dim,
+                                double* out);
+
+/**
+ * @Description: 批量加密 out = t * key，t 为 n×dim 行主序的扩展向量，key 为 dim×dim 行主序的加密矩阵
+ */
+typedef void (*EncryptRowsKernel)(const double* t, size_t n, size_t dim, const double* key, double* out);
+
+/**
+ * 一组同一指令集的内核
+ */
+struct SimdKernels {
+    const char* name;
+    ScanRowsKernel scanRows;
+    ScanBlockKernel scanBlock;
+    EncryptRowsKernel encryptRows;
+};
+
+/**
+ * 各指令集版本，未编译或当前平台不支持时返回 NULL
+ */
+const SimdKernels* scalarKernels();
+const SimdKernels* sse2Kernels();
+const SimdKernels* avx2Kernels();
+const SimdKernels* avx512Kernels();
+
+/**
+ * @Method: simdKernels
+ * @Description: 返回启动时按CPUID选中的内核，可用环境变量 SSQ_SIMD=scalar|sse2|avx2|avx512 强制指定
+ */
+const SimdKernels& simdKernels();
+
+/**
+ * @Method: printSimdReport
+ * @Description: 输出CPU支持的指令集以及选中的内核
+ */
+void printSimdReport();
+
+
+#endif //SIMD_KERNELS_H
@@ -0,0 +1,41 @@
+/**
+* @author: WTY
+* @date: 2024/8/19
+* @description: AVX2 + FMA 版本的扫描与加密内核，本文件单独使用 -mavx2 -mfma 编译
+*/
+
+#include "Simd_kernels.h"
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+#include <immintrin.h>
+
+static inline double hsum256(__m256d v) {
+    __m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+#define SIMD_VEC __m256d
+#define SIMD_WIDTH 4
+#define SIMD_LOAD(p) _mm256_loadu_pd(p)
+#define SIMD_STORE(p, v) _mm256_storeu_pd(p, v)
+#define SIMD_ZERO() _mm256_setzero_pd()
+#define SIMD_SET1(x) _mm256_set1_pd(x)
+#define SIMD_ADD(a, b) _mm256_add_pd(a, b)
+#define SIMD_FMA(a, b, c) _mm256_fmadd_pd(a, b, c)
+#define SIMD_HSUM(v) hsum256(v)
+
+#include "Simd_kernels_impl.h"
+
+const SimdKernels* avx2Kernels() {
+    static const SimdKernels kernels = {"avx2", simdScanRows, simdScanBlock, simdEncryptRows};
+    return &kernels;
+}
+
+#else
+
+const SimdKernels* avx2Kernels() {
+    return NULL;
+}
+
+#endif
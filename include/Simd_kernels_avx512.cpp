@@ -0,0 +1,45 @@
+/**
+* @author: WTY
+* @date: 2024/8/19
+* @description: AVX-512F 版本的扫描与加密内核，本文件单独使用 -mavx512f 编译
+*/
+
+#include "Simd_kernels.h"
+
+#if defined(__AVX512F__)
+
+#include <immintrin.h>
+
+// 不使用 _mm512_reduce_add_pd / _mm512_castpd512_pd256，它们在部分GCC版本上会产生未初始化变量的误报
+static inline double hsum512(__m512d v) {
+    __m256d lo = _mm512_maskz_extractf64x4_pd(0xFF, v, 0);
+    __m256d hi = _mm512_maskz_extractf64x4_pd(0xFF, v, 1);
+    __m256d s4 = _mm256_add_pd(lo, hi);
+    __m128d s2 = _mm_add_pd(_mm256_castpd256_pd128(s4), _mm256_extractf128_pd(s4, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(s2, _mm_unpackhi_pd(s2, s2)));
+}
+
+#define SIMD_VEC __m512d
+#define SIMD_WIDTH 8
+#define SIMD_LOAD(p) _mm512_loadu_pd(p)
+#define SIMD_STORE(p, v) _mm512_storeu_pd(p, v)
+#define SIMD_ZERO() _mm512_setzero_pd()
+#define SIMD_SET1(x) _mm512_set1_pd(x)
+#define SIMD_ADD(a, b) _mm512_add_pd(a, b)
+#define SIMD_FMA(a, b, c) _mm512_fmadd_pd(a, b, c)
+#define SIMD_HSUM(v) hsum512(v)
+
+#include "Simd_kernels_impl.h"
+
+const SimdKernels* avx512Kernels() {
+    static const SimdKernels kernels = {"avx512", simdScanRows, simdScanBlock, simdEncryptRows};
+    return &kernels;
+}
+
+#else
+
+const SimdKernels* avx512Kernels() {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,162 @@
+/**
+* @author: WTY
+* @date: 2024/8/19
+* @description: SIMD内核的公共实现，由各指令集的源文件在定义向量操作宏之后包含
+*
+* 包含前需要定义：
+*   SIMD_VEC            向量类型
+*   SIMD_WIDTH          每个向量的double个数
+*   SIMD_LOAD(p)        非对齐读取
+*   SIMD_STORE(p, v)    非对齐写入
+*   SIMD_ZERO()         全0向量
+*   SIMD_SET1(x)        广播
+*   SIMD_ADD(a, b)      a + b
+*   SIMD_FMA(a, b, c)   a * b + c
+*   SIMD_HSUM(v)        各分量之和
+*/
+
+#ifndef SIMD_KERNELS_IMPL_H
+#define SIMD_KERNELS_IMPL_H
+
+#include "Simd_kernels.h"
+
+// 各指令集版本用不同的编译选项编译，放在匿名命名空间中避免链接时互相替换
+namespace {
+
+/**
+ * @Description: 4 条密文同时与查询向量求内积，每条用两个累加器隐藏FMA延迟
+ */
+inline void dot4(const double* r0, const double* r1, const double* r2, const double* r3, const double* q,
+                 size_t dim, double* out) {
+    SIMD_VEC a0 = SIMD_ZERO(), a1 = SIMD_ZERO(), a2 = SIMD_ZERO(), a3 = SIMD_ZERO();
+    SIMD_VEC b0 = SIMD_ZERO(), b1 = SIMD_ZERO(), b2 = SIMD_ZERO(), b3 = SIMD_ZERO();
+    size_t j = 0;
+    for (; j + 2 * SIMD_WIDTH <= dim; j += 2 * SIMD_WIDTH) {
+        SIMD_VEC q0 = SIMD_LOAD(q + j);
+        SIMD_VEC q1 = SIMD_LOAD(q + j + SIMD_WIDTH);
+        a0 = SIMD_FMA(SIMD_LOAD(r0 + j), q0, a0);
+        a1 = SIMD_FMA(SIMD_LOAD(r1 + j), q0, a1);
+        a2 = SIMD_FMA(SIMD_LOAD(r2 + j), q0, a2);
+        a3 = SIMD_FMA(SIMD_LOAD(r3 + j), q0, a3);
+        b0 = SIMD_FMA(SIMD_LOAD(r0 + j + SIMD_WIDTH), q1, b0);
+        b1 = SIMD_FMA(SIMD_LOAD(r1 + j + SIMD_WIDTH), q1, b1);
+        b2 = SIMD_FMA(SIMD_LOAD(r2 + j + SIMD_WIDTH), q1, b2);
+        b3 = SIMD_FMA(SIMD_LOAD(r3 + j + SIMD_WIDTH), q1, b3);
+    }
+    for (; j + SIMD_WIDTH <= dim; j += SIMD_WIDTH) {
+        SIMD_VEC q0 = SIMD_LOAD(q + j);
+        a0 = SIMD_FMA(SIMD_LOAD(r0 + j), q0, a0);
+        a1 = SIMD_FMA(SIMD_LOAD(r1 + j), q0, a1);
+        a2 = SIMD_FMA(SIMD_LOAD(r2 + j), q0, a2);
+        a3 = SIMD_FMA(SIMD_LOAD(r3 + j), q0, a3);
+    }
+    double s0 = SIMD_HSUM(SIMD_ADD(a0, b0));
+    double s1 = SIMD_HSUM(SIMD_ADD(a1, b1));
+    double s2 = SIMD_HSUM(SIMD_ADD(a2, b2));
+    double s3 = SIMD_HSUM(SIMD_ADD(a3, b3));
+    for (; j < dim; j++) {
+        s0 += r0[j] * q[j];
+        s1 += r1[j] * q[j];
+        s2 += r2[j] * q[j];
+        s3 += r3[j] * q[j];
+    }
+    out[0] = s0;
+    out[1] = s1;
+    out[2] = s2;
+    out[3] = s3;
+}
+
+inline double dot1(const double* r, const double* q, size_t dim) {
+    SIMD_VEC a = SIMD_ZERO();
+    size_t j = 0;
+    for (; j + SIMD_WIDTH <= dim; j += SIMD_WIDTH) {
+        a = SIMD_FMA(SIMD_LOAD(r + j), SIMD_LOAD(q + j), a);
+    }
+    double s = SIMD_HSUM(a);
+    for (; j < dim; j++) {
+        s += r[j] * q[j];
+    }
+    return s;
+}
+
+void simdScanRows(const double* const* rows, size_t n, const double* q, size_t dim, double* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        dot4(rows[i], rows[i + 1], rows[i + 2], rows[i + 3], q, dim, out + i);
+    }
+    for (; i < n; i++) {
+        out[i] = dot1(rows[i], q, dim);
+    }
+}
+
+void simdScanBlock(const double* base, size_t n, size_t stride, const double* q, size_t dim, double* out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const double* r = base + i * stride;
+        dot4(r, r + stride, r + 2 * stride, r + 3 * stride, q, dim, out + i);
+    }
+    for (; i < n; i++) {
+        out[i] = dot1(base + i * stride, q, dim);
+    }
+}
+
+/**
+ * @Description: ROWS 行 × 2个向量宽度列（从第 j 列开始）的加密微内核，累加器常驻寄存器
+ */
+template<int ROWS>
+inline void encryptStrip(const double* t, size_t dim, const double* key, double* out, size_t j) {
+    SIMD_VEC acc[ROWS][2];
+    for (int r = 0; r < ROWS; r++) {
+        acc[r][0] = SIMD_ZERO();
+        acc[r][1] = SIMD_ZERO();
+    }
+    for (size_t i = 0; i < dim; i++) {
+        SIMD_VEC k0 = SIMD_LOAD(key + i * dim + j);
+        SIMD_VEC k1 = SIMD_LOAD(key + i * dim + j + SIMD_WIDTH);
+        for (int r = 0; r < ROWS; r++) {
+            SIMD_VEC x = SIMD_SET1(t[r * dim + i]);
+            acc[r][0] = SIMD_FMA(x, k0, acc[r][0]);
+            acc[r][1] = SIMD_FMA(x, k1, acc[r][1]);
+        }
+    }
+    for (int r = 0; r < ROWS; r++) {
+        SIMD_STORE(out + r * dim + j, acc[r][0]);
+        SIMD_STORE(out + r * dim + j + SIMD_WIDTH, acc[r][1]);
+    }
+}
+
+// 每次处理的行块大小，使一个行块的扩展向量留在二级缓存中，加密矩阵的列条带留在一级缓存中
+const size_t ENCRYPT_ROW_BLOCK = 64;
+
+void simdEncryptRows(const double* t, size_t n, size_t dim, const double* key, double* out) {
+    for (size_t rb = 0; rb < n; rb += ENCRYPT_ROW_BLOCK) {
+        size_t rows = n - rb < ENCRYPT_ROW_BLOCK ? n - rb : ENCRYPT_ROW_BLOCK;
+        const double* tb = t + rb * dim;
+        double* ob = out + rb * dim;
+        size_t j = 0;
+        for (; j + 2 * SIMD_WIDTH <= dim; j += 2 * SIMD_WIDTH) {
+            size_t r = 0;
+            for (; r + 4 <= rows; r += 4) {
+                encryptStrip<4>(tb + r * dim, dim, key, ob + r * dim, j);
+            }
+            for (; r < rows; r++) {
+                encryptStrip<1>(tb + r * dim, dim, key, ob + r * dim, j);
+            }
+        }
+        // 剩余不足两个向量宽度的列
+        for (; j < dim; j++) {
+            for (size_t r = 0; r < rows; r++) {
+                double sum = 0;
+                for (size_t i = 0; i < dim; i++) {
+                    sum += tb[r * dim + i] * key[i * dim + j];
+                }
+                ob[r * dim + j] = sum;
+            }
+        }
+    }
+}
+
+}
+
+
+#endif //SIMD_KERNELS_IMPL_H
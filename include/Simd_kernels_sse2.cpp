@@ -0,0 +1,36 @@
+/**
+* @author: WTY
+* @date: 2024/8/19
+* @description: SSE2 版本的扫描与加密内核（x86-64 基线指令集）
+*/
+
+#include "Simd_kernels.h"
+
+#if defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define SIMD_VEC __m128d
+#define SIMD_WIDTH 2
+#define SIMD_LOAD(p) _mm_loadu_pd(p)
+#define SIMD_STORE(p, v) _mm_storeu_pd(p, v)
+#define SIMD_ZERO() _mm_setzero_pd()
+#define SIMD_SET1(x) _mm_set1_pd(x)
+#define SIMD_ADD(a, b) _mm_add_pd(a, b)
+#define SIMD_FMA(a, b, c) _mm_add_pd(_mm_mul_pd(a, b), c)
+#define SIMD_HSUM(v) _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)))
+
+#include "Simd_kernels_impl.h"
+
+const SimdKernels* sse2Kernels() {
+    static const SimdKernels kernels = {"sse2", simdScanRows, simdScanBlock, simdEncryptRows};
+    return &kernels;
+}
+
+#else
+
+const SimdKernels* sse2Kernels() {
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,195 @@
+/**
+* @author: WTY
+* @date: 2024/8/17
+* @description: 密文快照文件的读写
+*/
+
+#include "Snapshot.h"
+#include "SSQ.h"
+#include "Block_index.h"
+#include <cstring>
+#include <unistd.h>
+
+// 文件缓冲区大小
+static const size_t SNAPSHOT_IO_BUFFER = 1 << 22;
+
+SnapshotWriter::SnapshotWriter() : file(NULL), failed(false) {
+    memset(&header, 0, sizeof(header));
+}
+
+SnapshotWriter::~SnapshotWriter() {
+    close();
+}
+
+bool SnapshotWriter::open(const char* path, uint32_t dim) {
+    close();
+    file = fopen(path, "wb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.dim = dim;
+    failed = fwrite(&header, sizeof(header), 1, file) != 1;
+    return !failed;
+}
+
+bool SnapshotWriter::resume(const char* path, uint32_t dim, uint64_t rows) {
+    close();
+    failed = false;
+    SnapshotHeader existing;
+    if (!readSnapshotHeader(path, existing) || existing.dim != dim) {
+        return false;
+    }
+    off_t bytes = (off_t) (SNAPSHOT_HEADER_SIZE + rows * dim * sizeof(double));
+    if (truncate(path, bytes) != 0) {
+        cerr << "Unable to truncate file " << path << endl;
+        return false;
+    }
+    file = fopen(path, "r+b");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return false;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+    header = existing;
+    header.rows = rows;
+    failed = fseeko(file, bytes, SEEK_SET) != 0;
+    return !failed;
+}
+
+bool SnapshotWriter::append(const double* data, size_t rows) {
+    if (file == NULL || failed) {
+        return false;
+    }
+    size_t count = rows * header.dim;
+    if (fwrite(data, sizeof(double), count, file) != count) {
+        failed = true;
+        return false;
+    }
+    header.rows += rows;
+    return true;
+}
+
+bool SnapshotWriter::sync() {
+    if (file == NULL || failed) {
+        return false;
+    }
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+        failed = true;
+    }
+    return !failed;
+}
+
+bool SnapshotWriter::close() {
+    if (file == NULL) {
+        return !failed;
+    }
+    // 回填行数
+    if (!failed && (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1)) {
+        failed = true;
+    }
+    if (fclose(file) != 0) {
+        failed = true;
+    }
+    file = NULL;
+    return !failed;
+}
+
+/**
+ * @Method: readSnapshotHeader
+ * @Description: 读取并校验快照文件头
+ * @param const char* path 快照文件
+ * @param SnapshotHeader& header 返回的文件头
+ * @return 状态码，1：成功；0：失败
+ */
+int readSnapshotHeader(const char* path, SnapshotHeader& header) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return 0;
+    }
+    size_t n = fread(&header, sizeof(header), 1, file);
+    fclose(file);
+    if (n != 1 || memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != SNAPSHOT_VERSION) {
+        cerr << "Invalid snapshot file " << path << endl;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @Method: saveSnapshot
+ * @Description: 将全局密文数据集写入快照文件
+ * @param const char* path 快照文件
+ * @return 状态码，1：成功；0：失败
+ */
+int saveSnapshot(const char* path) {
+    SnapshotWriter writer;
+    if (!writer.open(path, ciphertext.empty() ? 0 : (uint32_t) ciphertext[0].size())) {
+        return 0;
+    }
+    for (size_t i = 0; i < ciphertext.size(); i++) {
+        if (!writer.append(ciphertext[i].data(), 1)) {
+            break;
+        }
+    }
+    if (!writer.close()) {
+        cerr << "Error writing file " << path << endl;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @Method: loadSnapshot
+ * @Description: 从快照文件读取密文到全局密文数据集；快照带行号列（写前日志合并生成）时，
+ *               行号装入 originalRowId 的映射，查询结果报告的是这些行号。读取失败时原数据集不变
+ * @param const char* path 快照文件
+ * @return 状态码，1：成功；0：失败
+ */
+int loadSnapshot(const char* path) {
+    SnapshotHeader header;
+    if (!readSnapshotHeader(path, header)) {
+        return 0;
+    }
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    setvbuf(file, NULL, _IOFBF, SNAPSHOT_IO_BUFFER);
+    fseek(file, SNAPSHOT_HEADER_SIZE, SEEK_SET);
+
+    vector<VectorXd> rows(header.rows);
+    for (uint64_t i = 0; i < header.rows; i++) {
+        rows[i].resize(header.dim);
+        if (fread(rows[i].data(), sizeof(double), header.dim, file) != header.dim) {
+            cerr << "Truncated snapshot file " << path << endl;
+            fclose(file);
+            return 0;
+        }
+    }
+    vector<long> ids;
+    if (header.flags & SNAPSHOT_FLAG_ROW_IDS) {
+        vector<uint64_t> column(header.rows);
+        if (fread(column.data(), sizeof(uint64_t), header.rows, file) != header.rows) {
+            cerr << "Truncated snapshot file " << path << endl;
+            fclose(file);
+            return 0;
+        }
+        ids.assign(column.begin(), column.end());
+    }
+    fclose(file);
+
+    CiphertextWriteGuard guard;
+    ciphertext.swap(rows);
+    datasetVersion++;
+    // 没有行号列时映射为空，originalRowId 即行的位置
+    blockIndex.originalIds.swap(ids);
+    blockIndex.idsVersion = datasetVersion;
+    return 1;
+}
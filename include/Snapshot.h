@@ -0,0 +1,96 @@
+/**
+* @author: WTY
+* @date: 2024/8/17
+* @description: 密文快照文件的读写
+*/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Matrix_encryption.h"
+#include <cstdio>
+#include <cstdint>
+
+/*
+ * 快照文件布局（小端）：
+ *   SnapshotHeader（64字节）
+ *   rows × dim 个 double，行主序，每行为一条密文 (d+3 维)
+ *   flags 含 SNAPSHOT_FLAG_ROW_IDS 时其后为 rows 个 uint64_t 行号（递增），否则行号即行的位置
+ */
+struct SnapshotHeader {
+    char magic[8];          // "SSQSNAP"
+    uint32_t version;       // SNAPSHOT_VERSION
+    uint32_t dim;           // 密文维度 d+3
+    uint64_t rows;          // 行数
+    uint64_t flags;         // 特性位 SNAPSHOT_FLAG_*
+    uint64_t generation;    // 写前日志合并生成快照时的代数，普通快照为 0
+    uint64_t reserved[3];
+};
+
+const uint64_t SNAPSHOT_FLAG_ROW_IDS = 1;
+
+const char SNAPSHOT_MAGIC[8] = {'S', 'S', 'Q', 'S', 'N', 'A', 'P', '\0'};
+const uint32_t SNAPSHOT_VERSION = 1;
+const size_t SNAPSHOT_HEADER_SIZE = sizeof(SnapshotHeader);
+
+/**
+ * @Class: SnapshotWriter
+ * @Description: 顺序追加密文行的快照写出器，关闭时回填行数
+ */
+class SnapshotWriter {
+public:
+    SnapshotWriter();
+    ~SnapshotWriter();
+
+    bool open(const char* path, uint32_t dim);
+    /**
+     * @Method: resume
+     * @Description: 打开已有的快照继续追加，文件截断到前 rows 行（丢弃最后一次提交之后写入的部分）
+     */
+    bool resume(const char* path, uint32_t dim, uint64_t rows);
+    bool append(const double* data, size_t rows);
+    /**
+     * @Method: sync
+     * @Description: 将已追加的行刷到磁盘（fflush + fsync），返回后这些行在崩溃后依然存在
+     */
+    bool sync();
+    bool close();
+
+    uint64_t rows() const {
+        return header.rows;
+    }
+
+private:
+    FILE* file;
+    SnapshotHeader header;
+    bool failed;
+};
+
+/**
+ * @Method: readSnapshotHeader
+ * @Description: 读取并校验快照文件头
+ * @param const char* path 快照文件
+ * @param SnapshotHeader& header 返回的文件头
+ * @return 状态码，1：成功；0：失败
+ */
+int readSnapshotHeader(const char* path, SnapshotHeader& header);
+
+/**
+ * @Method: saveSnapshot
+ * @Description: 将全局密文数据集写入快照文件
+ * @param const char* path 快照文件
+ * @return 状态码，1：成功；0：失败
+ */
+int saveSnapshot(const char* path);
+
+/**
+ * @Method: loadSnapshot
+ * @Description: 从快照文件读取密文到全局密文数据集；快照带行号列时，
+ *               行号装入 originalRowId 的映射，查询结果报告的是这些行号
+ * @param const char* path 快照文件
+ * @return 状态码，1：成功；0：失败
+ */
+int loadSnapshot(const char* path);
+
+
+#endif //SNAPSHOT_H
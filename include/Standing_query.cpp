@@ -0,0 +1,252 @@
+/**
+* @author: WTY
+* @date: 2024/8/25
+* @description: 常驻查询：新插入的密文只与已注册的加密查询做小矩阵乘法，增量维护各查询的top-k并发出变化通知
+*/
+
+#include "Standing_query.h"
+#include "Block_index.h"
+#include <cstring>
+
+// 全局常驻查询注册表
+StandingQueryRegistry standingQueries;
+
+StandingQueryRegistry::StandingQueryRegistry() : nextId(1) {
+    memset(&counters, 0, sizeof(counters));
+}
+
+/**
+ * @Method: dropStaleLocked
+ * @Description: 删除注册之后数据集被重新导入或密钥被轮换的查询：它们用旧密钥加密，与新密文的内积没有意义。
+ *               insertBatch 自己的追加会同步推进各查询记录的版本，调用时需持有锁
+ */
+void StandingQueryRegistry::dropStaleLocked() {
+    const uint64_t version = datasetVersion;
+    const int mode = keyMode;
+    for (size_t j = queries.size(); j-- > 0;) {
+        if (queries[j].version == version && queries[j].keyMode == mode) {
+            continue;
+        }
+        size_t last = queries.size() - 1;
+        if (j != last) {
+            queries[j] = queries[last];
+            queryMatrix.col(j) = queryMatrix.col(last);
+        }
+        queries.pop_back();
+        queryMatrix.conservativeResize(queryMatrix.rows(), queries.size());
+        counters.dropped++;
+    }
+}
+
+long StandingQueryRegistry::registerQuery(const VectorXd& q, int k, StandingQueryCallback callback) {
+    // 初始top-k需要一次全量扫描。扫描与注册在同一把锁内完成：insertBatch 在锁内向 ciphertext 追加行，
+    // 扫描之后、注册之前插入的行不会漏掉
+    lock_guard<mutex> lock(mtx);
+    dropStaleLocked();
+    if (k <= 0 || !denseKeyReady(q.size() - 3) || (!queries.empty() && queryMatrix.rows() != q.size())) {
+        cerr << "Standing query does not match the current key" << endl;
+        return -1;
+    }
+    StandingQuery query;
+    query.version = datasetVersion;
+    query.keyMode = keyMode;
+    vector<pair<double, long>> initial = scanTopK(q, k);
+    query.id = nextId++;
+    query.heap = TopKHeap(k);
+    for (size_t i = 0; i < initial.size(); i++) {
+        query.heap.push(initial[i].first, initial[i].second);
+    }
+    query.callback = callback;
+    queries.push_back(query);
+
+    queryMatrix.conservativeResize(q.size(), queries.size());
+    queryMatrix.col(queries.size() - 1) = q;
+    return query.id;
+}
+
+bool StandingQueryRegistry::unregisterQuery(long id) {
+    lock_guard<mutex> lock(mtx);
+    for (size_t j = 0; j < queries.size(); j++) {
+        if (queries[j].id != id) {
+            continue;
+        }
+        // 最后一列移到被删除的位置，保持列顺序与 queries 一致
+        size_t last = queries.size() - 1;
+        if (j != last) {
+            queries[j] = queries[last];
+            queryMatrix.col(j) = queryMatrix.col(last);
+        }
+        queries.pop_back();
+        queryMatrix.conservativeResize(queryMatrix.rows(), queries.size());
+        return true;
+    }
+    return false;
+}
+
+int StandingQueryRegistry::insertBatch(const vector<vector<double>>& batch) {
+    typedef chrono::high_resolution_clock Clock;
+    if (batch.empty()) {
+        return 1;
+    }
+    const size_t d = batch[0].size();
+    const long n = (long) batch.size();
+    for (long i = 1; i < n; i++) {
+        if (batch[i].size() != d) {
+            cerr << "Inserted record " << i << " has " << batch[i].size() << " dimensions, expected " << d << endl;
+            return 0;
+        }
+    }
+
+    vector<StandingQueryEvent> events;
+    vector<StandingQueryCallback> callbacks;
+    {
+        lock_guard<mutex> lock(mtx);
+        Clock::time_point t0 = Clock::now();
+        dropStaleLocked();
+
+        long firstRow;
+        RowMatrixXd c(n, d + 3);
+        {
+            // 追加会扩容 ciphertext，与扫描互斥
+            CiphertextWriteGuard guard;
+            if (!denseKeyReady(d) || (!ciphertext.empty() && ciphertext[0].size() != (long) d + 3)) {
+                cerr << "Inserted records do not match the dataset dimension" << endl;
+                return 0;
+            }
+
+            // 加密新记录并追加到密文数据集末尾
+            random_device rd;
+            mt19937 generator(rd());
+            uniform_real_distribution<double> distribution(1, 100);
+            const RowMatrixXd key = encryptMatrix;
+            RowMatrixXd t(n, d + 3);
+            for (long i = 0; i < n; i++) {
+                augmentRecord(batch[i].data(), d, distribution(generator), t.row(i).data());
+            }
+            simdKernels().encryptRows(t.data(), n, d + 3, key.data(), c.data());
+            firstRow = (long) ciphertext.size();
+            ciphertext.reserve(ciphertext.size() + n);
+            for (long i = 0; i < n; i++) {
+                ciphertext.push_back(c.row(i).transpose());
+            }
+            uint64_t previousVersion = datasetVersion++;
+            // 剪枝重排过的密文，追加行的行号映射随之延长
+            extendOriginalIds(previousVersion, firstRow, n);
+            // 常驻查询与追加后的数据集依然对应
+            for (size_t j = 0; j < queries.size(); j++) {
+                queries[j].version = datasetVersion;
+            }
+        }
+        Clock::time_point t1 = Clock::now();
+
+        // 新行只与常驻查询打分：n×D 乘 D×m
+        if (!queries.empty()) {
+            MatrixXd scores = c * queryMatrix;
+            for (size_t j = 0; j < queries.size(); j++) {
+                StandingQuery& query = queries[j];
+                StandingQueryEvent event;
+                event.queryId = query.id;
+                for (long i = 0; i < n; i++) {
+                    double score = scores(i, j);
+                    if (query.heap.full() && !(query.heap.threshold() > score)) {
+                        continue;
+                    }
+                    bool replacing = query.heap.full();
+                    pair<double, long> old = replacing ? query.heap.top() : make_pair(0.0, -1L);
+                    if (!query.heap.push(score, firstRow + i)) {
+                        continue;
+                    }
+                    event.entered.push_back(make_pair(score, firstRow + i));
+                    if (!replacing) {
+                        continue;
+                    }
+                    if (old.second >= firstRow) {
+                        // 本批刚进入又被挤出的行不算变化
+                        for (size_t e = 0; e < event.entered.size(); e++) {
+                            if (event.entered[e].second == old.second) {
+                                event.entered.erase(event.entered.begin() + e);
+                                break;
+                            }
+                        }
+                    } else {
+                        event.evicted.push_back(old.second);
+                    }
+                }
+                if (!event.entered.empty()) {
+                    // 事件中的行号与 SSQ 返回的一致：剪枝重排过的密文换回原数据集的行号
+                    for (size_t e = 0; e < event.entered.size(); e++) {
+                        event.entered[e].second = originalRowId(event.entered[e].second);
+                    }
+                    for (size_t e = 0; e < event.evicted.size(); e++) {
+                        event.evicted[e] = originalRowId(event.evicted[e]);
+                    }
+                    event.threshold = query.heap.threshold();
+                    events.push_back(event);
+                    callbacks.push_back(query.callback);
+                }
+            }
+        }
+        Clock::time_point t2 = Clock::now();
+
+        counters.batches++;
+        counters.rowsInserted += n;
+        counters.notifications += events.size();
+        counters.encryptMillis += chrono::duration<double, milli>(t1 - t0).count();
+        counters.scoreMillis += chrono::duration<double, milli>(t2 - t1).count();
+    }
+
+    // 回调在锁外执行，回调中可以再次调用 topK
+    for (size_t e = 0; e < events.size(); e++) {
+        if (callbacks[e]) {
+            callbacks[e](events[e]);
+        }
+    }
+    return 1;
+}
+
+vector<pair<double, long>> StandingQueryRegistry::topK(long id) {
+    lock_guard<mutex> lock(mtx);
+    dropStaleLocked();
+    for (size_t j = 0; j < queries.size(); j++) {
+        if (queries[j].id == id) {
+            TopKHeap copy = queries[j].heap;
+            vector<pair<double, long>> winners = copy.extractDescending();
+            for (size_t i = 0; i < winners.size(); i++) {
+                winners[i].second = originalRowId(winners[i].second);
+            }
+            return winners;
+        }
+    }
+    return vector<pair<double, long>>();
+}
+
+size_t StandingQueryRegistry::size() {
+    lock_guard<mutex> lock(mtx);
+    dropStaleLocked();
+    return queries.size();
+}
+
+StandingQueryStats StandingQueryRegistry::stats() {
+    lock_guard<mutex> lock(mtx);
+    return counters;
+}
+
+/**
+ * @Method: insertDataFromFile
+ * @Description: 读取文件中的新记录并插入到全局常驻查询注册表
+ * @param char* fileString 新记录文件的地址，格式与数据集相同
+ * @return 状态码，1：成功；0：失败
+ */
+int insertDataFromFile(char* fileString) {
+    vector<vector<double>> batch = readDataFromFile(fileString);
+    if (batch.empty()) {
+        return 0;
+    }
+    auto start_time = chrono::high_resolution_clock::now();
+    int status = standingQueries.insertBatch(batch);
+    chrono::duration<double, milli> total_duration = chrono::high_resolution_clock::now() - start_time;
+    printf("插入 %zu 条记录，%zu 个常驻查询，时间 %f 毫秒\n", batch.size(), standingQueries.size(),
+           total_duration.count());
+    fflush(stdout);
+    return status;
+}
@@ -0,0 +1,113 @@
+/**
+* @author: WTY
+* @date: 2024/8/25
+* @description: 常驻查询：新插入的密文只与已注册的加密查询做小矩阵乘法，增量维护各查询的top-k并发出变化通知
+*/
+
+#ifndef STANDING_QUERY_H
+#define STANDING_QUERY_H
+
+#include "SSQ.h"
+#include <functional>
+#include <mutex>
+
+/**
+ * 一次插入导致某个常驻查询的top-k发生变化
+ */
+struct StandingQueryEvent {
+    long queryId;
+    vector<pair<double, long>> entered;     // 新进入top-k的 (距离, 原数据集的行号)
+    vector<long> evicted;                   // 被挤出top-k的原数据集行号（已存在于本次插入之前）
+    double threshold;                       // 变化后的第k小距离
+};
+
+typedef function<void(const StandingQueryEvent&)> StandingQueryCallback;
+
+/**
+ * 常驻查询统计
+ */
+struct StandingQueryStats {
+    uint64_t batches;
+    uint64_t rowsInserted;
+    uint64_t notifications;
+    uint64_t dropped;       // 因数据集重新导入或密钥轮换而删除的常驻查询数
+    double encryptMillis;
+    double scoreMillis;     // 新行与所有常驻查询打分及更新堆的时间
+};
+
+/**
+ * @Class: StandingQueryRegistry
+ * @Description: 常驻查询注册表。注册时对已有密文做一次全量扫描得到初始top-k，
+ *               之后每批插入只计算 (批大小 × 常驻查询数) 个内积，与数据集大小无关
+ */
+class StandingQueryRegistry {
+public:
+    StandingQueryRegistry();
+
+    /**
+     * @Method: registerQuery
+     * @Description: 注册一个加密后的查询
+     * @param const VectorXd& q 加密后的查询向量
+     * @param int k 维护的结果数
+     * @param StandingQueryCallback callback top-k变化时在插入线程上调用，可为空
+     * @return long 查询编号，查询与当前密钥不符时为 -1。之后数据集被重新导入或密钥被轮换时查询被删除
+     */
+    long registerQuery(const VectorXd& q, int k, StandingQueryCallback callback = StandingQueryCallback());
+
+    /**
+     * @Method: unregisterQuery
+     * @Description: 注销查询
+     * @return bool 查询是否存在
+     */
+    bool unregisterQuery(long id);
+
+    /**
+     * @Method: insertBatch
+     * @Description: 用全局加密矩阵加密一批新记录，追加到密文数据集末尾并增量更新所有常驻查询
+     * @param const vector<vector<double>>& batch 明文记录
+     * @return 状态码，1：成功；0：失败
+     */
+    int insertBatch(const vector<vector<double>>& batch);
+
+    /**
+     * @Method: topK
+     * @Description: 查询当前的top-k
+     * @return vector<pair<double, long>> (距离, 原数据集的行号)，距离从大到小；查询不存在或已被删除时为空
+     */
+    vector<pair<double, long>> topK(long id);
+
+    size_t size();
+
+    StandingQueryStats stats();
+
+private:
+    struct StandingQuery {
+        long id;
+        TopKHeap heap;
+        StandingQueryCallback callback;
+        uint64_t version;   // 与之对应的 datasetVersion，insertBatch 追加时随之推进
+        int keyMode;        // 注册时的密钥类型
+    };
+
+    void dropStaleLocked();
+
+    vector<StandingQuery> queries;
+    MatrixXd queryMatrix;   // D×m，第 j 列为 queries[j] 的加密查询向量
+    long nextId;
+    StandingQueryStats counters;
+    mutex mtx;
+};
+
+// 全局常驻查询注册表
+extern StandingQueryRegistry standingQueries;
+
+/**
+ * @Method: insertDataFromFile
+ * @Description: 读取文件中的新记录并插入到全局常驻查询注册表
+ * @param char* fileString 新记录文件的地址，格式与数据集相同
+ * @return 状态码，1：成功；0：失败
+ */
+int insertDataFromFile(char* fileString);
+
+
+#endif //STANDING_QUERY_H
@@ -0,0 +1,309 @@
+/**
+* @author: WTY
+* @date: 2024/9/3
+* @description: 进程内共享的工作窃取线程池：按优先级调度导入与查询的任务，支持协作式取消并统计各类任务的CPU时间
+*/
+
+#include "Task_runtime.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+
+// 当前线程所属的线程池与工作线程编号，池外线程为 NULL / -1
+static thread_local TaskRuntime* currentRuntime = NULL;
+static thread_local int currentWorker = -1;
+// 当前任务内嵌套执行的任务（TaskGroup::wait 帮忙执行的）所用的时间，外层任务从自己的统计中减去
+static thread_local uint64_t nestedCpuNanos = 0;
+static thread_local uint64_t nestedRunNanos = 0;
+
+static uint64_t threadCpuNanos() {
+    timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+TaskRuntime::TaskRuntime(int threads) : workerCount(max(1, threads)), pendingTasks(0), stopping(false) {
+    for (int i = 0; i <= workerCount; i++) {
+        queues.push_back(unique_ptr<WorkerQueues>(new WorkerQueues()));
+    }
+    resetStats();
+    for (int p = 0; p < TASK_PRIORITY_COUNT; p++) {
+        depth[p] = 0;
+    }
+    for (int i = 0; i < workerCount; i++) {
+        workers.push_back(thread(&TaskRuntime::workerLoop, this, i));
+    }
+}
+
+TaskRuntime::~TaskRuntime() {
+    {
+        lock_guard<mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+void TaskRuntime::submit(int priority, function<void()> task) {
+    priority = min(max(priority, 0), TASK_PRIORITY_COUNT - 1);
+    int target = currentRuntime == this && currentWorker >= 0 ? currentWorker : workerCount;
+    {
+        lock_guard<mutex> lock(queues[target]->lock);
+        queues[target]->tasks[priority].push_back(std::move(task));
+    }
+    submitted[priority]++;
+    depth[priority]++;
+    pendingTasks++;
+    // 在 sleepMutex 下通知，工作线程检查 pendingTasks 与进入等待之间不会漏掉
+    lock_guard<mutex> lock(sleepMutex);
+    wake.notify_one();
+}
+
+/**
+ * @Method: take
+ * @Description: 按优先级从高到低依次查看本地队列尾部、共享队列头部与其他工作线程队列的头部
+ */
+bool TaskRuntime::take(int self, int maxPriority, function<void()>& task, int& priority) {
+    if (pendingTasks <= 0) {
+        return false;
+    }
+    for (int p = 0; p <= maxPriority && p < TASK_PRIORITY_COUNT; p++) {
+        if (depth[p] <= 0) {
+            continue;
+        }
+        if (self >= 0) {
+            WorkerQueues& own = *queues[self];
+            lock_guard<mutex> lock(own.lock);
+            if (!own.tasks[p].empty()) {
+                task = std::move(own.tasks[p].back());
+                own.tasks[p].pop_back();
+                priority = p;
+                return true;
+            }
+        }
+        {
+            WorkerQueues& shared = *queues[workerCount];
+            lock_guard<mutex> lock(shared.lock);
+            if (!shared.tasks[p].empty()) {
+                task = std::move(shared.tasks[p].front());
+                shared.tasks[p].pop_front();
+                priority = p;
+                return true;
+            }
+        }
+        int start = self >= 0 ? self + 1 : 0;
+        for (int i = 0; i < workerCount; i++) {
+            int victim = (start + i) % workerCount;
+            if (victim == self) {
+                continue;
+            }
+            WorkerQueues& other = *queues[victim];
+            lock_guard<mutex> lock(other.lock);
+            if (!other.tasks[p].empty()) {
+                task = std::move(other.tasks[p].front());
+                other.tasks[p].pop_front();
+                priority = p;
+                steals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void TaskRuntime::execute(function<void()>& task, int priority) {
+    depth[priority]--;
+    pendingTasks--;
+    uint64_t outerCpu = nestedCpuNanos;
+    uint64_t outerRun = nestedRunNanos;
+    nestedCpuNanos = 0;
+    nestedRunNanos = 0;
+    auto start = chrono::steady_clock::now();
+    uint64_t cpuStart = threadCpuNanos();
+    task();
+    uint64_t cpu = threadCpuNanos() - cpuStart;
+    uint64_t run = (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() -
+                                                                         start).count();
+    // 嵌套任务已计入它们自己的类别，这里只记本任务自身的时间
+    cpuNanos[priority] += cpu - min(cpu, nestedCpuNanos);
+    runNanos[priority] += run - min(run, nestedRunNanos);
+    nestedCpuNanos = outerCpu + cpu;
+    nestedRunNanos = outerRun + run;
+    executed[priority]++;
+    task = nullptr;
+}
+
+bool TaskRuntime::runPending(int maxPriority) {
+    function<void()> task;
+    int priority;
+    int self = currentRuntime == this ? currentWorker : -1;
+    if (!take(self, maxPriority, task, priority)) {
+        return false;
+    }
+    execute(task, priority);
+    return true;
+}
+
+void TaskRuntime::workerLoop(int self) {
+    currentRuntime = this;
+    currentWorker = self;
+    function<void()> task;
+    int priority;
+    while (true) {
+        if (take(self, TASK_PRIORITY_COUNT - 1, task, priority)) {
+            execute(task, priority);
+            continue;
+        }
+        unique_lock<mutex> lock(sleepMutex);
+        wake.wait(lock, [this] { return stopping || pendingTasks > 0; });
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+int TaskRuntime::threads() const {
+    return workerCount;
+}
+
+TaskRuntimeStats TaskRuntime::stats() const {
+    TaskRuntimeStats result;
+    result.threads = workerCount;
+    result.steals = steals;
+    for (int p = 0; p < TASK_PRIORITY_COUNT; p++) {
+        TaskClassStats& c = result.classes[p];
+        c.submitted = submitted[p];
+        c.executed = executed[p];
+        c.cancelled = cancelled[p];
+        c.queueDepth = depth[p];
+        c.cpuMillis = cpuNanos[p] / 1e6;
+        c.runMillis = runNanos[p] / 1e6;
+    }
+    return result;
+}
+
+void TaskRuntime::resetStats() {
+    steals = 0;
+    for (int p = 0; p < TASK_PRIORITY_COUNT; p++) {
+        submitted[p] = 0;
+        executed[p] = 0;
+        cancelled[p] = 0;
+        cpuNanos[p] = 0;
+        runNanos[p] = 0;
+    }
+}
+
+/**
+ * @Method: taskRuntime
+ * @Description: 进程内共享的线程池，第一次使用时创建；线程数默认为CPU数，可用环境变量 SSQ_THREADS 指定
+ */
+TaskRuntime& taskRuntime() {
+    static TaskRuntime runtime([]() {
+        const char* configured = getenv("SSQ_THREADS");
+        int threads = configured != NULL ? atoi(configured) : 0;
+        return threads > 0 ? threads : max(1, (int) thread::hardware_concurrency());
+    }());
+    return runtime;
+}
+
+TaskGroup::TaskGroup(int priority, const CancellationToken& token)
+        : priority(priority), cancelToken(token), state(new State()) {
+}
+
+TaskGroup::~TaskGroup() {
+    wait();
+}
+
+void TaskGroup::run(function<void()> task) {
+    state->pending++;
+    shared_ptr<State> s = state;
+    CancellationToken token = cancelToken;
+    int p = priority;
+    taskRuntime().submit(priority, [s, token, p, task]() {
+        if (token.cancelled()) {
+            taskRuntime().cancelled[p]++;
+        } else {
+            task();
+        }
+        if (--s->pending == 0) {
+            lock_guard<mutex> lock(s->lock);
+            s->done.notify_all();
+        }
+    });
+}
+
+bool TaskGroup::wait() {
+    TaskRuntime& runtime = taskRuntime();
+    while (state->pending > 0) {
+        // 帮忙执行排队的任务，只取不低于本组优先级的，避免查询线程被拖进批量工作
+        if (runtime.runPending(priority)) {
+            continue;
+        }
+        unique_lock<mutex> lock(state->lock);
+        state->done.wait_for(lock, chrono::milliseconds(1), [this] { return state->pending == 0; });
+    }
+    return !cancelToken.cancelled();
+}
+
+/**
+ * @Method: parallelChunks
+ * @Description: 把 [0, chunks) 的块交给至多 slots 个并发任务，每个任务处理一块后重新入队，
+ *               块之间让出工作线程；同一 slot 的块依次执行，body 可以使用按 slot 分配的临时空间
+ * @param int priority 优先级 TaskPriority
+ * @param int slots 最多同时执行的块数，0 表示线程池的线程数
+ * @param long chunks 块数
+ * @param const function<void(long, int)>& body body(块号, slot)
+ * @param const CancellationToken& token 取消标志，取消后不再开始新的块
+ * @return bool 是否全部完成
+ */
+bool parallelChunks(int priority, int slots, long chunks, const function<void(long, int)>& body,
+                    const CancellationToken& token) {
+    if (chunks <= 1) {
+        // 只有一块时直接在当前线程执行
+        if (chunks == 1 && !token.cancelled()) {
+            body(0, 0);
+        }
+        return !token.cancelled();
+    }
+    if (slots <= 0) {
+        slots = taskRuntime().threads();
+    }
+    slots = (int) min((long) slots, chunks);
+
+    atomic<long> next(0);
+    TaskGroup group(priority, token);
+    function<void(int)> step = [&](int slot) {
+        long chunk = next++;
+        if (chunk >= chunks || token.cancelled()) {
+            return;
+        }
+        body(chunk, slot);
+        group.run([&step, slot]() { step(slot); });
+    };
+    for (int s = 0; s < slots; s++) {
+        group.run([&step, s]() { step(s); });
+    }
+    return group.wait();
+}
+
+/**
+ * @Method: printTaskRuntimeReport
+ * @Description: 输出线程数、窃取次数以及各优先级的排队深度、任务数与CPU时间
+ */
+void printTaskRuntimeReport() {
+    static const char* names[TASK_PRIORITY_COUNT] = {"query", "bulk", "background"};
+    TaskRuntimeStats s = taskRuntime().stats();
+    printf("任务运行时：线程 %d，窃取 %llu 次\n", s.threads, (unsigned long long) s.steals);
+    printf("%-12s %8s %12s %12s %10s %14s %14s\n", "class", "queued", "submitted", "executed", "cancelled",
+           "cpu(ms)", "run(ms)");
+    for (int p = 0; p < TASK_PRIORITY_COUNT; p++) {
+        const TaskClassStats& c = s.classes[p];
+        printf("%-12s %8ld %12llu %12llu %10llu %14.3f %14.3f\n", names[p], c.queueDepth,
+               (unsigned long long) c.submitted, (unsigned long long) c.executed, (unsigned long long) c.cancelled,
+               c.cpuMillis, c.runMillis);
+    }
+    fflush(stdout);
+}
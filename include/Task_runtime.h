@@ -0,0 +1,210 @@
+/**
+* @author: WTY
+* @date: 2024/9/3
+* @description: 进程内共享的工作窃取线程池：按优先级调度导入与查询的任务，支持协作式取消并统计各类任务的CPU时间
+*/
+
+#ifndef TASK_RUNTIME_H
+#define TASK_RUNTIME_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * 任务优先级，数值越小越优先。任务只在边界处切换，批量工作需要切成块提交，
+ * 每块结束后工作线程先取查询任务，交互查询因此不会被大批量导入饿死
+ */
+enum TaskPriority {
+    TASK_QUERY = 0,         // 交互查询：扫描、选择、解密
+    TASK_BULK = 1,          // 批量工作：数据导入的解析与加密、k 近邻连接
+    TASK_BACKGROUND = 2,    // 后台维护
+    TASK_PRIORITY_COUNT = 3
+};
+
+/**
+ * @Class: CancellationToken
+ * @Description: 协作式取消标志，副本共享同一个标志；任务在块边界检查，已取消的任务组不再执行尚未开始的任务
+ */
+class CancellationToken {
+public:
+    CancellationToken() : flag(new atomic<bool>(false)) {
+    }
+
+    void cancel() const {
+        *flag = true;
+    }
+
+    bool cancelled() const {
+        return *flag;
+    }
+
+private:
+    shared_ptr<atomic<bool>> flag;
+};
+
+/**
+ * 一类任务的统计
+ */
+struct TaskClassStats {
+    uint64_t submitted;
+    uint64_t executed;
+    uint64_t cancelled;     // 因取消而跳过的任务数
+    long queueDepth;        // 当前排队的任务数
+    double cpuMillis;       // 执行任务消耗的线程CPU时间，不含任务内嵌套执行的其他任务
+    double runMillis;       // 执行任务的墙钟时间，同样不含嵌套任务
+};
+
+/**
+ * 线程池统计
+ */
+struct TaskRuntimeStats {
+    int threads;
+    uint64_t steals;        // 从其他工作线程队列取走的任务数
+    TaskClassStats classes[TASK_PRIORITY_COUNT];
+};
+
+/**
+ * @Class: TaskRuntime
+ * @Description: 每个工作线程有按优先级分开的双端队列，自己从尾部取（后进先出，缓存友好），
+ *               空闲时从其他线程的头部窃取；池外线程提交的任务进入共享队列。
+ *               取任务时按优先级从高到低依次查看本地、共享与其他线程的队列
+ */
+class TaskRuntime {
+public:
+    explicit TaskRuntime(int threads);
+    ~TaskRuntime();
+
+    /**
+     * @Method: submit
+     * @Description: 提交任务，在工作线程上提交时进入该线程的本地队列
+     * @param int priority 优先级 TaskPriority
+     * @param function<void()> task 任务
+     */
+    void submit(int priority, function<void()> task);
+
+    /**
+     * @Method: runPending
+     * @Description: 在当前线程执行一个优先级不低于 maxPriority 的排队任务，等待任务组时用来帮忙而不是空等
+     * @param int maxPriority 可以执行的最低优先级
+     * @return bool 是否执行了任务
+     */
+    bool runPending(int maxPriority);
+
+    int threads() const;
+
+    TaskRuntimeStats stats() const;
+
+    void resetStats();
+
+private:
+    friend class TaskGroup;
+
+    struct WorkerQueues {
+        mutex lock;
+        deque<function<void()>> tasks[TASK_PRIORITY_COUNT];
+    };
+
+    bool take(int self, int maxPriority, function<void()>& task, int& priority);
+    void execute(function<void()>& task, int priority);
+    void workerLoop(int self);
+
+    int workerCount;
+    // [0, workerCount) 为各工作线程的队列，最后一个为共享队列
+    vector<unique_ptr<WorkerQueues>> queues;
+    vector<thread> workers;
+
+    mutex sleepMutex;
+    condition_variable wake;
+    atomic<long> pendingTasks;
+    bool stopping;
+
+    atomic<uint64_t> steals;
+    atomic<uint64_t> submitted[TASK_PRIORITY_COUNT];
+    atomic<uint64_t> executed[TASK_PRIORITY_COUNT];
+    atomic<uint64_t> cancelled[TASK_PRIORITY_COUNT];
+    atomic<long> depth[TASK_PRIORITY_COUNT];
+    atomic<uint64_t> cpuNanos[TASK_PRIORITY_COUNT];
+    atomic<uint64_t> runNanos[TASK_PRIORITY_COUNT];
+};
+
+/**
+ * @Method: taskRuntime
+ * @Description: 进程内共享的线程池，第一次使用时创建；线程数默认为CPU数，可用环境变量 SSQ_THREADS 指定
+ */
+TaskRuntime& taskRuntime();
+
+/**
+ * @Class: TaskGroup
+ * @Description: 一组同优先级的任务；wait 时当前线程执行排队的任务，在工作线程内嵌套等待也不会死锁
+ */
+class TaskGroup {
+public:
+    explicit TaskGroup(int priority = TASK_QUERY, const CancellationToken& token = CancellationToken());
+    ~TaskGroup();
+
+    /**
+     * @Method: run
+     * @Description: 提交一个任务，开始执行时任务组已取消则跳过
+     */
+    void run(function<void()> task);
+
+    /**
+     * @Method: wait
+     * @Description: 等待已提交的任务全部结束（或被跳过）
+     * @return bool 是否没有被取消
+     */
+    bool wait();
+
+    const CancellationToken& token() const {
+        return cancelToken;
+    }
+
+private:
+    TaskGroup(const TaskGroup&);
+    TaskGroup& operator=(const TaskGroup&);
+
+    struct State {
+        atomic<long> pending;
+        mutex lock;
+        condition_variable done;
+
+        State() : pending(0) {
+        }
+    };
+
+    int priority;
+    CancellationToken cancelToken;
+    shared_ptr<State> state;
+};
+
+/**
+ * @Method: parallelChunks
+ * @Description: 把 [0, chunks) 的块交给至多 slots 个并发任务，每个任务处理一块后重新入队，
+ *               块之间让出工作线程；同一 slot 的块依次执行，body 可以使用按 slot 分配的临时空间
+ * @param int priority 优先级 TaskPriority
+ * @param int slots 最多同时执行的块数，0 表示线程池的线程数
+ * @param long chunks 块数
+ * @param const function<void(long, int)>& body body(块号, slot)
+ * @param const CancellationToken& token 取消标志，取消后不再开始新的块
+ * @return bool 是否全部完成
+ */
+bool parallelChunks(int priority, int slots, long chunks, const function<void(long, int)>& body,
+                    const CancellationToken& token = CancellationToken());
+
+/**
+ * @Method: printTaskRuntimeReport
+ * @Description: 输出线程数、窃取次数以及各优先级的排队深度、任务数与CPU时间
+ */
+void printTaskRuntimeReport();
+
+
+#endif //TASK_RUNTIME_H
@@ -0,0 +1,115 @@
+/**
+* @author: WTY
+* @date: 2024/8/16
+* @description: 维护查询结果的 top-k 最大堆（只保存距离与行号）
+*/
+
+#ifndef TOP_K_H
+#define TOP_K_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+
+using namespace std;
+
+/**
+ * @Class: TopKHeap
+ * @Description: 大小为k的最大堆，堆顶为当前第k小的距离。
+ *               只保存(距离, 行号)，不再复制整条密文向量，结果在扫描结束后按行号统一取出。
+ */
+class TopKHeap {
+public:
+    explicit TopKHeap(size_t k = 0) : k(k) {
+        heap.reserve(k);
+    }
+
+    /**
+     * @Method: push
+     * @Description: 尝试插入一条候选结果，与原先 SSQ 中 priority_queue 的维护规则一致
+     * @param double distance 欧式平方距离（密文内积）
+     * @param long id 行号
+     * @return bool 是否进入了top-k
+     */
+    bool push(double distance, long id) {
+        if (heap.size() < k) {
+            heap.push_back(make_pair(distance, id));
+            push_heap(heap.begin(), heap.end(), compare);
+            return true;
+        }
+        if (k == 0 || !(heap.front().first > distance)) {
+            return false;
+        }
+        pop_heap(heap.begin(), heap.end(), compare);
+        heap.back() = make_pair(distance, id);
+        push_heap(heap.begin(), heap.end(), compare);
+        return true;
+    }
+
+    /**
+     * @Method: full
+     * @Description: 堆中是否已有k个元素
+     */
+    bool full() const {
+        return heap.size() >= k;
+    }
+
+    /**
+     * @Method: threshold
+     * @Description: 当前第k小的距离，堆未满时没有意义
+     */
+    double threshold() const {
+        return heap.front().first;
+    }
+
+    /**
+     * @Method: top
+     * @Description: 堆顶的 (距离, 行号)，堆满时下一次成功的 push 会将其淘汰
+     */
+    const pair<double, long>& top() const {
+        return heap.front();
+    }
+
+    size_t size() const {
+        return heap.size();
+    }
+
+    size_t capacity() const {
+        return k;
+    }
+
+    /**
+     * @Method: merge
+     * @Description: 合并另一个堆（多线程/多分区扫描后的归并）
+     */
+    void merge(const TopKHeap& other) {
+        for (size_t i = 0; i < other.heap.size(); i++) {
+            push(other.heap[i].first, other.heap[i].second);
+        }
+    }
+
+    /**
+     * @Method: extractDescending
+     * @Description: 按距离从大到小取出全部结果（与原先逐个弹出堆顶的输出顺序相同），取出后堆为空
+     * @return vector<pair<double, long>> (距离, 行号)
+     */
+    vector<pair<double, long>> extractDescending() {
+        vector<pair<double, long>> result;
+        result.swap(heap);
+        sort(result.begin(), result.end(), compare);
+        reverse(result.begin(), result.end());
+        return result;
+    }
+
+private:
+    // 仅根据 double 值排序，距离相同时按行号保证结果确定
+    static bool compare(const pair<double, long>& a, const pair<double, long>& b) {
+        return a.first < b.first || (a.first == b.first && a.second < b.second);
+    }
+
+    size_t k;
+    vector<pair<double, long>> heap;
+};
+
+
+#endif //TOP_K_H
@@ -0,0 +1,119 @@
+/**
+* @author: WTY
+* @date: 2024/8/26
+* @description: 读取 ANN 基准数据集常用的 fvecs/bvecs/ivecs 二进制格式
+*/
+
+#include "Vecs_io.h"
+#include <cstdio>
+#include <cstring>
+
+// 通过 readDataFromFile 读取 .fvecs/.bvecs 时最多读取的行数，0 表示全部
+long vecsRowLimit = 0;
+
+// 读取缓冲大小
+static const size_t VECS_IO_BUFFER = 1 << 20;
+
+static bool hasSuffix(const char* path, const char* suffix) {
+    size_t n = strlen(path), m = strlen(suffix);
+    return n >= m && strcmp(path + n - m, suffix) == 0;
+}
+
+/**
+ * @Method: isVecsFile
+ * @Description: 根据扩展名判断是否为 .fvecs 或 .bvecs 文件
+ * @param const char* path 文件路径
+ * @return bool 是否为二进制向量文件
+ */
+bool isVecsFile(const char* path) {
+    return hasSuffix(path, ".fvecs") || hasSuffix(path, ".bvecs");
+}
+
+/**
+ * @Method: readVecs
+ * @Description: 逐个读取 [int32 维度][维度个 T] 的记录并转换为 Out
+ */
+template<typename T, typename Out>
+static vector<vector<Out>> readVecs(const char* path, long maxRows) {
+    vector<vector<Out>> data;
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return data;
+    }
+    setvbuf(file, NULL, _IOFBF, VECS_IO_BUFFER);
+
+    int32_t dim = 0, firstDim = -1;
+    vector<T> buffer;
+    while ((maxRows <= 0 || (long) data.size() < maxRows) && fread(&dim, sizeof(int32_t), 1, file) == 1) {
+        if (dim <= 0 || (firstDim >= 0 && dim != firstDim)) {
+            cerr << "Inconsistent vector dimension in " << path << endl;
+            data.clear();
+            break;
+        }
+        firstDim = dim;
+        buffer.resize(dim);
+        if (fread(buffer.data(), sizeof(T), dim, file) != (size_t) dim) {
+            cerr << "Truncated vector file " << path << endl;
+            data.clear();
+            break;
+        }
+        data.push_back(vector<Out>(buffer.begin(), buffer.end()));
+    }
+    fclose(file);
+    return data;
+}
+
+vector<vector<double>> readFvecs(const char* path, long maxRows) {
+    return readVecs<float, double>(path, maxRows);
+}
+
+vector<vector<double>> readBvecs(const char* path, long maxRows) {
+    return readVecs<uint8_t, double>(path, maxRows);
+}
+
+vector<vector<int>> readIvecs(const char* path, long maxRows) {
+    return readVecs<int32_t, int>(path, maxRows);
+}
+
+vector<vector<double>> readVecsFile(const char* path, long maxRows) {
+    if (hasSuffix(path, ".bvecs")) {
+        return readBvecs(path, maxRows);
+    }
+    return readFvecs(path, maxRows);
+}
+
+/**
+ * @Method: writeVecs
+ * @Description: 逐行写出 [int32 维度][维度个 T] 的记录
+ */
+template<typename T, typename In>
+static int writeVecs(const char* path, const vector<vector<In>>& data) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return 0;
+    }
+    setvbuf(file, NULL, _IOFBF, VECS_IO_BUFFER);
+    vector<T> buffer;
+    bool ok = true;
+    for (size_t i = 0; i < data.size() && ok; i++) {
+        int32_t dim = (int32_t) data[i].size();
+        buffer.assign(data[i].begin(), data[i].end());
+        ok = fwrite(&dim, sizeof(int32_t), 1, file) == 1 &&
+             fwrite(buffer.data(), sizeof(T), dim, file) == (size_t) dim;
+    }
+    if (fclose(file) != 0 || !ok) {
+        cerr << "Unable to write file " << path << endl;
+        return 0;
+    }
+    return 1;
+}
+
+int writeFvecs(const char* path, const vector<vector<double>>& data) {
+    return writeVecs<float, double>(path, data);
+}
+
+int writeIvecs(const char* path, const vector<vector<int>>& data) {
+    return writeVecs<int32_t, int>(path, data);
+}
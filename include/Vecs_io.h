@@ -0,0 +1,85 @@
+/**
+* @author: WTY
+* @date: 2024/8/26
+* @description: 读取 ANN 基准数据集常用的 fvecs/bvecs/ivecs 二进制格式
+*/
+
+#ifndef VECS_IO_H
+#define VECS_IO_H
+
+#include "Matrix_encryption.h"
+
+/**
+ * 格式：每个向量先是 int32 的维度 d，随后是 d 个分量
+ *     .fvecs  float32
+ *     .bvecs  uint8
+ *     .ivecs  int32（通常是真实近邻的行号）
+ */
+
+// 通过 readDataFromFile 读取 .fvecs/.bvecs 时最多读取的行数，0 表示全部
+extern long vecsRowLimit;
+
+/**
+ * @Method: isVecsFile
+ * @Description: 根据扩展名判断是否为 .fvecs 或 .bvecs 文件
+ * @param const char* path 文件路径
+ * @return bool 是否为二进制向量文件
+ */
+bool isVecsFile(const char* path);
+
+/**
+ * @Method: readFvecs
+ * @Description: 读取 .fvecs 文件
+ * @param const char* path 文件路径
+ * @param long maxRows 最多读取的行数，0 表示全部
+ * @return vector<vector<double>> 数据，出错时为空
+ */
+vector<vector<double>> readFvecs(const char* path, long maxRows = 0);
+
+/**
+ * @Method: readBvecs
+ * @Description: 读取 .bvecs 文件
+ * @param const char* path 文件路径
+ * @param long maxRows 最多读取的行数，0 表示全部
+ * @return vector<vector<double>> 数据，出错时为空
+ */
+vector<vector<double>> readBvecs(const char* path, long maxRows = 0);
+
+/**
+ * @Method: readIvecs
+ * @Description: 读取 .ivecs 文件
+ * @param const char* path 文件路径
+ * @param long maxRows 最多读取的行数，0 表示全部
+ * @return vector<vector<int>> 数据，出错时为空
+ */
+vector<vector<int>> readIvecs(const char* path, long maxRows = 0);
+
+/**
+ * @Method: readVecsFile
+ * @Description: 按扩展名读取 .fvecs 或 .bvecs 文件
+ * @param const char* path 文件路径
+ * @param long maxRows 最多读取的行数，0 表示全部
+ * @return vector<vector<double>> 数据，出错时为空
+ */
+vector<vector<double>> readVecsFile(const char* path, long maxRows = 0);
+
+/**
+ * @Method: writeFvecs
+ * @Description: 写出 .fvecs 文件
+ * @param const char* path 文件路径
+ * @param const vector<vector<double>>& data 数据
+ * @return 状态码，1：成功；0：失败
+ */
+int writeFvecs(const char* path, const vector<vector<double>>& data);
+
+/**
+ * @Method: writeIvecs
+ * @Description: 写出 .ivecs 文件
+ * @param const char* path 文件路径
+ * @param const vector<vector<int>>& data 数据
+ * @return 状态码，1：成功；0：失败
+ */
+int writeIvecs(const char* path, const vector<vector<int>>& data);
+
+
+#endif //VECS_IO_H
@@ -0,0 +1,475 @@
+/**
+* @author: WTY
+* @date: 2024/8/23
+* @description: 按维度切分的纵向分区查询：各工作进程保存密文的一段列，协调者逐块累加部分内积后选top-k
+*/
+
+#include "Vertical_partition.h"
+#include "Block_index.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <cerrno>
+#include <climits>
+
+extern char** environ;
+
+// 正在运行的工作进程
+vector<VerticalWorker> verticalWorkers;
+
+// 工作进程启动时的数据集行数与每块行数
+static long verticalRows = 0;
+static long verticalBlockRows = 0;
+
+// 工作进程持有的列段切分自哪个 datasetVersion，与当前版本不同时按当前密文重新启动
+static uint64_t verticalVersion = 0;
+
+// 启动工作进程时的配置，失效后按此重新启动
+static VerticalConfig verticalConfig;
+static string verticalWorkerPath;
+
+// 某次通信出错后置位，socket 中可能残留上一次查询的部分内积，整组工作进程不能再使用
+static bool verticalBroken = false;
+
+// 工作进程中 socket 的文件描述符
+static const int VERTICAL_WORKER_FD = 3;
+
+// 发送列段时每次写出的行数
+static const long VERTICAL_LOAD_ROWS = 1024;
+
+// 请求类型
+enum VerticalOp {
+    VERTICAL_QUERY = 1,     // 后接 count 个 double 的查询向量段，返回逐块的部分内积
+    VERTICAL_FETCH = 2,     // 后接 count 个 int64 行号，返回这些行的列段
+    VERTICAL_EXIT = 3,
+    VERTICAL_LOAD = 4       // 后接 int64 行数、列数、每块行数与按行存放的列段
+};
+
+struct VerticalRequest {
+    uint32_t op;
+    uint32_t reserved;
+    uint64_t count;
+};
+
+static bool readFully(int fd, void* buffer, size_t bytes) {
+    char* p = (char*) buffer;
+    while (bytes > 0) {
+        ssize_t n = read(fd, p, bytes);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+// 对端已关闭时返回失败而不是产生 SIGPIPE，不需要修改进程的信号处理
+static bool writeFully(int fd, const void* buffer, size_t bytes) {
+    const char* p = (const char*) buffer;
+    while (bytes > 0) {
+        ssize_t n = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+/**
+ * @Method: workerLoop
+ * @Description: 工作进程的主循环，只持有自己的列段
+ * @return 状态码，1：收到退出请求；0：通信出错
+ */
+static int workerLoop(int fd, const RowMatrixXd& slice, long blockRows) {
+    const SimdKernels& kernels = simdKernels();
+    const long rows = slice.rows(), cols = slice.cols();
+    vector<double> partial(blockRows);
+    VerticalRequest request;
+    while (readFully(fd, &request, sizeof(request))) {
+        if (request.op == VERTICAL_QUERY) {
+            vector<double> q(request.count);
+            if (request.count != (uint64_t) cols || !readFully(fd, q.data(), cols * sizeof(double))) {
+                return 0;
+            }
+            // 每算完一块立即写出，socket 缓冲区写满时阻塞，工作进程不会领先协调者太多
+            for (long b = 0; b < rows; b += blockRows) {
+                long count = min(blockRows, rows - b);
+                kernels.scanBlock(slice.row(b).data(), count, cols, q.data(), cols, partial.data());
+                if (!writeFully(fd, partial.data(), count * sizeof(double))) {
+                    return 0;
+                }
+            }
+        } else if (request.op == VERTICAL_FETCH) {
+            vector<int64_t> ids(request.count);
+            if (!readFully(fd, ids.data(), ids.size() * sizeof(int64_t))) {
+                return 0;
+            }
+            RowMatrixXd out(ids.size(), cols);
+            for (size_t i = 0; i < ids.size(); i++) {
+                if (ids[i] < 0 || ids[i] >= rows) {
+                    return 0;
+                }
+                out.row(i) = slice.row(ids[i]);
+            }
+            if (!writeFully(fd, out.data(), out.size() * sizeof(double))) {
+                return 0;
+            }
+        } else {
+            return request.op == VERTICAL_EXIT ? 1 : 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @Method: runVerticalWorker
+ * @Description: 工作进程的入口：从 socket 接收列段，之后循环处理查询与取行请求
+ * @param int fd 与协调者之间的 socket
+ * @return 状态码，1：协调者正常通知退出；0：通信出错
+ */
+int runVerticalWorker(int fd) {
+    VerticalRequest request;
+    int64_t shape[3];
+    if (!readFully(fd, &request, sizeof(request)) || request.op != VERTICAL_LOAD ||
+        !readFully(fd, shape, sizeof(shape)) || shape[0] < 0 || shape[1] <= 0 || shape[2] <= 0) {
+        return 0;
+    }
+    RowMatrixXd slice(shape[0], shape[1]);
+    if (!readFully(fd, slice.data(), slice.size() * sizeof(double))) {
+        return 0;
+    }
+    return workerLoop(fd, slice, (long) shape[2]);
+}
+
+/**
+ * @Method: resolveWorkerPath
+ * @Description: 确定工作进程可执行文件：配置、环境变量 SSQ_VERTICAL_WORKER、协调者所在目录
+ */
+static string resolveWorkerPath(const VerticalConfig& config) {
+    if (config.workerPath != NULL) {
+        return config.workerPath;
+    }
+    const char* env = getenv("SSQ_VERTICAL_WORKER");
+    if (env != NULL && *env != 0) {
+        return env;
+    }
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        return VERTICAL_WORKER_PROGRAM;
+    }
+    string path(self, n);
+    size_t slash = path.rfind('/');
+    return (slash == string::npos ? string() : path.substr(0, slash + 1)) + VERTICAL_WORKER_PROGRAM;
+}
+
+/**
+ * @Method: spawnWorker
+ * @Description: 启动一个工作进程，子进程中 socket 位于 VERTICAL_WORKER_FD，其余描述符都带 CLOEXEC 不会继承
+ * @return pid_t 工作进程号，失败时为 -1，fd 返回协调者一端的 socket
+ */
+static pid_t spawnWorker(const string& path, int& fd) {
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) != 0) {
+        return -1;
+    }
+    // dup2 到相同的描述符不会清除 CLOEXEC，先移开
+    int childFd = pair[1];
+    if (childFd == VERTICAL_WORKER_FD) {
+        childFd = fcntl(pair[1], F_DUPFD_CLOEXEC, VERTICAL_WORKER_FD + 1);
+        close(pair[1]);
+        if (childFd < 0) {
+            close(pair[0]);
+            return -1;
+        }
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, childFd, VERTICAL_WORKER_FD);
+    char fdArgument[16];
+    snprintf(fdArgument, sizeof(fdArgument), "%d", VERTICAL_WORKER_FD);
+    char* argv[] = {(char*) path.c_str(), fdArgument, NULL};
+    pid_t pid;
+    int error = posix_spawn(&pid, path.c_str(), &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(childFd);
+    if (error != 0) {
+        close(pair[0]);
+        return -1;
+    }
+    fd = pair[0];
+    return pid;
+}
+
+/**
+ * @Method: sendSlice
+ * @Description: 把密文第 [firstCol, firstCol + cols) 列按行发送给工作进程
+ */
+static bool sendSlice(int fd, long firstCol, long cols) {
+    const long rows = verticalRows;
+    VerticalRequest request = {VERTICAL_LOAD, 0, 0};
+    int64_t shape[3] = {rows, cols, verticalBlockRows};
+    if (!writeFully(fd, &request, sizeof(request)) || !writeFully(fd, shape, sizeof(shape))) {
+        return false;
+    }
+    RowMatrixXd buffer(min(rows, VERTICAL_LOAD_ROWS), cols);
+    for (long b = 0; b < rows; b += VERTICAL_LOAD_ROWS) {
+        long count = min(VERTICAL_LOAD_ROWS, rows - b);
+        for (long r = 0; r < count; r++) {
+            buffer.row(r) = ciphertext[b + r].segment(firstCol, cols).transpose();
+        }
+        if (!writeFully(fd, buffer.data(), count * cols * sizeof(double))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @Method: startVerticalWorkers
+ * @Description: 将当前密文数据集按列切分，启动工作进程并把各自的列段发送过去
+ * @param const VerticalConfig& config 纵向分区配置
+ * @return 状态码，1：成功；0：失败
+ */
+int startVerticalWorkers(const VerticalConfig& config) {
+    stopVerticalWorkers();
+    // 发送列段期间 ciphertext 不能被追加或替换
+    CiphertextReadGuard guard;
+    if (ciphertext.empty()) {
+        return 0;
+    }
+    auto start_time = chrono::high_resolution_clock::now();
+    const long rows = (long) ciphertext.size();
+    const long dim = ciphertext[0].size();
+    const int workers = max(1, min(config.workers, (int) dim));
+    verticalRows = rows;
+    verticalBlockRows = max(1L, config.blockRows);
+    verticalVersion = datasetVersion;
+    verticalConfig = config;
+    verticalWorkerPath = resolveWorkerPath(config);
+    verticalConfig.workerPath = NULL;
+
+    for (int w = 0; w < workers; w++) {
+        VerticalWorker worker;
+        worker.firstCol = dim * w / workers;
+        worker.cols = dim * (w + 1) / workers - worker.firstCol;
+        worker.pid = spawnWorker(verticalWorkerPath, worker.fd);
+        if (worker.pid < 0) {
+            cerr << "Unable to start vertical worker " << verticalWorkerPath << endl;
+            verticalBroken = true;
+            stopVerticalWorkers();
+            verticalBroken = true;      // 下一次查询前重试
+            return 0;
+        }
+        verticalWorkers.push_back(worker);
+    }
+    // 所有工作进程都启动之后再逐个发送列段
+    for (size_t w = 0; w < verticalWorkers.size(); w++) {
+        if (!sendSlice(verticalWorkers[w].fd, verticalWorkers[w].firstCol, verticalWorkers[w].cols)) {
+            cerr << "Unable to send columns to vertical worker " << verticalWorkers[w].pid << endl;
+            verticalBroken = true;
+            stopVerticalWorkers();
+            verticalBroken = true;
+            return 0;
+        }
+    }
+
+    chrono::duration<double, milli> total_duration = chrono::high_resolution_clock::now() - start_time;
+    printf("纵向分区：%d 个工作进程，每块 %ld 行，启动时间 %f 毫秒\n", workers, verticalBlockRows,
+           total_duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: ensureVerticalWorkers
+ * @Description: 工作进程组失效或数据集已更新（dealData、insertBatch 等）时按原配置与当前密文重新启动
+ * @return bool 是否有可用的工作进程
+ */
+static bool ensureVerticalWorkers() {
+    if (!verticalBroken && (verticalWorkers.empty() || verticalVersion == datasetVersion)) {
+        return !verticalWorkers.empty();
+    }
+    // startVerticalWorkers 会覆盖 verticalWorkerPath，先复制一份
+    string path = verticalWorkerPath;
+    VerticalConfig config = verticalConfig;
+    config.workerPath = path.c_str();
+    cerr << "Restarting vertical workers" << endl;
+    return startVerticalWorkers(config) == 1;
+}
+
+/**
+ * @Method: verticalTopK
+ * @Description: 把查询向量的各段发给对应的工作进程，逐块读取部分内积并求和，
+ *               只在内存中保留一块的总分，完整的 N 维分数向量不会生成
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param VerticalStats* stats 返回统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；工作进程出错时为空
+ */
+vector<pair<double, long>> verticalTopK(const VectorXd& q, int k, VerticalStats* stats) {
+    typedef chrono::high_resolution_clock Clock;
+    Clock::time_point start = Clock::now();
+    double waitMillis = 0, mergeMillis = 0;
+    long blocks = 0;
+    if (!ensureVerticalWorkers()) {
+        return vector<pair<double, long>>();
+    }
+
+    for (size_t w = 0; w < verticalWorkers.size(); w++) {
+        const VerticalWorker& worker = verticalWorkers[w];
+        VerticalRequest request = {VERTICAL_QUERY, 0, (uint64_t) worker.cols};
+        if (!writeFully(worker.fd, &request, sizeof(request)) ||
+            !writeFully(worker.fd, q.data() + worker.firstCol, worker.cols * sizeof(double))) {
+            cerr << "Vertical worker " << worker.pid << " is not responding" << endl;
+            verticalBroken = true;
+            return vector<pair<double, long>>();
+        }
+    }
+
+    TopKHeap heap(k);
+    vector<double> total(verticalBlockRows), partial(verticalBlockRows);
+    for (long b = 0; b < verticalRows; b += verticalBlockRows) {
+        long count = min(verticalBlockRows, verticalRows - b);
+        Clock::time_point t0 = Clock::now();
+        for (size_t w = 0; w < verticalWorkers.size(); w++) {
+            double* target = w == 0 ? total.data() : partial.data();
+            if (!readFully(verticalWorkers[w].fd, target, count * sizeof(double))) {
+                // 其他工作进程已写出的部分内积留在 socket 中，之后的结果会错位
+                cerr << "Vertical worker " << verticalWorkers[w].pid << " is not responding" << endl;
+                verticalBroken = true;
+                return vector<pair<double, long>>();
+            }
+            if (w > 0) {
+                for (long i = 0; i < count; i++) {
+                    total[i] += partial[i];
+                }
+            }
+        }
+        Clock::time_point t1 = Clock::now();
+        for (long i = 0; i < count; i++) {
+            heap.push(total[i], b + i);
+        }
+        Clock::time_point t2 = Clock::now();
+        waitMillis += chrono::duration<double, milli>(t1 - t0).count();
+        mergeMillis += chrono::duration<double, milli>(t2 - t1).count();
+        blocks++;
+    }
+
+    if (stats != NULL) {
+        stats->blocks = blocks;
+        stats->waitMillis = waitMillis;
+        stats->mergeMillis = mergeMillis;
+        stats->totalMillis = chrono::duration<double, milli>(Clock::now() - start).count();
+    }
+    return heap.extractDescending();
+}
+
+/**
+ * @Method: fetchVerticalRows
+ * @Description: 向各工作进程取回结果行的列段，拼成完整的密文行
+ * @param const vector<pair<double, long>>& winners (距离, 行号)
+ * @param MatrixXd& rows 输出，每行一条密文
+ * @return 状态码，1：成功；0：失败
+ */
+int fetchVerticalRows(const vector<pair<double, long>>& winners, MatrixXd& rows) {
+    if (verticalBroken || verticalWorkers.empty()) {
+        return 0;
+    }
+    vector<int64_t> ids(winners.size());
+    long dim = 0;
+    for (size_t i = 0; i < winners.size(); i++) {
+        ids[i] = winners[i].second;
+    }
+    for (size_t w = 0; w < verticalWorkers.size(); w++) {
+        dim += verticalWorkers[w].cols;
+    }
+    rows.resize(winners.size(), dim);
+    for (size_t w = 0; w < verticalWorkers.size(); w++) {
+        const VerticalWorker& worker = verticalWorkers[w];
+        VerticalRequest request = {VERTICAL_FETCH, 0, (uint64_t) ids.size()};
+        RowMatrixXd part(ids.size(), worker.cols);
+        if (!writeFully(worker.fd, &request, sizeof(request)) ||
+            !writeFully(worker.fd, ids.data(), ids.size() * sizeof(int64_t)) ||
+            !readFully(worker.fd, part.data(), part.size() * sizeof(double))) {
+            cerr << "Vertical worker " << worker.pid << " is not responding" << endl;
+            verticalBroken = true;
+            return 0;
+        }
+        rows.middleCols(worker.firstCol, worker.cols) = part;
+    }
+    return 1;
+}
+
+/**
+ * @Method: stopVerticalWorkers
+ * @Description: 通知所有工作进程退出并回收，工作进程组已失效时直接终止
+ */
+void stopVerticalWorkers() {
+    for (size_t w = 0; w < verticalWorkers.size(); w++) {
+        if (verticalBroken) {
+            // 工作进程可能阻塞在写出上一次查询的部分内积，不再等待它读取退出请求
+            kill(verticalWorkers[w].pid, SIGKILL);
+        } else {
+            VerticalRequest request = {VERTICAL_EXIT, 0, 0};
+            writeFully(verticalWorkers[w].fd, &request, sizeof(request));
+        }
+        close(verticalWorkers[w].fd);
+    }
+    for (size_t w = 0; w < verticalWorkers.size(); w++) {
+        waitpid(verticalWorkers[w].pid, NULL, 0);
+    }
+    verticalWorkers.clear();
+    verticalBroken = false;
+}
+
+/**
+ * @Method: SSQVertical
+ * @Description: 使用纵向分区的工作进程发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQVertical(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || !denseKeyReady(point.size()) || !ensureVerticalWorkers()) {
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+
+    VerticalStats stats;
+    vector<pair<double, long>> winners = verticalTopK(q, k, &stats);
+    if (winners.empty() && k > 0 && verticalRows > 0) {
+        return 0;
+    }
+    printf("纵向扫描：%ld 块，等待工作进程 %f 毫秒，累加与选择 %f 毫秒，总时间 %f 毫秒\n", stats.blocks,
+           stats.waitMillis, stats.mergeMillis, stats.totalMillis);
+    fflush(stdout);
+
+    MatrixXd rows;
+    if (!fetchVerticalRows(winners, rows)) {
+        return 0;
+    }
+    // 与 outputResults 一致，密文被剪枝索引重排过时换回原数据集的行号
+    for (size_t i = 0; i < winners.size(); i++) {
+        winners[i].second = originalRowId(winners[i].second);
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
@@ -0,0 +1,108 @@
+/**
+* @author: WTY
+* @date: 2024/8/23
+* @description: 按维度切分的纵向分区查询：各工作进程保存密文的一段列，协调者逐块累加部分内积后选top-k
+*/
+
+#ifndef VERTICAL_PARTITION_H
+#define VERTICAL_PARTITION_H
+
+#include "SSQ.h"
+#include <sys/types.h>
+
+// 工作进程可执行文件的默认名称，与协调者程序位于同一目录
+#define VERTICAL_WORKER_PROGRAM "security_similarity_query_vertical_worker"
+
+/**
+ * 纵向分区配置。工作进程通过 posix_spawn 启动独立的可执行文件，而不是 fork 已经运行了
+ * 任务运行时线程的协调者进程；列段在启动后经 socket 发送给工作进程。
+ */
+struct VerticalConfig {
+    int workers;                // 工作进程数，列按此数均分
+    long blockRows;             // 每次传回的部分内积行数，协调者同时只持有一块
+    const char* workerPath;     // 工作进程可执行文件，NULL 时依次使用环境变量 SSQ_VERTICAL_WORKER
+                                // 与协调者所在目录下的 VERTICAL_WORKER_PROGRAM
+
+    VerticalConfig() : workers(2), blockRows(4096), workerPath(NULL) {
+    }
+};
+
+/**
+ * 一个工作进程，保存密文第 [firstCol, firstCol + cols) 列
+ */
+struct VerticalWorker {
+    pid_t pid;
+    int fd;             // 与工作进程之间的 UNIX 流 socket，请求与结果共用
+    long firstCol;
+    long cols;
+};
+
+/**
+ * 纵向查询统计
+ */
+struct VerticalStats {
+    long blocks;
+    double waitMillis;      // 等待工作进程部分内积的时间
+    double mergeMillis;     // 累加部分内积与维护堆的时间
+    double totalMillis;
+};
+
+// 正在运行的工作进程
+extern vector<VerticalWorker> verticalWorkers;
+
+/**
+ * @Method: startVerticalWorkers
+ * @Description: 将当前密文数据集按列切分，启动工作进程并把各自的列段发送过去
+ * @param const VerticalConfig& config 纵向分区配置
+ * @return 状态码，1：成功；0：失败
+ */
+int startVerticalWorkers(const VerticalConfig& config = VerticalConfig());
+
+/**
+ * @Method: verticalTopK
+ * @Description: 把查询向量的各段发给对应的工作进程，逐块读取部分内积并求和，
+ *               只在内存中保留一块的总分，完整的 N 维分数向量不会生成。
+ *               任何一次通信出错后整组工作进程被标记为失效（管道中可能残留部分内积），
+ *               下一次查询前按原配置重新启动；数据集更新（datasetVersion 变化）后同样按当前密文重新启动
+ * @param const VectorXd& q 加密后的查询向量
+ * @param int k 返回的结果数
+ * @param VerticalStats* stats 返回统计，可为 NULL
+ * @return vector<pair<double, long>> (距离, 行号)，距离从大到小；工作进程出错时为空
+ */
+vector<pair<double, long>> verticalTopK(const VectorXd& q, int k, VerticalStats* stats = NULL);
+
+/**
+ * @Method: fetchVerticalRows
+ * @Description: 向各工作进程取回结果行的列段，拼成完整的密文行
+ * @param const vector<pair<double, long>>& winners (距离, 行号)
+ * @param MatrixXd& rows 输出，每行一条密文
+ * @return 状态码，1：成功；0：失败
+ */
+int fetchVerticalRows(const vector<pair<double, long>>& winners, MatrixXd& rows);
+
+/**
+ * @Method: stopVerticalWorkers
+ * @Description: 通知所有工作进程退出并回收，工作进程组已失效时直接终止
+ */
+void stopVerticalWorkers();
+
+/**
+ * @Method: runVerticalWorker
+ * @Description: 工作进程的入口：从 socket 接收列段，之后循环处理查询与取行请求
+ * @param int fd 与协调者之间的 socket
+ * @return 状态码，1：协调者正常通知退出；0：通信出错
+ */
+int runVerticalWorker(int fd);
+
+/**
+ * @Method: SSQVertical
+ * @Description: 使用纵向分区的工作进程发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQVertical(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //VERTICAL_PARTITION_H
@@ -0,0 +1,782 @@
+/**
+* @author: WTY
+* @date: 2024/8/31
+* @description: 密文更新的写前日志：基础快照之上追加插入/删除记录，组提交，启动时只重放日志，后台合并成新快照
+*/
+
+#include "Wal.h"
+#include "Simd_kernels.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+WalStore walStore;
+
+// 扫描时每次交给内核的行数
+static const long WAL_SCAN_ROWS = 256;
+
+/**
+ * CRC-32（IEEE 802.3）查找表
+ */
+struct Crc32Table {
+    uint32_t values[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int j = 0; j < 8; j++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            values[i] = c;
+        }
+    }
+};
+
+static uint32_t crc32Update(uint32_t crc, const void* data, size_t bytes) {
+    static const Crc32Table table;
+    const unsigned char* p = (const unsigned char*) data;
+    crc = ~crc;
+    for (size_t i = 0; i < bytes; i++) {
+        crc = table.values[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static bool writeFully(int fd, const char* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t n = write(fd, data, bytes);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+/**
+ * @Method: syncDirectory
+ * @Description: 对文件所在目录调用 fsync，使新建与 rename 的目录项落盘
+ */
+static void syncDirectory(const string& path) {
+    size_t slash = path.rfind('/');
+    string directory = slash == string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    int fd = ::open(directory.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        fsync(fd);
+        ::close(fd);
+    }
+}
+
+static bool fileExists(const string& path) {
+    return access(path.c_str(), F_OK) == 0;
+}
+
+WalStore::WalStore()
+        : dim(0), opened(false), overlayFirstId(0), deletedCount(0), nextId(0), logFd(-1), activeGeneration(0),
+          appendedLsn(0), writtenLsn(0), durableLsn(0), logBytes(0), failed(false), stopping(false),
+          compactorStopping(false) {
+    memset(&base, 0, sizeof(base));
+    memset(&counters, 0, sizeof(counters));
+}
+
+WalStore::~WalStore() {
+    close();
+}
+
+string WalStore::segmentPath(uint64_t generation) const {
+    return logPrefix + "." + to_string((unsigned long long) generation);
+}
+
+long WalStore::positionOf(long id) const {
+    if (id < 0) {
+        return -1;
+    }
+    if (id >= overlayFirstId) {
+        long index = id - overlayFirstId;
+        return index < (long) overlay.size() ? base.count + index : -1;
+    }
+    if (base.ids == NULL) {
+        return id < base.count ? id : -1;
+    }
+    const uint64_t* found = lower_bound(base.ids, base.ids + base.count, (uint64_t) id);
+    return found != base.ids + base.count && *found == (uint64_t) id ? found - base.ids : -1;
+}
+
+long WalStore::idAt(long position) const {
+    if (position >= base.count) {
+        return overlayFirstId + (position - base.count);
+    }
+    return base.ids == NULL ? position : (long) base.ids[position];
+}
+
+const double* WalStore::rowAt(long position) const {
+    if (position >= base.count) {
+        return overlay[position - base.count].data();
+    }
+    return base.rows + (size_t) position * dim;
+}
+
+void WalStore::applyInsert(const double* row) {
+    overlay.push_back(VectorXd::Map(row, dim));
+    deleted.push_back(false);
+    nextId++;
+}
+
+void WalStore::applyDelete(long id) {
+    long position = positionOf(id);
+    if (position >= 0 && !deleted[position]) {
+        deleted[position] = true;
+        deletedCount++;
+    }
+}
+
+/**
+ * @Method: recover
+ * @Description: 映射基础快照，删除已合并的旧分段，依次重放代数不小于快照代数的分段
+ */
+bool WalStore::recover(uint64_t& records) {
+    if (base.map != NULL) {
+        munmap(base.map, base.bytes);
+    }
+    memset(&base, 0, sizeof(base));
+    overlay.clear();
+    deleted.clear();
+    deletedCount = 0;
+
+    SnapshotHeader header;
+    if (!readSnapshotHeader(basePath.c_str(), header)) {
+        return false;
+    }
+    int fd = ::open(basePath.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "Unable to open file " << basePath << endl;
+        return false;
+    }
+    struct stat info;
+    size_t rowBytes = header.rows * header.dim * sizeof(double);
+    size_t idBytes = (header.flags & SNAPSHOT_FLAG_ROW_IDS) ? header.rows * sizeof(uint64_t) : 0;
+    base.bytes = SNAPSHOT_HEADER_SIZE + rowBytes + idBytes;
+    if (fstat(fd, &info) != 0 || (size_t) info.st_size < base.bytes) {
+        cerr << "Truncated snapshot file " << basePath << endl;
+        ::close(fd);
+        return false;
+    }
+    // 只映射，不读取；恢复时间与快照大小无关
+    base.map = mmap(NULL, base.bytes, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base.map == MAP_FAILED) {
+        base.map = NULL;
+        cerr << "Unable to map file " << basePath << endl;
+        return false;
+    }
+    const char* bytes = (const char*) base.map;
+    base.rows = (const double*) (bytes + SNAPSHOT_HEADER_SIZE);
+    base.ids = idBytes > 0 ? (const uint64_t*) (bytes + SNAPSHOT_HEADER_SIZE + rowBytes) : NULL;
+    base.count = (long) header.rows;
+    base.generation = header.generation;
+    dim = header.dim;
+    nextId = base.count == 0 ? 0 : idAt(base.count - 1) + 1;
+    overlayFirstId = nextId;
+    deleted.assign(base.count, false);
+
+    for (uint64_t g = base.generation; g > 0 && fileExists(segmentPath(g - 1)); g--) {
+        remove(segmentPath(g - 1).c_str());
+    }
+    activeGeneration = base.generation;
+    for (uint64_t g = base.generation; fileExists(segmentPath(g)); g++) {
+        if (!replaySegment(g, records)) {
+            return false;
+        }
+        activeGeneration = g;
+    }
+    return true;
+}
+
+/**
+ * @Method: replaySegment
+ * @Description: 重放一个分段，遇到不完整或校验失败的记录时截断文件
+ */
+bool WalStore::replaySegment(uint64_t generation, uint64_t& records) {
+    string path = segmentPath(generation);
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return false;
+    }
+    WalHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, WAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != WAL_VERSION || header.dim != dim || header.generation != generation ||
+        (long) header.firstId < nextId) {
+        cerr << "Invalid log file " << path << endl;
+        fclose(file);
+        return false;
+    }
+    // 被删除的行号不会出现在合并后的快照中，分段记录的起始行号可能更大
+    nextId = (long) header.firstId;
+    if (overlay.empty()) {
+        overlayFirstId = nextId;
+    }
+
+    vector<double> payload(dim);
+    uint64_t valid = sizeof(header);
+    WalRecordHeader record;
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        size_t payloadBytes = record.type == WAL_INSERT ? dim * sizeof(double) : 0;
+        if ((record.type != WAL_INSERT && record.type != WAL_DELETE) ||
+            (payloadBytes > 0 && fread(payload.data(), 1, payloadBytes, file) != payloadBytes)) {
+            break;
+        }
+        uint32_t crc = crc32Update(0, &record.type, sizeof(record) - sizeof(record.crc));
+        crc = crc32Update(crc, payload.data(), payloadBytes);
+        if (crc != record.crc) {
+            break;
+        }
+        if (record.type == WAL_INSERT) {
+            if ((long) record.id != nextId) {
+                break;
+            }
+            applyInsert(payload.data());
+        } else {
+            applyDelete((long) record.id);
+        }
+        appendedLsn = record.lsn;
+        valid += sizeof(record) + payloadBytes;
+        records++;
+    }
+    fclose(file);
+
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && (uint64_t) info.st_size > valid) {
+        printf("写前日志：截断 %s 尾部不完整的 %llu 字节\n", path.c_str(),
+               (unsigned long long) (info.st_size - valid));
+        fflush(stdout);
+        if (truncate(path.c_str(), (off_t) valid) != 0) {
+            cerr << "Unable to truncate file " << path << endl;
+            return false;
+        }
+    }
+    logBytes = valid;
+    writtenLsn = durableLsn = appendedLsn;
+    return true;
+}
+
+/**
+ * @Method: createSegment
+ * @Description: 新建一个只含文件头的分段并落盘，返回追加写入的文件描述符
+ */
+int WalStore::createSegment(uint64_t generation, uint64_t firstId) {
+    string path = segmentPath(generation);
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        cerr << "Unable to open file " << path << endl;
+        return -1;
+    }
+    WalHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WAL_MAGIC, sizeof(header.magic));
+    header.version = WAL_VERSION;
+    header.dim = dim;
+    header.generation = generation;
+    header.firstId = firstId;
+    if (!writeFully(fd, (const char*) &header, sizeof(header)) || fsync(fd) != 0) {
+        cerr << "Error writing file " << path << endl;
+        ::close(fd);
+        return -1;
+    }
+    syncDirectory(path);
+    logBytes = sizeof(header);
+    return fd;
+}
+
+bool WalStore::open(const char* basePath, const char* logPrefix, const WalConfig& config) {
+    close();
+    auto start_time = chrono::high_resolution_clock::now();
+    this->basePath = basePath;
+    this->logPrefix = logPrefix;
+    this->config = config;
+    memset(&counters, 0, sizeof(counters));
+    appendedLsn = writtenLsn = durableLsn = 0;
+    failed = false;
+    stopping = false;
+    compactorStopping = false;
+
+    uint64_t records = 0;
+    if (!recover(records)) {
+        return false;
+    }
+    if (fileExists(segmentPath(activeGeneration))) {
+        logFd = ::open(segmentPath(activeGeneration).c_str(), O_WRONLY | O_APPEND);
+        if (logFd < 0) {
+            cerr << "Unable to open file " << segmentPath(activeGeneration) << endl;
+        }
+    } else {
+        logFd = createSegment(activeGeneration, nextId);
+    }
+    if (logFd < 0) {
+        return false;
+    }
+
+    counters.recoveredRecords = records;
+    counters.recoveryMillis =
+            chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start_time).count();
+    opened = true;
+    flusher = thread(&WalStore::flusherLoop, this);
+    compactor = thread(&WalStore::compactorLoop, this);
+    printf("写前日志：快照 %ld 行（第 %llu 代），重放 %llu 条记录，恢复时间 %f 毫秒\n", base.count,
+           (unsigned long long) base.generation, (unsigned long long) records, counters.recoveryMillis);
+    fflush(stdout);
+    return true;
+}
+
+void WalStore::close() {
+    if (!opened) {
+        return;
+    }
+    {
+        lock_guard<mutex> lock(wakeMutex);
+        compactorStopping = true;
+    }
+    compactWake.notify_all();
+    compactor.join();
+    {
+        lock_guard<mutex> lock(logMutex);
+        stopping = true;
+    }
+    flushWake.notify_all();
+    flusher.join();
+
+    lock_guard<mutex> state(stateMutex);
+    ::close(logFd);
+    logFd = -1;
+    if (base.map != NULL) {
+        munmap(base.map, base.bytes);
+    }
+    memset(&base, 0, sizeof(base));
+    vector<VectorXd>().swap(overlay);
+    vector<bool>().swap(deleted);
+    deletedCount = 0;
+    opened = false;
+}
+
+/**
+ * @Method: appendRecord
+ * @Description: 把一条记录放入待写缓冲，调用者持有 logMutex
+ */
+uint64_t WalStore::appendRecord(uint32_t type, long id, const double* payload) {
+    WalRecordHeader record;
+    record.type = type;
+    record.lsn = ++appendedLsn;
+    record.id = (uint64_t) id;
+    size_t payloadBytes = payload != NULL ? dim * sizeof(double) : 0;
+    uint32_t crc = crc32Update(0, &record.type, sizeof(record) - sizeof(record.crc));
+    record.crc = crc32Update(crc, payload, payloadBytes);
+    pending.append((const char*) &record, sizeof(record));
+    if (payloadBytes > 0) {
+        pending.append((const char*) payload, payloadBytes);
+    }
+    counters.records++;
+    return record.lsn;
+}
+
+/**
+ * @Method: flushPendingLocked
+ * @Description: 同步写出并落盘待写缓冲，调用者持有 ioMutex 与 logMutex
+ */
+bool WalStore::flushPendingLocked() {
+    bool ok = pending.empty() || writeFully(logFd, pending.data(), pending.size());
+    ok = ok && fsync(logFd) == 0;
+    if (!pending.empty()) {
+        counters.groups++;
+        counters.bytes += pending.size();
+        logBytes += pending.size();
+        pending.clear();
+    }
+    counters.syncs++;
+    if (!ok) {
+        failed = true;
+        return false;
+    }
+    writtenLsn = durableLsn = appendedLsn;
+    return true;
+}
+
+bool WalStore::waitCommitted(uint64_t lsn) {
+    unique_lock<mutex> lock(logMutex);
+    committed.wait(lock, [&] {
+        return failed || (config.syncPolicy == WAL_SYNC_COMMIT ? durableLsn : writtenLsn) >= lsn;
+    });
+    return !failed;
+}
+
+/**
+ * @Method: flusherLoop
+ * @Description: 组提交线程：收集一段时间内的记录后一次写入，按策略 fsync，然后唤醒等待的提交者
+ */
+void WalStore::flusherLoop() {
+    typedef chrono::steady_clock Clock;
+    const chrono::duration<double, milli> groupWait(config.groupCommitMillis);
+    const chrono::duration<double, milli> interval(config.syncIntervalMillis);
+    Clock::time_point lastSync = Clock::now();
+    while (true) {
+        bool stop;
+        {
+            unique_lock<mutex> lock(logMutex);
+            auto ready = [&] { return stopping || !pending.empty(); };
+            if (config.syncPolicy == WAL_SYNC_INTERVAL) {
+                flushWake.wait_for(lock, interval, ready);
+            } else {
+                flushWake.wait(lock, ready);
+            }
+            if (!pending.empty() && !stopping && config.groupCommitMillis > 0) {
+                flushWake.wait_for(lock, groupWait, [&] {
+                    return stopping || pending.size() >= config.groupCommitBytes;
+                });
+            }
+            stop = stopping;
+        }
+
+        // 持有 ioMutex 期间不会切换分段，取出的记录一定写入当前分段
+        lock_guard<mutex> io(ioMutex);
+        string buffer;
+        uint64_t lsn;
+        bool dirty;
+        {
+            lock_guard<mutex> lock(logMutex);
+            buffer.swap(pending);
+            lsn = appendedLsn;
+            dirty = durableLsn < lsn;
+        }
+        bool ok = buffer.empty() || writeFully(logFd, buffer.data(), buffer.size());
+        bool sync = dirty && (stop || config.syncPolicy == WAL_SYNC_COMMIT ||
+                              (config.syncPolicy == WAL_SYNC_INTERVAL && Clock::now() - lastSync >= interval));
+        if (ok && sync) {
+            ok = fsync(logFd) == 0;
+            lastSync = Clock::now();
+        }
+        {
+            lock_guard<mutex> lock(logMutex);
+            if (!buffer.empty()) {
+                counters.groups++;
+                counters.bytes += buffer.size();
+                logBytes += buffer.size();
+                writtenLsn = lsn;
+            }
+            if (sync) {
+                counters.syncs++;
+            }
+            if (!ok) {
+                failed = true;
+            } else if (sync) {
+                durableLsn = lsn;
+            }
+        }
+        committed.notify_all();
+        if (stop) {
+            return;
+        }
+    }
+}
+
+long WalStore::insertBatch(const vector<VectorXd>& rows) {
+    uint64_t lsn = 0;
+    long first;
+    {
+        lock_guard<mutex> state(stateMutex);
+        if (!opened) {
+            return -1;
+        }
+        for (size_t i = 0; i < rows.size(); i++) {
+            if (rows[i].size() != dim) {
+                return -1;
+            }
+        }
+        lock_guard<mutex> lock(logMutex);
+        if (failed) {
+            return -1;
+        }
+        first = nextId;
+        for (size_t i = 0; i < rows.size(); i++) {
+            lsn = appendRecord(WAL_INSERT, nextId, rows[i].data());
+            applyInsert(rows[i].data());
+        }
+    }
+    flushWake.notify_one();
+    return waitCommitted(lsn) ? first : -1;
+}
+
+bool WalStore::removeBatch(const vector<long>& ids) {
+    uint64_t lsn = 0;
+    {
+        lock_guard<mutex> state(stateMutex);
+        if (!opened) {
+            return false;
+        }
+        lock_guard<mutex> lock(logMutex);
+        if (failed) {
+            return false;
+        }
+        for (size_t i = 0; i < ids.size(); i++) {
+            long position = positionOf(ids[i]);
+            if (position < 0 || deleted[position]) {
+                continue;
+            }
+            lsn = appendRecord(WAL_DELETE, ids[i], NULL);
+            applyDelete(ids[i]);
+        }
+    }
+    if (lsn == 0) {
+        return true;
+    }
+    flushWake.notify_one();
+    return waitCommitted(lsn);
+}
+
+vector<pair<double, long>> WalStore::topK(const VectorXd& q, int k) {
+    TopKHeap heap(k);
+    lock_guard<mutex> state(stateMutex);
+    if (!opened || q.size() != dim) {
+        return heap.extractDescending();
+    }
+    const SimdKernels& kernels = simdKernels();
+    const long total = base.count + (long) overlay.size();
+    vector<const double*> rows(WAL_SCAN_ROWS);
+    vector<long> positions(WAL_SCAN_ROWS);
+    vector<double> distances(WAL_SCAN_ROWS);
+    for (long begin = 0; begin < total; begin += WAL_SCAN_ROWS) {
+        long end = min(total, begin + WAL_SCAN_ROWS);
+        long count = 0;
+        for (long p = begin; p < end; p++) {
+            if (!deleted[p]) {
+                rows[count] = rowAt(p);
+                positions[count] = p;
+                count++;
+            }
+        }
+        kernels.scanRows(rows.data(), count, q.data(), dim, distances.data());
+        for (long i = 0; i < count; i++) {
+            heap.push(distances[i], idAt(positions[i]));
+        }
+    }
+    return heap.extractDescending();
+}
+
+bool WalStore::fetchRow(long id, VectorXd& row) {
+    lock_guard<mutex> state(stateMutex);
+    long position = opened ? positionOf(id) : -1;
+    if (position < 0 || deleted[position]) {
+        return false;
+    }
+    row = VectorXd::Map(rowAt(position), dim);
+    return true;
+}
+
+long WalStore::size() {
+    lock_guard<mutex> state(stateMutex);
+    return base.count + (long) overlay.size() - deletedCount;
+}
+
+WalStats WalStore::stats() {
+    WalStats result;
+    {
+        lock_guard<mutex> state(stateMutex);
+        lock_guard<mutex> lock(logMutex);
+        result = counters;
+        result.baseRows = base.count;
+        result.overlayRows = overlay.size();
+        result.deletedRows = deletedCount;
+        result.logBytes = logBytes;
+    }
+    return result;
+}
+
+bool WalStore::compact() {
+    lock_guard<mutex> only(compactMutex);
+    auto start_time = chrono::high_resolution_clock::now();
+    string tempPath = basePath + ".tmp";
+    string oldSegment;
+
+    // 1. 记下当前状态并切换到新分段，之后的更新只进入新分段
+    BaseMap captured;
+    vector<bool> capturedDeleted;
+    vector<VectorXd> capturedOverlay;
+    long capturedOverlayFirstId, live;
+    uint64_t generation;
+    {
+        lock_guard<mutex> state(stateMutex);
+        if (!opened) {
+            return false;
+        }
+        lock_guard<mutex> io(ioMutex);
+        lock_guard<mutex> lock(logMutex);
+        if (failed || !flushPendingLocked()) {
+            return false;
+        }
+        captured = base;
+        capturedDeleted = deleted;
+        capturedOverlay = overlay;
+        capturedOverlayFirstId = overlayFirstId;
+        live = base.count + (long) overlay.size() - deletedCount;
+        generation = activeGeneration + 1;
+        int fd = createSegment(generation, nextId);
+        if (fd < 0) {
+            return false;
+        }
+        ::close(logFd);
+        logFd = fd;
+        activeGeneration = generation;
+    }
+    committed.notify_all();
+
+    // 2. 不持有锁写出新快照：快照中未删除的行与之后插入的行，附行号列
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << tempPath << endl;
+        return false;
+    }
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.dim = dim;
+    header.rows = (uint64_t) live;
+    header.flags = SNAPSHOT_FLAG_ROW_IDS;
+    header.generation = generation;
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    vector<uint64_t> ids;
+    ids.reserve(live);
+    const long total = captured.count + (long) capturedOverlay.size();
+    for (long p = 0; p < total && ok; p++) {
+        if (capturedDeleted[p]) {
+            continue;
+        }
+        const double* row;
+        if (p < captured.count) {
+            row = captured.rows + (size_t) p * dim;
+            ids.push_back(captured.ids == NULL ? p : captured.ids[p]);
+        } else {
+            row = capturedOverlay[p - captured.count].data();
+            ids.push_back(capturedOverlayFirstId + (p - captured.count));
+        }
+        ok = fwrite(row, sizeof(double), dim, file) == dim;
+    }
+    ok = ok && fwrite(ids.data(), sizeof(uint64_t), ids.size(), file) == ids.size();
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    ok = fclose(file) == 0 && ok;
+    vector<VectorXd>().swap(capturedOverlay);
+    if (!ok) {
+        cerr << "Error writing file " << tempPath << endl;
+        remove(tempPath.c_str());
+        return false;
+    }
+
+    // 3. 安装新快照，并由新快照与新分段重建内存状态（新分段只含合并期间的更新）
+    uint64_t records = 0;
+    {
+        lock_guard<mutex> state(stateMutex);
+        lock_guard<mutex> io(ioMutex);
+        lock_guard<mutex> lock(logMutex);
+        if (failed || !flushPendingLocked()) {
+            return false;
+        }
+        if (rename(tempPath.c_str(), basePath.c_str()) != 0) {
+            cerr << "Unable to rename file " << tempPath << endl;
+            return false;
+        }
+        syncDirectory(basePath);
+        uint64_t lsn = appendedLsn;
+        if (!recover(records)) {
+            failed = true;
+            return false;
+        }
+        appendedLsn = writtenLsn = durableLsn = lsn;
+        counters.compactions++;
+        counters.lastCompactMillis =
+                chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start_time).count();
+    }
+    printf("写前日志合并：新快照 %ld 行（第 %llu 代），合并期间的更新 %llu 条，时间 %f 毫秒\n", live,
+           (unsigned long long) generation, (unsigned long long) records, counters.lastCompactMillis);
+    fflush(stdout);
+    return true;
+}
+
+/**
+ * @Method: compactorLoop
+ * @Description: 后台合并线程：当前分段超过 compactLogBytes 时合并
+ */
+void WalStore::compactorLoop() {
+    const chrono::duration<double, milli> interval(config.compactCheckMillis);
+    while (true) {
+        {
+            unique_lock<mutex> lock(wakeMutex);
+            compactWake.wait_for(lock, interval, [&] { return compactorStopping; });
+            if (compactorStopping) {
+                return;
+            }
+        }
+        bool due;
+        {
+            lock_guard<mutex> lock(logMutex);
+            due = config.compactLogBytes > 0 && logBytes >= config.compactLogBytes && !failed;
+        }
+        if (due) {
+            compact();
+        }
+    }
+}
+
+/**
+ * @Method: walInsertFromFile
+ * @Description: 用全局加密矩阵加密文件中的新记录并插入全局写前日志存储
+ * @param char* fileString 新记录文件的地址，格式与数据集相同
+ * @return 状态码，1：成功；0：失败
+ */
+int walInsertFromFile(char* fileString) {
+    vector<vector<double>> batch = readDataFromFile(fileString);
+    if (batch.empty() || !denseKeyReady(batch[0].size())) {
+        return 0;
+    }
+    auto start_time = chrono::high_resolution_clock::now();
+    vector<VectorXd> rows;
+    encryptDataList(batch, NULL, rows);
+    long first = walStore.insertBatch(rows);
+    chrono::duration<double, milli> duration = chrono::high_resolution_clock::now() - start_time;
+    if (first < 0) {
+        return 0;
+    }
+    printf("写前日志插入：%zu 行，行号从 %ld 开始，时间 %f 毫秒\n", rows.size(), first, duration.count());
+    fflush(stdout);
+    return 1;
+}
+
+/**
+ * @Method: SSQWal
+ * @Description: 在全局写前日志存储上发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQWal(char* fileString, char* resultFilePath, int resultFormat) {
+    int k;
+    vector<double> point;
+    if (!readQuery(fileString, k, point) || !denseKeyReady(point.size())) {
+        return 0;
+    }
+
+    MatrixXd encryptMatrixInverse = calculateInverseMatrix(encryptMatrix);
+    VectorXd q = encryptQuery(point, encryptMatrixInverse);
+    vector<pair<double, long>> winners = walStore.topK(q, k);
+
+    MatrixXd rows(winners.size(), encryptMatrix.rows());
+    for (size_t i = 0; i < winners.size(); i++) {
+        VectorXd row;
+        if (!walStore.fetchRow(winners[i].second, row)) {
+            return 0;
+        }
+        rows.row(i) = row.transpose();
+    }
+    return writeResults(resultFilePath, winners, decryptRows(rows, encryptMatrixInverse), resultFormat);
+}
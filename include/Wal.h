@@ -0,0 +1,243 @@
+/**
+* @author: WTY
+* @date: 2024/8/31
+* @description: 密文更新的写前日志：基础快照之上追加插入/删除记录，组提交，启动时只重放日志，后台合并成新快照
+*/
+
+#ifndef WAL_H
+#define WAL_H
+
+#include "SSQ.h"
+#include "Snapshot.h"
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+/*
+ * 日志分段文件 <logPrefix>.<代数>，布局（小端）：
+ *   WalHeader（64字节）
+ *   记录序列：WalRecordHeader + 插入时 dim 个 double 的密文，crc 覆盖 type 到密文末尾
+ * 基础快照的 generation 为 G 时，代数不小于 G 的分段依次重放，更小的分段已合并进快照，可以删除。
+ * 合并时先切换到新分段 G'，再把切换前的全部状态写成 generation = G' 的新快照并 rename 覆盖旧快照，
+ * 任何时刻崩溃，重放规则都能得到完整的状态。
+ * 行号在插入时分配且永不改变，合并后的快照带行号列。
+ */
+struct WalHeader {
+    char magic[8];          // "SSQWAL"
+    uint32_t version;
+    uint32_t dim;           // 密文维度 d+3
+    uint64_t generation;    // 分段代数
+    uint64_t firstId;       // 本分段第一条插入的行号
+    uint64_t reserved[4];
+};
+
+struct WalRecordHeader {
+    uint32_t crc;
+    uint32_t type;          // WAL_INSERT / WAL_DELETE
+    uint64_t lsn;           // 日志序号，跨分段递增
+    uint64_t id;            // 插入或删除的行号
+};
+
+const char WAL_MAGIC[8] = {'S', 'S', 'Q', 'W', 'A', 'L', '\0', '\0'};
+const uint32_t WAL_VERSION = 1;
+const uint32_t WAL_INSERT = 1;
+const uint32_t WAL_DELETE = 2;
+
+/**
+ * 落盘策略
+ */
+enum WalSyncPolicy {
+    WAL_SYNC_COMMIT = 0,    // 每次提交返回前 fsync，同一组内的提交共享一次 fsync
+    WAL_SYNC_INTERVAL = 1,  // 写入操作系统即返回，每隔 syncIntervalMillis 后台 fsync 一次
+    WAL_SYNC_NONE = 2       // 只写入操作系统，由操作系统决定何时落盘
+};
+
+/**
+ * 写前日志配置
+ */
+struct WalConfig {
+    int syncPolicy;             // WalSyncPolicy
+    double groupCommitMillis;   // 第一条记录到达后最多等待多久以收集同一组的记录
+    size_t groupCommitBytes;    // 缓冲达到该大小时立即写出
+    double syncIntervalMillis;  // WAL_SYNC_INTERVAL 下两次 fsync 的间隔
+    size_t compactLogBytes;     // 当前分段超过该大小时后台合并，0 表示不自动合并
+    double compactCheckMillis;  // 后台合并线程的检查间隔
+
+    WalConfig() : syncPolicy(WAL_SYNC_COMMIT), groupCommitMillis(1), groupCommitBytes(1 << 20),
+                  syncIntervalMillis(100), compactLogBytes(64 << 20), compactCheckMillis(1000) {
+    }
+};
+
+/**
+ * 写前日志统计
+ */
+struct WalStats {
+    uint64_t records;           // 追加的记录数
+    uint64_t groups;            // 写入次数（组提交后）
+    uint64_t syncs;             // fsync 次数
+    uint64_t bytes;             // 写入的字节数
+    uint64_t recoveredRecords;  // 启动时重放的记录数
+    double recoveryMillis;      // 启动时映射快照与重放日志的时间
+    uint64_t compactions;
+    double lastCompactMillis;
+    uint64_t baseRows;          // 基础快照行数
+    uint64_t overlayRows;       // 快照之后插入的行数
+    uint64_t deletedRows;       // 已删除但尚未合并的行数
+    uint64_t logBytes;          // 当前分段的大小
+};
+
+/**
+ * @Class: WalStore
+ * @Description: 基础快照以 mmap 只读映射，之后的插入保存在内存中，删除记为墓碑；
+ *               所有更新先追加到日志。查询可能看到尚未落盘的更新，更新调用按落盘策略等待后返回。
+ */
+class WalStore {
+public:
+    WalStore();
+    ~WalStore();
+
+    /**
+     * @Method: open
+     * @Description: 映射基础快照并重放日志分段，尾部不完整的记录被截断
+     * @param const char* basePath 基础快照，可由 saveSnapshot 生成
+     * @param const char* logPrefix 日志分段文件前缀
+     * @param const WalConfig& config 日志配置
+     * @return bool 是否成功
+     */
+    bool open(const char* basePath, const char* logPrefix, const WalConfig& config = WalConfig());
+
+    /**
+     * @Method: close
+     * @Description: 写出并落盘剩余的记录，停止后台线程
+     */
+    void close();
+
+    /**
+     * @Method: insertBatch
+     * @Description: 追加一批密文，按落盘策略等待提交
+     * @param const vector<VectorXd>& rows 加密后的记录
+     * @return long 第一条记录的行号，其余依次递增；失败时为 -1
+     */
+    long insertBatch(const vector<VectorXd>& rows);
+
+    /**
+     * @Method: removeBatch
+     * @Description: 删除一批行，不存在的行号被忽略
+     * @param const vector<long>& ids 行号
+     * @return bool 是否提交成功
+     */
+    bool removeBatch(const vector<long>& ids);
+
+    /**
+     * @Method: topK
+     * @Description: 扫描快照中未删除的行与之后插入的行
+     * @return vector<pair<double, long>> (距离, 行号)，距离从大到小
+     */
+    vector<pair<double, long>> topK(const VectorXd& q, int k);
+
+    /**
+     * @Method: fetchRow
+     * @Description: 读取一行密文
+     * @return bool 行是否存在
+     */
+    bool fetchRow(long id, VectorXd& row);
+
+    /**
+     * @Method: compact
+     * @Description: 把快照与日志合并成新的基础快照，合并期间更新与查询照常进行
+     * @return bool 是否成功
+     */
+    bool compact();
+
+    long size();
+
+    WalStats stats();
+
+private:
+    struct BaseMap {
+        void* map;
+        size_t bytes;
+        const double* rows;
+        const uint64_t* ids;    // 为 NULL 时行号即位置
+        long count;
+        uint64_t generation;
+    };
+
+    string segmentPath(uint64_t generation) const;
+    bool recover(uint64_t& records);
+    bool replaySegment(uint64_t generation, uint64_t& records);
+    int createSegment(uint64_t generation, uint64_t firstId);
+    uint64_t appendRecord(uint32_t type, long id, const double* payload);
+    bool flushPendingLocked();
+    bool waitCommitted(uint64_t lsn);
+    void applyInsert(const double* row);
+    void applyDelete(long id);
+    long positionOf(long id) const;
+    long idAt(long position) const;
+    const double* rowAt(long position) const;
+    void flusherLoop();
+    void compactorLoop();
+
+    string basePath;
+    string logPrefix;
+    WalConfig config;
+    uint32_t dim;
+    bool opened;
+
+    // 内存状态，受 stateMutex 保护；位置 [0, base.count) 为快照中的行，之后为 overlay
+    BaseMap base;
+    vector<VectorXd> overlay;
+    long overlayFirstId;
+    vector<bool> deleted;
+    long deletedCount;
+    long nextId;
+    mutex stateMutex;
+
+    // 日志写入，加锁顺序 stateMutex -> ioMutex -> logMutex
+    int logFd;
+    uint64_t activeGeneration;
+    string pending;
+    uint64_t appendedLsn;
+    uint64_t writtenLsn;
+    uint64_t durableLsn;
+    uint64_t logBytes;
+    bool failed;
+    bool stopping;
+    WalStats counters;
+    mutex ioMutex;
+    mutex logMutex;
+    condition_variable flushWake;
+    condition_variable committed;
+    thread flusher;
+
+    // 合并
+    mutex compactMutex;
+    mutex wakeMutex;
+    condition_variable compactWake;
+    bool compactorStopping;
+    thread compactor;
+};
+
+// 全局写前日志存储
+extern WalStore walStore;
+
+/**
+ * @Method: walInsertFromFile
+ * @Description: 用全局加密矩阵加密文件中的新记录并插入全局写前日志存储
+ * @param char* fileString 新记录文件的地址，格式与数据集相同
+ * @return 状态码，1：成功；0：失败
+ */
+int walInsertFromFile(char* fileString);
+
+/**
+ * @Method: SSQWal
+ * @Description: 在全局写前日志存储上发起查询请求
+ * @param char* fileString 读取查询数据的地址
+ * @param char* resultFilePath 输出数据的地址
+ * @param int resultFormat 结果格式 ResultFormat
+ * @return 状态码，1：成功；0：失败
+ */
+int SSQWal(char* fileString, char* resultFilePath, int resultFormat = RESULT_TEXT);
+
+
+#endif //WAL_H
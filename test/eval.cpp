@@ -0,0 +1,220 @@
+/**
+* @author: WTY
+* @date: 2024/8/26
+* @description: 召回率与延迟评测：对每种查询模式在同一数据集上测量 recall@k、QPS 与 p50/p99 延迟
+*/
+
+#include <SSQ.h>
+#include <Block_index.h>
+#include <Numa.h>
+#include <Out_of_core.h>
+#include <Vertical_partition.h>
+#include <Block_key.h>
+#include <Proximity_graph.h>
+#include <functional>
+#include <cstring>
+
+/**
+ * 一种模式的评测结果
+ */
+struct EvalResult {
+    string mode;
+    double recall;
+    double qps;
+    double p50Millis;
+    double p99Millis;
+};
+
+// 给定明文查询点，返回距离最近的k个原始行号
+typedef function<vector<long>(const vector<double>& point, int k)> QueryRunner;
+
+/**
+ * @Method: bruteForceGroundTruth
+ * @Description: 在明文上暴力计算真实近邻（欧式平方距离）
+ */
+static vector<vector<int>> bruteForceGroundTruth(const vector<vector<double>>& base,
+                                                 const vector<vector<double>>& queries, int k) {
+    vector<vector<int>> truth(queries.size());
+    for (size_t qi = 0; qi < queries.size(); qi++) {
+        TopKHeap heap(k);
+        for (size_t i = 0; i < base.size(); i++) {
+            double sum = 0;
+            for (size_t j = 0; j < base[i].size(); j++) {
+                double diff = base[i][j] - queries[qi][j];
+                sum += diff * diff;
+            }
+            heap.push(sum, (long) i);
+        }
+        vector<pair<double, long>> winners = heap.extractDescending();
+        for (size_t i = winners.size(); i-- > 0;) {
+            truth[qi].push_back((int) winners[i].second);
+        }
+    }
+    return truth;
+}
+
+/**
+ * @Method: evaluate
+ * @Description: 逐个执行查询，统计召回率、吞吐量与延迟分位数
+ */
+static EvalResult evaluate(const string& mode, QueryRunner runner, const vector<vector<double>>& queries,
+                           const vector<vector<int>>& truth, int k) {
+    vector<double> latencies;
+    double hits = 0;
+    auto start_time = chrono::high_resolution_clock::now();
+    for (size_t qi = 0; qi < queries.size(); qi++) {
+        auto t0 = chrono::high_resolution_clock::now();
+        vector<long> ids = runner(queries[qi], k);
+        auto t1 = chrono::high_resolution_clock::now();
+        latencies.push_back(chrono::duration<double, milli>(t1 - t0).count());
+
+        size_t limit = min((size_t) k, truth[qi].size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            if (find(truth[qi].begin(), truth[qi].begin() + limit, (int) ids[i]) != truth[qi].begin() + limit) {
+                hits++;
+            }
+        }
+    }
+    chrono::duration<double> total = chrono::high_resolution_clock::now() - start_time;
+
+    sort(latencies.begin(), latencies.end());
+    EvalResult result;
+    result.mode = mode;
+    result.recall = queries.empty() ? 0 : hits / ((double) k * queries.size());
+    result.qps = total.count() > 0 ? queries.size() / total.count() : 0;
+    result.p50Millis = latencies.empty() ? 0 : latencies[latencies.size() / 2];
+    result.p99Millis = latencies.empty() ? 0 : latencies[min(latencies.size() - 1, latencies.size() * 99 / 100)];
+    printf("%-12s recall@%d=%.4f  QPS=%.1f  p50=%.3f 毫秒  p99=%.3f 毫秒\n", mode.c_str(), k, result.recall,
+           result.qps, result.p50Millis, result.p99Millis);
+    fflush(stdout);
+    return result;
+}
+
+static vector<long> idsOf(const vector<pair<double, long>>& winners) {
+    vector<long> ids;
+    for (size_t i = 0; i < winners.size(); i++) {
+        ids.push_back(winners[i].second);
+    }
+    return ids;
+}
+
+static bool enabled(const char* modes, const char* mode) {
+    if (strcmp(modes, "all") == 0) {
+        return true;
+    }
+    string list = string(",") + modes + ",";
+    return list.find(string(",") + mode + ",") != string::npos;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        printf("用法：%s <base.fvecs|bvecs|txt> <query.fvecs|txt> <groundtruth.ivecs|-> [k=10] [maxBase=0] "
+               "[maxQueries=100] [modes=all] [workDir=/tmp]\n", argv[0]);
+        printf("modes：exact,pruned,numa,vertical,outofcore,blockkey,graph 的逗号分隔列表\n");
+        return 1;
+    }
+    char* basePath = argv[1];
+    char* queryPath = argv[2];
+    const char* truthPath = argv[3];
+    int k = argc > 4 ? atoi(argv[4]) : 10;
+    long maxBase = argc > 5 ? atol(argv[5]) : 0;
+    long maxQueries = argc > 6 ? atol(argv[6]) : 100;
+    const char* modes = argc > 7 ? argv[7] : "all";
+    string workDir = argc > 8 ? argv[8] : "/tmp";
+
+    printSimdReport();
+
+    // 查询与明文数据集只用于计算真实近邻
+    vecsRowLimit = maxQueries;
+    vector<vector<double>> queries = readDataFromFile(queryPath);
+    vecsRowLimit = maxBase;
+    if (queries.size() > 1 && queries[0].size() == 1 && queries[1].size() > 1) {
+        // 文本查询文件第一行为 k（readQuery 的格式），不是查询点
+        queries.erase(queries.begin());
+    }
+    if (queries.empty()) {
+        return 1;
+    }
+
+    vector<vector<int>> truth;
+    if (strcmp(truthPath, "-") != 0 && maxBase == 0) {
+        truth = readIvecs(truthPath, (long) queries.size());
+    }
+    if (truth.size() != queries.size()) {
+        // 没有真实近邻文件，或数据集被截断后原文件不再适用
+        printf("在明文上暴力计算真实近邻\n");
+        truth = bruteForceGroundTruth(readDataFromFile(basePath), queries, k);
+    }
+
+    vector<EvalResult> results;
+    if (enabled(modes, "exact") && dealData(basePath)) {
+        MatrixXd inverse = calculateInverseMatrix(encryptMatrix);
+        results.push_back(evaluate("exact", [&](const vector<double>& p, int topK) {
+            return idsOf(scanTopK(encryptQuery(p, inverse), topK));
+        }, queries, truth, k));
+    }
+    if (enabled(modes, "pruned") && dealDataPruned(basePath)) {
+        MatrixXd inverse = calculateInverseMatrix(encryptMatrix);
+        results.push_back(evaluate("pruned", [&](const vector<double>& p, int topK) {
+            vector<long> ids = idsOf(prunedTopK(encryptQuery(p, inverse), topK));
+            for (size_t i = 0; i < ids.size(); i++) {
+                ids[i] = blockIndex.originalIds[ids[i]];
+            }
+            return ids;
+        }, queries, truth, k));
+    }
+    if (enabled(modes, "numa") && dealDataNuma(basePath)) {
+        MatrixXd inverse = calculateInverseMatrix(encryptMatrix);
+        results.push_back(evaluate("numa", [&](const vector<double>& p, int topK) {
+            return idsOf(numaTopK(encryptQuery(p, inverse), topK));
+        }, queries, truth, k));
+        numaCiphertext.clear();
+    }
+    if (enabled(modes, "vertical") && dealData(basePath) && startVerticalWorkers()) {
+        MatrixXd inverse = calculateInverseMatrix(encryptMatrix);
+        results.push_back(evaluate("vertical", [&](const vector<double>& p, int topK) {
+            return idsOf(verticalTopK(encryptQuery(p, inverse), topK));
+        }, queries, truth, k));
+        stopVerticalWorkers();
+    }
+    string snapshotPath = workDir + "/ssq_eval.snap";
+    if (enabled(modes, "outofcore") && dealData(basePath) && saveSnapshot(snapshotPath.c_str())) {
+        MatrixXd inverse = calculateInverseMatrix(encryptMatrix);
+        vector<VectorXd>().swap(ciphertext);    // 只从快照文件扫描
+        OutOfCoreConfig config;
+        results.push_back(evaluate("outofcore", [&](const vector<double>& p, int topK) {
+            return idsOf(outOfCoreTopK(snapshotPath.c_str(), encryptQuery(p, inverse), topK, config));
+        }, queries, truth, k));
+        remove(snapshotPath.c_str());
+    }
+    if (enabled(modes, "blockkey") && dealDataBlockKey(basePath)) {
+        results.push_back(evaluate("blockkey", [&](const vector<double>& p, int topK) {
+            return idsOf(scanTopK(blockKeyEncryptQuery(blockKey, augmentQuery(p)), topK));
+        }, queries, truth, k));
+    }
+    if (enabled(modes, "graph") && dealDataGraph(basePath)) {
+        MatrixXd inverse = calculateInverseMatrix(encryptMatrix);
+        // 不同 ef 下的召回率与延迟
+        int efs[] = {k, 2 * k, 4 * k, 8 * k, 16 * k};
+        for (int e = 0; e < 5; e++) {
+            char mode[32];
+            snprintf(mode, sizeof(mode), "graph-ef%d", efs[e]);
+            results.push_back(evaluate(mode, [&](const vector<double>& p, int topK) {
+                return idsOf(graphTopK(encryptQuery(p, inverse), topK, efs[e]));
+            }, queries, truth, k));
+        }
+    }
+    // float / quantized 模式：当前版本的密文只以 double 保存，尚无对应实现
+    if (enabled(modes, "float") || enabled(modes, "quantized")) {
+        printf("float/quantized 模式尚未实现，跳过\n");
+    }
+
+    printf("--------------------------------------------\n");
+    printf("%-12s %10s %10s %12s %12s\n", "mode", "recall", "QPS", "p50(ms)", "p99(ms)");
+    for (size_t i = 0; i < results.size(); i++) {
+        printf("%-12s %10.4f %10.1f %12.3f %12.3f\n", results[i].mode.c_str(), results[i].recall, results[i].qps,
+               results[i].p50Millis, results[i].p99Millis);
+    }
+    fflush(stdout);
+    return 0;
+}
@@ -0,0 +1,454 @@
+/**
+* @author: WTY
+* @date: 2024/9/2
+* @description: 合成数据集与查询生成工具：多线程按块生成任意规模的数据集（文本或 fvecs），
+*               同时生成查询文件，并用分块矩阵乘法在明文上计算真实近邻（ivecs）
+*/
+
+#include <SSQ.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+#include <cmath>
+#include <cstring>
+
+/**
+ * 数据分布
+ */
+enum Distribution {
+    DIST_UNIFORM = 0,       // 每一维独立均匀分布于 [0, 100)
+    DIST_CLUSTERS = 1,      // 若干高斯簇
+    DIST_HEAVY_TAIL = 2,    // 随机方向，范数服从帕累托分布
+    DIST_DUPLICATES = 3     // 高斯簇，且一部分行与之前的某行完全相同
+};
+
+// 每块的行数；块的划分与线程数无关，保证任意线程数下输出相同
+const long GENERATE_BLOCK_ROWS = 4096;
+// 计算真实近邻时每次矩阵乘法的查询数
+const long GENERATE_QUERY_TILE = 256;
+// 高斯簇的个数与标准差
+const int CLUSTER_COUNT = 64;
+const double CLUSTER_SIGMA = 5;
+// 均匀分布与簇中心的取值范围
+const double VALUE_RANGE = 100;
+// 帕累托分布的形状参数、尺度与截断上限
+const double PARETO_ALPHA = 1.5;
+const double PARETO_SCALE = 10;
+const double PARETO_LIMIT = 1000;
+// DIST_DUPLICATES 默认的重复比例
+const double DEFAULT_DUPLICATE_FRACTION = 0.2;
+// 文本格式保留的小数位数，与现有数据文件一致
+const double TEXT_SCALE = 1e4;
+
+// 随机数流：数据集与查询使用互不相关的流
+const uint64_t STREAM_BASE = 0x5851f42d4c957f2dULL;
+const uint64_t STREAM_QUERY = 0x14057b7ef767814fULL;
+
+/**
+ * @Method: mix64
+ * @Description: splitmix64 的输出函数
+ */
+static inline uint64_t mix64(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @Class: SplitMix64
+ * @Description: 轻量随机数发生器，每行由 (种子, 流, 行号) 独立播种，生成结果与块的调度顺序无关
+ */
+class SplitMix64 {
+public:
+    explicit SplitMix64(uint64_t seed) : state(seed) {
+    }
+
+    uint64_t next() {
+        state += 0x9e3779b97f4a7c15ULL;
+        return mix64(state);
+    }
+
+    // (0, 1] 上的均匀分布
+    double uniform() {
+        return ((next() >> 11) + 1) * (1.0 / 9007199254740992.0);
+    }
+
+    double gaussian() {
+        // Box-Muller，只使用其中一个输出
+        return sqrt(-2 * log(uniform())) * cos(2 * M_PI * uniform());
+    }
+
+private:
+    uint64_t state;
+};
+
+/**
+ * 生成配置
+ */
+struct GeneratorConfig {
+    int distribution;       // Distribution
+    long rows;
+    int dim;
+    double duplicateFraction;
+    uint64_t seed;
+    bool binary;            // true：fvecs；false：文本
+};
+
+/**
+ * @Class: RowGenerator
+ * @Description: 按行号确定性地生成一行，数值已舍入到输出格式能精确表示的值，真实近邻与写出的数据一致
+ */
+class RowGenerator {
+public:
+    explicit RowGenerator(const GeneratorConfig& config) : config(config) {
+        if (config.distribution == DIST_CLUSTERS || config.distribution == DIST_DUPLICATES) {
+            SplitMix64 random(mix64(config.seed ^ 0xc1057e75ULL));
+            centers.resize((size_t) CLUSTER_COUNT * config.dim);
+            for (size_t i = 0; i < centers.size(); i++) {
+                centers[i] = random.uniform() * VALUE_RANGE;
+            }
+        }
+    }
+
+    /**
+     * @Method: row
+     * @Description: 生成第 i 行
+     * @param uint64_t stream 随机数流
+     * @param long i 行号
+     * @param double* out 输出，长度为 dim
+     */
+    void row(uint64_t stream, long i, double* out) const {
+        // 重复的行取之前某一行的值；被引用的行也可能是重复行，行号严格递减，一定终止
+        if (stream == STREAM_BASE && config.duplicateFraction > 0) {
+            while (i > 0) {
+                SplitMix64 random(mix64(config.seed ^ mix64(stream + 1) ^ mix64((uint64_t) i)));
+                if (random.uniform() > config.duplicateFraction) {
+                    break;
+                }
+                i = (long) (random.next() % (uint64_t) i);
+            }
+        }
+        SplitMix64 random(mix64(config.seed ^ mix64(stream) ^ (uint64_t) i));
+        const int dim = config.dim;
+        if (config.distribution == DIST_UNIFORM) {
+            for (int j = 0; j < dim; j++) {
+                out[j] = random.uniform() * VALUE_RANGE;
+            }
+        } else if (config.distribution == DIST_HEAVY_TAIL) {
+            double norm = 0;
+            for (int j = 0; j < dim; j++) {
+                out[j] = random.gaussian();
+                norm += out[j] * out[j];
+            }
+            double length = min(PARETO_LIMIT, PARETO_SCALE / pow(random.uniform(), 1 / PARETO_ALPHA));
+            double scale = norm > 0 ? length / sqrt(norm) : 0;
+            for (int j = 0; j < dim; j++) {
+                out[j] *= scale;
+            }
+        } else {
+            const double* center = &centers[(random.next() % CLUSTER_COUNT) * dim];
+            for (int j = 0; j < dim; j++) {
+                out[j] = center[j] + random.gaussian() * CLUSTER_SIGMA;
+            }
+        }
+        for (int j = 0; j < dim; j++) {
+            out[j] = config.binary ? (double) (float) out[j] : round(out[j] * TEXT_SCALE) / TEXT_SCALE;
+        }
+    }
+
+private:
+    GeneratorConfig config;
+    vector<double> centers;
+};
+
+/**
+ * @Method: appendText
+ * @Description: 以4位小数写出一行，手工格式化比 printf 快得多
+ */
+static void appendText(const double* x, int dim, string& out) {
+    char buffer[32];
+    for (int j = 0; j < dim; j++) {
+        long long ticks = llround(x[j] * TEXT_SCALE);
+        char* p = buffer + sizeof(buffer);
+        unsigned long long magnitude = ticks < 0 ? -(unsigned long long) ticks : ticks;
+        for (int digit = 0; digit < 4; digit++) {
+            *--p = (char) ('0' + magnitude % 10);
+            magnitude /= 10;
+        }
+        *--p = '.';
+        do {
+            *--p = (char) ('0' + magnitude % 10);
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (ticks < 0) {
+            *--p = '-';
+        }
+        if (j > 0) {
+            out.push_back(' ');
+        }
+        out.append(p, buffer + sizeof(buffer) - p);
+    }
+    out.push_back('\n');
+}
+
+/**
+ * @Method: appendBinary
+ * @Description: 以 fvecs 格式写出一行
+ */
+static void appendBinary(const double* x, int dim, string& out) {
+    int32_t d = dim;
+    out.append((const char*) &d, sizeof(d));
+    for (int j = 0; j < dim; j++) {
+        float value = (float) x[j];
+        out.append((const char*) &value, sizeof(value));
+    }
+}
+
+// 按 (距离, 行号) 排序的最大堆，距离相同时保留行号较小的，结果与线程调度无关
+typedef priority_queue<pair<double, long>> NeighborHeap;
+
+/**
+ * @Method: pushNeighbor
+ * @Description: 尝试插入一条候选近邻
+ */
+static inline void pushNeighbor(NeighborHeap& heap, size_t k, double distance, long id) {
+    if (heap.size() < k) {
+        heap.push(make_pair(distance, id));
+    } else if (make_pair(distance, id) < heap.top()) {
+        heap.pop();
+        heap.push(make_pair(distance, id));
+    }
+}
+
+/**
+ * @Method: generateDataset
+ * @Description: 多线程生成数据集：线程动态领取块，生成并编码后按块号顺序写出；
+ *               给定查询时同一遍内对每块做分块矩阵乘法 Q·B^T，以 |q|^2 + |b|^2 - 2q·b 维护各线程的 top-k
+ * @param const GeneratorConfig& config 生成配置
+ * @param const char* path 输出文件
+ * @param const RowMatrixXd& queries 查询，行数为 0 时不计算真实近邻
+ * @param int k 真实近邻数
+ * @param int threads 线程数
+ * @param vector<vector<int>>& truth 返回的真实近邻行号，由近到远
+ * @return 状态码，1：成功；0：失败
+ */
+static int generateDataset(const GeneratorConfig& config, const char* path, const RowMatrixXd& queries, int k,
+                           int threads, vector<vector<int>>& truth) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return 0;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 22);
+
+    const RowGenerator generator(config);
+    const int dim = config.dim;
+    const long blocks = (config.rows + GENERATE_BLOCK_ROWS - 1) / GENERATE_BLOCK_ROWS;
+    const long queryCount = queries.rows();
+    VectorXd queryNorms = queries.rowwise().squaredNorm();
+
+    atomic<long> nextBlock(0);
+    long writeTurn = 0;
+    bool failed = false;
+    mutex writeMutex;
+    condition_variable writeReady;
+    vector<vector<NeighborHeap>> heaps(threads, vector<NeighborHeap>(queryCount));
+
+    auto worker = [&](int t) {
+        RowMatrixXd block(GENERATE_BLOCK_ROWS, dim);
+        MatrixXd products;
+        string encoded;
+        vector<NeighborHeap>& local = heaps[t];
+        long b;
+        while ((b = nextBlock++) < blocks) {
+            const long begin = b * GENERATE_BLOCK_ROWS;
+            const long count = min(GENERATE_BLOCK_ROWS, config.rows - begin);
+            encoded.clear();
+            for (long r = 0; r < count; r++) {
+                double* x = block.row(r).data();
+                generator.row(STREAM_BASE, begin + r, x);
+                if (config.binary) {
+                    appendBinary(x, dim, encoded);
+                } else {
+                    appendText(x, dim, encoded);
+                }
+            }
+
+            if (queryCount > 0) {
+                VectorXd norms = block.topRows(count).rowwise().squaredNorm();
+                for (long q0 = 0; q0 < queryCount; q0 += GENERATE_QUERY_TILE) {
+                    const long nq = min(GENERATE_QUERY_TILE, queryCount - q0);
+                    products.noalias() = queries.middleRows(q0, nq) * block.topRows(count).transpose();
+                    for (long qi = 0; qi < nq; qi++) {
+                        NeighborHeap& heap = local[q0 + qi];
+                        for (long r = 0; r < count; r++) {
+                            double distance = queryNorms[q0 + qi] + norms[r] - 2 * products(qi, r);
+                            pushNeighbor(heap, (size_t) k, distance, begin + r);
+                        }
+                    }
+                }
+            }
+
+            // 按块号顺序写出，等待的时间不超过其他线程处理一块的时间
+            unique_lock<mutex> lock(writeMutex);
+            writeReady.wait(lock, [&] { return writeTurn == b; });
+            if (!failed && fwrite(encoded.data(), 1, encoded.size(), file) != encoded.size()) {
+                failed = true;
+            }
+            writeTurn++;
+            if (blocks >= 10 && writeTurn % (blocks / 10) == 0) {
+                printf("已生成 %ld / %ld 行\n", min(config.rows, writeTurn * GENERATE_BLOCK_ROWS), config.rows);
+                fflush(stdout);
+            }
+            writeReady.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.push_back(thread(worker, t));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    if (fclose(file) != 0 || failed) {
+        cerr << "Error writing file " << path << endl;
+        return 0;
+    }
+
+    // 归并各线程的堆
+    truth.assign(queryCount, vector<int>());
+    for (long qi = 0; qi < queryCount; qi++) {
+        NeighborHeap merged;
+        for (int t = 0; t < threads; t++) {
+            NeighborHeap& heap = heaps[t][qi];
+            for (; !heap.empty(); heap.pop()) {
+                pushNeighbor(merged, (size_t) k, heap.top().first, heap.top().second);
+            }
+        }
+        truth[qi].resize(merged.size());
+        for (size_t i = merged.size(); i-- > 0; merged.pop()) {
+            truth[qi][i] = (int) merged.top().second;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @Method: writeQueries
+ * @Description: 写出查询：fvecs 格式每行一个查询；文本格式第一行为 k，之后每行一个查询，
+ *               与 readQuery 兼容（SSQ 使用第一个查询）
+ */
+static int writeQueries(const char* path, const RowMatrixXd& queries, int k, bool binary) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        cerr << "Unable to open file " << path << endl;
+        return 0;
+    }
+    string encoded;
+    if (!binary) {
+        encoded = to_string(k) + "\n";
+    }
+    for (long i = 0; i < queries.rows(); i++) {
+        if (binary) {
+            appendBinary(queries.row(i).data(), (int) queries.cols(), encoded);
+        } else {
+            appendText(queries.row(i).data(), (int) queries.cols(), encoded);
+        }
+    }
+    bool ok = fwrite(encoded.data(), 1, encoded.size(), file) == encoded.size();
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        cerr << "Error writing file " << path << endl;
+        return 0;
+    }
+    return 1;
+}
+
+static bool hasSuffix(const char* path, const char* suffix) {
+    size_t n = strlen(path), m = strlen(suffix);
+    return n >= m && strcmp(path + n - m, suffix) == 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 4) {
+        printf("用法：%s <base.txt|fvecs> <rows> <dim> [dist=uniform] [queries=0] [query.txt|fvecs|-] [k=10] "
+               "[groundtruth.ivecs|-] [duplicateFraction] [seed=1] [threads=0]\n", argv[0]);
+        printf("dist：uniform、clusters、heavytail、duplicates；duplicateFraction 对任意分布生效，"
+               "duplicates 默认为 %.2f\n", DEFAULT_DUPLICATE_FRACTION);
+        return 1;
+    }
+    const char* basePath = argv[1];
+    GeneratorConfig config;
+    config.rows = atol(argv[2]);
+    config.dim = atoi(argv[3]);
+    const char* dist = argc > 4 ? argv[4] : "uniform";
+    long queryCount = argc > 5 ? atol(argv[5]) : 0;
+    const char* queryPath = argc > 6 ? argv[6] : "-";
+    int k = argc > 7 ? atoi(argv[7]) : 10;
+    const char* truthPath = argc > 8 ? argv[8] : "-";
+    config.duplicateFraction = argc > 9 ? atof(argv[9]) : -1;
+    config.seed = argc > 10 ? strtoull(argv[10], NULL, 10) : 1;
+    int threads = argc > 11 ? atoi(argv[11]) : 0;
+    config.binary = hasSuffix(basePath, ".fvecs");
+
+    if (strcmp(dist, "uniform") == 0) {
+        config.distribution = DIST_UNIFORM;
+    } else if (strcmp(dist, "clusters") == 0) {
+        config.distribution = DIST_CLUSTERS;
+    } else if (strcmp(dist, "heavytail") == 0) {
+        config.distribution = DIST_HEAVY_TAIL;
+    } else if (strcmp(dist, "duplicates") == 0) {
+        config.distribution = DIST_DUPLICATES;
+    } else {
+        cerr << "Unknown distribution " << dist << endl;
+        return 1;
+    }
+    if (config.duplicateFraction < 0) {
+        config.duplicateFraction = config.distribution == DIST_DUPLICATES ? DEFAULT_DUPLICATE_FRACTION : 0;
+    }
+    bool wantTruth = strcmp(truthPath, "-") != 0;
+    if (config.rows <= 0 || config.dim <= 0 || k <= 0 || queryCount < 0 || config.duplicateFraction >= 1) {
+        cerr << "Invalid arguments" << endl;
+        return 1;
+    }
+    if (wantTruth && (queryCount == 0 || config.rows > INT32_MAX)) {
+        // ivecs 的行号为 int32
+        cerr << "Ground truth needs queries and at most " << INT32_MAX << " rows" << endl;
+        return 1;
+    }
+    if (threads <= 0) {
+        threads = max(1u, thread::hardware_concurrency());
+    }
+
+    auto start_time = chrono::high_resolution_clock::now();
+
+    // 查询与数据集同分布，来自另一条随机数流
+    const RowGenerator generator(config);
+    RowMatrixXd queries(queryCount, config.dim);
+    for (long i = 0; i < queryCount; i++) {
+        generator.row(STREAM_QUERY, i, queries.row(i).data());
+    }
+    if (queryCount > 0 && strcmp(queryPath, "-") != 0 &&
+        !writeQueries(queryPath, queries, k, hasSuffix(queryPath, ".fvecs"))) {
+        return 1;
+    }
+
+    vector<vector<int>> truth;
+    if (!generateDataset(config, basePath, wantTruth ? queries : RowMatrixXd(0, config.dim), k, threads, truth)) {
+        return 1;
+    }
+    if (wantTruth && !writeIvecs(truthPath, truth)) {
+        return 1;
+    }
+
+    auto end_time = chrono::high_resolution_clock::now();
+    chrono::duration<double, milli> total_duration = end_time - start_time;
+    printf("生成 %ld 行 %d 维数据（%s，重复比例 %.2f），%ld 个查询%s，%d 线程，时间 %f 毫秒\n", config.rows,
+           config.dim, dist, config.duplicateFraction, queryCount, wantTruth ? "及真实近邻" : "", threads,
+           total_duration.count());
+    fflush(stdout);
+    return 0;
+}
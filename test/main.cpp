@@ -114,6 +114,8 @@ int main() {
     char* res = "/root/wty/result.txt";
 
 
+    printSimdReport(); // 输出选中的SIMD内核
+
     auto start_time = chrono::high_resolution_clock::now();
 
     dealData(fileString); // 预处理数据
@@ -0,0 +1,485 @@
+/**
+* @author: WTY
+* @date: 2024/9/3
+* @description: 回归测试：写前日志恢复、断点续传、剪枝行号映射、结果格式化、分块密钥、属性位图与令牌、
+*               数据集注册表与共享内存传输。数据在临时目录中生成，任何一项失败时返回非0，由 ctest 运行
+*/
+
+#include <SSQ.h>
+#include <Wal.h>
+#include <Checkpoint_ingest.h>
+#include <Block_index.h>
+#include <Standing_query.h>
+#include <Block_key.h>
+#include <Attribute_index.h>
+#include <Dataset_registry.h>
+#include <Shm_transport.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 测试数据集的规模
+const int TEST_ROWS = 600;
+const int TEST_DIM = 8;
+
+static int failures = 0;
+
+static void check(bool condition, const char* name) {
+    printf("[%s] %s\n", condition ? "PASS" : "FAIL", name);
+    fflush(stdout);
+    if (!condition) {
+        failures++;
+    }
+}
+
+static string tempDir;
+static string dataPath;
+static vector<vector<double>> plaintext;
+static vector<uint64_t> lineOffsets;    // 第 i 行之前的字节数，共 TEST_ROWS+1 项
+
+static long fileSize(const string& path) {
+    struct stat info;
+    return stat(path.c_str(), &info) == 0 ? (long) info.st_size : -1;
+}
+
+static string readFile(const string& path) {
+    ifstream in(path.c_str(), ios::binary);
+    return string((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+}
+
+static void writeFile(const string& path, const string& bytes) {
+    ofstream out(path.c_str(), ios::binary | ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+/**
+ * @Description: 生成固定种子的文本数据集，并记录每行的起始偏移
+ */
+static void generateData() {
+    mt19937 generator(20240903);
+    uniform_real_distribution<double> distribution(0, 100);
+    dataPath = tempDir + "/data.txt";
+    string text;
+    plaintext.assign(TEST_ROWS, vector<double>(TEST_DIM));
+    lineOffsets.assign(1, 0);
+    for (int r = 0; r < TEST_ROWS; r++) {
+        char number[32];
+        for (int j = 0; j < TEST_DIM; j++) {
+            snprintf(number, sizeof(number), j == 0 ? "%.4f" : " %.4f", distribution(generator));
+            text += number;
+            plaintext[r][j] = strtod(number, NULL);
+        }
+        text += "\n";
+        lineOffsets.push_back(text.size());
+    }
+    writeFile(dataPath, text);
+}
+
+static vector<VectorXd> randomRows(int count, int dim, unsigned seed) {
+    mt19937 generator(seed);
+    normal_distribution<double> distribution(0, 1);
+    vector<VectorXd> rows(count, VectorXd(dim));
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < dim; j++) {
+            rows[i][j] = distribution(generator);
+        }
+    }
+    return rows;
+}
+
+/**
+ * @Description: 读出行号 [0, maxId) 的全部行，不存在的行为空向量
+ */
+static vector<VectorXd> allRows(WalStore& store, long maxId) {
+    vector<VectorXd> rows(maxId);
+    for (long id = 0; id < maxId; id++) {
+        if (!store.fetchRow(id, rows[id])) {
+            rows[id].resize(0);
+        }
+    }
+    return rows;
+}
+
+/**
+ * @Description: 写前日志：关闭后重新打开得到相同的行；尾部写了一半的记录被截断；
+ *               合并过程中在快照 rename 之前崩溃时，旧快照加上新旧两个分段依然能恢复完整状态
+ */
+static void testWal() {
+    string basePath = tempDir + "/wal.snap", logPrefix = tempDir + "/wal.log";
+    dealData((char*) dataPath.c_str());
+    check(saveSnapshot(basePath.c_str()) == 1, "wal: save base snapshot");
+    const int dim = TEST_DIM + 3;
+    vector<VectorXd> inserted = randomRows(40, dim, 1);
+    VectorXd q = randomRows(1, dim, 2)[0];
+    long maxId = TEST_ROWS + 100;
+
+    vector<pair<double, long>> expected;
+    {
+        WalStore store;
+        check(store.open(basePath.c_str(), logPrefix.c_str()), "wal: open");
+        long first = store.insertBatch(inserted);
+        check(first == TEST_ROWS, "wal: insert ids follow the base snapshot");
+        check(store.removeBatch(vector<long>{3, 17, first + 5}), "wal: delete");
+        expected = store.topK(q, 10);
+        store.close();
+    }
+    {
+        WalStore store;
+        check(store.open(basePath.c_str(), logPrefix.c_str()), "wal: reopen");
+        check(store.size() == TEST_ROWS + 40 - 3, "wal: recovered row count");
+        check(store.topK(q, 10) == expected, "wal: recovered top-k");
+        VectorXd row;
+        check(!store.fetchRow(3, row) && store.fetchRow(TEST_ROWS, row) && row == inserted[0],
+              "wal: recovered deletes and inserts");
+        store.close();
+    }
+
+    // 在当前分段末尾追加半条记录，模拟写入过程中崩溃
+    string segment = logPrefix + ".0";
+    long intactBytes = fileSize(segment);
+    string torn = readFile(segment);
+    torn.append(string(sizeof(WalRecordHeader) + 7, '\x5a'));
+    writeFile(segment, torn);
+    {
+        WalStore store;
+        check(store.open(basePath.c_str(), logPrefix.c_str()), "wal: reopen with torn tail");
+        check(store.topK(q, 10) == expected, "wal: torn tail ignored");
+        store.close();
+    }
+    check(fileSize(segment) == intactBytes, "wal: torn tail truncated");
+
+    // 合并前保存旧快照与旧分段，合并并继续写入后再放回，相当于新快照 rename 之前崩溃
+    string oldBase = readFile(basePath), oldSegment = readFile(segment);
+    vector<VectorXd> later = randomRows(10, dim, 3);
+    {
+        WalStore store;
+        check(store.open(basePath.c_str(), logPrefix.c_str()), "wal: open before compaction");
+        check(store.compact(), "wal: compact");
+        check(store.insertBatch(later) == TEST_ROWS + 40, "wal: insert after compaction");
+        check(store.removeBatch(vector<long>{4}), "wal: delete after compaction");
+        store.close();
+    }
+    long compactedSize;
+    vector<VectorXd> compactedRows;
+    {
+        // 快照以 mmap 映射，放回旧文件之前先关闭
+        WalStore store;
+        check(store.open(basePath.c_str(), logPrefix.c_str()), "wal: reopen after compaction");
+        compactedSize = store.size();
+        expected = store.topK(q, 10);
+        compactedRows = allRows(store, maxId);
+        store.close();
+    }
+    writeFile(basePath, oldBase);
+    writeFile(segment, oldSegment);
+    {
+        WalStore store;
+        check(store.open(basePath.c_str(), logPrefix.c_str()), "wal: reopen after crash during compaction");
+        check(store.size() == compactedSize && store.topK(q, 10) == expected && allRows(store, maxId) == compactedRows,
+              "wal: replay across compaction crash");
+        store.close();
+    }
+}
+
+/**
+ * @Description: 断点续传：把完整导入的状态回退到第 r 行提交之后（快照尾部留有未提交的半块），
+ *               续传得到的快照与不中断时逐字节一致
+ */
+static void testCheckpointResume() {
+    string full = tempDir + "/full", resumed = tempDir + "/resumed";
+    CheckpointConfig config;
+    config.chunkRows = 64;
+    config.loadWhenDone = false;
+    check(dealDataCheckpointed((char*) dataPath.c_str(), full.c_str(), config) == 1, "checkpoint: full ingest");
+
+    IngestCheckpoint checkpoint;
+    check(readCheckpoint((full + ".ckpt").c_str(), checkpoint) == 1 && checkpoint.complete &&
+          checkpoint.rows == (uint64_t) TEST_ROWS, "checkpoint: complete checkpoint");
+
+    const uint64_t r = 256;
+    writeFile(resumed + ".key", readFile(full + ".key"));
+    string snapshot = readFile(full + ".snap");
+    size_t committedBytes = SNAPSHOT_HEADER_SIZE + r * checkpoint.dim * sizeof(double);
+    writeFile(resumed + ".snap", snapshot.substr(0, committedBytes) + string(100, '\x33'));
+    checkpoint.inputOffset = lineOffsets[r];
+    checkpoint.rows = r;
+    checkpoint.rngDraws = r;
+    checkpoint.complete = 0;
+    writeFile(resumed + ".ckpt", string((const char*) &checkpoint, sizeof(checkpoint)));
+
+    check(dealDataCheckpointed((char*) dataPath.c_str(), resumed.c_str(), config) == 1, "checkpoint: resume");
+    check(readFile(resumed + ".snap") == snapshot, "checkpoint: resumed snapshot is identical");
+    struct stat info;
+    check(stat((full + ".key").c_str(), &info) == 0 && (info.st_mode & 077) == 0, "checkpoint: key file is 0600");
+}
+
+/**
+ * @Description: 剪枝索引重排密文后，每个位置解密得到的明文与 originalRowId 指向的原始行一致，追加行之后依然成立
+ */
+static void testPrunedIds() {
+    check(dealDataPruned((char*) dataPath.c_str(), 32, 3) == 1, "pruned: build index");
+    vector<vector<double>> batch(5, vector<double>(TEST_DIM, 1.5));
+    for (int i = 0; i < 5; i++) {
+        batch[i][0] = i;
+    }
+    check(standingQueries.insertBatch(batch) == 1, "pruned: append rows");
+
+    vector<vector<double>> expected = plaintext;
+    expected.insert(expected.end(), batch.begin(), batch.end());
+    MatrixXd rows(ciphertext.size(), TEST_DIM + 3);
+    for (size_t p = 0; p < ciphertext.size(); p++) {
+        rows.row(p) = ciphertext[p].transpose();
+    }
+    MatrixXd decrypted = decryptRows(rows, calculateInverseMatrix(encryptMatrix));
+    bool ok = ciphertext.size() == expected.size();
+    bool permuted = false;
+    for (long p = 0; ok && p < (long) ciphertext.size(); p++) {
+        long id = originalRowId(p);
+        ok = id >= 0 && id < (long) expected.size();
+        permuted = permuted || id != p;
+        for (int j = 0; ok && j < TEST_DIM; j++) {
+            ok = fabs(-decrypted(p, j + 1) / 2 - expected[id][j]) < 1e-6;
+        }
+    }
+    check(permuted, "pruned: ciphertext is reordered");
+    check(ok, "pruned: positions map to original rows after append");
+}
+
+/**
+ * @Description: formatDouble 与 %g 的输出一致，包括舍入位恰好为 .5 附近的值
+ */
+static void testFormatDouble() {
+    vector<double> values = {0, -0.0, 1, -1, 0.5, 2.5, 0.1, 1.0000005, 123456.5, 999999.5, 1234567, 1e-5,
+                             1.5e-4, 3.14159265, -2.7182818, 1e21, 12.3456749999, 0.000123456};
+    mt19937_64 generator(7);
+    uniform_real_distribution<double> mantissa(-1000, 1000);
+    uniform_int_distribution<int> decimals(0, 6);
+    for (int i = 0; i < 200000; i++) {
+        double v = mantissa(generator);
+        double scale = pow(10.0, decimals(generator));
+        values.push_back(floor(v * scale) / scale + (i % 2 == 0 ? 0.5 / scale / 10 : 0));
+    }
+    int mismatches = 0;
+    char fast[32], reference[32];
+    for (size_t i = 0; i < values.size(); i++) {
+        int n = formatDouble(values[i], fast);
+        snprintf(reference, sizeof(reference), "%g", values[i]);
+        if (n != (int) strlen(reference) || memcmp(fast, reference, n) != 0) {
+            mismatches++;
+        }
+    }
+    check(mismatches == 0, "formatDouble: matches %g");
+}
+
+/**
+ * @Description: 明文上按平方距离的 k 近邻行号，距离从小到大
+ */
+static vector<long> plainNearest(const vector<double>& point, int k) {
+    vector<pair<double, long>> distances(plaintext.size());
+    for (size_t r = 0; r < plaintext.size(); r++) {
+        double sum = 0;
+        for (int j = 0; j < TEST_DIM; j++) {
+            sum += (plaintext[r][j] - point[j]) * (plaintext[r][j] - point[j]);
+        }
+        distances[r] = make_pair(sum, (long) r);
+    }
+    sort(distances.begin(), distances.end());
+    vector<long> ids;
+    for (int i = 0; i < k; i++) {
+        ids.push_back(distances[i].second);
+    }
+    return ids;
+}
+
+/**
+ * @Description: 分块密钥：加密数据集、加密查询、扫描、解密结果行，与明文上的最近邻一致；
+ *               块大小不整除维度时最后一块较小
+ */
+static void testBlockKey() {
+    check(dealDataBlockKey((char*) dataPath.c_str(), 4) == 1 && keyMode == KEY_BLOCK, "block key: encrypt dataset");
+    vector<double> point(TEST_DIM, 50.0);
+    point[0] = 20;
+    VectorXd q = blockKeyEncryptQuery(blockKey, augmentQuery(point));
+    vector<pair<double, long>> winners = scanTopK(q, 10);
+    vector<long> ids;
+    MatrixXd rows(winners.size(), blockKey.dim);
+    for (size_t i = 0; i < winners.size(); i++) {
+        ids.push_back(winners[i].second);
+        rows.row(i) = ciphertext[winners[i].second].transpose();
+    }
+    // 扫描结果按距离从大到小排列
+    reverse(ids.begin(), ids.end());
+    check(ids == plainNearest(point, 10), "block key: top-k matches a plaintext scan");
+
+    MatrixXd decrypted = blockKeyDecryptRows(blockKey, rows);
+    bool ok = true;
+    for (size_t i = 0; i < winners.size(); i++) {
+        for (int j = 0; ok && j < TEST_DIM; j++) {
+            ok = fabs(-decrypted(i, j + 1) / 2 - plaintext[winners[i].second][j]) < 1e-6;
+        }
+    }
+    check(ok, "block key: decrypted rows match the plaintext");
+}
+
+/**
+ * @Description: 位图交集与逐元素求交一致，覆盖数组容器、位图容器与跨容器的行号；
+ *               属性令牌与 RFC 4231 的 HMAC-SHA256 测试向量一致
+ */
+static void testBitmapAndTokens() {
+    const uint32_t limit = 3 * 65536;
+    vector<uint32_t> a, b, expected;
+    for (uint32_t r = 0; r < limit; r++) {
+        // 第一个容器两边都稀疏，第二个容器 a 稠密，第三个容器两边都稠密
+        bool inA = r < 65536 ? r % 97 == 0 : r % 3 != 0;
+        bool inB = r < 2 * 65536 ? r % 5 == 0 : r % 2 == 0;
+        if (inA) {
+            a.push_back(r);
+        }
+        if (inB) {
+            b.push_back(r);
+        }
+        if (inA && inB) {
+            expected.push_back(r);
+        }
+    }
+    RowBitmap bitmapA, bitmapB;
+    for (size_t i = 0; i < a.size(); i++) {
+        bitmapA.add(a[i]);
+    }
+    for (size_t i = 0; i < b.size(); i++) {
+        bitmapB.add(b[i]);
+    }
+    vector<uint32_t> actual;
+    RowBitmap both = RowBitmap::intersect(bitmapA, bitmapB);
+    both.forEach([&actual](uint32_t row) { actual.push_back(row); });
+    check(actual == expected && both.cardinality() == expected.size(), "bitmap: intersection");
+    check(bitmapA.contains(a[1]) && !bitmapA.contains(a[1] + 1) && !bitmapB.contains(limit),
+          "bitmap: membership");
+
+    // RFC 4231 测试用例 1、2、3、6、7
+    const string longKey(131, '\xaa');
+    struct {
+        string key, data, mac;
+    } vectors[] = {
+            {string(20, '\x0b'), "Hi There",
+             "b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7"},
+            {"Jefe", "what do ya want for nothing?",
+             "5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"},
+            {string(20, '\xaa'), string(50, '\xdd'),
+             "773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe"},
+            {longKey, "Test Using Larger Than Block-Size Key - Hash Key First",
+             "60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"},
+            {longKey, "This is a test using a larger than block-size key and a larger than block-size data. "
+                      "The key needs to be hashed before being used by the HMAC algorithm.",
+             "9b09ffa71b942fcb27635fbcd5b0e944bfdc63644f0713938a7f51535c3a35e2"},
+    };
+    bool ok = true;
+    for (size_t i = 0; i < sizeof(vectors) / sizeof(vectors[0]); i++) {
+        ok = ok && attributeToken(vectors[i].data, vectors[i].key) == vectors[i].mac;
+    }
+    check(ok, "hmac-sha256: RFC 4231 vectors");
+}
+
+/**
+ * @Description: 数据集注册表：固定的数据集不会被淘汰（读入可以暂时超出上限），解除固定后淘汰未固定的数据集
+ *               回到上限以内，被淘汰的数据集再次 acquire 时重新读入相同的行
+ */
+static void testRegistry() {
+    check(dealData((char*) dataPath.c_str()) == 1, "registry: encrypt dataset");
+    string snapshot = tempDir + "/registry.snap";
+    check(saveSnapshot(snapshot.c_str()) == 1, "registry: save snapshot");
+    const size_t bytes = (size_t) TEST_ROWS * (TEST_DIM + 3) * sizeof(double);
+
+    DatasetRegistry registry(bytes + bytes / 2);
+    check(registry.registerDataset("a", "tenant", snapshot, RESIDENCY_LOAD) == 1 &&
+          registry.registerDataset("b", "tenant", snapshot, RESIDENCY_MMAP) == 1, "registry: register");
+    {
+        DatasetHandle first = registry.acquire("a");
+        DatasetHandle second = registry.acquire("b");
+        RegistryStats s = registry.stats();
+        check(first.valid() && second.valid() && s.resident == 2 && s.pinned == 2 && s.overCapLoads == 1,
+              "registry: pinned datasets stay resident over the cap");
+        check(registry.unregisterDataset("a") == 0, "registry: pinned dataset cannot be unregistered");
+    }
+    // 先解除固定的 b 被淘汰，a 仍驻留
+    RegistryStats s = registry.stats();
+    check(s.resident == 1 && s.pinned == 0 && s.residentBytes <= s.memoryCapBytes,
+          "registry: unpinning evicts back under the cap");
+    check(registry.acquire("a").valid() && registry.tenantStats()["tenant"].hits == 1,
+          "registry: resident dataset hits");
+
+    // 重新读入 b 时淘汰 a
+    DatasetHandle reloaded = registry.acquire("b");
+    bool same = reloaded.valid() && reloaded.count() == TEST_ROWS && reloaded.dim() == TEST_DIM + 3;
+    for (long r = 0; same && r < TEST_ROWS; r++) {
+        same = memcmp(reloaded.rows() + r * reloaded.dim(), ciphertext[r].data(),
+                      reloaded.dim() * sizeof(double)) == 0 && reloaded.rowId(r) == r;
+    }
+    TenantStats tenant = registry.tenantStats()["tenant"];
+    check(same && tenant.loads == 3 && tenant.evictions == 2 && registry.stats().resident == 1,
+          "registry: evicted dataset reloads the same rows");
+}
+
+/**
+ * @Description: 共享内存传输：结果与密文行同扫描一致；结果放不下响应环时回复错误而不是丢弃，之后的请求照常处理
+ */
+static void testShm() {
+    check(dealData((char*) dataPath.c_str()) == 1, "shm: encrypt dataset");
+    ShmConfig config;
+    config.ringBytes = 16 << 10;
+    string name = "/ssq-regression-" + to_string(getpid());
+    ShmChannel server, client;
+    check(server.create(name.c_str(), config) == 1 && client.attach(name.c_str(), config) == 1, "shm: create");
+    thread worker([&server]() { serveShmChannel(server); });
+
+    vector<double> point(TEST_DIM, 30.0);
+    VectorXd q = encryptQuery(point, calculateInverseMatrix(encryptMatrix));
+    vector<pair<double, long>> expected = scanTopK(q, 10);
+    uint64_t id = 0;
+    vector<pair<double, long>> winners;
+    MatrixXd rows;
+    bool ok = shmSubmitQuery(client, 1, q, 10, SHM_WITH_ROWS) && shmReceiveResult(client, id, winners, &rows, 5000);
+    ok = ok && id == 1 && winners == expected && rows.rows() == (long) expected.size();
+    for (size_t i = 0; ok && i < expected.size(); i++) {
+        ok = rows.row(i) == ciphertext[expected[i].second].transpose();
+    }
+    check(ok, "shm: request/response round trip");
+
+    // TEST_ROWS 条结果连同密文行远大于响应环
+    id = 0;
+    ok = shmSubmitQuery(client, 2, q, TEST_ROWS, SHM_WITH_ROWS) && !shmReceiveResult(client, id, winners, &rows, 5000);
+    check(ok && id == 2, "shm: oversized response is answered with an error");
+    ok = shmSubmitQuery(client, 3, q, 10, 0) && shmReceiveResult(client, id, winners, NULL, 5000);
+    check(ok && id == 3 && winners == expected, "shm: channel still serves after an error");
+
+    shmShutdown(client);
+    worker.join();
+}
+
+int main() {
+    char pattern[] = "/tmp/ssq_regression_XXXXXX";
+    if (mkdtemp(pattern) == NULL) {
+        cerr << "Unable to create temporary directory" << endl;
+        return 1;
+    }
+    tempDir = pattern;
+    generateData();
+
+    testFormatDouble();
+    testWal();
+    testCheckpointResume();
+    testPrunedIds();
+    testBlockKey();
+    testBitmapAndTokens();
+    testRegistry();
+    testShm();
+
+    string command = "rm -rf " + tempDir;
+    if (system(command.c_str()) != 0) {
+        cerr << "Unable to remove " << tempDir << endl;
+    }
+    printf("%d failure(s)\n", failures);
+    return failures == 0 ? 0 : 1;
+}
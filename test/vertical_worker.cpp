@@ -0,0 +1,15 @@
+/**
+* @author: WTY
+* @date: 2024/8/23
+* @description: 纵向分区的工作进程：由协调者通过 posix_spawn 启动，参数为与协调者通信的 socket 描述符
+*/
+
+#include <Vertical_partition.h>
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        cerr << "Usage: " << argv[0] << " <socket fd>" << endl;
+        return 1;
+    }
+    return runVerticalWorker(atoi(argv[1])) ? 0 : 1;
+}